@@ -0,0 +1,139 @@
+#ifndef MCU_COM_BYTE_RING_H
+#define MCU_COM_BYTE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <atomic>
+#include "spsc_queue.h"
+
+/*
+ * Single producer / single consumer byte ring for stream data.
+ *
+ * Besides the copying Write()/Read() both sides can work on the ring
+ * memory directly: WriteSpans() hands out the free space as at most two
+ * iovecs for readv(), ReadSpans() the filled part for writev(), and
+ * Commit()/Consume() publish what was actually moved. Nothing blocks or
+ * allocates. N must be a power of two.
+ */
+template<size_t N>
+class SpscByteRing
+{
+    static_assert((N >= 2) && (0 == (N & (N - 1))), "SpscByteRing size must be a power of two");
+
+    public:
+        SpscByteRing() : head(0), tail(0) {}
+
+        //producer side
+        size_t Free(void) const
+        {
+            return N - (this->tail.load(std::memory_order_relaxed) - this->head.load(std::memory_order_acquire));
+        }
+
+        int WriteSpans(struct iovec iov[2])
+        {
+            size_t t = this->tail.load(std::memory_order_relaxed);
+            size_t free = N - (t - this->head.load(std::memory_order_acquire));
+
+            return Spans(t, free, iov);
+        }
+
+        void Commit(size_t len)
+        {
+            this->tail.store(this->tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+        }
+
+        //all or nothing, a stream must not lose the middle of a packet
+        bool Write(const void *data, size_t len)
+        {
+            struct iovec iov[2];
+            int n = 0;
+
+            if(this->Free() < len)
+            {
+                return false;
+            }
+            n = this->WriteSpans(iov);
+            CopyIn(iov, n, (const uint8_t *)data, len);
+            this->Commit(len);
+            return true;
+        }
+
+        //consumer side
+        size_t Size(void) const
+        {
+            return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_relaxed);
+        }
+
+        int ReadSpans(struct iovec iov[2])
+        {
+            size_t h = this->head.load(std::memory_order_relaxed);
+            size_t used = this->tail.load(std::memory_order_acquire) - h;
+
+            return Spans(h, used, iov);
+        }
+
+        void Consume(size_t len)
+        {
+            this->head.store(this->head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+        }
+
+        //copies out up to len bytes, returns how many
+        size_t Read(void *data, size_t len)
+        {
+            struct iovec iov[2];
+            uint8_t *out = (uint8_t *)data;
+            size_t done = 0;
+            int n = this->ReadSpans(iov);
+
+            for(int i = 0; (i < n) && (done < len); i++)
+            {
+                size_t part = (iov[i].iov_len < len - done) ? iov[i].iov_len : len - done;
+                memcpy(out + done, iov[i].iov_base, part);
+                done += part;
+            }
+            this->Consume(done);
+            return done;
+        }
+
+    private:
+        //len bytes from index pos on, split where the ring wraps
+        int Spans(size_t pos, size_t len, struct iovec iov[2])
+        {
+            size_t off = pos & (N - 1);
+            size_t first = (len < N - off) ? len : N - off;
+
+            if(0 == len)
+            {
+                return 0;
+            }
+            iov[0].iov_base = this->buf + off;
+            iov[0].iov_len = first;
+            if(first == len)
+            {
+                return 1;
+            }
+            iov[1].iov_base = this->buf;
+            iov[1].iov_len = len - first;
+            return 2;
+        }
+
+        static void CopyIn(struct iovec *iov, int n, const uint8_t *data, size_t len)
+        {
+            size_t done = 0;
+
+            for(int i = 0; (i < n) && (done < len); i++)
+            {
+                size_t part = (iov[i].iov_len < len - done) ? iov[i].iov_len : len - done;
+                memcpy(iov[i].iov_base, data + done, part);
+                done += part;
+            }
+        }
+
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> head;     //next byte to read, owned by the consumer
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> tail;     //next byte to write, owned by the producer
+        alignas(MCU_COM_CACHE_LINE) uint8_t buf[N];
+};
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef MCU_COM_CAPTURE_H
+#define MCU_COM_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "link_stats.h"
+
+/*
+ * Traffic capture log:
+ *
+ *   capture_file_header_t | capture_record_t data[len] | capture_record_t data[len] ...
+ *
+ * Records are packed back to back in the order they were taken, ts_us counts
+ * from start_mono_us. Every link of a process goes into the same file.
+ */
+#define CAPTURE_MAGIC               "MCUCAP01"
+#define CAPTURE_VERSION             1
+
+#define CAPTURE_LINK_POWERBOARD     0
+#define CAPTURE_LINK_MOVEBASE       1
+#define CAPTURE_LINK_SENSOR         2
+#define CAPTURE_LINK_LED            3
+#define CAPTURE_LINK_UPPER_COM      4       //TCP to the pad, not MCU framed
+#define CAPTURE_LINK_NUM            5
+
+#define CAPTURE_DIR_RX              0
+#define CAPTURE_DIR_TX              1
+
+#define CAPTURE_BUF_LEN             (1024 * 1024)   //per half of the double buffer
+#define CAPTURE_FLUSH_MS            200
+
+typedef struct
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    reserved;
+    uint64_t    start_realtime_us;      //wall clock at start, to line up with the logs
+    uint64_t    start_mono_us;
+}__attribute__((packed)) capture_file_header_t;
+
+typedef struct
+{
+    uint64_t    ts_us;
+    uint16_t    len;
+    uint8_t     link;
+    uint8_t     dir;
+}__attribute__((packed)) capture_record_t;
+
+static inline const char *capture_link_name(uint8_t link)
+{
+    static const char *names[CAPTURE_LINK_NUM] = {"powerboard", "movebase", "sensor", "led", "upper_com"};
+    return (link < CAPTURE_LINK_NUM) ? names[link] : "unknown";
+}
+
+//links that speak the 0x5A ... 0xA5 framing of frame_parser.h
+static inline bool capture_link_is_mcu(uint8_t link)
+{
+    return link < CAPTURE_LINK_UPPER_COM;
+}
+
+/*
+ * Process wide capture writer. Record() copies into the active half of a
+ * preallocated double buffer under a short lock; a background thread swaps
+ * the halves and writes the full one out, so the I/O threads never touch
+ * the file. When the writer falls behind a whole buffer, records are
+ * dropped and counted instead of blocking a serial loop.
+ *
+ * Off by default, Record() costs a single atomic load until Start().
+ */
+class LinkCapture
+{
+    public:
+        static LinkCapture &Instance(void)
+        {
+            static LinkCapture capture;
+            return capture;
+        }
+
+        //returns 0, or -1 with errno set when the file can not be created
+        int Start(const char *path)
+        {
+            capture_file_header_t header;
+            struct timeval now;
+
+            if(this->enabled.load(std::memory_order_relaxed))
+            {
+                return 0;
+            }
+            this->file = fopen(path, "wb");
+            if(NULL == this->file)
+            {
+                return -1;
+            }
+            this->buf[0] = new uint8_t[CAPTURE_BUF_LEN];
+            this->buf[1] = new uint8_t[CAPTURE_BUF_LEN];
+            this->active = 0;
+            this->used = 0;
+            this->stop = false;
+
+            gettimeofday(&now, NULL);
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+            header.version = CAPTURE_VERSION;
+            header.start_realtime_us = (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_usec;
+            header.start_mono_us = link_stats_now_us();
+            this->start_us = header.start_mono_us;
+            fwrite(&header, sizeof(header), 1, this->file);
+
+            this->writer = std::thread(&LinkCapture::WriterLoop, this);
+            this->enabled.store(true, std::memory_order_release);
+            return 0;
+        }
+
+        //flushes what is buffered and closes the file
+        void Stop(void)
+        {
+            if(!this->enabled.exchange(false))
+            {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->lock);
+                this->stop = true;
+            }
+            this->wake.notify_one();
+            this->writer.join();
+            fclose(this->file);
+            this->file = NULL;
+            //a capture with drops has holes, replay results from it are not complete
+            fprintf(stderr, "capture: %llu records written, %llu dropped\n",
+                    (unsigned long long)this->Records(), (unsigned long long)this->Dropped());
+            {
+                std::lock_guard<std::mutex> lock(this->lock);
+                delete[] this->buf[0];
+                delete[] this->buf[1];
+                this->buf[0] = NULL;
+                this->buf[1] = NULL;
+            }
+        }
+
+        bool Enabled(void) const
+        {
+            return this->enabled.load(std::memory_order_relaxed);
+        }
+
+        void Record(uint8_t link, uint8_t dir, const uint8_t *data, int len)
+        {
+            capture_record_t record;
+            bool wake_writer = false;
+
+            if(!this->enabled.load(std::memory_order_acquire) || (len <= 0))
+            {
+                return;
+            }
+            if(len > 0xffff)
+            {
+                len = 0xffff;
+            }
+            record.ts_us = link_stats_now_us() - this->start_us;
+            record.len = len;
+            record.link = link;
+            record.dir = dir;
+            {
+                std::lock_guard<std::mutex> lock(this->lock);
+                uint8_t *dst = NULL;
+
+                if(this->stop || (NULL == this->buf[this->active]))
+                {
+                    return;
+                }
+                dst = this->buf[this->active] + this->used;
+                if(this->used + sizeof(record) + len > CAPTURE_BUF_LEN)
+                {
+                    this->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                memcpy(dst, &record, sizeof(record));
+                memcpy(dst + sizeof(record), data, len);
+                this->used += sizeof(record) + len;
+                wake_writer = (this->used >= CAPTURE_BUF_LEN / 2);
+            }
+            this->records.fetch_add(1, std::memory_order_relaxed);
+            if(wake_writer)
+            {
+                this->wake.notify_one();
+            }
+        }
+
+        uint64_t Records(void) const
+        {
+            return this->records.load(std::memory_order_relaxed);
+        }
+
+        uint64_t Dropped(void) const
+        {
+            return this->dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        LinkCapture() : file(NULL), active(0), used(0), stop(false), start_us(0),
+                enabled(false), records(0), dropped(0)
+        {
+            this->buf[0] = NULL;
+            this->buf[1] = NULL;
+        }
+
+        ~LinkCapture()
+        {
+            this->Stop();
+        }
+
+        void WriterLoop(void)
+        {
+            bool done = false;
+
+            while(!done)
+            {
+                uint8_t *full = NULL;
+                size_t len = 0;
+                {
+                    std::unique_lock<std::mutex> lock(this->lock);
+                    this->wake.wait_for(lock, std::chrono::milliseconds(CAPTURE_FLUSH_MS));
+                    done = this->stop;
+                    full = this->buf[this->active];
+                    len = this->used;
+                    this->active ^= 1;
+                    this->used = 0;
+                }
+                if(len > 0)
+                {
+                    if(fwrite(full, 1, len, this->file) != len)
+                    {
+                        fprintf(stderr, "capture: write failed: %s\n", strerror(errno));
+                    }
+                    fflush(this->file);
+                }
+            }
+        }
+
+        FILE *file;
+        uint8_t *buf[2];
+        int active;             //half the producers append to
+        size_t used;
+        bool stop;
+        uint64_t start_us;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::thread writer;
+        std::atomic<bool> enabled;
+        std::atomic<uint64_t> records;
+        std::atomic<uint64_t> dropped;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef MCU_COM_DEV_WATCH_H
+#define MCU_COM_DEV_WATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <string>
+
+#define DEV_WATCH_ADDED             0x01    //the device path appeared or changed
+#define DEV_WATCH_REMOVED           0x02    //the device path is gone
+
+#define DEV_WATCH_BUF_LEN           4096
+
+/*
+ * Tells when a device path such as /dev/ros/powerboard comes and goes.
+ *
+ * udev creates the /dev/ros links on enumeration and removes them, and the
+ * directory once it is empty, on unplug. Both the directory and its parent
+ * are watched with inotify, so Fd() only becomes readable on a change and
+ * nobody has to stat() the path while the device is absent.
+ */
+class DevWatch
+{
+    public:
+        DevWatch() : fd(-1), dir_wd(-1), parent_wd(-1)
+        {
+        }
+
+        ~DevWatch()
+        {
+            if(this->fd >= 0)
+            {
+                close(this->fd);
+            }
+        }
+
+        //returns the inotify fd to poll, -1 on error
+        int Init(const char *path)
+        {
+            std::string dev_path(path);
+            size_t slash = dev_path.find_last_of('/');
+
+            if(slash == std::string::npos)
+            {
+                this->dir = ".";
+                this->dev_name = dev_path;
+            }
+            else
+            {
+                this->dir = (0 == slash) ? "/" : dev_path.substr(0, slash);
+                this->dev_name = dev_path.substr(slash + 1);
+            }
+            //the parent only matters when the directory itself can vanish, like /dev/ros
+            slash = this->dir.find_last_of('/');
+            if((slash != std::string::npos) && (this->dir != "/"))
+            {
+                this->parent = (0 == slash) ? "/" : this->dir.substr(0, slash);
+                this->dir_name = this->dir.substr(slash + 1);
+            }
+
+            this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(this->fd < 0)
+            {
+                return -1;
+            }
+            if(!this->dir_name.empty())
+            {
+                this->parent_wd = inotify_add_watch(this->fd, this->parent.c_str(), IN_CREATE | IN_MOVED_TO);
+            }
+            this->WatchDir();
+            return this->fd;
+        }
+
+        int Fd(void) const
+        {
+            return this->fd;
+        }
+
+        //drain the pending events, returns DEV_WATCH_* flags
+        int Handle(void)
+        {
+            uint8_t buf[DEV_WATCH_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+            int flags = 0;
+            ssize_t len = 0;
+
+            while((len = read(this->fd, buf, sizeof(buf))) > 0)
+            {
+                for(ssize_t pos = 0; pos < len; )
+                {
+                    const struct inotify_event *event = (const struct inotify_event *)&buf[pos];
+                    const char *name = event->len ? event->name : "";
+
+                    pos += sizeof(struct inotify_event) + event->len;
+                    if((event->wd == this->parent_wd) && (this->dir_name == name))
+                    {
+                        //the link may already be in the new directory before the watch is added
+                        this->WatchDir();
+                        if(0 == access(this->Path().c_str(), F_OK))
+                        {
+                            flags |= DEV_WATCH_ADDED;
+                        }
+                    }
+                    else if(event->wd == this->dir_wd)
+                    {
+                        if(event->mask & IN_IGNORED)
+                        {
+                            this->dir_wd = -1;
+                            flags |= DEV_WATCH_REMOVED;
+                        }
+                        else if(this->dev_name != name)
+                        {
+                            continue;
+                        }
+                        else if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                        {
+                            flags |= DEV_WATCH_REMOVED;
+                        }
+                        else
+                        {
+                            flags |= DEV_WATCH_ADDED;
+                        }
+                    }
+                }
+            }
+            return flags;
+        }
+
+        std::string Path(void) const
+        {
+            return (this->dir == "/") ? "/" + this->dev_name : this->dir + "/" + this->dev_name;
+        }
+
+    private:
+        void WatchDir(void)
+        {
+            if(this->dir_wd < 0)
+            {
+                //fails while the directory does not exist, the parent watch retries
+                this->dir_wd = inotify_add_watch(this->fd, this->dir.c_str(),
+                        IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE_SELF);
+            }
+        }
+
+        int fd;
+        int dir_wd;
+        int parent_wd;
+        std::string dir;
+        std::string dir_name;
+        std::string parent;
+        std::string dev_name;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef MCU_COM_FRAME_CODEC_H
+#define MCU_COM_FRAME_CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "frame_parser.h"
+
+/*
+ * Frame layouts declared once as types, with the encoder and decoder
+ * generated from them:
+ *
+ *   typedef FrameSchema<0x68, FrameBe<int16_t>, FrameBe<int16_t> > MoveSpeedFrame;
+ *
+ *   uint8_t data[MoveSpeedFrame::len];
+ *   MoveSpeedFrame::Encode(data, vx, vth);
+ *   MoveSpeedFrame::Decode(frame, len, vx, vth);
+ *
+ * Every offset and the frame length are compile time constants, so Encode()
+ * is a fixed sequence of stores and an unrolled sum, and nothing is allocated.
+ */
+#define FRAME_LITTLE_ENDIAN         0
+#define FRAME_BIG_ENDIAN            1
+#define FRAME_HEADER_LEN            3       //head, len, type
+
+//an integer field, stored in the given byte order whatever the host is
+template<typename T, int Endian>
+struct FrameInt
+{
+    static_assert(std::is_integral<T>::value, "frame fields are integers");
+    typedef T value_type;
+    enum { size = sizeof(T) };
+
+    static void Put(uint8_t *p, T value)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        U u = (U)value;
+        for(int i = 0; i < size; i++)
+        {
+            p[(FRAME_BIG_ENDIAN == Endian) ? size - 1 - i : i] = (uint8_t)(u >> (8 * i));
+        }
+    }
+
+    static void Get(const uint8_t *p, T &value)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        U u = 0;
+        for(int i = 0; i < size; i++)
+        {
+            u |= (U)p[(FRAME_BIG_ENDIAN == Endian) ? size - 1 - i : i] << (8 * i);
+        }
+        value = (T)u;
+    }
+};
+
+template<typename T>
+using FrameLe = FrameInt<T, FRAME_LITTLE_ENDIAN>;
+template<typename T>
+using FrameBe = FrameInt<T, FRAME_BIG_ENDIAN>;
+typedef FrameInt<uint8_t, FRAME_LITTLE_ENDIAN> FrameU8;
+
+//N raw bytes, such as an md5; decoding points into the frame
+template<int N>
+struct FrameBytes
+{
+    typedef const uint8_t *value_type;
+    enum { size = N };
+
+    static void Put(uint8_t *p, const uint8_t *value)
+    {
+        memcpy(p, value, N);
+    }
+
+    static void Get(const uint8_t *p, const uint8_t *&value)
+    {
+        value = p;
+    }
+};
+
+//lays the fields out back to back from Offset
+template<int Offset, typename... Fields>
+struct FrameFieldList;
+
+template<int Offset>
+struct FrameFieldList<Offset>
+{
+    enum { size = 0 };
+
+    static void Put(uint8_t *)
+    {
+    }
+
+    static void Get(const uint8_t *)
+    {
+    }
+};
+
+template<int Offset, typename Field, typename... Rest>
+struct FrameFieldList<Offset, Field, Rest...>
+{
+    typedef FrameFieldList<Offset + Field::size, Rest...> Next;
+    enum { size = Field::size + Next::size };
+
+    static void Put(uint8_t *frame, typename Field::value_type value, typename Rest::value_type... rest)
+    {
+        Field::Put(frame + Offset, value);
+        Next::Put(frame, rest...);
+    }
+
+    static void Get(const uint8_t *frame, typename Field::value_type &value, typename Rest::value_type &... rest)
+    {
+        Field::Get(frame + Offset, value);
+        Next::Get(frame, rest...);
+    }
+};
+
+//byte sum of the first N bytes, unrolled at compile time
+template<int N>
+struct FrameSum
+{
+    static uint8_t Of(const uint8_t *p)
+    {
+        return (uint8_t)(FrameSum<N - 1>::Of(p) + p[N - 1]);
+    }
+};
+
+template<>
+struct FrameSum<0>
+{
+    static uint8_t Of(const uint8_t *)
+    {
+        return 0;
+    }
+};
+
+template<uint8_t Type, typename... Fields>
+struct FrameSchema
+{
+    typedef FrameFieldList<FRAME_HEADER_LEN, Fields...> Payload;
+
+    static const uint8_t type = Type;
+    static const int payload_len = Payload::size;
+    static const int len = MCU_FRAME_MIN_LEN + Payload::size;
+    static_assert(MCU_FRAME_MIN_LEN + Payload::size <= MCU_FRAME_MAX_LEN, "frame longer than the len byte allows");
+
+    //writes the whole frame, buf holds at least len bytes, returns len
+    static int Encode(uint8_t *buf, typename Fields::value_type... values)
+    {
+        return EncodeAs(Type, buf, values...);
+    }
+
+    //the same layout under another type byte, for frames several boards share
+    static int EncodeAs(uint8_t type, uint8_t *buf, typename Fields::value_type... values)
+    {
+        buf[0] = MCU_FRAME_HEAD;
+        buf[1] = len;
+        buf[2] = type;
+        Payload::Put(buf, values...);
+        buf[len - 2] = FrameSum<len - 2>::Of(buf);
+        buf[len - 1] = MCU_FRAME_TAIL;
+        return len;
+    }
+
+    //false when the frame is of another type or length, sum and tail are the parser's job
+    static bool Decode(const uint8_t *frame, int frame_len, typename Fields::value_type &... values)
+    {
+        if((len != frame_len) || (Type != frame[2]))
+        {
+            return false;
+        }
+        Payload::Get(frame, values...);
+        return true;
+    }
+};
+
+template<uint8_t Type, typename... Fields>
+const uint8_t FrameSchema<Type, Fields...>::type;
+template<uint8_t Type, typename... Fields>
+const int FrameSchema<Type, Fields...>::payload_len;
+template<uint8_t Type, typename... Fields>
+const int FrameSchema<Type, Fields...>::len;
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MCU_COM_FRAME_PARSER_H
+#define MCU_COM_FRAME_PARSER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "link_stats.h"
+#include "capture.h"
+
+/*
+ * Every MCU link speaks the same framing:
+ *
+ *   0x5A | len | type | payload ... | sum | 0xA5
+ *
+ * len counts the whole frame and sum is the byte sum of everything before it.
+ */
+#define MCU_FRAME_HEAD              0x5A
+#define MCU_FRAME_TAIL              0xA5
+#define MCU_FRAME_MIN_LEN           5
+#define MCU_FRAME_MAX_LEN           255
+#define MCU_FRAME_PARSER_BUF_LEN    4096
+
+/*
+ * Receive buffer that frames are located, validated and handed out in place.
+ *
+ * Bytes are read straight into the free space behind the write index and
+ * the handler gets a pointer into the buffer, so a frame is never copied.
+ * Consumed bytes are released by moving the read index. A frame never wraps:
+ * when the space left at the end gets smaller than the largest frame, the
+ * unparsed tail (at most one partial frame) is moved to the front.
+ */
+class FrameParser
+{
+    public:
+        FrameParser() : head(0), tail(0), in_sync(true), stats(NULL), capture_link(-1) {}
+
+        //count bytes, frames and framing errors into stats from now on
+        void SetStats(LinkStats *stats)
+        {
+            this->stats = stats;
+        }
+
+        //log every chunk read by Fill() as this CAPTURE_LINK_* while capture runs
+        void SetCapture(int link)
+        {
+            this->capture_link = link;
+        }
+
+        //read whatever the fd has into the buffer, returns read() result
+        int Fill(int fd)
+        {
+            int nread = 0;
+            this->Compact();
+            nread = read(fd, this->buf + this->tail, MCU_FRAME_PARSER_BUF_LEN - this->tail);
+            if(nread > 0)
+            {
+                if(this->capture_link >= 0)
+                {
+                    LinkCapture::Instance().Record(this->capture_link, CAPTURE_DIR_RX, this->buf + this->tail, nread);
+                }
+                this->tail += nread;
+                if(NULL != this->stats)
+                {
+                    this->stats->AddRx(nread);
+                }
+            }
+            return nread;
+        }
+
+        //copy bytes from memory, returns how many bytes fitted
+        int Append(const uint8_t *data, int len)
+        {
+            this->Compact();
+            if(len > MCU_FRAME_PARSER_BUF_LEN - this->tail)
+            {
+                len = MCU_FRAME_PARSER_BUF_LEN - this->tail;
+            }
+            memcpy(this->buf + this->tail, data, len);
+            this->tail += len;
+            if(NULL != this->stats)
+            {
+                this->stats->AddRx(len);
+            }
+            return len;
+        }
+
+        /*
+         * Call handler(uint8_t *frame, int len) for every complete and valid
+         * frame. The pointer is only valid during the call. Returns the
+         * number of frames handled.
+         */
+        template<typename Handler>
+        int Parse(Handler handler)
+        {
+            int frames = 0;
+
+            while(this->head < this->tail)
+            {
+                uint8_t *frame = this->buf + this->head;
+                int avail = this->tail - this->head;
+                int frame_len = 0;
+
+                if(MCU_FRAME_HEAD != frame[0])
+                {
+                    uint8_t *next = (uint8_t *)memchr(frame, MCU_FRAME_HEAD, avail);
+                    int next_head = (NULL == next) ? this->tail : (int)(next - this->buf);
+                    this->Skip(next_head - this->head);
+                    this->head = next_head;
+                    continue;
+                }
+                if(avail < 2)
+                {
+                    break;
+                }
+                frame_len = frame[1];
+                if(frame_len < MCU_FRAME_MIN_LEN)
+                {
+                    this->Skip(1);
+                    this->head++;
+                    continue;
+                }
+                if(frame_len > avail)
+                {
+                    //wait for the rest of the frame
+                    break;
+                }
+                if((MCU_FRAME_TAIL != frame[frame_len - 1])
+                        || (CheckSum(frame, frame_len - 2) != frame[frame_len - 2]))
+                {
+                    //not a frame, resync on the next head byte
+                    if(NULL != this->stats)
+                    {
+                        this->stats->checksum_errors.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    this->Skip(1);
+                    this->head++;
+                    continue;
+                }
+
+                handler(frame, frame_len);
+                this->head += frame_len;
+                this->in_sync = true;
+                frames++;
+            }
+
+            if(this->head == this->tail)
+            {
+                this->head = 0;
+                this->tail = 0;
+            }
+            if((NULL != this->stats) && (frames > 0))
+            {
+                this->stats->frames_in.fetch_add(frames, std::memory_order_relaxed);
+            }
+            return frames;
+        }
+
+        void Reset(void)
+        {
+            this->head = 0;
+            this->tail = 0;
+            this->in_sync = true;
+        }
+
+        int Pending(void) const
+        {
+            return this->tail - this->head;
+        }
+
+        static uint8_t CheckSum(const uint8_t *data, int len)
+        {
+            uint8_t sum = 0;
+            for(int i = 0; i < len; i++)
+            {
+                sum += data[i];
+            }
+            return sum;
+        }
+
+    private:
+        //bytes dropped while hunting for a head, one resync per lost boundary
+        void Skip(int bytes)
+        {
+            if(NULL == this->stats)
+            {
+                return;
+            }
+            if(this->in_sync)
+            {
+                this->in_sync = false;
+                this->stats->resyncs.fetch_add(1, std::memory_order_relaxed);
+            }
+            this->stats->skipped_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        void Compact(void)
+        {
+            if((MCU_FRAME_PARSER_BUF_LEN - this->tail < MCU_FRAME_MAX_LEN) && (this->head > 0))
+            {
+                memmove(this->buf, this->buf + this->head, this->tail - this->head);
+                this->tail -= this->head;
+                this->head = 0;
+            }
+        }
+
+        uint8_t buf[MCU_FRAME_PARSER_BUF_LEN];
+        int head;       //first unparsed byte
+        int tail;       //first free byte
+        bool in_sync;   //the last byte consumed ended a valid frame
+        LinkStats *stats;
+        int capture_link;
+};
+
+#endif
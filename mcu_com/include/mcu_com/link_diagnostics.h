@@ -0,0 +1,115 @@
+#ifndef MCU_COM_LINK_DIAGNOSTICS_H
+#define MCU_COM_LINK_DIAGNOSTICS_H
+
+#include <stdio.h>
+#include <string>
+#include "diagnostic_msgs/DiagnosticStatus.h"
+#include "diagnostic_msgs/KeyValue.h"
+#include "link_stats.h"
+#include "capture.h"
+
+//counters at the previous publish, the level only looks at what changed since
+typedef struct
+{
+    uint64_t    frames_in;
+    uint64_t    frames_out;
+    uint64_t    checksum_errors;
+    uint64_t    timeouts;
+}link_diag_last_t;
+
+static inline void link_diag_add(diagnostic_msgs::DiagnosticStatus *status, const char *key, unsigned long long value)
+{
+    diagnostic_msgs::KeyValue kv;
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%llu", value);
+    kv.key = key;
+    kv.value = buf;
+    status->values.push_back(kv);
+}
+
+/*
+ * One DiagnosticStatus per link: ERROR when frames went out and nothing came
+ * back since the last call, WARN on new timeouts or checksum errors.
+ */
+static inline void link_stats_to_diagnostic(const LinkStats &stats, const std::string &node_name,
+        link_diag_last_t *last, diagnostic_msgs::DiagnosticStatus *status)
+{
+    uint64_t frames_in = stats.frames_in.load(std::memory_order_relaxed);
+    uint64_t frames_out = stats.frames_out.load(std::memory_order_relaxed);
+    uint64_t checksum_errors = stats.checksum_errors.load(std::memory_order_relaxed);
+    uint64_t timeouts = stats.timeouts.load(std::memory_order_relaxed);
+
+    status->name = node_name + ": " + stats.name + " link";
+    status->hardware_id = stats.name;
+    if((frames_out > last->frames_out) && (frames_in == last->frames_in))
+    {
+        status->level = diagnostic_msgs::DiagnosticStatus::ERROR;
+        status->message = "no reply";
+    }
+    else if((timeouts > last->timeouts) || (checksum_errors > last->checksum_errors))
+    {
+        status->level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status->message = "timeouts or checksum errors";
+    }
+    else
+    {
+        status->level = diagnostic_msgs::DiagnosticStatus::OK;
+        status->message = "OK";
+    }
+    last->frames_in = frames_in;
+    last->frames_out = frames_out;
+    last->checksum_errors = checksum_errors;
+    last->timeouts = timeouts;
+
+    status->values.clear();
+    link_diag_add(status, "bytes in", stats.bytes_in.load(std::memory_order_relaxed));
+    link_diag_add(status, "bytes out", stats.bytes_out.load(std::memory_order_relaxed));
+    link_diag_add(status, "frames in", frames_in);
+    link_diag_add(status, "frames out", frames_out);
+    link_diag_add(status, "checksum errors", checksum_errors);
+    link_diag_add(status, "resyncs", stats.resyncs.load(std::memory_order_relaxed));
+    link_diag_add(status, "skipped bytes", stats.skipped_bytes.load(std::memory_order_relaxed));
+    link_diag_add(status, "timeouts", timeouts);
+    link_diag_add(status, "retries", stats.retries.load(std::memory_order_relaxed));
+    for(int i = 0; i < stats.RttTypes(); i++)
+    {
+        const LinkHistogram &h = stats.Rtt(i);
+        char key[48];
+
+        snprintf(key, sizeof(key), "rtt %02x p50 us", stats.RttType(i));
+        link_diag_add(status, key, h.Percentile(50));
+        snprintf(key, sizeof(key), "rtt %02x p99 us", stats.RttType(i));
+        link_diag_add(status, key, h.Percentile(99));
+        snprintf(key, sizeof(key), "rtt %02x max us", stats.RttType(i));
+        link_diag_add(status, key, h.Max());
+    }
+}
+
+/*
+ * The traffic capture of the process, WARN once records were dropped so a
+ * capture with holes is not taken for a complete one.
+ */
+static inline void capture_to_diagnostic(const LinkCapture &capture, const std::string &node_name,
+        diagnostic_msgs::DiagnosticStatus *status)
+{
+    uint64_t dropped = capture.Dropped();
+
+    status->name = node_name + ": link capture";
+    status->hardware_id = "capture";
+    if(dropped > 0)
+    {
+        status->level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status->message = "records dropped";
+    }
+    else
+    {
+        status->level = diagnostic_msgs::DiagnosticStatus::OK;
+        status->message = "OK";
+    }
+    status->values.clear();
+    link_diag_add(status, "records", capture.Records());
+    link_diag_add(status, "dropped", dropped);
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef MCU_COM_LINK_STATS_H
+#define MCU_COM_LINK_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+/*
+ * Round trip histogram in the HDR style: values below LINK_HIST_LINEAR get a
+ * bucket each, above that every power of two is cut into LINK_HIST_SUB
+ * buckets, so any value is kept within 1/LINK_HIST_SUB of itself from
+ * microseconds up to about a minute.
+ */
+#define LINK_HIST_SUB_BITS          3
+#define LINK_HIST_SUB               (1 << LINK_HIST_SUB_BITS)
+#define LINK_HIST_LINEAR            (2 * LINK_HIST_SUB)
+#define LINK_HIST_MAX_BIT           26      //2^26 us, 67 s
+#define LINK_HIST_BUCKETS           (LINK_HIST_LINEAR + (LINK_HIST_MAX_BIT - LINK_HIST_SUB_BITS - 1) * LINK_HIST_SUB)
+
+#define LINK_STATS_RTT_TYPES        8       //frame types with a histogram, first come first served
+#define LINK_STATS_TYPE_NONE        0xff
+
+static inline uint64_t link_stats_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+class LinkHistogram
+{
+    public:
+        LinkHistogram()
+        {
+            this->Reset();
+        }
+
+        void Reset(void)
+        {
+            for(int i = 0; i < LINK_HIST_BUCKETS; i++)
+            {
+                this->bucket[i].store(0, std::memory_order_relaxed);
+            }
+            this->count.store(0, std::memory_order_relaxed);
+            this->sum_us.store(0, std::memory_order_relaxed);
+            this->max_us.store(0, std::memory_order_relaxed);
+        }
+
+        void Add(uint64_t us)
+        {
+            this->bucket[Index(us)].fetch_add(1, std::memory_order_relaxed);
+            this->count.fetch_add(1, std::memory_order_relaxed);
+            this->sum_us.fetch_add(us, std::memory_order_relaxed);
+            //single writer, a plain compare is enough
+            if(us > this->max_us.load(std::memory_order_relaxed))
+            {
+                this->max_us.store(us, std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t Count(void) const
+        {
+            return this->count.load(std::memory_order_relaxed);
+        }
+
+        uint64_t Max(void) const
+        {
+            return this->max_us.load(std::memory_order_relaxed);
+        }
+
+        double Mean(void) const
+        {
+            uint64_t n = this->Count();
+            return n ? (double)this->sum_us.load(std::memory_order_relaxed) / n : 0.0;
+        }
+
+        //lowest value of the bucket holding the given percentile, 0 when empty
+        uint64_t Percentile(double percent) const
+        {
+            uint64_t n = this->Count();
+            uint64_t rank = 0;
+            uint64_t seen = 0;
+
+            if(0 == n)
+            {
+                return 0;
+            }
+            rank = (uint64_t)(percent / 100.0 * (n - 1));
+            for(int i = 0; i < LINK_HIST_BUCKETS; i++)
+            {
+                seen += this->bucket[i].load(std::memory_order_relaxed);
+                if(seen > rank)
+                {
+                    return Lowest(i);
+                }
+            }
+            return this->Max();
+        }
+
+        static int Index(uint64_t us)
+        {
+            int bit = 0;
+
+            if(us < LINK_HIST_LINEAR)
+            {
+                return (int)us;
+            }
+            bit = 63 - __builtin_clzll(us);
+            if(bit >= LINK_HIST_MAX_BIT)
+            {
+                return LINK_HIST_BUCKETS - 1;
+            }
+            return LINK_HIST_LINEAR + (bit - LINK_HIST_SUB_BITS - 1) * LINK_HIST_SUB
+                    + (int)((us >> (bit - LINK_HIST_SUB_BITS)) & (LINK_HIST_SUB - 1));
+        }
+
+        static uint64_t Lowest(int index)
+        {
+            int bit = 0;
+
+            if(index < LINK_HIST_LINEAR)
+            {
+                return index;
+            }
+            bit = (index - LINK_HIST_LINEAR) / LINK_HIST_SUB + LINK_HIST_SUB_BITS + 1;
+            return (uint64_t)(LINK_HIST_SUB + (index - LINK_HIST_LINEAR) % LINK_HIST_SUB) << (bit - LINK_HIST_SUB_BITS);
+        }
+
+    private:
+        std::atomic<uint32_t> bucket[LINK_HIST_BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum_us;
+        std::atomic<uint64_t> max_us;
+};
+
+/*
+ * Counters of one serial link. The thread that owns the link writes them,
+ * any thread may read them for diagnostics, so they are relaxed atomics.
+ *
+ * Round trips are either measured by the caller and given to AddRtt(), or
+ * derived from MarkSent()/MarkReply() for links where a reply carries the
+ * frame type of its request. A type that ever got a reply and is sent again
+ * while the previous one is unanswered counts as a timeout.
+ */
+class LinkStats
+{
+    public:
+        LinkStats(const char *name) : name(name)
+        {
+            memset(this->sent_us, 0, sizeof(this->sent_us));
+            this->Reset();
+        }
+
+        void Reset(void)
+        {
+            this->bytes_in.store(0, std::memory_order_relaxed);
+            this->bytes_out.store(0, std::memory_order_relaxed);
+            this->frames_in.store(0, std::memory_order_relaxed);
+            this->frames_out.store(0, std::memory_order_relaxed);
+            this->checksum_errors.store(0, std::memory_order_relaxed);
+            this->resyncs.store(0, std::memory_order_relaxed);
+            this->skipped_bytes.store(0, std::memory_order_relaxed);
+            this->timeouts.store(0, std::memory_order_relaxed);
+            this->retries.store(0, std::memory_order_relaxed);
+            for(int i = 0; i < LINK_STATS_RTT_TYPES; i++)
+            {
+                this->rtt[i].Reset();
+            }
+        }
+
+        void AddRx(int bytes)
+        {
+            this->bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        void AddTx(int bytes)
+        {
+            this->bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+            this->frames_out.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void AddRtt(uint8_t type, uint64_t us)
+        {
+            int slot = this->Slot(type, true);
+            if(slot >= 0)
+            {
+                this->rtt[slot].Add(us);
+            }
+        }
+
+        void MarkSent(uint8_t type)
+        {
+            if((0 != this->sent_us[type]) && (this->Slot(type, false) >= 0))
+            {
+                this->timeouts.fetch_add(1, std::memory_order_relaxed);
+            }
+            this->sent_us[type] = link_stats_now_us();
+        }
+
+        void MarkReply(uint8_t type)
+        {
+            if(0 != this->sent_us[type])
+            {
+                this->AddRtt(type, link_stats_now_us() - this->sent_us[type]);
+                this->sent_us[type] = 0;
+            }
+        }
+
+        int RttTypes(void) const
+        {
+            return this->rtt_types.load(std::memory_order_acquire);
+        }
+
+        uint8_t RttType(int slot) const
+        {
+            return this->rtt_type[slot];
+        }
+
+        const LinkHistogram &Rtt(int slot) const
+        {
+            return this->rtt[slot];
+        }
+
+        //human readable summary, one line per counter group
+        std::string Dump(void) const
+        {
+            char line[256];
+            std::string out;
+
+            snprintf(line, sizeof(line), "[%s]\n", this->name);
+            out += line;
+            snprintf(line, sizeof(line), "  in  %llu bytes %llu frames, out %llu bytes %llu frames\n",
+                    (unsigned long long)this->bytes_in.load(), (unsigned long long)this->frames_in.load(),
+                    (unsigned long long)this->bytes_out.load(), (unsigned long long)this->frames_out.load());
+            out += line;
+            snprintf(line, sizeof(line), "  checksum errors %llu, resyncs %llu, skipped %llu bytes, timeouts %llu, retries %llu\n",
+                    (unsigned long long)this->checksum_errors.load(), (unsigned long long)this->resyncs.load(),
+                    (unsigned long long)this->skipped_bytes.load(), (unsigned long long)this->timeouts.load(),
+                    (unsigned long long)this->retries.load());
+            out += line;
+            for(int i = 0; i < this->RttTypes(); i++)
+            {
+                const LinkHistogram &h = this->rtt[i];
+                snprintf(line, sizeof(line), "  rtt type %02x: n %llu mean %.0f p50 %llu p90 %llu p99 %llu max %llu us\n",
+                        this->rtt_type[i], (unsigned long long)h.Count(), h.Mean(),
+                        (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90),
+                        (unsigned long long)h.Percentile(99), (unsigned long long)h.Max());
+                out += line;
+            }
+            return out;
+        }
+
+        const char *name;
+        std::atomic<uint64_t> bytes_in;
+        std::atomic<uint64_t> bytes_out;
+        std::atomic<uint64_t> frames_in;
+        std::atomic<uint64_t> frames_out;
+        std::atomic<uint64_t> checksum_errors;  //complete frame with a bad sum or tail
+        std::atomic<uint64_t> resyncs;          //times the parser lost the frame boundary
+        std::atomic<uint64_t> skipped_bytes;    //bytes dropped while looking for a head
+        std::atomic<uint64_t> timeouts;
+        std::atomic<uint64_t> retries;
+
+    private:
+        //only the owning thread adds types, readers see a slot once rtt_types covers it
+        int Slot(uint8_t type, bool add)
+        {
+            int num = this->rtt_types.load(std::memory_order_relaxed);
+            for(int i = 0; i < num; i++)
+            {
+                if(this->rtt_type[i] == type)
+                {
+                    return i;
+                }
+            }
+            if(!add || (num >= LINK_STATS_RTT_TYPES))
+            {
+                return -1;
+            }
+            this->rtt_type[num] = type;
+            this->rtt_types.store(num + 1, std::memory_order_release);
+            return num;
+        }
+
+        uint64_t sent_us[256];
+        uint8_t rtt_type[LINK_STATS_RTT_TYPES];
+        std::atomic<int> rtt_types{0};
+        LinkHistogram rtt[LINK_STATS_RTT_TYPES];
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MCU_COM_MPSC_QUEUE_H
+#define MCU_COM_MPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include "spsc_queue.h"
+
+/*
+ * Bounded multi producer / single consumer queue.
+ *
+ * Any thread may Push(), one thread Pop()s. Every slot carries a sequence
+ * number that tells whether it is free for the producer of that round or
+ * filled for the consumer, so producers only contend on one fetch of the
+ * tail index and nobody ever takes a lock. Push() fails when the queue is
+ * full. N must be a power of two.
+ */
+template<typename T, size_t N>
+class MpscQueue
+{
+    static_assert((N >= 2) && (0 == (N & (N - 1))), "MpscQueue size must be a power of two");
+
+    public:
+        MpscQueue() : head(0), tail(0)
+        {
+            for(size_t i = 0; i < N; i++)
+            {
+                this->slot[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool Push(const T &item)
+        {
+            size_t t = this->tail.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                cell_t *cell = &this->slot[t & (N - 1)];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)t;
+
+                if(0 == diff)
+                {
+                    //slot is free for this round, claim it
+                    if(this->tail.compare_exchange_weak(t, t + 1, std::memory_order_relaxed))
+                    {
+                        cell->item = item;
+                        cell->seq.store(t + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(diff < 0)
+                {
+                    //consumer has not freed the slot of the previous round
+                    return false;
+                }
+                else
+                {
+                    t = this->tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool Pop(T &item)
+        {
+            size_t h = this->head.load(std::memory_order_relaxed);
+            cell_t *cell = &this->slot[h & (N - 1)];
+
+            if(cell->seq.load(std::memory_order_acquire) != h + 1)
+            {
+                //empty, or a producer claimed the slot and is still writing it
+                return false;
+            }
+            item = cell->item;
+            cell->seq.store(h + N, std::memory_order_release);
+            this->head.store(h + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+    private:
+        typedef struct
+        {
+            std::atomic<size_t> seq;
+            T                   item;
+        }cell_t;
+
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> head;     //owned by the consumer
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> tail;     //shared by the producers
+        alignas(MCU_COM_CACHE_LINE) cell_t slot[N];
+};
+
+#endif
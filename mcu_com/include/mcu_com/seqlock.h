@@ -0,0 +1,62 @@
+#ifndef MCU_COM_SEQLOCK_H
+#define MCU_COM_SEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+/*
+ * Latest value of a plain struct, written by one thread and read by any.
+ *
+ * The writer bumps the sequence to odd, copies the value and bumps it to
+ * even again. A reader copies the value and retries when the sequence was
+ * odd or changed meanwhile. Neither side blocks, and readers never slow
+ * the writer down. T is copied with memcpy and must be POD.
+ */
+template<typename T>
+class Seqlock
+{
+    static_assert(std::is_pod<T>::value, "Seqlock only holds POD types");
+
+    public:
+        Seqlock() : seq(0)
+        {
+            memset(&this->value, 0, sizeof(T));
+        }
+
+        //single writer only
+        void Store(const T &value)
+        {
+            uint32_t s = this->seq.load(std::memory_order_relaxed);
+            this->seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(&this->value, &value, sizeof(T));
+            this->seq.store(s + 2, std::memory_order_release);
+        }
+
+        void Load(T &value) const
+        {
+            uint32_t s0 = 0;
+            uint32_t s1 = 0;
+            do
+            {
+                s0 = this->seq.load(std::memory_order_acquire);
+                memcpy(&value, &this->value, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                s1 = this->seq.load(std::memory_order_relaxed);
+            }while((s0 & 1) || (s0 != s1));
+        }
+
+        //how often Store() ran, lets a reader skip an unchanged value
+        uint32_t Version(void) const
+        {
+            return this->seq.load(std::memory_order_acquire) / 2;
+        }
+
+    private:
+        std::atomic<uint32_t> seq;
+        T value;
+};
+
+#endif
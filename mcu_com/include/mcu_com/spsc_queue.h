@@ -0,0 +1,61 @@
+#ifndef MCU_COM_SPSC_QUEUE_H
+#define MCU_COM_SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+#define MCU_COM_CACHE_LINE      64
+
+/*
+ * Bounded single producer / single consumer queue.
+ *
+ * Push() may only be called from one thread and Pop() from one other
+ * thread. Neither blocks nor allocates: Push() fails when the queue is full
+ * and Pop() fails when it is empty. N must be a power of two.
+ */
+template<typename T, size_t N>
+class SpscQueue
+{
+    static_assert((N >= 2) && (0 == (N & (N - 1))), "SpscQueue size must be a power of two");
+
+    public:
+        SpscQueue() : head(0), tail(0) {}
+
+        bool Push(const T &item)
+        {
+            size_t t = this->tail.load(std::memory_order_relaxed);
+            if(t - this->head.load(std::memory_order_acquire) == N)
+            {
+                return false;
+            }
+            this->slot[t & (N - 1)] = item;
+            this->tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool Pop(T &item)
+        {
+            size_t h = this->head.load(std::memory_order_relaxed);
+            if(h == this->tail.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            item = this->slot[h & (N - 1)];
+            this->head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        //only a hint when called while the other side is running
+        size_t Size(void) const
+        {
+            return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+        }
+
+    private:
+        //keep the two indices on their own cache lines so the threads do not share one
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> head;     //next slot to pop, owned by the consumer
+        alignas(MCU_COM_CACHE_LINE) std::atomic<size_t> tail;     //next slot to push, owned by the producer
+        alignas(MCU_COM_CACHE_LINE) T slot[N];
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Feed a traffic capture back through the frame parsers.
+ *
+ * usage: capture_replay [-r] [-d] [-n loops] capture_file
+ *   -r    keep the recorded timing instead of running at full speed
+ *   -d    print every received frame, for diffing parser behaviour
+ *   -n    replay the file this many times, for throughput numbers
+ *
+ * The received bytes of each MCU link go through their own FrameParser in
+ * the chunks they were read in, so framing errors and resyncs come out the
+ * same as on the robot. Sent bytes and the upper_com socket are only counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mcu_com/frame_parser.h"
+#include "mcu_com/capture.h"
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t len;
+    bool realtime;
+    bool dump;
+}replay_t;
+
+static LinkStats *link_stats[CAPTURE_LINK_NUM];
+static FrameParser parser[CAPTURE_LINK_NUM];
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void wait_until_us(uint64_t start_us, uint64_t ts_us)
+{
+    uint64_t now_us = link_stats_now_us();
+    if(now_us < start_us + ts_us)
+    {
+        usleep(start_us + ts_us - now_us);
+    }
+}
+
+static void feed(uint8_t link, const uint8_t *data, int len, uint64_t ts_us, bool dump)
+{
+    while(len > 0)
+    {
+        int used = parser[link].Append(data, len);
+
+        data += used;
+        len -= used;
+        parser[link].Parse([&](uint8_t *frame, int frame_len)
+        {
+            if(!dump)
+            {
+                return;
+            }
+            printf("%10.6f %-10s", ts_us * 1e-6, capture_link_name(link));
+            for(int i = 0; i < frame_len; i++)
+            {
+                printf(" %02x", frame[i]);
+            }
+            printf("\n");
+        });
+    }
+}
+
+//returns the number of records, -1 on a corrupt file
+static long replay_once(const replay_t *replay)
+{
+    size_t pos = sizeof(capture_file_header_t);
+    uint64_t start_us = link_stats_now_us();
+    long records = 0;
+
+    while(pos + sizeof(capture_record_t) <= replay->len)
+    {
+        capture_record_t record;
+        const uint8_t *data = replay->data + pos + sizeof(capture_record_t);
+
+        memcpy(&record, replay->data + pos, sizeof(record));
+        if((record.link >= CAPTURE_LINK_NUM) || (pos + sizeof(record) + record.len > replay->len))
+        {
+            fprintf(stderr, "corrupt record at offset %zu\n", pos);
+            return -1;
+        }
+        pos += sizeof(record) + record.len;
+        records++;
+
+        if(replay->realtime)
+        {
+            wait_until_us(start_us, record.ts_us);
+        }
+        if(CAPTURE_DIR_TX == record.dir)
+        {
+            link_stats[record.link]->AddTx(record.len);
+        }
+        else if(capture_link_is_mcu(record.link))
+        {
+            feed(record.link, data, record.len, record.ts_us, replay->dump);
+        }
+        else
+        {
+            link_stats[record.link]->AddRx(record.len);
+        }
+    }
+    return records;
+}
+
+int main(int argc, char **argv)
+{
+    const capture_file_header_t *header = NULL;
+    replay_t replay;
+    struct stat st;
+    int loops = 1;
+    int opt = 0;
+    int fd = -1;
+    long records = 0;
+    double start = 0.0;
+    double elapsed = 0.0;
+
+    memset(&replay, 0, sizeof(replay));
+    while((opt = getopt(argc, argv, "rdn:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                replay.realtime = true;
+                break;
+            case 'd':
+                replay.dump = true;
+                break;
+            case 'n':
+                loops = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r] [-d] [-n loops] capture_file\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-r] [-d] [-n loops] capture_file\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if((fd < 0) || (fstat(fd, &st) < 0))
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if((size_t)st.st_size < sizeof(capture_file_header_t))
+    {
+        fprintf(stderr, "%s: too short for a capture\n", argv[optind]);
+        return 1;
+    }
+    replay.len = st.st_size;
+    replay.data = (const uint8_t *)mmap(NULL, replay.len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == replay.data)
+    {
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        return 1;
+    }
+    madvise((void *)replay.data, replay.len, MADV_SEQUENTIAL);
+
+    header = (const capture_file_header_t *)replay.data;
+    if((0 != memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic))) || (CAPTURE_VERSION != header->version))
+    {
+        fprintf(stderr, "%s: not a version %d capture\n", argv[optind], CAPTURE_VERSION);
+        return 1;
+    }
+
+    for(int i = 0; i < CAPTURE_LINK_NUM; i++)
+    {
+        link_stats[i] = new LinkStats(capture_link_name(i));
+        parser[i].SetStats(link_stats[i]);
+    }
+
+    start = now_sec();
+    for(int i = 0; i < loops; i++)
+    {
+        long n = replay_once(&replay);
+        if(n < 0)
+        {
+            break;
+        }
+        records += n;
+    }
+    elapsed = now_sec() - start;
+
+    for(int i = 0; i < CAPTURE_LINK_NUM; i++)
+    {
+        if((0 != link_stats[i]->bytes_in.load()) || (0 != link_stats[i]->bytes_out.load()))
+        {
+            fputs(link_stats[i]->Dump().c_str(), stderr);
+        }
+    }
+    fprintf(stderr, "%ld records, %.1f MB in %.3f s, %.1f MB/s\n",
+            records, (double)replay.len * loops / 1e6, elapsed, replay.len * loops / elapsed / 1e6);
+
+    munmap((void *)replay.data, replay.len);
+    return 0;
+}
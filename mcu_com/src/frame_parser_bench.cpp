@@ -0,0 +1,163 @@
+/*
+ * Throughput of FrameParser against the copy based parser it replaced.
+ *
+ * usage: frame_parser_bench [megabytes] [chunk_bytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "mcu_com/frame_parser.h"
+
+#define LEGACY_BUF_LEN      256
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//frames of random type and length, with a few garbage bytes in between
+static void build_stream(std::vector<uint8_t> &stream, size_t size)
+{
+    srand(1);
+    while(stream.size() < size)
+    {
+        uint8_t frame[MCU_FRAME_MAX_LEN];
+        int len = MCU_FRAME_MIN_LEN + rand() % 60;
+
+        frame[0] = MCU_FRAME_HEAD;
+        frame[1] = len;
+        frame[2] = rand() & 0x0f;
+        for(int i = 3; i < len - 2; i++)
+        {
+            frame[i] = rand();
+        }
+        frame[len - 2] = FrameParser::CheckSum(frame, len - 2);
+        frame[len - 1] = MCU_FRAME_TAIL;
+        stream.insert(stream.end(), frame, frame + len);
+
+        if(0 == rand() % 16)
+        {
+            stream.push_back(0x00);
+        }
+    }
+}
+
+static volatile uint32_t sink = 0;
+
+static void handle_frame(uint8_t *frame, int len)
+{
+    sink += frame[2] + len;
+}
+
+//the receive path every driver used before FrameParser, kept for comparison
+static int legacy_parse(const uint8_t *chunk, int nread)
+{
+    static int last_unread_bytes = 0;
+    static unsigned char recv_buf_last[LEGACY_BUF_LEN] = {0};
+    unsigned char recv_buf[LEGACY_BUF_LEN] = {0};
+    unsigned char recv_buf_complete[LEGACY_BUF_LEN] = {0};
+    unsigned char recv_buf_temp[LEGACY_BUF_LEN] = {0};
+    int i = 0;
+    int j = 0;
+    int data_len = 0;
+    int frame_len = 0;
+    int frames = 0;
+
+    for(j = 0; j < last_unread_bytes; j++)
+    {
+        recv_buf_complete[j] = recv_buf_last[j];
+    }
+    memcpy(recv_buf, chunk, nread);
+    memcpy(recv_buf_complete + last_unread_bytes, recv_buf, nread);
+    data_len = last_unread_bytes + nread;
+    last_unread_bytes = 0;
+    while(i < data_len)
+    {
+        if(0x5A == recv_buf_complete[i])
+        {
+            frame_len = recv_buf_complete[i + 1];
+            if(i + frame_len <= data_len)
+            {
+                if((frame_len > 0) && (0xA5 == recv_buf_complete[i + frame_len - 1]))
+                {
+                    for(j = 0; j < frame_len; j++)
+                    {
+                        recv_buf_temp[j] = recv_buf_complete[i + j];
+                    }
+                    if(FrameParser::CheckSum(recv_buf_temp, frame_len - 2) == recv_buf_temp[frame_len - 2])
+                    {
+                        handle_frame(recv_buf_temp, frame_len);
+                        frames++;
+                    }
+                    i = i + frame_len;
+                }
+                else
+                {
+                    i++;
+                }
+            }
+            else
+            {
+                last_unread_bytes = data_len - i;
+                for(j = 0; j < last_unread_bytes; j++)
+                {
+                    recv_buf_last[j] = recv_buf_complete[i + j];
+                }
+                break;
+            }
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return frames;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    int chunk = argc > 2 ? atoi(argv[2]) : 64;
+    std::vector<uint8_t> stream;
+    FrameParser parser;
+    double start = 0.0;
+    double elapsed = 0.0;
+    long frames = 0;
+
+    if((chunk <= 0) || (chunk > LEGACY_BUF_LEN / 2))
+    {
+        //the legacy parser overflows when a chunk plus a partial frame exceeds its buffer
+        chunk = LEGACY_BUF_LEN / 2;
+    }
+    build_stream(stream, size);
+    size = stream.size();
+
+    start = now_sec();
+    for(size_t off = 0; off < size; off += chunk)
+    {
+        int len = (size - off < (size_t)chunk) ? (int)(size - off) : chunk;
+        parser.Append(&stream[off], len);
+        frames += parser.Parse(handle_frame);
+    }
+    elapsed = now_sec() - start;
+    printf("FrameParser : %10.1f MB/s %12.0f frames/s (%ld frames)\n",
+            size / elapsed / 1e6, frames / elapsed, frames);
+
+    frames = 0;
+    start = now_sec();
+    for(size_t off = 0; off < size; off += chunk)
+    {
+        int len = (size - off < (size_t)chunk) ? (int)(size - off) : chunk;
+        frames += legacy_parse(&stream[off], len);
+    }
+    elapsed = now_sec() - start;
+    printf("legacy      : %10.1f MB/s %12.0f frames/s (%ld frames)\n",
+            size / elapsed / 1e6, frames / elapsed, frames);
+
+    return 0;
+}
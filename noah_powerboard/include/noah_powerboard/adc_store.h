@@ -0,0 +1,82 @@
+#ifndef ADC_STORE_H
+#define ADC_STORE_H
+
+#include <stdint.h>
+
+#define ADC_STORE_FIELD_NUM         32      //16 bit fields of voltage_data_t
+#define ADC_STORE_DEPTH             6000    //raw samples, 60 s at 100 Hz
+#define ADC_STORE_PANE_MS           100     //aggregation step of the windows
+#define ADC_STORE_PANE_NUM          600     //panes of the longest window
+
+enum
+{
+    ADC_WINDOW_1S = 0,
+    ADC_WINDOW_10S,
+    ADC_WINDOW_60S,
+    ADC_WINDOW_NUM,
+};
+
+typedef struct
+{
+    float       min;
+    float       max;
+    float       mean;
+    float       p50;
+    float       p90;
+    float       p99;
+}adc_field_stats_t;
+
+/*
+ * Fixed size history of ADC samples with 1 s, 10 s and 60 s aggregates.
+ *
+ * Raw samples are kept column by column in a ring, so a percentile query
+ * only touches the one field it sorts. Time is cut into 100 ms panes that
+ * hold count, sum, min and max of every field. A new sample updates one
+ * pane and the running sum of each window. When a pane leaves a window its
+ * sum is subtracted again, so mean needs no scan. min and max combine the
+ * panes of the window, and percentiles select from a copy of the raw
+ * column. If samples come faster than 100 Hz, the ring keeps only the
+ * newest ADC_STORE_DEPTH samples for percentiles.
+ *
+ * Not thread safe, Add() and Query() belong to the serial loop.
+ */
+class AdcStore
+{
+    public:
+        AdcStore();
+        //signed_mask: bit n set when field n is int16_t instead of uint16_t
+        void Init(uint32_t signed_mask);
+        void Add(uint64_t now_ms, const uint16_t *raw);
+        //fills ADC_STORE_FIELD_NUM stats, returns the number of samples in the window
+        int Query(int window, uint64_t now_ms, adc_field_stats_t *stats);
+        static uint32_t WindowMs(int window);
+
+    private:
+        void Advance(uint64_t now_ms);
+        void Reset(uint64_t pane_seq);
+        int32_t Value(int field, uint16_t raw) const;
+
+        uint32_t signed_mask;
+
+        //raw samples, structure of arrays
+        uint64_t sample_ms[ADC_STORE_DEPTH];
+        uint16_t sample[ADC_STORE_FIELD_NUM][ADC_STORE_DEPTH];
+        int sample_head;        //next slot to write
+        int sample_count;
+
+        //panes, pane_seq is now_ms / ADC_STORE_PANE_MS
+        uint64_t pane_seq;
+        bool started;
+        uint32_t pane_count[ADC_STORE_PANE_NUM];
+        int32_t pane_sum[ADC_STORE_FIELD_NUM][ADC_STORE_PANE_NUM];
+        int32_t pane_min[ADC_STORE_FIELD_NUM][ADC_STORE_PANE_NUM];
+        int32_t pane_max[ADC_STORE_FIELD_NUM][ADC_STORE_PANE_NUM];
+
+        //running totals of every window
+        uint32_t window_count[ADC_WINDOW_NUM];
+        int64_t window_sum[ADC_WINDOW_NUM][ADC_STORE_FIELD_NUM];
+
+        int32_t scratch[ADC_STORE_DEPTH];
+};
+
+#endif
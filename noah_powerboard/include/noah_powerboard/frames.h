@@ -0,0 +1,36 @@
+#ifndef POWERBOARD_FRAMES_H
+#define POWERBOARD_FRAMES_H
+
+#include "mcu_com/frame_codec.h"
+
+//plain linux, shared with powerboard_sim
+#define FRAME_TYPE_LEDS_CONTROL         0x01
+#define FRAME_TYPE_SYS_STATUS           0x02
+#define FRAME_TYPE_BAT_STATUS           0x03
+#define FRAME_TYPE_GET_MODULE_STATE     0x04
+//#define FRAME_TYPE_READ_ERR_CURRENT     0x05//
+#define FRAME_TYPE_MODULE_CONTROL       0x06
+#define FRAME_TYPE_IRLED_CONTROL        0x07
+#define FRAME_TYPE_GET_CURRENT          0x0a
+#define FRAME_TYPE_GET_VERSION          0x0e
+
+//requests to the board, payload fields in wire order
+
+//effect, r, g, b, period
+typedef FrameSchema<FRAME_TYPE_LEDS_CONTROL, FrameU8, FrameU8, FrameU8, FrameU8, FrameU8> LedsControlFrame;
+//always 0
+typedef FrameSchema<FRAME_TYPE_SYS_STATUS, FrameU8> SysStatusFrame;
+//CMD_BAT_*
+typedef FrameSchema<FRAME_TYPE_BAT_STATUS, FrameU8> BatStatusFrame;
+//always 1
+typedef FrameSchema<FRAME_TYPE_GET_MODULE_STATE, FrameU8> GetModuleStateFrame;
+//module mask, MODULE_CTRL_ON/OFF
+typedef FrameSchema<FRAME_TYPE_MODULE_CONTROL, FrameLe<uint32_t>, FrameU8> ModuleControlFrame;
+//IR_CMD_*, percent, only used by IR_CMD_WRITE
+typedef FrameSchema<FRAME_TYPE_IRLED_CONTROL, FrameU8, FrameU8> IrLedControlFrame;
+//1, 1, SEND_RATE_*
+typedef FrameSchema<FRAME_TYPE_GET_CURRENT, FrameU8, FrameU8, FrameU8> GetCurrentFrame;
+//VERSION_TYPE_*
+typedef FrameSchema<FRAME_TYPE_GET_VERSION, FrameU8> GetVersionFrame;
+
+#endif
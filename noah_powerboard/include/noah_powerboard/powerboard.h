@@ -1,27 +1,41 @@
 #include "ros/ros.h"
 #include "std_msgs/String.h"
 #include "json.hpp"
+#include "transaction.h"
+#include "scheduler.h"
+#include "adc_store.h"
+#include "frames.h"
+#include "mcu_com/frame_parser.h"
+#include "mcu_com/spsc_queue.h"
+#include "mcu_com/mpsc_queue.h"
+#include "mcu_com/seqlock.h"
+#include "mcu_com/dev_watch.h"
+#include "mcu_com/link_stats.h"
+#include "mcu_com/link_diagnostics.h"
+#include "ros/callback_queue.h"
+#include "noah_powerboard/ModuleState.h"
+#include "noah_powerboard/BatteryInfo.h"
+#include "noah_powerboard/SysStatus.h"
+#include "noah_powerboard/AdcData.h"
+#include "noah_powerboard/Version.h"
+#include "noah_powerboard/AdcBatch.h"
+#include "noah_powerboard/AdcStats.h"
+#include "noah_powerboard/GetAdcStats.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+#include "std_srvs/Trigger.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <atomic>
+#include <sys/eventfd.h>
 using json = nlohmann::json;
 #ifndef LED_H
 #define LED_H
 
 
-#define PROTOCOL_HEAD               0x5a
-#define PROTOCOL_TAIL               0xa5
 #define POWER_CURRENT_LEN           33
 
 #define BUF_LEN                    256
 
-#define FRAME_TYPE_LEDS_CONTROL         0x01
-#define FRAME_TYPE_SYS_STATUS           0x02
-#define FRAME_TYPE_BAT_STATUS           0x03
-#define FRAME_TYPE_GET_MODULE_STATE     0x04
-//#define FRAME_TYPE_READ_ERR_CURRENT     0x05//
-#define FRAME_TYPE_MODULE_CONTROL       0x06
-#define FRAME_TYPE_IRLED_CONTROL        0x07
-#define FRAME_TYPE_GET_CURRENT          0x0a
-#define FRAME_TYPE_GET_VERSION          0x0e
-
 #define COM_ERR_REPEAT_TIME             3 
 
 typedef enum
@@ -63,6 +77,9 @@ typedef enum
 
 } module_ctrl_e;
 
+//turning these off is sent ahead of every other command
+#define SAFETY_MODULES          (POWER_24V_EN | POWER_VSYS_24V_NV)
+
 typedef struct
 {
 #define MODULE_CTRL_ON      1  
@@ -223,11 +240,20 @@ typedef struct
     uint8_t set_ir_percent;
     uint8_t lightness_percent;
 }ir_cmd_t;
+typedef enum
+{
+    COM_OPENING = 1,
+    COM_CHECK_VERSION,
+    COM_RUN_OK,
+    COM_CLOSING,
+}com_state_e;
+
 typedef struct
 {
 #define DEV_STRING_LEN              50
     char                        dev[DEV_STRING_LEN]; 
     int                         device;
+    com_state_e                 com_state;
     led_t                       led;
     led_t                       led_set;
     rcv_serial_leds_frame_t     rcv_serial_leds_frame;
@@ -245,7 +271,7 @@ typedef struct
 #define PROTOCOL_VERSION_SIZE       15 
     char                        hw_version[HW_VERSION_SIZE];
     char                        sw_version[SW_VERSION_SIZE];
-    char                        protocol_version[];
+    char                        protocol_version[PROTOCOL_VERSION_SIZE];
 
 #define SYS_STATUS_OFF              0
 #define SYS_STATUS_TURNING_ON       1
@@ -285,12 +311,61 @@ typedef enum
     LIGHTS_MODE_SETTING                 = 0xff,
 }light_mode_t;
 
+#define ADC_QUEUE_DEPTH             256     //2.5 s of samples at 100 Hz
+#define ADC_BATCH_SIZE_DEFAULT      10
+#define ADC_STREAM_TIMEOUT_MS       3000    //arm auto upload again after this long without a sample
+#define ADC_BATCH_FLUSH_MS          200     //a partial batch is published once its oldest sample is this old
+#define ADC_STATS_PERIOD_DEFAULT    10      //s
+#define SCHED_METRICS_PERIOD        10      //s
+
+typedef struct
+{
+    ros::Time                   stamp;
+    voltage_info_t              info;
+}adc_sample_t;
+
+#define POWERBOARD_CMD_QUEUE_DEPTH  64
+#define POWERBOARD_SPINNER_THREADS  2
+
+//what a ros callback asks the serial thread to do
+typedef struct
+{
+#define POWERBOARD_CMD_MODULE_ON    1
+#define POWERBOARD_CMD_MODULE_OFF   2
+    uint8_t                     cmd;
+    uint32_t                    module;
+}powerboard_cmd_t;
+
+//board state as last reported to the serial thread, read by the ros callbacks
+typedef struct
+{
+    uint16_t                    bat_info;
+    uint16_t                    sys_status;
+    uint32_t                    module_status;
+}powerboard_state_t;
+
 //#define DEV_PATH                "/dev/noah_powerboard"
 extern powerboard_t    *sys_powerboard;
+/*
+ * Callback queue of the serial thread. A callback added from a ros thread
+ * wakes the serial loop through the command eventfd, so the loop does not
+ * have to poll the queue.
+ */
+class IoCallbackQueue : public ros::CallbackQueue
+{
+    public:
+        IoCallbackQueue() : wake_fd(-1) {}
+        void SetWakeFd(int fd) { wake_fd = fd; }
+        virtual void addCallback(const ros::CallbackInterfacePtr &callback, uint64_t owner_id = 0);
+
+    private:
+        int wake_fd;
+};
+
 class NoahPowerboard
 {
     public:
-        NoahPowerboard()
+        NoahPowerboard() : link_stats("powerboard")
         {
             noah_powerboard_pub = n.advertise<std_msgs::String>("tx_noah_powerboard_node",1000);
             pub_charge_status_to_move_base = n.advertise<std_msgs::UInt8MultiArray>("charge_status_to_move_base",1000);
@@ -299,19 +374,67 @@ class NoahPowerboard
             power_sub_from_app = n.subscribe("app_pub_power",1000,&NoahPowerboard::power_from_app_rcv_callback,this);
             noah_powerboard_sub = n.subscribe("rx_noah_powerboard_node",1000,&NoahPowerboard::from_app_rcv_callback,this);
             sub_navigation_camera_leds = n.subscribe("lane_follower_node/camera_using_n",1000,&NoahPowerboard::from_navigation_rcv_callback,this);
-            
+
+            module_state_pub = n.advertise<noah_powerboard::ModuleState>("noah_powerboard/module_state",10,true);
+            battery_info_pub = n.advertise<noah_powerboard::BatteryInfo>("noah_powerboard/battery_info",10,true);
+            sys_status_pub = n.advertise<noah_powerboard::SysStatus>("noah_powerboard/sys_status",10,true);
+            adc_data_pub = n.advertise<noah_powerboard::AdcData>("noah_powerboard/adc_data",10);
+            version_pub = n.advertise<noah_powerboard::Version>("noah_powerboard/version",1,true);
+            adc_batch_pub = n.advertise<noah_powerboard::AdcBatch>("noah_powerboard/adc_batch",10);
+            adc_stats_pub = n.advertise<noah_powerboard::AdcStats>("noah_powerboard/adc_stats",10);
+            diagnostics_pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics",1);
+            dump_link_stats_srv = n.advertiseService("noah_powerboard/dump_link_stats",&NoahPowerboard::DumpLinkStatsCallback,this);
+            frame_parser.SetStats(&link_stats);
+            frame_parser.SetCapture(CAPTURE_LINK_POWERBOARD);
+            transactions.SetStats(&link_stats);
+            memset(&link_diag_last, 0, sizeof(link_diag_last));
+            cmd_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            //the stats service reads adc_store, so it is served on the serial thread
+            io_queue.SetWakeFd(cmd_event_fd);
+            io_n.setCallbackQueue(&io_queue);
+            adc_stats_srv = io_n.advertiseService("noah_powerboard/get_adc_stats",&NoahPowerboard::GetAdcStatsCallback,this);
+            pub_json = true;
+            adc_send_rate = SEND_RATE_SINGLE;
+            adc_batch_size = ADC_BATCH_SIZE_DEFAULT;
+            adc_last_ms = 0;
+            adc_dropped = 0;
+            adc_running = false;
+            adc_stats_period = ADC_STATS_PERIOD_DEFAULT;
+            module_on_pending = 0;
+            module_off_pending = 0;
+            module_want_on = 0;
+            module_want_off = 0;
+            link_retry = false;
         }
+        ~NoahPowerboard();
         int PowerboardParamInit(void);
-        int SetLedEffect(powerboard_t *powerboard);
+        int SetLedEffect(powerboard_t *powerboard, transaction_done_t done = transaction_done_t());
         int GetBatteryInfo(powerboard_t *sys);
-        int GetAdcData(powerboard_t *sys);
-        int GetVersion(powerboard_t *sys);
+        int GetAdcData(powerboard_t *sys, transaction_done_t done = transaction_done_t());
+        int GetVersion(powerboard_t *sys, transaction_done_t done = transaction_done_t());
         int GetSysStatus(powerboard_t *sys);
-        int InfraredLedCtrl(powerboard_t *sys);
-        int SetModulePowerOnOff(powerboard_t *sys);
-        int GetModulePowerOnOff(powerboard_t *sys);
+        int InfraredLedCtrl(powerboard_t *sys, transaction_done_t done = transaction_done_t());
+        int SetModulePowerOnOff(powerboard_t *sys, transaction_done_t done = transaction_done_t());
+        int GetModulePowerOnOff(powerboard_t *sys, transaction_done_t done = transaction_done_t());
         int send_serial_data(powerboard_t *sys);
         int handle_receive_data(powerboard_t *sys);
+        void CheckTransactionTimeout(void);
+        int PollTimeoutMs(void);
+        int LinkWatchInit(powerboard_t *sys);
+        int LinkWatchFd(void) const { return dev_watch.Fd(); }
+        void HandleLinkWatch(powerboard_t *sys);
+        void UpdateLink(powerboard_t *sys);
+        bool LinkRetry(void) const { return link_retry; }
+        int OpenLink(powerboard_t *sys);
+        int StartAdcStream(powerboard_t *sys);
+        void CheckAdcStream(powerboard_t *sys);
+        void PubAdcStats(void);
+        void LogSchedMetrics(void);
+        void PubDiagnostics(void);
+        void PostModuleCtrl(uint32_t module, bool on);
+        int CommandEventFd(void) const { return cmd_event_fd; }
+        void HandleCommands(powerboard_t *sys);
+        void CallIoCallbacks(void);
         void from_app_rcv_callback(const std_msgs::String::ConstPtr &msg);
         void from_navigation_rcv_callback(const std_msgs::String::ConstPtr &msg);
         void power_from_app_rcv_callback(std_msgs::UInt8MultiArray data);
@@ -319,7 +442,18 @@ class NoahPowerboard
         void PubChargeStatus(uint8_t status);
 
     private:
-        uint8_t CalCheckSum(uint8_t *data, uint8_t len);
+        int SendFrame(const uint8_t *frame, int len);
+        TransactionTable transactions;
+        CommandScheduler scheduler;
+
+        //counters of the serial link, written by the serial thread
+        LinkStats link_stats;
+        link_diag_last_t link_diag_last;
+        ros::Publisher diagnostics_pub;
+        ros::ServiceServer dump_link_stats_srv;
+        bool DumpLinkStatsCallback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res);
+        int SubmitFrame(const uint8_t *frame, transaction_done_t done, int cls = -1);
+        FrameParser frame_parser;
         int handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf);
         ros::NodeHandle n;
         ros::Publisher noah_powerboard_pub;
@@ -330,8 +464,67 @@ class NoahPowerboard
         ros::Subscriber power_sub_from_app;
         ros::Publisher pub_charge_status_to_move_base;
         json j;
+        bool pub_json;      //~pub_json, false leaves tx_noah_powerboard_node silent
         void pub_json_msg_to_app(const nlohmann::json j_msg);
 
+        //app json commands, keyed by pub_name
+        typedef void (NoahPowerboard::*app_cmd_handler_t)(const json &data);
+        void HandleSetModuleState(const json &data);
+
+        //commands from the ros callbacks, drained by the serial thread
+        MpscQueue<powerboard_cmd_t, POWERBOARD_CMD_QUEUE_DEPTH> cmd_queue;
+        int cmd_event_fd;
+        uint32_t module_on_pending;
+        uint32_t module_off_pending;
+        void QueueModuleCtrl(uint32_t module, bool on);
+        void FlushModuleCtrl(powerboard_t *sys);
+
+        //reconnect on hot plug, replaying what was last asked for
+        DevWatch dev_watch;
+        bool link_retry;            //open or version check failed with the device present
+        uint32_t module_want_on;
+        uint32_t module_want_off;
+        void CloseLink(powerboard_t *sys);
+        void ReplayState(powerboard_t *sys);
+
+        //written by the serial thread after every reply
+        Seqlock<powerboard_state_t> state;
+        void UpdateState(const powerboard_t *sys);
+
+        //callbacks that must run on the serial thread
+        IoCallbackQueue io_queue;
+        ros::NodeHandle io_n;
+
+        ros::Publisher module_state_pub;
+        ros::Publisher battery_info_pub;
+        ros::Publisher sys_status_pub;
+        ros::Publisher adc_data_pub;
+        ros::Publisher version_pub;
+        void PubModuleState(uint32_t set_module, int error_code);
+        void PubAdcData(const voltage_info_t *info);
+
+        //auto uploaded ADC samples, pushed by the serial loop and published in batches by adc_thread
+        uint8_t adc_send_rate;
+        int adc_batch_size;
+        uint64_t adc_last_ms;
+        std::atomic<uint32_t> adc_dropped;
+        std::atomic<bool> adc_running;
+        SpscQueue<adc_sample_t, ADC_QUEUE_DEPTH> adc_queue;
+        boost::mutex adc_lock;
+        boost::condition_variable adc_cond;     //a batch is queued or the stream stopped
+        boost::thread adc_thread;
+        void WakeAdcPublisher(void);
+        ros::Publisher adc_batch_pub;
+        void AdcPublishLoop(void);
+        void PubAdcBatch(noah_powerboard::AdcBatch *batch);
+
+        //windowed summaries of every ADC field, see adc_store.h
+        int adc_stats_period;
+        ros::Publisher adc_stats_pub;
+        ros::ServiceServer adc_stats_srv;
+        void GetAdcStats(int window, noah_powerboard::AdcStats *msg);
+        bool GetAdcStatsCallback(noah_powerboard::GetAdcStats::Request &req, noah_powerboard::GetAdcStats::Response &res);
+
 };
 int handle_receive_data(powerboard_t *sys);
 void set_speed(int fd, int speed);
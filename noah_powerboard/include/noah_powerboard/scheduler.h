@@ -0,0 +1,95 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "transaction.h"
+
+//priority classes, a lower value is sent first
+#define SCHED_CLASS_CRITICAL            0       //safety power off, never rate limited or held back
+#define SCHED_CLASS_CONTROL             1       //module switches
+#define SCHED_CLASS_QUERY               2       //periodic status queries
+#define SCHED_CLASS_COSMETIC            3       //leds, infrared leds
+#define SCHED_CLASS_NUM                 4
+
+#define SCHED_DEDUP_NONE                0
+#define SCHED_DEDUP_REPLACE             1       //a newer frame of the same type replaces the queued one
+#define SCHED_DEDUP_SAME                2       //an identical queued frame absorbs the new one
+#define SCHED_DEDUP_MODULE              3       //module control masks are merged, see Submit()
+
+#define SCHED_QUEUE_DEPTH               16      //per class
+#define SCHED_INFLIGHT_MAX              2       //unanswered frames before non critical ones wait
+
+#define TRANSACTION_ERR_SUPERSEDED      -4      //a newer command replaced it before it was sent
+
+typedef struct
+{
+    uint8_t                 frame_type;
+    uint8_t                 cls;            //default class, Submit() may raise it
+    uint8_t                 dedup;
+}sched_policy_t;
+
+typedef struct
+{
+    uint32_t                rate;           //frames per second, 0 is unlimited
+    uint32_t                burst;
+}sched_class_policy_t;
+
+typedef struct
+{
+    uint32_t                depth;
+    uint32_t                max_depth;
+    uint32_t                submitted;
+    uint32_t                sent;
+    uint32_t                superseded;
+    uint32_t                dropped;
+    uint64_t                wait_ms_sum;    //submit to send, over the sent frames
+    uint32_t                wait_ms_max;
+}sched_metrics_t;
+
+typedef struct
+{
+    uint8_t                 frame[TRANSACTION_FRAME_LEN];
+    uint64_t                submit_ms;
+    std::vector<transaction_done_t> done;   //every command merged into this frame
+}sched_cmd_t;
+
+/*
+ * Sits in front of the transaction table. Commands wait in one queue per
+ * priority class and Dispatch() hands them to the transaction table highest
+ * class first, as far as each class' token bucket and the number of frames
+ * in flight allow. Superseded commands are merged or dropped while queued.
+ * Serial loop only, like the transaction table.
+ */
+class CommandScheduler
+{
+    public:
+        CommandScheduler();
+        void Init(const sched_policy_t *policy, int policy_num, const sched_class_policy_t *class_policy, TransactionTable *transactions);
+        int Submit(const uint8_t *frame, transaction_done_t done, int cls = -1);
+        void Dispatch(void);
+        uint64_t NextDispatch(uint64_t now);
+        void SetLinkUp(bool up);
+        void Abort(int result);
+        void GetMetrics(int cls, sched_metrics_t *metrics, bool reset);
+
+    private:
+        const sched_policy_t *GetPolicy(uint8_t frame_type);
+        bool TakeToken(int cls, uint64_t now);
+        void Supersede(int cls, sched_cmd_t *cmd);
+        bool MergeModule(int cls, const uint8_t *frame, transaction_done_t &done);
+        void Send(int cls, uint64_t now);
+
+        sched_policy_t policy[TRANSACTION_TYPE_NUM];
+        sched_class_policy_t class_policy[SCHED_CLASS_NUM];
+        std::deque<sched_cmd_t> queue[SCHED_CLASS_NUM];
+        uint64_t tokens[SCHED_CLASS_NUM];        //in 1/1000 frame
+        uint64_t refill_ms[SCHED_CLASS_NUM];
+        sched_metrics_t metrics[SCHED_CLASS_NUM];
+        TransactionTable *transactions;
+        bool dispatching;
+        bool link_up;
+};
+
+#endif
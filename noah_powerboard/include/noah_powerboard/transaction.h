@@ -0,0 +1,70 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include <stdint.h>
+#include <functional>
+#include "mcu_com/link_stats.h"
+
+#define TRANSACTION_TYPE_NUM            0x10    //frame type is the table index
+#define TRANSACTION_QUEUE_DEPTH         4       //same type commands in flight
+#define TRANSACTION_FRAME_LEN           255
+
+#define TRANSACTION_ERR_TIMEOUT         -1
+#define TRANSACTION_ERR_DROPPED         -2
+#define TRANSACTION_ERR_LINK_DOWN       -3
+
+/*
+ * result >= 0 is the frame type of the matched reply, < 0 is TRANSACTION_ERR_*.
+ * It is called from the serial loop and must never sleep.
+ */
+typedef std::function<void(int result)> transaction_done_t;
+typedef std::function<int(const uint8_t *frame, int len)> transaction_send_t;
+
+typedef struct
+{
+    uint8_t                 frame_type;
+    uint32_t                timeout_ms;     //reply deadline of one try
+    uint8_t                 retry_times;    //resends after the first try timed out
+}transaction_policy_t;
+
+typedef struct
+{
+    uint8_t                 frame[TRANSACTION_FRAME_LEN];
+    uint8_t                 retries_left;
+    uint64_t                deadline_ms;
+    uint64_t                sent_us;        //last (re)send, for the round trip
+    transaction_done_t      done;
+}transaction_t;
+
+typedef struct
+{
+    transaction_policy_t    policy;
+    transaction_t           slot[TRANSACTION_QUEUE_DEPTH];
+    uint8_t                 head;
+    uint8_t                 count;
+}transaction_queue_t;
+
+class TransactionTable
+{
+    public:
+        TransactionTable();
+        void Init(const transaction_policy_t *policy, int policy_num, transaction_send_t send);
+        void SetStats(LinkStats *stats);
+        int Begin(const uint8_t *frame, transaction_done_t done);
+        void Complete(uint8_t frame_type, int result);
+        void CheckTimeout(void);
+        void Abort(int result);
+        int PendingCount(void);
+        uint64_t NextDeadline(void);
+
+    private:
+        transaction_queue_t *GetQueue(uint8_t frame_type);
+        void Pop(transaction_queue_t *queue, int result);
+        transaction_queue_t queue[TRANSACTION_TYPE_NUM];
+        transaction_send_t send;
+        LinkStats *stats;       //timeouts, retries and round trips
+};
+
+uint64_t transaction_now_ms(void);
+
+#endif
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <algorithm>
+#include "../include/noah_powerboard/adc_store.h"
+
+//length of every window in panes
+static const uint32_t window_panes[ADC_WINDOW_NUM] =
+{
+    1000 / ADC_STORE_PANE_MS,
+    10000 / ADC_STORE_PANE_MS,
+    60000 / ADC_STORE_PANE_MS,
+};
+
+AdcStore::AdcStore()
+{
+    this->signed_mask = 0;
+    this->Reset(0);
+    this->started = false;
+}
+
+void AdcStore::Init(uint32_t signed_mask)
+{
+    this->signed_mask = signed_mask;
+}
+
+uint32_t AdcStore::WindowMs(int window)
+{
+    return window_panes[window] * ADC_STORE_PANE_MS;
+}
+
+int32_t AdcStore::Value(int field, uint16_t raw) const
+{
+    if(this->signed_mask & (1u << field))
+    {
+        return (int16_t)raw;
+    }
+    return raw;
+}
+
+void AdcStore::Reset(uint64_t pane_seq)
+{
+    this->sample_head = 0;
+    this->sample_count = 0;
+    this->pane_seq = pane_seq;
+    memset(this->pane_count, 0, sizeof(this->pane_count));
+    memset(this->pane_sum, 0, sizeof(this->pane_sum));
+    memset(this->window_count, 0, sizeof(this->window_count));
+    memset(this->window_sum, 0, sizeof(this->window_sum));
+}
+
+//move the current pane up to now_ms, dropping the panes that leave each window
+void AdcStore::Advance(uint64_t now_ms)
+{
+    uint64_t seq = now_ms / ADC_STORE_PANE_MS;
+
+    if(!this->started)
+    {
+        this->started = true;
+        this->pane_seq = seq;
+        return;
+    }
+    if(seq <= this->pane_seq)
+    {
+        return;
+    }
+    if(seq - this->pane_seq >= ADC_STORE_PANE_NUM)
+    {
+        //nothing in the longest window is recent enough
+        this->Reset(seq);
+        return;
+    }
+
+    while(this->pane_seq < seq)
+    {
+        int slot = 0;
+
+        this->pane_seq++;
+        for(int w = 0; w < ADC_WINDOW_NUM; w++)
+        {
+            //pane_seq - window_panes[w] just left window w, it is still stored
+            int leaving = (this->pane_seq + ADC_STORE_PANE_NUM - window_panes[w]) % ADC_STORE_PANE_NUM;
+            if(0 == this->pane_count[leaving])
+            {
+                continue;
+            }
+            this->window_count[w] -= this->pane_count[leaving];
+            for(int f = 0; f < ADC_STORE_FIELD_NUM; f++)
+            {
+                this->window_sum[w][f] -= this->pane_sum[f][leaving];
+            }
+        }
+
+        //the longest window just released this slot
+        slot = this->pane_seq % ADC_STORE_PANE_NUM;
+        this->pane_count[slot] = 0;
+        for(int f = 0; f < ADC_STORE_FIELD_NUM; f++)
+        {
+            this->pane_sum[f][slot] = 0;
+        }
+    }
+}
+
+void AdcStore::Add(uint64_t now_ms, const uint16_t *raw)
+{
+    int slot = 0;
+
+    this->Advance(now_ms);
+    slot = this->pane_seq % ADC_STORE_PANE_NUM;
+
+    for(int f = 0; f < ADC_STORE_FIELD_NUM; f++)
+    {
+        int32_t value = this->Value(f, raw[f]);
+
+        if((0 == this->pane_count[slot]) || (value < this->pane_min[f][slot]))
+        {
+            this->pane_min[f][slot] = value;
+        }
+        if((0 == this->pane_count[slot]) || (value > this->pane_max[f][slot]))
+        {
+            this->pane_max[f][slot] = value;
+        }
+        this->pane_sum[f][slot] += value;
+        for(int w = 0; w < ADC_WINDOW_NUM; w++)
+        {
+            this->window_sum[w][f] += value;
+        }
+        this->sample[f][this->sample_head] = raw[f];
+    }
+    this->pane_count[slot]++;
+    for(int w = 0; w < ADC_WINDOW_NUM; w++)
+    {
+        this->window_count[w]++;
+    }
+
+    this->sample_ms[this->sample_head] = now_ms;
+    this->sample_head = (this->sample_head + 1) % ADC_STORE_DEPTH;
+    if(this->sample_count < ADC_STORE_DEPTH)
+    {
+        this->sample_count++;
+    }
+}
+
+int AdcStore::Query(int window, uint64_t now_ms, adc_field_stats_t *stats)
+{
+    uint64_t first_seq = 0;
+    int count = 0;
+    int raw_count = 0;
+
+    if((window < 0) || (window >= ADC_WINDOW_NUM))
+    {
+        return 0;
+    }
+    this->Advance(now_ms);
+    count = this->window_count[window];
+    if(0 == count)
+    {
+        memset(stats, 0, sizeof(adc_field_stats_t) * ADC_STORE_FIELD_NUM);
+        return 0;
+    }
+
+    //raw samples that fall into the panes of the window, newest first
+    if(this->pane_seq + 1 > window_panes[window])
+    {
+        first_seq = this->pane_seq + 1 - window_panes[window];
+    }
+    while(raw_count < this->sample_count)
+    {
+        int idx = (this->sample_head - 1 - raw_count + ADC_STORE_DEPTH) % ADC_STORE_DEPTH;
+        if(this->sample_ms[idx] / ADC_STORE_PANE_MS < first_seq)
+        {
+            break;
+        }
+        raw_count++;
+    }
+
+    for(int f = 0; f < ADC_STORE_FIELD_NUM; f++)
+    {
+        adc_field_stats_t *s = &stats[f];
+        bool first = true;
+
+        s->mean = (float)this->window_sum[window][f] / count;
+        for(uint32_t i = 0; i < window_panes[window]; i++)
+        {
+            int slot = (this->pane_seq + ADC_STORE_PANE_NUM - i) % ADC_STORE_PANE_NUM;
+            if(0 == this->pane_count[slot])
+            {
+                continue;
+            }
+            if(first || (this->pane_min[f][slot] < s->min))
+            {
+                s->min = this->pane_min[f][slot];
+            }
+            if(first || (this->pane_max[f][slot] > s->max))
+            {
+                s->max = this->pane_max[f][slot];
+            }
+            first = false;
+        }
+
+        for(int i = 0; i < raw_count; i++)
+        {
+            int idx = (this->sample_head - 1 - i + ADC_STORE_DEPTH) % ADC_STORE_DEPTH;
+            this->scratch[i] = this->Value(f, this->sample[f][idx]);
+        }
+        //each selection leaves the larger values behind its rank, so the next one searches only those
+        int r50 = (raw_count - 1) * 50 / 100;
+        int r90 = (raw_count - 1) * 90 / 100;
+        int r99 = (raw_count - 1) * 99 / 100;
+        std::nth_element(this->scratch, this->scratch + r50, this->scratch + raw_count);
+        s->p50 = this->scratch[r50];
+        std::nth_element(this->scratch + r50, this->scratch + r90, this->scratch + raw_count);
+        s->p90 = this->scratch[r90];
+        std::nth_element(this->scratch + r90, this->scratch + r99, this->scratch + raw_count);
+        s->p99 = this->scratch[r99];
+    }
+    return count;
+}
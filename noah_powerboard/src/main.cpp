@@ -12,8 +12,24 @@
 #include <stdio.h>
 #include <vector>
 #include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/timerfd.h>
 #include "../include/noah_powerboard/powerboard.h"
 
+#define POWERBOARD_QUERY_PERIOD_MS      1000    //battery info and system status are queried alternately
+
+enum
+{
+    POLL_FD_DEVICE = 0,
+    POLL_FD_TIMER,
+    POLL_FD_COMMAND,
+    POLL_FD_WATCH,
+    POLL_FD_NUM,
+};
+
 class NoahPowerboard;
 void sigintHandler(int sig)
 {
@@ -21,46 +37,153 @@ void sigintHandler(int sig)
     ros::shutdown();
 }
 
+static int create_query_timer(void)
+{
+    struct itimerspec spec;
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0)
+    {
+        ROS_ERROR("create query timer failed: %s", strerror(errno));
+        return -1;
+    }
+
+    spec.it_interval.tv_sec = POWERBOARD_QUERY_PERIOD_MS / 1000;
+    spec.it_interval.tv_nsec = (POWERBOARD_QUERY_PERIOD_MS % 1000) * 1000 * 1000;
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = 500 * 1000 * 1000;
+    if(timerfd_settime(fd, 0, &spec, NULL) < 0)
+    {
+        ROS_ERROR("set query timer failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void handle_query_timer(NoahPowerboard *powerboard, int timer_fd)
+{
+    static uint32_t query_cnt = 0;
+    uint64_t expirations = 0;
+
+    if(read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+
+    powerboard->PubAdcStats();
+    powerboard->LogSchedMetrics();
+    powerboard->PubDiagnostics();
+    if(COM_OPENING == sys_powerboard->com_state)
+    {
+        //only when the device exists but could not be opened, an absent one is left to the watch
+        if(powerboard->LinkRetry())
+        {
+            powerboard->OpenLink(sys_powerboard);
+        }
+        return;
+    }
+    if(COM_RUN_OK != sys_powerboard->com_state)
+    {
+        return;
+    }
+    powerboard->CheckAdcStream(sys_powerboard);
+
+    if(query_cnt++ % 2 == 0)
+    {
+#if 1   //Get battery info test function
+        sys_powerboard->bat_info.cmd = 2;
+        powerboard->GetBatteryInfo(sys_powerboard);
+#endif
+    }
+    else
+    {
+#if 1  //Get system status
+        powerboard->GetSysStatus(sys_powerboard);
+#endif
+    }
+}
+
 int main(int argc, char **argv)
 {
     ros::init(argc, argv, "noah_powerboard_node");
     NoahPowerboard  powerboard;
-    ros::Rate loop_rate(100);
-    uint32_t cnt = 0;
+    struct pollfd poll_fds[POLL_FD_NUM];
+    int timer_fd = -1;
+    int ret = 0;
     powerboard.PowerboardParamInit();
 
-    sys_powerboard->device = open_com_device(sys_powerboard->dev);
-    if(sys_powerboard->device < 0 )
-    {
-        ROS_ERROR("Open %s Failed !",sys_powerboard->dev);
-    }
-    else
+    //watch before the first open, so a device plugged in between is not missed
+    powerboard.LinkWatchInit(sys_powerboard);
+    if(powerboard.OpenLink(sys_powerboard) < 0)
     {
-        set_speed(sys_powerboard->device,115200);
-        set_parity(sys_powerboard->device,8,1,'N');  
-        ROS_INFO("Open %s OK.",sys_powerboard->dev);
+        ROS_ERROR("Open %s Failed, wait for it to appear",sys_powerboard->dev);
     }
     signal(SIGINT, sigintHandler);
 
-//    powerboard.handle_receive_data(sys_powerboard);
+    timer_fd = create_query_timer();
+
+    /*
+     * This thread is the serial I/O thread, it alone owns the device and
+     * sys_powerboard. Subscriber callbacks run on the spinner threads, post
+     * their commands to the powerboard command queue and wake this loop
+     * through its eventfd, so they return without waiting for the link.
+     * The callbacks served on this thread (the adc stats service) wake it
+     * through the same eventfd. The loop only times out for a reply
+     * deadline or a rate limited command, and sleeps while idle.
+     */
+    ros::AsyncSpinner spinner(POWERBOARD_SPINNER_THREADS);
+    spinner.start();
     while(ros::ok())
     {
-        cnt++;
-        powerboard.handle_receive_data(sys_powerboard);
-        if(cnt % 200 == 50)
+        poll_fds[POLL_FD_DEVICE].fd = sys_powerboard->device;    //negative fd is ignored by poll
+        poll_fds[POLL_FD_DEVICE].events = POLLIN;
+        poll_fds[POLL_FD_DEVICE].revents = 0;
+        poll_fds[POLL_FD_TIMER].fd = timer_fd;
+        poll_fds[POLL_FD_TIMER].events = POLLIN;
+        poll_fds[POLL_FD_TIMER].revents = 0;
+        poll_fds[POLL_FD_COMMAND].fd = powerboard.CommandEventFd();
+        poll_fds[POLL_FD_COMMAND].events = POLLIN;
+        poll_fds[POLL_FD_COMMAND].revents = 0;
+        poll_fds[POLL_FD_WATCH].fd = powerboard.LinkWatchFd();
+        poll_fds[POLL_FD_WATCH].events = POLLIN;
+        poll_fds[POLL_FD_WATCH].revents = 0;
+
+        ret = poll(poll_fds, POLL_FD_NUM, powerboard.PollTimeoutMs());
+        if(ret < 0 && errno != EINTR)
         {
-            
-#if 1   //Get battery info test function
-            sys_powerboard->bat_info.cmd = 2; 
-            powerboard.GetBatteryInfo(sys_powerboard);
-#endif
+            ROS_ERROR("poll failed: %s", strerror(errno));
         }
-        if(cnt % 200 == 150)
+
+        if(poll_fds[POLL_FD_DEVICE].revents & POLLIN)
         {
-#if 1  //Get system status
-            powerboard.GetSysStatus(sys_powerboard);
-#endif
+            powerboard.handle_receive_data(sys_powerboard);
         }
+        else if(poll_fds[POLL_FD_DEVICE].revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+            ROS_ERROR("%s hang up", sys_powerboard->dev);
+            sys_powerboard->com_state = COM_CLOSING;
+        }
+
+        if(poll_fds[POLL_FD_WATCH].revents & POLLIN)
+        {
+            powerboard.HandleLinkWatch(sys_powerboard);
+        }
+
+        if(poll_fds[POLL_FD_TIMER].revents & POLLIN)
+        {
+            handle_query_timer(&powerboard, timer_fd);
+        }
+
+        //module switches the callbacks posted, merged into at most two frames
+        if(poll_fds[POLL_FD_COMMAND].revents & POLLIN)
+        {
+            powerboard.HandleCommands(sys_powerboard);
+        }
+
+        //resend or fail the commands whose reply is overdue
+        powerboard.CheckTransactionTimeout();
+        //close after a failed read/write or version check
+        powerboard.UpdateLink(sys_powerboard);
         //powerboard.handle_receive_data(sys_powerboard);
 #if 0   // Set LED effect test function
         sys_powerboard->led_set.color.r = 0x12;
@@ -127,13 +250,18 @@ int main(int argc, char **argv)
 #if 0
         powerboard.GetModulePowerOnOff(sys_powerboard);
 #endif
-        ros::spinOnce();
-        loop_rate.sleep();
+        powerboard.CallIoCallbacks();
+    }
+    spinner.stop();
+    LinkCapture::Instance().Stop();
+    if(timer_fd >= 0)
+    {
+        close(timer_fd);
     }
     //close(fd);
-    if(close(sys_powerboard->device) > 0)
+    if(sys_powerboard->device >= 0)
     {
-       // ROS_INFO("Close 
+        close(sys_powerboard->device);
     }
 
 }
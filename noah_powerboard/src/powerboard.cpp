@@ -18,185 +18,286 @@
 #include "cstdlib"
 #include "string"
 #include "sstream"
+#include <unordered_map>
 #include "../include/noah_powerboard/powerboard.h"
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
-#define TEST_WAIT_TIME     90*1000
-
 #define PowerboardInfo     ROS_INFO
 
 static int led_over_time_flag = 0;
-static int last_unread_bytes = 0;
-static unsigned char recv_buf_last[BUF_LEN] = {0};
+
+//~adc_rate_hz to the send rate code of the GET_CURRENT frame
+static const struct
+{
+    int         hz;
+    uint8_t     send_rate;
+}adc_rate_table[] = 
+{
+    {1,     SEND_RATE_1HZ},
+    {2,     SEND_RATE_2HZ},
+    {5,     SEND_RATE_5HZ},
+    {10,    SEND_RATE_10HZ},
+    {50,    SEND_RATE_50HZ},
+    {100,   SEND_RATE_100HZ},
+};
 
 powerboard_t    sys_powerboard_ram; 
 powerboard_t    *sys_powerboard = &sys_powerboard_ram;
 
+//history of every ADC sample, too large for the stack where NoahPowerboard lives
+static AdcStore adc_store;
+
+//voltage_data_t field names as in AdcData.msg
+static const char *adc_field_name[ADC_STORE_FIELD_NUM] = 
+{
+    "reserve1_5v_currents",     "nv_24v_currents",      "nv_12v_currents",      "extend_48v_currents",
+    "extend_12v_currents",      "motor_currents",       "slam_currents",        "pa_2_1_currents",
+    "pad_currents",             "printer_currents",     "x86_currents",         "ir_led_currents",
+    "leds_5v_currents",         "recharge_currents",    "extend_24v_currents",  "charge_currents",
+    "batin_currents",           "vbus_currents",        "bat_motor_currents",   "temp_24v",
+    "temp_12v",                 "temp_5v",              "air_temp",             "all_24v_currents",
+    "all_12v_currents",         "all_5v_currents",      "voltage_24v",          "voltage_12v",
+    "voltage_5v",               "bat_voltage",          "sensor_board_currents","router_5v_currents",
+};
+//dev_name of set_module_state from the app
+static const std::unordered_map<std::string, uint32_t> app_module_table = 
+{
+    {"_24v_printer",        POWER_24V_PRINTER},
+    {"_24v_dcdc",           POWER_24V_EN},
+    {"_5v_dcdc",            POWER_5V_EN},
+    {"_12v_dcdc",           POWER_12V_EN},
+    {"door_ctrl_state",     POWER_VSYS_24V_NV},
+};
+
+static_assert(sizeof(voltage_data_t) == ADC_STORE_FIELD_NUM * sizeof(uint16_t), "adc_store expects 32 16bit fields");
+
+/*
+ * Reply deadline and resend policy of every command, the transaction table
+ * resends the frame itself so no command ever waits on the serial port.
+ */
+static const transaction_policy_t transaction_policy[] = 
+{
+    //frame type                        timeout(ms)     retry times
+    {FRAME_TYPE_LEDS_CONTROL,           500,            COM_ERR_REPEAT_TIME},
+    {FRAME_TYPE_SYS_STATUS,             200,            0},
+    {FRAME_TYPE_BAT_STATUS,             200,            0},
+    {FRAME_TYPE_GET_MODULE_STATE,       200,            0},
+    {FRAME_TYPE_MODULE_CONTROL,         150,            COM_ERR_REPEAT_TIME},
+    {FRAME_TYPE_IRLED_CONTROL,          200,            0},
+    {FRAME_TYPE_GET_CURRENT,            200,            0},
+    {FRAME_TYPE_GET_VERSION,            200,            0},
+};
+
+/*
+ * Priority class and deduplication of every command. Critical frames go
+ * out at once, the others are rate limited per class and wait while the
+ * board has not answered the frames in flight.
+ */
+static const sched_policy_t sched_policy[] = 
+{
+    //frame type                        class                   dedup
+    {FRAME_TYPE_LEDS_CONTROL,           SCHED_CLASS_COSMETIC,   SCHED_DEDUP_REPLACE},
+    {FRAME_TYPE_IRLED_CONTROL,          SCHED_CLASS_COSMETIC,   SCHED_DEDUP_REPLACE},
+    {FRAME_TYPE_SYS_STATUS,             SCHED_CLASS_QUERY,      SCHED_DEDUP_SAME},
+    {FRAME_TYPE_BAT_STATUS,             SCHED_CLASS_QUERY,      SCHED_DEDUP_SAME},
+    {FRAME_TYPE_GET_MODULE_STATE,       SCHED_CLASS_QUERY,      SCHED_DEDUP_SAME},
+    {FRAME_TYPE_GET_CURRENT,            SCHED_CLASS_QUERY,      SCHED_DEDUP_REPLACE},
+    {FRAME_TYPE_GET_VERSION,            SCHED_CLASS_QUERY,      SCHED_DEDUP_SAME},
+    {FRAME_TYPE_MODULE_CONTROL,         SCHED_CLASS_CONTROL,    SCHED_DEDUP_MODULE},
+};
+
+static const sched_class_policy_t sched_class_policy[SCHED_CLASS_NUM] = 
+{
+    //rate(frames/s)    burst
+    {0,                 0},     //SCHED_CLASS_CRITICAL
+    {100,               10},    //SCHED_CLASS_CONTROL
+    {20,                4},     //SCHED_CLASS_QUERY
+    {10,                2},     //SCHED_CLASS_COSMETIC
+};
+
+static const char *sched_class_name[SCHED_CLASS_NUM] = {"critical", "control", "query", "cosmetic"};
+
 //extern NoahPowerboard  powerboard;
 int NoahPowerboard::PowerboardParamInit(void)
 {
+    int adc_rate_hz = 0;
     //char dev_path[] = "/dev/ttyUSB0";
-    char dev_path[] = "/dev/ros/powerboard";
-    memcpy(sys_powerboard->dev,dev_path, sizeof(dev_path));
+    std::string dev_path;
+    std::string capture_file;
+    ros::param::param<std::string>("~dev", dev_path, "/dev/ros/powerboard");
+    strncpy(sys_powerboard->dev, dev_path.c_str(), DEV_STRING_LEN - 1);
+    sys_powerboard->dev[DEV_STRING_LEN - 1] = 0;
     sys_powerboard->led_set.effect = LIGHTS_MODE_DEFAULT;
+    ros::param::param<bool>("~pub_json", this->pub_json, true);
+    //every byte to and from the board, for capture_replay
+    ros::param::param<std::string>("~capture_file", capture_file, "");
+    if(!capture_file.empty())
+    {
+        if(LinkCapture::Instance().Start(capture_file.c_str()) < 0)
+        {
+            ROS_ERROR("capture to %s failed: %s", capture_file.c_str(), strerror(errno));
+        }
+        else
+        {
+            ROS_INFO("capturing serial traffic to %s", capture_file.c_str());
+        }
+    }
+
+    ros::param::param<int>("~adc_rate_hz", adc_rate_hz, 0);
+    ros::param::param<int>("~adc_batch_size", this->adc_batch_size, ADC_BATCH_SIZE_DEFAULT);
+    this->adc_send_rate = SEND_RATE_SINGLE;
+    for(size_t i = 0; i < sizeof(adc_rate_table) / sizeof(adc_rate_table[0]); i++)
+    {
+        if(adc_rate_table[i].hz == adc_rate_hz)
+        {
+            this->adc_send_rate = adc_rate_table[i].send_rate;
+        }
+    }
+    if((0 != adc_rate_hz) && (SEND_RATE_SINGLE == this->adc_send_rate))
+    {
+        ROS_ERROR("adc_rate_hz %d not supported, use 1/2/5/10/50/100, adc streaming off", adc_rate_hz);
+    }
+    if(this->adc_batch_size < 1)
+    {
+        this->adc_batch_size = 1;
+    }
+    ros::param::param<int>("~adc_stats_period", this->adc_stats_period, ADC_STATS_PERIOD_DEFAULT);
+    adc_store.Init(1u << (ADC_STORE_FIELD_NUM - 1));    //_5V_router_currents is int16_t
+    this->transactions.Init(transaction_policy, sizeof(transaction_policy) / sizeof(transaction_policy[0]),
+            std::bind(&NoahPowerboard::SendFrame, this, std::placeholders::_1, std::placeholders::_2));
+    this->scheduler.Init(sched_policy, sizeof(sched_policy) / sizeof(sched_policy[0]), sched_class_policy, &this->transactions);
     return 0;
 }
 
 
-int NoahPowerboard::send_serial_data(powerboard_t *sys)
+int NoahPowerboard::SendFrame(const uint8_t *frame, int len)
 {
-    boost::mutex io_mutex;
-    boost::mutex::scoped_lock lock(io_mutex);
-    int len = 0;
+    int send_len = 0;
 
-    int send_buf_len = 0;
-
-    if((sys->device < 0) || (NULL == sys->send_data_buf))
+    if((sys_powerboard->device < 0) || (NULL == frame))
     {
         ROS_INFO("dev or send_buf NULL!");
         return -1;
     }
 
-    send_buf_len = sys->send_data_buf[1];
-
-    if(send_buf_len <= 0 )
+    if(len <= 0 )
     {
-        PowerboardInfo("noah_power send_buf len: %d small 0!",send_buf_len);
+        PowerboardInfo("noah_power send_buf len: %d small 0!",len);
         return -1;
     }
-    for(int i =0;i<send_buf_len;i++)
+    for(int i =0;i<len;i++)
     {
-        //PowerboardInfo("noah_power send_buf :%02x",sys->send_data_buf[i]);
+        //PowerboardInfo("noah_power send_buf :%02x",frame[i]);
     }
-    len = write(sys->device,sys->send_data_buf,send_buf_len);
-    if (len == send_buf_len)
+    send_len = write(sys_powerboard->device,frame,len);
+    if (send_len == len)
     {
+        this->link_stats.AddTx(len);
+        LinkCapture::Instance().Record(CAPTURE_LINK_POWERBOARD, CAPTURE_DIR_TX, frame, len);
         //PowerboardInfo("noah_powerboard send ok");
         return 0;
     }     
     else   
     {               
-        tcflush(sys->device,TCOFLUSH);
-        if(-1 == len)
+        tcflush(sys_powerboard->device,TCOFLUSH);
+        if(-1 == send_len)
         {
-            //sys->com_state = COM_CLOSING;
+            sys_powerboard->com_state = COM_CLOSING;
         }
         return -1;
     }
 }
 
-uint8_t NoahPowerboard::CalCheckSum(uint8_t *data, uint8_t len)
+int NoahPowerboard::send_serial_data(powerboard_t *sys)
+{
+    return this->SendFrame(sys->send_data_buf, sys->send_data_buf[1]);
+}
+
+/*
+ * Every command goes through the scheduler, except the version query of the
+ * link check: the scheduler holds everything until the link is up.
+ */
+int NoahPowerboard::SubmitFrame(const uint8_t *frame, transaction_done_t done, int cls)
 {
-    uint8_t sum = 0;
-    for(uint8_t i = 0; i < len; i++)
+    if(COM_CHECK_VERSION == sys_powerboard->com_state)
     {
-        sum += data[i];
+        return this->transactions.Begin(frame, done);
     }
-    return sum;  
+    return this->scheduler.Submit(frame, done, cls);
 }
 
-int NoahPowerboard::SetLedEffect(powerboard_t *powerboard)     // done
+void NoahPowerboard::CheckTransactionTimeout(void)
 {
-begin:
-    static uint8_t err_cnt = 0;
+    this->transactions.CheckTimeout();
+    //tokens refilled and replies freed the link meanwhile
+    this->scheduler.Dispatch();
+}
 
-    int error = -1;
-    powerboard->send_data_buf[0] = PROTOCOL_HEAD;
-    powerboard->send_data_buf[1] = 0x0a;
-    powerboard->send_data_buf[2] = FRAME_TYPE_LEDS_CONTROL;
-    powerboard->send_data_buf[3] = powerboard->led_set.effect;
-    memcpy(&powerboard->send_data_buf[4], (uint8_t *)&(powerboard->led_set.color), sizeof(color_t));
-    powerboard->send_data_buf[7] = powerboard->led_set.period;
-    powerboard->send_data_buf[8] = this->CalCheckSum(powerboard->send_data_buf, 8);
-    powerboard->send_data_buf[9] = PROTOCOL_TAIL;
-    this->send_serial_data(powerboard);
-    usleep(TEST_WAIT_TIME);
-    if((error = this->handle_receive_data(powerboard)) < 0)
-    {
-        
-        if(err_cnt++ < COM_ERR_REPEAT_TIME)
-        {
-            usleep(500*1000); 
-            ROS_ERROR("Set leds effect start to resend");
-            goto begin; 
-        }
-        ROS_ERROR("Set Leds Effecct : com error !");
+/*
+ * How long the serial loop may sleep: until the first reply deadline or
+ * until a held command gets its token. Replies, callbacks and the query
+ * timer wake the loop through their fds, so -1 when nothing is waiting.
+ */
+int NoahPowerboard::PollTimeoutMs(void)
+{
+    uint64_t now = transaction_now_ms();
+    uint64_t deadline = this->transactions.NextDeadline();
+    uint64_t dispatch = this->scheduler.NextDispatch(now);
+
+    if((0 == deadline) || ((0 != dispatch) && (dispatch < deadline)))
+    {
+        deadline = dispatch;
     }
-    else
+    if(0 == deadline)
     {
-        err_cnt = 0;
+        return -1;
     }
-    return error;
+    return (deadline > now) ? (int)(deadline - now) : 0;
+}
+
+int NoahPowerboard::SetLedEffect(powerboard_t *powerboard, transaction_done_t done)     // done
+{
+    LedsControlFrame::Encode(powerboard->send_data_buf, powerboard->led_set.effect, powerboard->led_set.color.r,
+            powerboard->led_set.color.g, powerboard->led_set.color.b, powerboard->led_set.period);
+    return this->SubmitFrame(powerboard->send_data_buf, [done](int result)
+    {
+        if((result < 0) && (TRANSACTION_ERR_SUPERSEDED != result))
+        {
+            ROS_ERROR("Set Leds Effecct : com error !");
+        }
+        if(done)
+        {
+            done(result);
+        }
+    });
 }
 int NoahPowerboard::GetBatteryInfo(powerboard_t *sys)      // done
 {
-    int error = 0;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 6;
-    sys->send_data_buf[2] = FRAME_TYPE_BAT_STATUS;
-    sys->send_data_buf[3] = sys->bat_info.cmd;
-    sys->send_data_buf[4] = this->CalCheckSum(sys->send_data_buf, 4);
-    sys->send_data_buf[5] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-#if 0
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-#endif
-    return error;
+    BatStatusFrame::Encode(sys->send_data_buf, sys->bat_info.cmd);
+    return this->SubmitFrame(sys->send_data_buf, transaction_done_t());
 }
-int NoahPowerboard::SetModulePowerOnOff(powerboard_t *sys)
+int NoahPowerboard::SetModulePowerOnOff(powerboard_t *sys, transaction_done_t done)
 {
-begin:
-    static uint8_t err_cnt = 0;
-    int error = -1; 
-    boost::mutex io_mutex;
-    boost::mutex::scoped_lock lock(io_mutex);
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 10;
-    sys->send_data_buf[2] = FRAME_TYPE_MODULE_CONTROL;
-    memcpy(&sys->send_data_buf[3],(uint8_t *)&sys->module_status_set.module, 4 );
-    sys->send_data_buf[7] = sys->module_status_set.on_off;
-    sys->send_data_buf[8] = this->CalCheckSum(sys->send_data_buf, 8);
-    sys->send_data_buf[9] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
-    {
-        if(err_cnt++ < COM_ERR_REPEAT_TIME)
+    uint32_t module = sys->module_status_set.module;
+
+    ModuleControlFrame::Encode(sys->send_data_buf, module, sys->module_status_set.on_off);
+    //switching the main 24V rail or the door supply off must not wait behind anything
+    int cls = ((MODULE_CTRL_OFF == sys->module_status_set.on_off) && (module & SAFETY_MODULES)) ? SCHED_CLASS_CRITICAL : -1;
+    return this->SubmitFrame(sys->send_data_buf, [this, sys, module, done](int error)
+    {
+        if(error < 0)
         {
-            usleep(50*1000); 
-            goto begin; 
+            ROS_ERROR("com error");
         }
-        ROS_ERROR("com error");
-        if(sys->module_status_set.module & POWER_VSYS_24V_NV)
+        else
         {
-
-            this->j.clear();
-            this->j = 
-            {
-                {"sub_name","set_module_state"},
-                {
-                    "data",
-                    {
-                        //{"_xx_xxx_state",!(bool)(sys->module_status.module & POWER_5V_EN)},
-                        {"door_ctrl_state",(bool)(sys->module_status.module & POWER_VSYS_24V_NV)},
-                        {"error_code", error},
-                    } 
-                }
-            };
-            this->pub_json_msg_to_app(this->j);
+            ROS_INFO("module %d",module);
         }
-    }
-    else 
-    {
-        err_cnt = 0;
-        
-        if(sys->module_status_set.module & POWER_VSYS_24V_NV)
-        {
 
-            ROS_INFO("module %d",sys->module_status_set.module);
+        this->PubModuleState(module, error);
 
+        if(this->pub_json && (module & POWER_VSYS_24V_NV))
+        {
             this->j.clear();
             this->j = 
             {
@@ -212,9 +313,8 @@ begin:
             };
             this->pub_json_msg_to_app(this->j);
         }
-        if(sys->module_status_set.module & POWER_24V_PRINTER)
+        if(this->pub_json && (error >= 0) && (module & POWER_24V_PRINTER))
         {
-            
             this->j.clear();
             this->j = 
             {
@@ -230,242 +330,488 @@ begin:
             };
             this->pub_json_msg_to_app(this->j);
         }
-        
-        if(sys->module_status_set.module & POWER_24V_EXTEND)
+        if(done)
         {
-            
+            done(error);
         }
-    }
-    return error;
+    }, cls);
+}
+
+int NoahPowerboard::GetModulePowerOnOff(powerboard_t *sys, transaction_done_t done)
+{
+    GetModuleStateFrame::Encode(sys->send_data_buf, 1);
+    return this->SubmitFrame(sys->send_data_buf, done);
+}
+int NoahPowerboard::GetAdcData(powerboard_t *sys, transaction_done_t done)      // done
+{
+    GetCurrentFrame::Encode(sys->send_data_buf, 0x01, 0x01, sys->current_cmd_frame.cmd);
+    return this->SubmitFrame(sys->send_data_buf, done);
+}
+
+int NoahPowerboard::GetVersion(powerboard_t *sys, transaction_done_t done)      // done
+{
+    GetVersionFrame::Encode(sys->send_data_buf, sys->get_version_type);
+    return this->SubmitFrame(sys->send_data_buf, done);
+}
+
+int NoahPowerboard::GetSysStatus(powerboard_t *sys)     // done
+{
+    SysStatusFrame::Encode(sys->send_data_buf, 0x00);
+    return this->SubmitFrame(sys->send_data_buf, transaction_done_t());
+}
+
+int NoahPowerboard::InfraredLedCtrl(powerboard_t *sys, transaction_done_t done)     // done
+{
+    IrLedControlFrame::Encode(sys->send_data_buf, sys->ir_cmd.cmd,
+            (IR_CMD_WRITE == sys->ir_cmd.cmd) ? sys->ir_cmd.set_ir_percent : 0);
+    return this->SubmitFrame(sys->send_data_buf, done);
 }
 
-int NoahPowerboard::GetModulePowerOnOff(powerboard_t *sys)
+
+int NoahPowerboard::handle_receive_data(powerboard_t *sys)
 {
     int error = -1;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 6;
-    sys->send_data_buf[2] = FRAME_TYPE_GET_MODULE_STATE;
-    sys->send_data_buf[3] = 1;
-    sys->send_data_buf[4] = CalCheckSum(sys->send_data_buf, 4);
-    sys->send_data_buf[5] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
-    {
-        
+
+    if(this->frame_parser.Fill(sys->device) > 0)
+    {
+        //frames are handled in place, the parser already checked sum and tail
+        this->frame_parser.Parse([&](uint8_t *frame, int len)
+        {
+            error = this->handle_rev_frame(sys, frame);
+        });
+        //the replies made room for the frames the scheduler held back
+        this->scheduler.Dispatch();
+    }
+    else 
+    {
+        //readable but nothing to read: the tty hung up or the usb device is gone
+        sys->com_state = COM_CLOSING;
     }
     return error;
 }
-int NoahPowerboard::GetAdcData(powerboard_t *sys)      // done
+
+/*
+ * Link to the board, the same states as the starline serial threads:
+ *
+ *   COM_OPENING         closed, waits for dev_watch to report the device
+ *   COM_CHECK_VERSION   open and configured, waits for the version reply
+ *   COM_RUN_OK          normal traffic
+ *   COM_CLOSING         read/write failed, closed by the next UpdateLink()
+ *
+ * Nothing polls the device path while it is absent, dev_watch wakes the
+ * serial loop once udev creates the link again.
+ */
+int NoahPowerboard::LinkWatchInit(powerboard_t *sys)
 {
-    int error = -1;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 8;
-    sys->send_data_buf[2] = FRAME_TYPE_GET_CURRENT;
-    sys->send_data_buf[3] = 0x01;
-    sys->send_data_buf[4] = 0x01;
-    sys->send_data_buf[5] = sys->current_cmd_frame.cmd;
-    sys->send_data_buf[6] = this->CalCheckSum(sys->send_data_buf, 5);
-    sys->send_data_buf[7] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
-    {
-        
+    sys->device = -1;
+    sys->com_state = COM_OPENING;
+    if(this->dev_watch.Init(sys->dev) < 0)
+    {
+        ROS_ERROR("watch %s failed: %s, reconnect only on the query timer", sys->dev, strerror(errno));
+        this->link_retry = true;
+        return -1;
     }
-    return error;
+    return this->dev_watch.Fd();
 }
 
-int NoahPowerboard::GetVersion(powerboard_t *sys)      // done
+int NoahPowerboard::OpenLink(powerboard_t *sys)
 {
-    int error = -1;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 6;
-    sys->send_data_buf[2] = FRAME_TYPE_GET_VERSION;
-    sys->send_data_buf[3] = sys->get_version_type;
-    sys->send_data_buf[4] = this->CalCheckSum(sys->send_data_buf, 4);
-    sys->send_data_buf[5] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
-    {
-        
+    if(COM_OPENING != sys->com_state)
+    {
+        return 0;
     }
-    return error;
+    sys->device = open_com_device(sys->dev);
+    if(sys->device < 0)
+    {
+        //an absent device is reported by dev_watch, anything else is retried by the query timer
+        this->link_retry = (ENOENT != errno) || (this->dev_watch.Fd() < 0);
+        return -1;
+    }
+    set_speed(sys->device,115200);
+    set_parity(sys->device,8,1,'N');
+    this->frame_parser.Reset();
+    this->link_retry = false;
+    sys->com_state = COM_CHECK_VERSION;
+    ROS_INFO("Open %s OK.",sys->dev);
+
+    sys->get_version_type = VERSION_TYPE_FW;
+    return this->GetVersion(sys, [this, sys](int result)
+    {
+        if(COM_CHECK_VERSION != sys->com_state)
+        {
+            return;
+        }
+        if(result < 0)
+        {
+            ROS_ERROR("%s: no version reply, reopen", sys->dev);
+            sys->com_state = COM_CLOSING;
+            return;
+        }
+        ROS_INFO("%s: link up, sw version %.*s", sys->dev, SW_VERSION_SIZE, sys->sw_version);
+        sys->com_state = COM_RUN_OK;
+        this->ReplayState(sys);
+        this->scheduler.SetLinkUp(true);
+    });
 }
 
-int NoahPowerboard::GetSysStatus(powerboard_t *sys)     // done
+void NoahPowerboard::CloseLink(powerboard_t *sys)
 {
-    int error = 0;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 6;
-    sys->send_data_buf[2] = FRAME_TYPE_SYS_STATUS;
-    sys->send_data_buf[3] = 0x00;
-    sys->send_data_buf[4] = this->CalCheckSum(sys->send_data_buf, 4);
-    sys->send_data_buf[5] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-#if 0
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
+    if(sys->device >= 0)
     {
-        
+        close(sys->device);
+        sys->device = -1;
     }
-    else
+    //state first, so the aborted version check does not act on it
+    sys->com_state = COM_OPENING;
+    this->frame_parser.Reset();
+    this->scheduler.SetLinkUp(false);
+    this->scheduler.Abort(TRANSACTION_ERR_LINK_DOWN);
+    this->transactions.Abort(TRANSACTION_ERR_LINK_DOWN);
+}
+
+void NoahPowerboard::HandleLinkWatch(powerboard_t *sys)
+{
+    int flags = this->dev_watch.Handle();
+
+    if((flags & DEV_WATCH_REMOVED) && (sys->device >= 0))
     {
+        ROS_WARN("%s removed", sys->dev);
+        this->CloseLink(sys);
+    }
+    if((flags & DEV_WATCH_ADDED) && (COM_OPENING == sys->com_state))
+    {
+        ROS_INFO("%s appeared", sys->dev);
+        this->OpenLink(sys);
     }
-#endif
-    return error;
 }
 
-int NoahPowerboard::InfraredLedCtrl(powerboard_t *sys)     // done
+void NoahPowerboard::UpdateLink(powerboard_t *sys)
 {
-    int error = -1;
-    sys->send_data_buf[0] = PROTOCOL_HEAD;
-    sys->send_data_buf[1] = 7;
-    sys->send_data_buf[2] = FRAME_TYPE_IRLED_CONTROL;
-    sys->send_data_buf[3] = sys->ir_cmd.cmd;
-    if(sys->send_data_buf[3] == IR_CMD_READ)
+    if(COM_CLOSING == sys->com_state)
     {
-        sys->send_data_buf[4] = 0;
+        ROS_WARN("close %s", sys->dev);
+        this->CloseLink(sys);
+        //the device may still be there, e.g. the board reset or missed the version query
+        this->link_retry = true;
     }
-    else if(sys->send_data_buf[3] == IR_CMD_WRITE)
+}
+
+//the board comes back with everything at its defaults
+void NoahPowerboard::ReplayState(powerboard_t *sys)
+{
+    this->QueueModuleCtrl(this->module_want_on, true);
+    this->QueueModuleCtrl(this->module_want_off, false);
+    this->FlushModuleCtrl(sys);
+    if(LIGHTS_MODE_DEFAULT != sys->led_set.effect)
     {
-        sys->send_data_buf[4] = sys->ir_cmd.set_ir_percent;
+        this->SetLedEffect(sys);
     }
-    sys->send_data_buf[5] = this->CalCheckSum(sys->send_data_buf, 5);
-    sys->send_data_buf[6] = PROTOCOL_TAIL;
-    this->send_serial_data(sys);
-    usleep(TEST_WAIT_TIME);
-    error = this->handle_receive_data(sys);
-    if(error < 0)
-    {
-        
+    this->GetModulePowerOnOff(sys);
+    this->StartAdcStream(sys);
+}
+
+
+void NoahPowerboard::pub_json_msg_to_app( const nlohmann::json j_msg)
+{
+    std_msgs::String pub_json_msg;
+    std::stringstream ss;
+
+    if(!this->pub_json)
+    {
+        return;
     }
-    return error;
+    ss.clear();
+    ss << j_msg;
+    pub_json_msg.data = ss.str();
+    this->noah_powerboard_pub.publish(pub_json_msg);
 }
 
+void NoahPowerboard::PubModuleState(uint32_t set_module, int error_code)
+{
+    noah_powerboard::ModuleState msg;
 
-int NoahPowerboard::handle_receive_data(powerboard_t *sys)
+    msg.header.stamp = ros::Time::now();
+    msg.module_status = sys_powerboard->module_status.module;
+    msg.set_module = set_module;
+    msg.error_code = error_code < 0 ? error_code : 0;
+    this->module_state_pub.publish(msg);
+}
+
+static void fill_adc_data(const voltage_info_t *info, const ros::Time &stamp, noah_powerboard::AdcData *msg)
 {
-    int nread = 0;
-    int i = 0;
-    int j = 0;
-    int data_Len = 0;
-    int frame_len = 0;
-    unsigned char recv_buf[BUF_LEN] = {0};
-    unsigned char recv_buf_complete[BUF_LEN] = {0};
-    unsigned char recv_buf_temp[BUF_LEN] = {0};
+    const voltage_data_t *data = &info->voltage_data;
+
+    msg->header.stamp = stamp;
+    msg->reserve1_5v_currents = data->_5V_reserve1_currents;
+    msg->nv_24v_currents = data->_24V_nv_currents;
+    msg->nv_12v_currents = data->_12V_nv_currents;
+    msg->extend_48v_currents = data->_48V_extend_currents;
+    msg->extend_12v_currents = data->_12V_extend_currents;
+    msg->motor_currents = data->motor_currents;
+    msg->slam_currents = data->slam_currents;
+    msg->pa_2_1_currents = data->_2_1_pa_currents;
+    msg->pad_currents = data->pad_currents;
+    msg->printer_currents = data->printer_currents;
+    msg->x86_currents = data->x86_currents;
+    msg->ir_led_currents = data->ir_led_currents;
+    msg->leds_5v_currents = data->_5V_leds_currents;
+    msg->recharge_currents = data->recharge_currents;
+    msg->extend_24v_currents = data->_24V_extend_currents;
+    msg->charge_currents = data->charge_currents;
+    msg->batin_currents = data->batin_currents;
+    msg->vbus_currents = data->vbus_currents;
+    msg->bat_motor_currents = data->bat_motor_currents;
+    msg->temp_24v = data->_24V_temp;
+    msg->temp_12v = data->_12V_temp;
+    msg->temp_5v = data->_5V_temp;
+    msg->air_temp = data->air_temp;
+    msg->all_24v_currents = data->_24V_all_currents;
+    msg->all_12v_currents = data->_12V_all_currents;
+    msg->all_5v_currents = data->_5V_all_currents;
+    msg->voltage_24v = data->_24V_voltage;
+    msg->voltage_12v = data->_12V_voltage;
+    msg->voltage_5v = data->_5V_voltage;
+    msg->bat_voltage = data->bat_voltage;
+    msg->sensor_board_currents = data->sensor_board_currents;
+    msg->router_5v_currents = data->_5V_router_currents;
+    msg->send_rate = info->send_rate;
+}
 
-    struct stat file_info;
-    int error = -1;
-    if(0 != last_unread_bytes)
+void NoahPowerboard::PubAdcData(const voltage_info_t *info)
+{
+    noah_powerboard::AdcData msg;
+
+    fill_adc_data(info, ros::Time::now(), &msg);
+    this->adc_data_pub.publish(msg);
+}
+
+/*
+ * Ask the board to upload ADC samples by itself at ~adc_rate_hz. Samples are
+ * queued by the serial loop and published in batches of ~adc_batch_size
+ * on noah_powerboard/adc_batch from a thread of their own.
+ */
+int NoahPowerboard::StartAdcStream(powerboard_t *sys)
+{
+    if(SEND_RATE_SINGLE == this->adc_send_rate)
+    {
+        return 0;
+    }
+    if(!this->adc_running)
+    {
+        this->adc_running = true;
+        this->adc_thread = boost::thread(&NoahPowerboard::AdcPublishLoop, this);
+    }
+    this->adc_last_ms = transaction_now_ms();
+    sys->current_cmd_frame.cmd = this->adc_send_rate;
+    return this->GetAdcData(sys);
+}
+
+//the board forgets the upload rate when it resets, arm it again when samples stop
+void NoahPowerboard::CheckAdcStream(powerboard_t *sys)
+{
+    if(this->adc_running && (transaction_now_ms() - this->adc_last_ms > ADC_STREAM_TIMEOUT_MS))
     {
-        for(j=0;j<last_unread_bytes;j++)
+        ROS_WARN("no adc sample for %d ms, start auto upload again", ADC_STREAM_TIMEOUT_MS);
+        this->StartAdcStream(sys);
+    }
+}
+
+void NoahPowerboard::PubAdcBatch(noah_powerboard::AdcBatch *batch)
+{
+    batch->header.stamp = ros::Time::now();
+    batch->send_rate = this->adc_send_rate;
+    batch->dropped = this->adc_dropped;
+    this->adc_batch_pub.publish(*batch);
+    batch->samples.clear();
+}
+
+//taking the lock orders the notify after the publisher's predicate check
+void NoahPowerboard::WakeAdcPublisher(void)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(this->adc_lock);
+    }
+    this->adc_cond.notify_one();
+}
+
+void NoahPowerboard::AdcPublishLoop(void)
+{
+    noah_powerboard::AdcBatch batch;
+    adc_sample_t sample;
+    uint64_t first_ms = 0;
+    uint64_t now = 0;
+    int wait_ms = 0;
+
+    batch.samples.reserve(this->adc_batch_size);
+    while(this->adc_running)
+    {
+        //a full batch wakes us, a partial one is flushed once its oldest sample is ADC_BATCH_FLUSH_MS old
+        now = transaction_now_ms();
+        wait_ms = ADC_BATCH_FLUSH_MS;
+        if(!batch.samples.empty())
         {
-            recv_buf_complete [j] = recv_buf_last[j];
+            wait_ms = (first_ms + ADC_BATCH_FLUSH_MS > now) ? (int)(first_ms + ADC_BATCH_FLUSH_MS - now) : 0;
         }
-    }
-    //PowerboardInfo("start read ...");
-    //PowerboardInfo("rcv device is %d",sys->device);
-    if((nread = read(sys->device, recv_buf, BUF_LEN))>0)
-    { 
-        //PowerboardInfo("read complete ... ");
-        memcpy(recv_buf_complete+last_unread_bytes,recv_buf,nread);
-        data_Len = last_unread_bytes + nread;
-        last_unread_bytes = 0;
-//        for(i = 0; i < data_Len; i++)
-//        {
-//            PowerboardInfo("rcv buf %2x ", recv_buf_complete[last_unread_bytes + i]);
-//        }
-
-        while(i<data_Len)
         {
-            if(0x5A == recv_buf_complete [i])
+            boost::unique_lock<boost::mutex> lock(this->adc_lock);
+            this->adc_cond.wait_for(lock, boost::chrono::milliseconds(wait_ms), [this, &batch]{
+                return !this->adc_running || (batch.samples.size() + this->adc_queue.Size() >= (size_t)this->adc_batch_size);
+            });
+        }
+        while(this->adc_queue.Pop(sample))
+        {
+            if(batch.samples.empty())
             {
-
-                frame_len = recv_buf_complete[i+1]; 
-                if(i+frame_len <= data_Len)
-                {
-                    if(0xA5 == recv_buf_complete[i+frame_len-1])
-                    {
-                        for(j=0;j<frame_len;j++)
-                        {
-                            recv_buf_temp[j] = recv_buf_complete[i+j];
-                            //PowerboardInfo("rcv buf %d is %2x",j, recv_buf_temp[j]);
-                        }
-
-                        error = this->handle_rev_frame(sys,recv_buf_temp);
-                        i = i+ frame_len;
-                    }
-                    else
-                    {
-                        i++;
-                    }
-                }
-                else
-                {
-                    last_unread_bytes = data_Len - i;
-                    for(j=0;j<last_unread_bytes;j++)
-                    {
-                        recv_buf_last[j] = recv_buf_complete[i+j];
-                    }
-                    break;
-                }
+                first_ms = transaction_now_ms();
             }
-            else 
+            batch.samples.resize(batch.samples.size() + 1);
+            fill_adc_data(&sample.info, sample.stamp, &batch.samples.back());
+            if(batch.samples.size() >= (size_t)this->adc_batch_size)
             {
-                i++;
+                this->PubAdcBatch(&batch);
             }
         }
+        //the board stopped uploading or slowed down, do not hold the tail back
+        if(!batch.samples.empty() && (transaction_now_ms() - first_ms >= ADC_BATCH_FLUSH_MS))
+        {
+            this->PubAdcBatch(&batch);
+        }
     }
-    else 
+
+    //stream turned off, whatever is left goes out as the last batch
+    while(this->adc_queue.Pop(sample))
+    {
+        batch.samples.resize(batch.samples.size() + 1);
+        fill_adc_data(&sample.info, sample.stamp, &batch.samples.back());
+    }
+    if(!batch.samples.empty())
+    {
+        this->PubAdcBatch(&batch);
+    }
+}
+
+void NoahPowerboard::GetAdcStats(int window, noah_powerboard::AdcStats *msg)
+{
+    adc_field_stats_t stats[ADC_STORE_FIELD_NUM];
+
+    msg->header.stamp = ros::Time::now();
+    msg->window_ms = AdcStore::WindowMs(window);
+    msg->samples = adc_store.Query(window, transaction_now_ms(), stats);
+    msg->fields.resize(ADC_STORE_FIELD_NUM);
+    for(int i = 0; i < ADC_STORE_FIELD_NUM; i++)
+    {
+        msg->fields[i].name = adc_field_name[i];
+        msg->fields[i].min = stats[i].min;
+        msg->fields[i].max = stats[i].max;
+        msg->fields[i].mean = stats[i].mean;
+        msg->fields[i].p50 = stats[i].p50;
+        msg->fields[i].p90 = stats[i].p90;
+        msg->fields[i].p99 = stats[i].p99;
+    }
+}
+
+bool NoahPowerboard::GetAdcStatsCallback(noah_powerboard::GetAdcStats::Request &req, noah_powerboard::GetAdcStats::Response &res)
+{
+    for(int w = 0; w < ADC_WINDOW_NUM; w++)
     {
-        i = stat(sys->dev,&file_info);
-        if(-1 == i)
+        if((0 == req.window_ms) || (AdcStore::WindowMs(w) == req.window_ms))
         {
-            //sys->com_state = COM_CLOSING;
+            res.stats.resize(res.stats.size() + 1);
+            this->GetAdcStats(w, &res.stats.back());
         }
     }
-    return error;
+    return !res.stats.empty();
 }
 
+//called once a second, publishes all windows every ~adc_stats_period seconds
+void NoahPowerboard::PubAdcStats(void)
+{
+    static int cnt = 0;
+    noah_powerboard::AdcStats msg;
 
-void NoahPowerboard::pub_json_msg_to_app( const nlohmann::json j_msg)
+    if((this->adc_stats_period <= 0) || (++cnt < this->adc_stats_period))
+    {
+        return;
+    }
+    cnt = 0;
+    for(int w = 0; w < ADC_WINDOW_NUM; w++)
+    {
+        this->GetAdcStats(w, &msg);
+        this->adc_stats_pub.publish(msg);
+    }
+}
+
+//called once a second, logs queue depth and wait time every SCHED_METRICS_PERIOD seconds
+void NoahPowerboard::LogSchedMetrics(void)
 {
-    std_msgs::String pub_json_msg;
-    std::stringstream ss;
+    static int cnt = 0;
+    sched_metrics_t metrics;
 
-    ss.clear();
-    ss << j_msg;
-    pub_json_msg.data = ss.str();
-    this->noah_powerboard_pub.publish(pub_json_msg);
+    if(++cnt < SCHED_METRICS_PERIOD)
+    {
+        return;
+    }
+    cnt = 0;
+    for(int cls = 0; cls < SCHED_CLASS_NUM; cls++)
+    {
+        this->scheduler.GetMetrics(cls, &metrics, true);
+        if((0 == metrics.submitted) && (0 == metrics.depth))
+        {
+            continue;
+        }
+        ROS_INFO("sched %s: depth %u max %u, submitted %u sent %u superseded %u dropped %u, wait avg %.1f max %u ms",
+                sched_class_name[cls], metrics.depth, metrics.max_depth, metrics.submitted, metrics.sent,
+                metrics.superseded, metrics.dropped,
+                metrics.sent ? (double)metrics.wait_ms_sum / metrics.sent : 0.0, metrics.wait_ms_max);
+    }
+}
+
+//called once a second from the serial thread
+void NoahPowerboard::PubDiagnostics(void)
+{
+    diagnostic_msgs::DiagnosticArray msg;
+
+    msg.header.stamp = ros::Time::now();
+    msg.status.resize(1);
+    link_stats_to_diagnostic(this->link_stats, ros::this_node::getName(), &this->link_diag_last, &msg.status[0]);
+    if(LinkCapture::Instance().Enabled())
+    {
+        msg.status.resize(2);
+        capture_to_diagnostic(LinkCapture::Instance(), ros::this_node::getName(), &msg.status[1]);
+    }
+    this->diagnostics_pub.publish(msg);
+}
+
+bool NoahPowerboard::DumpLinkStatsCallback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    res.success = true;
+    res.message = this->link_stats.Dump();
+    return true;
+}
+
+NoahPowerboard::~NoahPowerboard()
+{
+    this->adc_running = false;
+    this->WakeAdcPublisher();
+    if(this->adc_thread.joinable())
+    {
+        this->adc_thread.join();
+    }
+    if(this->cmd_event_fd >= 0)
+    {
+        this->io_queue.SetWakeFd(-1);
+        close(this->cmd_event_fd);
+    }
 }
          
 int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf)
 {
-    int frame_len = 0;
     int i = 0;
     int j = 0;
     int command = 0; 
-    unsigned char check_data = 0;
     uint8_t cmd_type = 0;
     int error = -1;
-    frame_len = frame_buf[1];
-
-    for(i=0;i<frame_len-2;i++)
-    {
-        check_data += frame_buf[i];
-    }
 
-    if(check_data != frame_buf[frame_len-2] || PROTOCOL_TAIL != frame_buf[frame_len -1])
-    {
-        PowerboardInfo("led receive frame check error");
-        return -1;
-    }
 //    PowerboardInfo("Powrboard recieve data check OK.");
 #if 0
     for(i =0;i<frame_len;i++)
@@ -489,22 +835,25 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
             PowerboardInfo("color.b is %2x",        sys->rcv_serial_leds_frame.color.b);
             PowerboardInfo("period is %d",          sys->rcv_serial_leds_frame.period);
 #if 0
-            this->j.clear();
-            this->j = 
+            if(this->pub_json)
             {
-                {"sub_name","led_ctrl"},
+                this->j.clear();
+                this->j = 
                 {
-                    "data",
+                    {"sub_name","led_ctrl"},
                     {
-                        {"cur_light_mode",sys->rcv_serial_leds_frame.cur_light_mode},
-                        {"color_r",sys->rcv_serial_leds_frame.color.r},
-                        {"color_g",sys->rcv_serial_leds_frame.color.g},
-                        {"color_b",sys->rcv_serial_leds_frame.color.b},
-                        {"period",sys->rcv_serial_leds_frame.period},
+                        "data",
+                        {
+                            {"cur_light_mode",sys->rcv_serial_leds_frame.cur_light_mode},
+                            {"color_r",sys->rcv_serial_leds_frame.color.r},
+                            {"color_g",sys->rcv_serial_leds_frame.color.g},
+                            {"color_b",sys->rcv_serial_leds_frame.color.b},
+                            {"period",sys->rcv_serial_leds_frame.period},
+                        }
                     }
-                }
-            };
-            this->pub_json_msg_to_app(this->j);
+                };
+                this->pub_json_msg_to_app(this->j);
+            }
 #endif
             error = FRAME_TYPE_LEDS_CONTROL;
             break;
@@ -517,18 +866,21 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                 sys->bat_info.bat_info = frame_buf[5]<< 8  | frame_buf[4]; 
                 PowerboardInfo("battery voltage is %d",sys->bat_info.bat_info);
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","battery_info"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","battery_info"},
                         {
-                            {"battery_voltage",sys->bat_info.bat_info},
+                            "data",
+                            {
+                                {"battery_voltage",sys->bat_info.bat_info},
+                            }
                         }
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
             }
             if(sys->bat_info.cmd == CMD_BAT_PERCENT)
@@ -540,57 +892,105 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                 }
                 PowerboardInfo("battery voltage is %d",sys->bat_info.bat_info);
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","battery_info"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","battery_info"},
                         {
-                            {"battery_percent",sys->bat_info.bat_info},
+                            "data",
+                            {
+                                {"battery_percent",sys->bat_info.bat_info},
+                            }
                         }
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
             }
+            {
+                noah_powerboard::BatteryInfo msg;
+                msg.header.stamp = ros::Time::now();
+                msg.cmd = sys->bat_info.cmd;
+                msg.value = sys->bat_info.bat_info;
+                this->battery_info_pub.publish(msg);
+            }
             error = FRAME_TYPE_BAT_STATUS;
             break;
 
         case FRAME_TYPE_GET_CURRENT:
-            memcpy((uint8_t *)&sys->voltage_info.voltage_data, &frame_buf[4], sizeof(voltage_data_t));
-            PowerboardInfo("_12v_voltage     is %5d mv",sys->voltage_info.voltage_data._12V_voltage);
-            PowerboardInfo("_24v_voltage     is %5d mv",sys->voltage_info.voltage_data._24V_voltage);
-            PowerboardInfo("_5v_voltage      is %5d mv",sys->voltage_info.voltage_data._5V_voltage);
-            PowerboardInfo("bat_voltage     is %5d mv",sys->voltage_info.voltage_data.bat_voltage);
-            PowerboardInfo("_24V_temp       is %d",sys->voltage_info.voltage_data._24V_temp);
-            PowerboardInfo("_12V_temp       is %d",sys->voltage_info.voltage_data._12V_temp);
-            PowerboardInfo("_5V_temp        is %d",sys->voltage_info.voltage_data._5V_temp);
-            PowerboardInfo("air_temp        is %d",sys->voltage_info.voltage_data.air_temp);
-            PowerboardInfo("send_rate       is %d",sys->voltage_info.send_rate);
+            {
+                //payload is voltage_info_t, older firmware stops after voltage_data
+                int payload_len = frame_buf[1] - 6;
+                if(payload_len > (int)sizeof(voltage_info_t))
+                {
+                    payload_len = sizeof(voltage_info_t);
+                }
+                if(payload_len > 0)
+                {
+                    memcpy((uint8_t *)&sys->voltage_info, &frame_buf[4], payload_len);
+                }
+            }
+            ROS_DEBUG("_12v_voltage     is %5d mv",sys->voltage_info.voltage_data._12V_voltage);
+            ROS_DEBUG("_24v_voltage     is %5d mv",sys->voltage_info.voltage_data._24V_voltage);
+            ROS_DEBUG("_5v_voltage      is %5d mv",sys->voltage_info.voltage_data._5V_voltage);
+            ROS_DEBUG("bat_voltage     is %5d mv",sys->voltage_info.voltage_data.bat_voltage);
+            ROS_DEBUG("_24V_temp       is %d",sys->voltage_info.voltage_data._24V_temp);
+            ROS_DEBUG("_12V_temp       is %d",sys->voltage_info.voltage_data._12V_temp);
+            ROS_DEBUG("_5V_temp        is %d",sys->voltage_info.voltage_data._5V_temp);
+            ROS_DEBUG("air_temp        is %d",sys->voltage_info.voltage_data.air_temp);
+            ROS_DEBUG("send_rate       is %d",sys->voltage_info.send_rate);
 #if 0
-            this->j.clear();
-            this->j = 
+            if(this->pub_json)
             {
-                {"sub_name","get_adc_data"},
+                this->j.clear();
+                this->j = 
                 {
-                    "data",
+                    {"sub_name","get_adc_data"},
                     {
+                        "data",
+                        {
 
-                        {"_12v_voltage", sys->voltage_info.voltage_data._12V_voltage},
-                        {"_24v_voltage", sys->voltage_info.voltage_data._24V_voltage},
-                        {"_5v_voltage", sys->voltage_info.voltage_data._5V_voltage},
-                        {"bat_voltage", sys->voltage_info.voltage_data.bat_voltage},
-                        {"_24V_temp", sys->voltage_info.voltage_data._24V_temp},
-                        {"_12V_temp", sys->voltage_info.voltage_data._12V_temp},
-                        {"_5V_temp", sys->voltage_info.voltage_data._5V_temp},
-                        {"air_temp", sys->voltage_info.voltage_data.air_temp},
-                        {"send_rate", sys->voltage_info.send_rate},
+                            {"_12v_voltage", sys->voltage_info.voltage_data._12V_voltage},
+                            {"_24v_voltage", sys->voltage_info.voltage_data._24V_voltage},
+                            {"_5v_voltage", sys->voltage_info.voltage_data._5V_voltage},
+                            {"bat_voltage", sys->voltage_info.voltage_data.bat_voltage},
+                            {"_24V_temp", sys->voltage_info.voltage_data._24V_temp},
+                            {"_12V_temp", sys->voltage_info.voltage_data._12V_temp},
+                            {"_5V_temp", sys->voltage_info.voltage_data._5V_temp},
+                            {"air_temp", sys->voltage_info.voltage_data.air_temp},
+                            {"send_rate", sys->voltage_info.send_rate},
+                        }
                     }
-                }
-            };
-            this->pub_json_msg_to_app(this->j);
+                };
+                this->pub_json_msg_to_app(this->j);
+            }
 #endif
+            {
+                uint16_t raw[ADC_STORE_FIELD_NUM];
+                memcpy(raw, &sys->voltage_info.voltage_data, sizeof(raw));
+                adc_store.Add(transaction_now_ms(), raw);
+            }
+            if(this->adc_running)
+            {
+                adc_sample_t sample;
+                sample.stamp = ros::Time::now();
+                sample.info = sys->voltage_info;
+                this->adc_last_ms = transaction_now_ms();
+                if(!this->adc_queue.Push(sample))
+                {
+                    this->adc_dropped++;
+                }
+                else if(0 == this->adc_queue.Size() % this->adc_batch_size)
+                {
+                    this->WakeAdcPublisher();
+                }
+            }
+            else
+            {
+                this->PubAdcData(&sys->voltage_info);
+            }
             error = FRAME_TYPE_GET_CURRENT;
             break;
 
@@ -603,19 +1003,22 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                 PowerboardInfo("hw version: %s",sys->hw_version);
                 PowerboardInfo("sw version: %s",sys->sw_version);
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","get_version"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","get_version"},
                         {
-                            {"hw_version",sys->hw_version},     
-                            {"sw_version",sys->sw_version},     
+                            "data",
+                            {
+                                {"hw_version",sys->hw_version},     
+                                {"sw_version",sys->sw_version},     
+                            }
                         }
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif 
             }
 
@@ -624,21 +1027,33 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                 memcpy((uint8_t *)&sys->protocol_version,&frame_buf[4], PROTOCOL_VERSION_SIZE);
                 PowerboardInfo("protocol version: %s",sys->protocol_version);
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","get_version"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","get_version"},
                         {
-                            {"protocol_version",sys->protocol_version},     
+                            "data",
+                            {
+                                {"protocol_version",sys->protocol_version},     
+                            }
                         }
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
             }
 
+            {
+                noah_powerboard::Version msg;
+                msg.header.stamp = ros::Time::now();
+                msg.type = sys->get_version_type;
+                msg.hw_version.assign(sys->hw_version, strnlen(sys->hw_version, HW_VERSION_SIZE));
+                msg.sw_version.assign(sys->sw_version, strnlen(sys->sw_version, SW_VERSION_SIZE));
+                msg.protocol_version.assign(sys->protocol_version, strnlen(sys->protocol_version, PROTOCOL_VERSION_SIZE));
+                this->version_pub.publish(msg);
+            }
             error = FRAME_TYPE_GET_VERSION;
             break;
 
@@ -686,19 +1101,31 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
             }
 
 #if 0
-            this->j.clear();
-            this->j = 
+            if(this->pub_json)
             {
-                {"pub_name","get_sys_status"},
+                this->j.clear();
+                this->j = 
                 {
-                    "data",
+                    {"pub_name","get_sys_status"},
                     {
-                        {"sys_status",sys->sys_status},
+                        "data",
+                        {
+                            {"sys_status",sys->sys_status},
+                        }
                     }
-                }
-            };
-            this->pub_json_msg_to_app(this->j);
+                };
+                this->pub_json_msg_to_app(this->j);
+            }
 #endif 
+            {
+                noah_powerboard::SysStatus msg;
+                msg.header.stamp = ros::Time::now();
+                msg.sys_status = sys->sys_status;
+                msg.power_state = sys->sys_status & 0x0f;
+                msg.charger_in = (sys->sys_status & STATE_IS_CHARGER_IN) != 0;
+                msg.recharge_in = (sys->sys_status & STATE_IS_RECHARGE_IN) != 0;
+                this->sys_status_pub.publish(msg);
+            }
             error = FRAME_TYPE_SYS_STATUS;
             break;
 
@@ -706,18 +1133,21 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
             sys->ir_cmd.lightness_percent = frame_buf[3];
             PowerboardInfo("ir lightness is %d",sys->ir_cmd.lightness_percent);
 #if 0
-            this->j.clear();
-            this->j = 
+            if(this->pub_json)
             {
-                {"sub_name","ir_lightness"},
+                this->j.clear();
+                this->j = 
                 {
-                    "data",
+                    {"sub_name","ir_lightness"},
                     {
-                        {"ir_lightness",sys->ir_cmd.lightness_percent},
+                        "data",
+                        {
+                            {"ir_lightness",sys->ir_cmd.lightness_percent},
+                        }
                     }
-                }
-            };
-            this->pub_json_msg_to_app(this->j);
+                };
+                this->pub_json_msg_to_app(this->j);
+            }
 #endif
             error = FRAME_TYPE_IRLED_CONTROL;
             break;
@@ -735,32 +1165,38 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                     PowerboardInfo("hard ware not support !");
                 }
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","set_module_state"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","set_module_state"},
                         {
-                            {"module_status",sys->module_status.module},
-                        } 
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                            "data",
+                            {
+                                {"module_status",sys->module_status.module},
+                            } 
+                        }
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","set_module_state"},
+                    this->j.clear();
+                    this->j = 
                     {
-                        "data",
+                        {"sub_name","set_module_state"},
                         {
-                            //{"_xx_xxx_state",!(bool)(sys->module_status.module & POWER_5V_EN)},
-                            {"door_ctrl_state",!(bool)(sys->module_status.module & POWER_12V_EXTEND)},
-                        } 
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                            "data",
+                            {
+                                //{"_xx_xxx_state",!(bool)(sys->module_status.module & POWER_5V_EN)},
+                                {"door_ctrl_state",!(bool)(sys->module_status.module & POWER_12V_EXTEND)},
+                            } 
+                        }
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
                 error = FRAME_TYPE_MODULE_CONTROL;
                 break; 
@@ -779,34 +1215,41 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
                     PowerboardInfo("hardware not support !");
                 }
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","get_module_state"},
+                    this->j.clear();
+                    this->j = 
                     {
-                       "data",
-                       {
-                           {"module_status",sys->module_status.module},
-                       } 
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                        {"sub_name","get_module_state"},
+                        {
+                           "data",
+                           {
+                               {"module_status",sys->module_status.module},
+                           } 
+                        }
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
 #if 0
-                this->j.clear();
-                this->j = 
+                if(this->pub_json)
                 {
-                    {"sub_name","get_module_state"},
+                    this->j.clear();
+                    this->j = 
                     {
-                       "data",
-                       {
-                           //{"_xx_xxx_state",!(bool)(sys->module_status.module & POWER_5V_EN)},
-                           {"door_ctrl_state",!(bool)(sys->module_status.module & POWER_12V_EXTEND)},
-                       } 
-                    }
-                };
-                this->pub_json_msg_to_app(this->j);
+                        {"sub_name","get_module_state"},
+                        {
+                           "data",
+                           {
+                               //{"_xx_xxx_state",!(bool)(sys->module_status.module & POWER_5V_EN)},
+                               {"door_ctrl_state",!(bool)(sys->module_status.module & POWER_12V_EXTEND)},
+                           } 
+                        }
+                    };
+                    this->pub_json_msg_to_app(this->j);
+                }
 #endif
+                this->PubModuleState(0, 0);
                 error = FRAME_TYPE_GET_MODULE_STATE;
                 break; 
             }
@@ -814,142 +1257,191 @@ int NoahPowerboard::handle_rev_frame(powerboard_t *sys,unsigned char * frame_buf
         default :
             break;
     }
+    if(error >= 0)
+    {
+        this->UpdateState(sys);
+        this->transactions.Complete(cmd_type, error);
+    }
     return error;
 }
 
-void NoahPowerboard::from_app_rcv_callback(const std_msgs::String::ConstPtr &msg)
+void NoahPowerboard::UpdateState(const powerboard_t *sys)
 {
-    //ROS_INFO("Rcv test data");
-    auto j = json::parse(msg->data.c_str());
-    if(j.find("pub_name") != j.end())
-    {
-        //ROS_INFO("find pub_name");
-        if(j["pub_name"] == "set_module_state")
-        {
-            //ROS_INFO("find set_module_state");
-
-
+    powerboard_state_t snapshot;
 
-            if(j["data"]["dev_name"] == "_24v_printer")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set 24v printer on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_24V_PRINTER; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set 24v printer off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_24V_PRINTER; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-            }
-            if(j["data"]["dev_name"] == "_24v_printer")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set 24v printer on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_24V_PRINTER; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set 24v printer off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_24V_PRINTER; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-            }
+    snapshot.bat_info = sys->bat_info.bat_info;
+    snapshot.sys_status = sys->sys_status;
+    snapshot.module_status = sys->module_status.module;
+    this->state.Store(snapshot);
+}
 
+void NoahPowerboard::from_app_rcv_callback(const std_msgs::String::ConstPtr &msg)
+{
+    //pub_name of the app json commands
+    static const std::unordered_map<std::string, app_cmd_handler_t> app_cmd_table = 
+    {
+        {"set_module_state",    &NoahPowerboard::HandleSetModuleState},
+    };
+    json j;
+    json::const_iterator pub_name;
+    json::const_iterator data;
 
+    try
+    {
+        j = json::parse(msg->data.c_str());
+    }
+    catch(const std::exception &e)
+    {
+        ROS_ERROR("bad json from app: %s", e.what());
+        return;
+    }
 
-            if(j["data"]["dev_name"] == "_24v_dcdc")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set 24v dcdc on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_24V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set 24v dcdc off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_24V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-            }
+    pub_name = j.find("pub_name");
+    data = j.find("data");
+    if((pub_name == j.end()) || !pub_name->is_string() || (data == j.end()))
+    {
+        return;
+    }
 
+    std::unordered_map<std::string, app_cmd_handler_t>::const_iterator cmd = app_cmd_table.find(pub_name->get<std::string>());
+    if(cmd != app_cmd_table.end())
+    {
+        (this->*(cmd->second))(*data);
+    }
+}
 
+void NoahPowerboard::HandleSetModuleState(const json &data)
+{
+    json::const_iterator dev_name = data.find("dev_name");
+    json::const_iterator set_state = data.find("set_state");
 
-            if(j["data"]["dev_name"] == "_5v_dcdc")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set 5v dcdc on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_5V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set 5v dcdc off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_5V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
+    if((dev_name == data.end()) || !dev_name->is_string() || (set_state == data.end()) || !set_state->is_boolean())
+    {
+        return;
+    }
 
-            }
+    std::unordered_map<std::string, uint32_t>::const_iterator dev = app_module_table.find(dev_name->get<std::string>());
+    if(dev == app_module_table.end())
+    {
+        ROS_WARN("unknown dev_name %s", dev_name->get<std::string>().c_str());
+        return;
+    }
+    ROS_INFO("set %s %s", dev->first.c_str(), set_state->get<bool>() ? "on" : "off");
+    this->PostModuleCtrl(dev->second, set_state->get<bool>());
+}
 
+/*
+ * Called from the spinner threads. The command is handed to the serial
+ * thread through cmd_queue and the eventfd wakes it up, the callback never
+ * touches the device or sys_powerboard.
+ */
+void NoahPowerboard::PostModuleCtrl(uint32_t module, bool on)
+{
+    powerboard_cmd_t cmd;
+    uint64_t one = 1;
 
-            if(j["data"]["dev_name"] == "_12v_dcdc")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set 12v dcdc on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_12V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set 12v dcdc off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_12V_EN; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-            }
+    cmd.cmd = on ? POWERBOARD_CMD_MODULE_ON : POWERBOARD_CMD_MODULE_OFF;
+    cmd.module = module;
+    if(!this->cmd_queue.Push(cmd))
+    {
+        ROS_ERROR("command queue full, drop module ctrl %08x", module);
+        return;
+    }
+    if(write(this->cmd_event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        ROS_ERROR("wake serial thread failed: %s", strerror(errno));
+    }
+}
 
-            if(j["data"]["dev_name"] == "door_ctrl_state")
-            {
-                if(j["data"]["set_state"] == true)
-                {
-                    ROS_INFO("set door ctrl  on");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON;
-                    sys_powerboard->module_status_set.module = POWER_VSYS_24V_NV; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-                else if(j["data"]["set_state"] == false)
-                {
-                    ROS_INFO("set door ctrl off");
-                    sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-                    sys_powerboard->module_status_set.module = POWER_VSYS_24V_NV; 
-                    this->SetModulePowerOnOff(sys_powerboard);
-                }
-            }
+//serial thread: run what the callbacks posted since the last wakeup
+void NoahPowerboard::HandleCommands(powerboard_t *sys)
+{
+    powerboard_cmd_t cmd;
+    uint64_t count = 0;
 
+    //clear the wakeup first, a command posted after this wakes the next poll
+    if(read(this->cmd_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        ROS_ERROR("read command event failed: %s", strerror(errno));
+    }
+    while(this->cmd_queue.Pop(cmd))
+    {
+        switch(cmd.cmd)
+        {
+            case POWERBOARD_CMD_MODULE_ON:
+                this->QueueModuleCtrl(cmd.module, true);
+                break;
+            case POWERBOARD_CMD_MODULE_OFF:
+                this->QueueModuleCtrl(cmd.module, false);
+                break;
+            default:
+                break;
         }
     }
+    this->FlushModuleCtrl(sys);
 }
 
+void NoahPowerboard::CallIoCallbacks(void)
+{
+    this->io_queue.callAvailable();
+}
+
+void IoCallbackQueue::addCallback(const ros::CallbackInterfacePtr &callback, uint64_t owner_id)
+{
+    uint64_t one = 1;
 
+    ros::CallbackQueue::addCallback(callback, owner_id);
+    if((this->wake_fd >= 0) && (write(this->wake_fd, &one, sizeof(one)) != sizeof(one)))
+    {
+        ROS_ERROR("wake serial thread failed: %s", strerror(errno));
+    }
+}
 
+/*
+ * Module switches drained in one HandleCommands() call are merged and sent by
+ * FlushModuleCtrl(), one frame for everything turned on and one for
+ * everything turned off. The latest request of a module wins.
+ */
+void NoahPowerboard::QueueModuleCtrl(uint32_t module, bool on)
+{
+    if(on)
+    {
+        this->module_on_pending |= module;
+        this->module_off_pending &= ~module;
+        this->module_want_on |= module;
+        this->module_want_off &= ~module;
+    }
+    else
+    {
+        this->module_off_pending |= module;
+        this->module_on_pending &= ~module;
+        this->module_want_off |= module;
+        this->module_want_on &= ~module;
+    }
+}
 
+void NoahPowerboard::FlushModuleCtrl(powerboard_t *sys)
+{
+    //kept pending until the link is up, ReplayState() sends them then
+    if(COM_RUN_OK != sys->com_state)
+    {
+        return;
+    }
+    if(0 != this->module_on_pending)
+    {
+        sys->module_status_set.on_off = MODULE_CTRL_ON;
+        sys->module_status_set.module = this->module_on_pending;
+        this->module_on_pending = 0;
+        this->SetModulePowerOnOff(sys);
+    }
+    if(0 != this->module_off_pending)
+    {
+        sys->module_status_set.on_off = MODULE_CTRL_OFF;
+        sys->module_status_set.module = this->module_off_pending;
+        this->module_off_pending = 0;
+        this->SetModulePowerOnOff(sys);
+    }
+}
 
 void NoahPowerboard:: from_navigation_rcv_callback(const std_msgs::String::ConstPtr &msg)
 {
@@ -960,27 +1452,19 @@ void NoahPowerboard:: from_navigation_rcv_callback(const std_msgs::String::Const
     {
         case 0:
             ROS_INFO("camera led ctrl:get 00"); 
-            sys_powerboard->module_status_set.on_off = MODULE_CTRL_OFF; 
-            sys_powerboard->module_status_set.module = POWER_CAMERA_LED; 
-            this->SetModulePowerOnOff(sys_powerboard);
+            this->PostModuleCtrl(POWER_CAMERA_LED, false);
             break;
         case 1:
             ROS_INFO("camera led ctrl:get 01"); 
-            sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON; 
-            sys_powerboard->module_status_set.module = POWER_CAMERA_LED; 
-            this->SetModulePowerOnOff(sys_powerboard);
+            this->PostModuleCtrl(POWER_CAMERA_LED, true);
             break;
         case 10:
             ROS_INFO("camera led ctrl:get 10"); 
-            sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON; 
-            sys_powerboard->module_status_set.module = POWER_CAMERA_LED; 
-            this->SetModulePowerOnOff(sys_powerboard);
+            this->PostModuleCtrl(POWER_CAMERA_LED, true);
             break;
         case 11:
             ROS_INFO("camera led ctrl:get 11"); 
-            sys_powerboard->module_status_set.on_off = MODULE_CTRL_ON; 
-            sys_powerboard->module_status_set.module = POWER_CAMERA_LED; 
-            this->SetModulePowerOnOff(sys_powerboard);
+            this->PostModuleCtrl(POWER_CAMERA_LED, true);
             break;
         default :
             break;
@@ -990,9 +1474,11 @@ void NoahPowerboard:: from_navigation_rcv_callback(const std_msgs::String::Const
 
 void NoahPowerboard::PubPower(void)
 {
+    powerboard_state_t snapshot;
+    this->state.Load(snapshot);
     unsigned char power = 0;
-    power = sys_powerboard->bat_info.bat_info;
-    unsigned char status = sys_powerboard->sys_status;    //std_msgs::Int8 msg;
+    power = snapshot.bat_info;
+    unsigned char status = snapshot.sys_status;    //std_msgs::Int8 msg;
     //msg.data=power;
     std_msgs::UInt8MultiArray bytes_msg;
 
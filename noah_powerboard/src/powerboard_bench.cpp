@@ -0,0 +1,227 @@
+/*
+ * End to end benchmark of noah_powerboard_node, usually run against
+ * powerboard_sim:
+ *
+ *   powerboard_sim -l /tmp/powerboard -d 2 -j 1 &
+ *   rosrun noah_powerboard noah_powerboard_node _dev:=/tmp/powerboard &
+ *   rosrun noah_powerboard powerboard_bench _count:=1000
+ *
+ * Toggles one module through the app json topic, one command at a time, and
+ * times every command until the node reports it on noah_powerboard/module_state.
+ * Prints p50/p99 round trip, toggles per second and the CPU the node used.
+ *
+ * params: ~count       commands to send, default 1000
+ *         ~dev_name    module to toggle, default _24v_printer
+ *         ~timeout_ms  a command without reply after this long counts as lost
+ *         ~node_pid    pid of the node, found through /proc when 0
+ */
+#include "ros/ros.h"
+#include "std_msgs/String.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "noah_powerboard/ModuleState.h"
+
+#define BENCH_NODE_COMM             "noah_powerboard"   //comm is cut to 15 chars
+
+static volatile bool reply_received = false;
+static volatile int reply_error = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+static void module_state_callback(const noah_powerboard::ModuleState::ConstPtr &msg)
+{
+    //plain queries carry set_module 0, only command replies count
+    if(0 != msg->set_module)
+    {
+        reply_error = msg->error_code;
+        reply_received = true;
+    }
+}
+
+static int find_node_pid(void)
+{
+    DIR *dir = opendir("/proc");
+    struct dirent *entry = NULL;
+    int pid = 0;
+
+    if(NULL == dir)
+    {
+        return 0;
+    }
+    while((0 == pid) && (NULL != (entry = readdir(dir))))
+    {
+        char path[64];
+        char comm[32] = {0};
+        FILE *file = NULL;
+
+        if((entry->d_name[0] < '0') || (entry->d_name[0] > '9'))
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        file = fopen(path, "r");
+        if(NULL == file)
+        {
+            continue;
+        }
+        if((NULL != fgets(comm, sizeof(comm), file)) && (0 == strncmp(comm, BENCH_NODE_COMM, strlen(BENCH_NODE_COMM))))
+        {
+            pid = atoi(entry->d_name);
+        }
+        fclose(file);
+    }
+    closedir(dir);
+    return pid;
+}
+
+//utime + stime of a process in clock ticks, -1 when it is gone
+static long read_cpu_ticks(int pid)
+{
+    char path[64];
+    char buf[1024] = {0};
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    FILE *file = NULL;
+    char *p = NULL;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    file = fopen(path, "r");
+    if(NULL == file)
+    {
+        return -1;
+    }
+    if(NULL == fgets(buf, sizeof(buf), file))
+    {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    //comm may hold spaces, the fields after it start behind the last ')'
+    p = strrchr(buf, ')');
+    if((NULL == p) || (2 != sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime)))
+    {
+        return -1;
+    }
+    return utime + stime;
+}
+
+static std::string set_module_json(const std::string &dev_name, bool on)
+{
+    return "{\"pub_name\":\"set_module_state\",\"data\":{\"dev_name\":\"" + dev_name + "\",\"set_state\":" + (on ? "true" : "false") + "}}";
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "powerboard_bench");
+    ros::NodeHandle n;
+    ros::NodeHandle private_n("~");
+    std::vector<uint32_t> rtt_us;
+    std::string dev_name;
+    int count = 0;
+    int timeout_ms = 0;
+    int node_pid = 0;
+    int lost = 0;
+    int failed = 0;
+    long cpu_start = -1;
+    long cpu_end = -1;
+    uint64_t start_us = 0;
+    uint64_t elapsed_us = 0;
+
+    private_n.param<int>("count", count, 1000);
+    private_n.param<std::string>("dev_name", dev_name, "_24v_printer");
+    private_n.param<int>("timeout_ms", timeout_ms, 1000);
+    private_n.param<int>("node_pid", node_pid, 0);
+
+    ros::Publisher cmd_pub = n.advertise<std_msgs::String>("rx_noah_powerboard_node", 10);
+    ros::Subscriber state_sub = n.subscribe("noah_powerboard/module_state", 10, module_state_callback);
+
+    //wait until both topics are connected to the node
+    start_us = now_us();
+    while(ros::ok() && ((0 == cmd_pub.getNumSubscribers()) || (0 == state_sub.getNumPublishers())))
+    {
+        if(now_us() - start_us > 5 * 1000 * 1000)
+        {
+            ROS_ERROR("noah_powerboard_node not found");
+            return 1;
+        }
+        ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.01));
+    }
+    //let the latched state from the connection go by
+    ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.2));
+    reply_received = false;
+
+    if(0 == node_pid)
+    {
+        node_pid = find_node_pid();
+    }
+    if(node_pid > 0)
+    {
+        cpu_start = read_cpu_ticks(node_pid);
+    }
+
+    rtt_us.reserve(count);
+    start_us = now_us();
+    for(int i = 0; (i < count) && ros::ok(); i++)
+    {
+        std_msgs::String cmd;
+        uint64_t sent_us = 0;
+
+        cmd.data = set_module_json(dev_name, i % 2 == 0);
+        reply_received = false;
+        sent_us = now_us();
+        cmd_pub.publish(cmd);
+        while(!reply_received && ros::ok() && (now_us() - sent_us < (uint64_t)timeout_ms * 1000))
+        {
+            ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.001));
+        }
+        if(!reply_received)
+        {
+            lost++;
+            continue;
+        }
+        if(reply_error < 0)
+        {
+            failed++;
+        }
+        rtt_us.push_back(now_us() - sent_us);
+    }
+    elapsed_us = now_us() - start_us;
+    if(node_pid > 0)
+    {
+        cpu_end = read_cpu_ticks(node_pid);
+    }
+
+    printf("%d commands, %zu replies, %d failed on the serial link, %d lost\n", count, rtt_us.size(), failed, lost);
+    if(!rtt_us.empty())
+    {
+        std::sort(rtt_us.begin(), rtt_us.end());
+        printf("round trip p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                rtt_us[(rtt_us.size() - 1) * 50 / 100] / 1000.0,
+                rtt_us[(rtt_us.size() - 1) * 99 / 100] / 1000.0,
+                rtt_us.back() / 1000.0);
+        printf("%.1f toggles/s\n", rtt_us.size() / (elapsed_us / 1e6));
+    }
+    if((cpu_start >= 0) && (cpu_end >= 0))
+    {
+        double cpu_s = (double)(cpu_end - cpu_start) / sysconf(_SC_CLK_TCK);
+        printf("node pid %d cpu %.1f%%\n", node_pid, 100.0 * cpu_s / (elapsed_us / 1e6));
+    }
+    else
+    {
+        printf("node cpu unknown, set ~node_pid\n");
+    }
+    return 0;
+}
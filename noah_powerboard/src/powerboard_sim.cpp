@@ -0,0 +1,404 @@
+/*
+ * Powerboard MCU simulator on a pseudo terminal.
+ *
+ * Answers every FRAME_TYPE_* of noah_powerboard_node like the board does,
+ * so the node can be run and measured without hardware:
+ *
+ *   powerboard_sim -l /tmp/powerboard -d 2 -j 1 &
+ *   rosrun noah_powerboard noah_powerboard_node _dev:=/tmp/powerboard
+ *
+ * usage: powerboard_sim [-l link] [-d delay_ms] [-j jitter_ms]
+ *                       [-b byte_drop_rate] [-c corrupt_rate] [-s seed] [-v]
+ *
+ * -l  symlink pointing at the slave side of the pty
+ * -d  delay of every reply
+ * -j  the delay varies by up to +-jitter
+ * -b  probability that a single byte of a reply is lost
+ * -c  probability that the checksum of a reply is wrong
+ *
+ * Plain Linux program, it does not need ROS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include "mcu_com/frame_parser.h"
+#include "../include/noah_powerboard/frames.h"
+
+#define SIM_ADC_FIELD_NUM               32
+#define SIM_VOLTAGE_INFO_LEN            76      //sizeof(voltage_info_t)
+#define SIM_HW_VERSION                  "SIM"
+#define SIM_SW_VERSION                  "NOAH_PB_SIM_V1.0"
+#define SIM_PROTOCOL_VERSION            "NOAH_PB_P_V1.0"
+#define SIM_MODULE_DEFAULT              0x0000ffff
+#define SIM_BAT_MV                      25600
+#define SIM_BAT_PERCENT                 80
+
+typedef struct
+{
+    const char      *link;
+    int             delay_ms;
+    int             jitter_ms;
+    double          byte_drop_rate;
+    double          corrupt_rate;
+    int             verbose;
+}sim_option_t;
+
+typedef struct
+{
+    uint32_t        module;
+    uint8_t         led[5];         //effect, r, g, b, period
+    uint8_t         ir_percent;
+    uint16_t        sys_status;
+    uint8_t         adc_send_rate;
+    int             adc_period_ms;  //auto upload period, 0 is off
+    uint64_t        adc_next_ms;
+
+    uint32_t        rx_frames;
+    uint32_t        tx_frames;
+    uint32_t        dropped_bytes;
+    uint32_t        corrupted_frames;
+}sim_board_t;
+
+static volatile sig_atomic_t sim_exit = 0;
+static sim_option_t opt = {NULL, 0, 0, 0.0, 0.0, 0};
+static sim_board_t board;
+static std::multimap<uint64_t, std::vector<uint8_t> > tx_queue;     //due time to frame
+
+//send rate code of GET_CURRENT to upload period
+static const int adc_period_table[] = {0, 1000, 500, 200, 100, 20, 10, 2000, 5000, 10000};
+
+static void sim_signal(int)
+{
+    sim_exit = 1;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / (1000 * 1000);
+}
+
+static double random_unit(void)
+{
+    return rand() / ((double)RAND_MAX + 1.0);
+}
+
+static void queue_reply(uint8_t type, const uint8_t *payload, int len)
+{
+    std::vector<uint8_t> frame(len + 5);
+    int delay = opt.delay_ms;
+
+    frame[0] = MCU_FRAME_HEAD;
+    frame[1] = len + 5;
+    frame[2] = type;
+    memcpy(&frame[3], payload, len);
+    frame[len + 3] = FrameParser::CheckSum(&frame[0], len + 3);
+    frame[len + 4] = MCU_FRAME_TAIL;
+    if(random_unit() < opt.corrupt_rate)
+    {
+        frame[len + 3] ^= 0x5a;
+        board.corrupted_frames++;
+    }
+
+    if(opt.jitter_ms > 0)
+    {
+        delay += rand() % (2 * opt.jitter_ms + 1) - opt.jitter_ms;
+    }
+    if(delay < 0)
+    {
+        delay = 0;
+    }
+    tx_queue.insert(std::make_pair(now_ms() + delay, frame));
+}
+
+static void put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *buf, uint32_t value)
+{
+    put_u16(buf, value & 0xffff);
+    put_u16(buf + 2, value >> 16);
+}
+
+static void queue_adc_sample(void)
+{
+    uint8_t payload[1 + SIM_VOLTAGE_INFO_LEN] = {0};
+    uint8_t *data = &payload[1];
+
+    payload[0] = 0x01;
+    for(int i = 0; i < SIM_ADC_FIELD_NUM; i++)
+    {
+        put_u16(&data[i * 2], 100 + rand() % 50);
+    }
+    //voltages and temperatures where voltage_data_t keeps them
+    put_u16(&data[19 * 2], 40 + rand() % 3);
+    put_u16(&data[20 * 2], 38 + rand() % 3);
+    put_u16(&data[21 * 2], 35 + rand() % 3);
+    put_u16(&data[22 * 2], 30 + rand() % 3);
+    put_u16(&data[26 * 2], 24000 + rand() % 100);
+    put_u16(&data[27 * 2], 12000 + rand() % 50);
+    put_u16(&data[28 * 2], 5000 + rand() % 20);
+    put_u16(&data[29 * 2], SIM_BAT_MV + rand() % 100);
+    data[SIM_ADC_FIELD_NUM * 2 + 4] = board.adc_send_rate;     //send_rate after fault_bit[4]
+    queue_reply(FRAME_TYPE_GET_CURRENT, payload, sizeof(payload));
+}
+
+static void handle_frame(uint8_t *frame, int len)
+{
+    uint8_t payload[64] = {0};
+    uint8_t type = frame[2];
+
+    board.rx_frames++;
+    if(opt.verbose)
+    {
+        printf("rx type %02x len %d\n", type, len);
+    }
+
+    switch(type)
+    {
+        case FRAME_TYPE_LEDS_CONTROL:
+            memcpy(board.led, &frame[3], sizeof(board.led));
+            queue_reply(type, board.led, sizeof(board.led));
+            break;
+
+        case FRAME_TYPE_SYS_STATUS:
+            put_u16(&payload[1], board.sys_status);
+            queue_reply(type, payload, 3);
+            break;
+
+        case FRAME_TYPE_BAT_STATUS:
+            payload[0] = frame[3];
+            put_u16(&payload[1], (1 == frame[3]) ? SIM_BAT_MV : SIM_BAT_PERCENT);
+            queue_reply(type, payload, 3);
+            break;
+
+        case FRAME_TYPE_GET_MODULE_STATE:
+            payload[0] = frame[3];
+            put_u32(&payload[1], board.module);
+            queue_reply(type, payload, 5);
+            break;
+
+        case FRAME_TYPE_MODULE_CONTROL:
+            {
+                uint32_t module = 0;
+                uint8_t on_off = 0;
+                if(!ModuleControlFrame::Decode(frame, len, module, on_off))
+                {
+                    break;
+                }
+                if(on_off)
+                {
+                    board.module |= module;
+                }
+                else
+                {
+                    board.module &= ~module;
+                }
+                put_u32(payload, board.module);
+                queue_reply(type, payload, 4);
+            }
+            break;
+
+        case FRAME_TYPE_IRLED_CONTROL:
+            if(1 == frame[3])
+            {
+                board.ir_percent = frame[4];
+            }
+            payload[0] = board.ir_percent;
+            queue_reply(type, payload, 1);
+            break;
+
+        case FRAME_TYPE_GET_CURRENT:
+            {
+                uint8_t rate = frame[5];
+                board.adc_send_rate = rate;
+                board.adc_period_ms = (rate < sizeof(adc_period_table) / sizeof(adc_period_table[0])) ? adc_period_table[rate] : 0;
+                board.adc_next_ms = now_ms() + board.adc_period_ms;
+                queue_adc_sample();
+            }
+            break;
+
+        case FRAME_TYPE_GET_VERSION:
+            payload[0] = frame[3];
+            if(0 == frame[3])
+            {
+                memcpy(&payload[1], SIM_HW_VERSION, 3);
+                memcpy(&payload[4], SIM_SW_VERSION, 16);
+                queue_reply(type, payload, 20);
+            }
+            else
+            {
+                memcpy(&payload[1], SIM_PROTOCOL_VERSION, strlen(SIM_PROTOCOL_VERSION));
+                queue_reply(type, payload, 16);
+            }
+            break;
+
+        default:
+            printf("unknown frame type %02x\n", type);
+            break;
+    }
+}
+
+//write the replies that are due, dropping bytes on the way if asked to
+static void flush_replies(int fd)
+{
+    uint64_t now = now_ms();
+
+    while(!tx_queue.empty() && (tx_queue.begin()->first <= now))
+    {
+        std::vector<uint8_t> &frame = tx_queue.begin()->second;
+        std::vector<uint8_t> out;
+
+        out.reserve(frame.size());
+        for(size_t i = 0; i < frame.size(); i++)
+        {
+            if(random_unit() < opt.byte_drop_rate)
+            {
+                board.dropped_bytes++;
+                continue;
+            }
+            out.push_back(frame[i]);
+        }
+        if(!out.empty() && (write(fd, &out[0], out.size()) < 0))
+        {
+            printf("write failed: %s\n", strerror(errno));
+        }
+        board.tx_frames++;
+        tx_queue.erase(tx_queue.begin());
+    }
+}
+
+static int open_pty(int *slave_fd)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if((fd < 0) || (grantpt(fd) < 0) || (unlockpt(fd) < 0))
+    {
+        printf("open pty failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    //keep the slave open with echo off, the node may open it at any time
+    *slave_fd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    if(*slave_fd < 0)
+    {
+        printf("open %s failed: %s\n", ptsname(fd), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    tcgetattr(*slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave_fd, TCSANOW, &tio);
+
+    if(NULL != opt.link)
+    {
+        unlink(opt.link);
+        if(symlink(ptsname(fd), opt.link) < 0)
+        {
+            printf("link %s failed: %s\n", opt.link, strerror(errno));
+        }
+    }
+    printf("powerboard simulator on %s%s%s\n", ptsname(fd), opt.link ? " -> " : "", opt.link ? opt.link : "");
+    fflush(stdout);
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    FrameParser parser;
+    struct pollfd pfd;
+    int master_fd = -1;
+    int slave_fd = -1;
+    int c = 0;
+
+    srand(time(NULL));
+    while((c = getopt(argc, argv, "l:d:j:b:c:s:v")) != -1)
+    {
+        switch(c)
+        {
+            case 'l': opt.link = optarg; break;
+            case 'd': opt.delay_ms = atoi(optarg); break;
+            case 'j': opt.jitter_ms = atoi(optarg); break;
+            case 'b': opt.byte_drop_rate = atof(optarg); break;
+            case 'c': opt.corrupt_rate = atof(optarg); break;
+            case 's': srand(atoi(optarg)); break;
+            case 'v': opt.verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-l link] [-d delay_ms] [-j jitter_ms] [-b byte_drop_rate] [-c corrupt_rate] [-s seed] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    memset(&board, 0, sizeof(board));
+    board.module = SIM_MODULE_DEFAULT;
+    board.sys_status = 2;       //SYS_STATUS_ON
+
+    master_fd = open_pty(&slave_fd);
+    if(master_fd < 0)
+    {
+        return 1;
+    }
+    signal(SIGINT, sim_signal);
+    signal(SIGTERM, sim_signal);
+
+    while(!sim_exit)
+    {
+        uint64_t now = now_ms();
+        int timeout = 100;
+
+        if(!tx_queue.empty())
+        {
+            timeout = (tx_queue.begin()->first > now) ? (int)(tx_queue.begin()->first - now) : 0;
+        }
+        if(board.adc_period_ms > 0)
+        {
+            int adc_timeout = (board.adc_next_ms > now) ? (int)(board.adc_next_ms - now) : 0;
+            timeout = (adc_timeout < timeout) ? adc_timeout : timeout;
+        }
+
+        pfd.fd = master_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if((poll(&pfd, 1, timeout) < 0) && (EINTR != errno))
+        {
+            printf("poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if((pfd.revents & POLLIN) && (parser.Fill(master_fd) > 0))
+        {
+            parser.Parse(handle_frame);
+        }
+
+        if((board.adc_period_ms > 0) && (now_ms() >= board.adc_next_ms))
+        {
+            board.adc_next_ms += board.adc_period_ms;
+            queue_adc_sample();
+        }
+        flush_replies(master_fd);
+    }
+
+    printf("rx %u frames, tx %u frames, %u bytes dropped, %u checksums corrupted\n",
+            board.rx_frames, board.tx_frames, board.dropped_bytes, board.corrupted_frames);
+    if(NULL != opt.link)
+    {
+        unlink(opt.link);
+    }
+    close(slave_fd);
+    close(master_fd);
+    return 0;
+}
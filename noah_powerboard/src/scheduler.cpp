@@ -0,0 +1,405 @@
+#include "ros/ros.h"
+#include <string.h>
+#include "../include/noah_powerboard/frames.h"
+#include "../include/noah_powerboard/scheduler.h"
+
+static uint32_t module_frame_mask(const uint8_t *frame)
+{
+    uint32_t mask = 0;
+    uint8_t on_off = 0;
+    ModuleControlFrame::Decode(frame, frame[1], mask, on_off);
+    return mask;
+}
+
+static uint8_t module_frame_on_off(const uint8_t *frame)
+{
+    uint32_t mask = 0;
+    uint8_t on_off = 0;
+    ModuleControlFrame::Decode(frame, frame[1], mask, on_off);
+    return on_off;
+}
+
+static void module_frame_set_mask(uint8_t *frame, uint32_t mask)
+{
+    ModuleControlFrame::Encode(frame, mask, module_frame_on_off(frame));
+}
+
+CommandScheduler::CommandScheduler()
+{
+    memset(this->policy, 0, sizeof(this->policy));
+    memset(this->class_policy, 0, sizeof(this->class_policy));
+    memset(this->tokens, 0, sizeof(this->tokens));
+    memset(this->refill_ms, 0, sizeof(this->refill_ms));
+    memset(this->metrics, 0, sizeof(this->metrics));
+    this->transactions = NULL;
+    this->dispatching = false;
+    this->link_up = false;
+}
+
+void CommandScheduler::Init(const sched_policy_t *policy, int policy_num, const sched_class_policy_t *class_policy, TransactionTable *transactions)
+{
+    uint64_t now = transaction_now_ms();
+
+    for(int i = 0; i < policy_num; i++)
+    {
+        if(policy[i].frame_type < TRANSACTION_TYPE_NUM)
+        {
+            this->policy[policy[i].frame_type] = policy[i];
+        }
+    }
+    for(int i = 0; i < SCHED_CLASS_NUM; i++)
+    {
+        this->class_policy[i] = class_policy[i];
+        this->tokens[i] = (uint64_t)class_policy[i].burst * 1000;
+        this->refill_ms[i] = now;
+    }
+    this->transactions = transactions;
+}
+
+const sched_policy_t *CommandScheduler::GetPolicy(uint8_t frame_type)
+{
+    static const sched_policy_t default_policy = {0, SCHED_CLASS_CONTROL, SCHED_DEDUP_NONE};
+
+    if((frame_type >= TRANSACTION_TYPE_NUM) || (0 == this->policy[frame_type].frame_type))
+    {
+        return &default_policy;
+    }
+    return &this->policy[frame_type];
+}
+
+bool CommandScheduler::TakeToken(int cls, uint64_t now)
+{
+    const sched_class_policy_t *class_policy = &this->class_policy[cls];
+    uint64_t max_tokens = (uint64_t)class_policy->burst * 1000;
+
+    if(0 == class_policy->rate)
+    {
+        return true;
+    }
+    this->tokens[cls] += (now - this->refill_ms[cls]) * class_policy->rate;
+    this->refill_ms[cls] = now;
+    if(this->tokens[cls] > max_tokens)
+    {
+        this->tokens[cls] = max_tokens;
+    }
+    if(this->tokens[cls] < 1000)
+    {
+        return false;
+    }
+    this->tokens[cls] -= 1000;
+    return true;
+}
+
+//the callbacks run inside Submit() and must not submit again
+void CommandScheduler::Supersede(int cls, sched_cmd_t *cmd)
+{
+    std::vector<transaction_done_t> done;
+
+    done.swap(cmd->done);
+    for(size_t i = 0; i < done.size(); i++)
+    {
+        if(done[i])
+        {
+            done[i](TRANSACTION_ERR_SUPERSEDED);
+        }
+    }
+    this->metrics[cls].superseded++;
+}
+
+/*
+ * A queued switch loses the modules a newer switch turns the other way, and
+ * is dropped once it has none left, so on followed by off goes out as one
+ * frame. A queued switch of the same direction and class takes the new
+ * modules in. Returns true when the new command was merged.
+ */
+bool CommandScheduler::MergeModule(int cls, const uint8_t *frame, transaction_done_t &done)
+{
+    uint32_t mask = module_frame_mask(frame);
+    uint8_t on_off = module_frame_on_off(frame);
+    sched_cmd_t *target = NULL;
+
+    for(int c = 0; c < SCHED_CLASS_NUM; c++)
+    {
+        std::deque<sched_cmd_t>::iterator it = this->queue[c].begin();
+        while(it != this->queue[c].end())
+        {
+            uint32_t queued_mask = 0;
+
+            if(frame[2] != it->frame[2])
+            {
+                ++it;
+                continue;
+            }
+            queued_mask = module_frame_mask(it->frame);
+            if(module_frame_on_off(it->frame) == on_off)
+            {
+                if((c == cls) && (NULL == target))
+                {
+                    target = &(*it);
+                }
+                ++it;
+                continue;
+            }
+            if(0 == (queued_mask & mask))
+            {
+                ++it;
+                continue;
+            }
+            queued_mask &= ~mask;
+            if(0 == queued_mask)
+            {
+                this->Supersede(c, &(*it));
+                it = this->queue[c].erase(it);
+                continue;
+            }
+            module_frame_set_mask(it->frame, queued_mask);
+            ++it;
+        }
+    }
+
+    if(NULL == target)
+    {
+        return false;
+    }
+    module_frame_set_mask(target->frame, module_frame_mask(target->frame) | mask);
+    target->done.push_back(done);
+    return true;
+}
+
+int CommandScheduler::Submit(const uint8_t *frame, transaction_done_t done, int cls)
+{
+    const sched_policy_t *policy = this->GetPolicy(frame[2]);
+    sched_cmd_t cmd;
+
+    if((cls < 0) || (cls >= SCHED_CLASS_NUM))
+    {
+        cls = policy->cls;
+    }
+    this->metrics[cls].submitted++;
+
+    switch(policy->dedup)
+    {
+        case SCHED_DEDUP_REPLACE:
+            for(size_t i = 0; i < this->queue[cls].size(); i++)
+            {
+                sched_cmd_t *queued = &this->queue[cls][i];
+                if(queued->frame[2] == frame[2])
+                {
+                    //keeps its place and submit time, only the content is newer
+                    this->Supersede(cls, queued);
+                    memcpy(queued->frame, frame, frame[1]);
+                    queued->done.push_back(done);
+                    this->Dispatch();
+                    return 0;
+                }
+            }
+            break;
+
+        case SCHED_DEDUP_SAME:
+            for(size_t i = 0; i < this->queue[cls].size(); i++)
+            {
+                sched_cmd_t *queued = &this->queue[cls][i];
+                if((queued->frame[1] == frame[1]) && (0 == memcmp(queued->frame, frame, frame[1])))
+                {
+                    queued->done.push_back(done);
+                    return 0;
+                }
+            }
+            break;
+
+        case SCHED_DEDUP_MODULE:
+            if(this->MergeModule(cls, frame, done))
+            {
+                this->Dispatch();
+                return 0;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if(this->queue[cls].size() >= SCHED_QUEUE_DEPTH)
+    {
+        std::vector<transaction_done_t> dropped;
+
+        ROS_ERROR("class %d: command queue full, drop the oldest", cls);
+        dropped.swap(this->queue[cls].front().done);
+        this->queue[cls].pop_front();
+        this->metrics[cls].dropped++;
+        for(size_t i = 0; i < dropped.size(); i++)
+        {
+            if(dropped[i])
+            {
+                dropped[i](TRANSACTION_ERR_DROPPED);
+            }
+        }
+    }
+
+    memcpy(cmd.frame, frame, frame[1]);
+    cmd.submit_ms = transaction_now_ms();
+    cmd.done.push_back(done);
+    this->queue[cls].push_back(cmd);
+    if(this->queue[cls].size() > this->metrics[cls].max_depth)
+    {
+        this->metrics[cls].max_depth = this->queue[cls].size();
+    }
+
+    this->Dispatch();
+    return 0;
+}
+
+void CommandScheduler::Send(int cls, uint64_t now)
+{
+    sched_cmd_t cmd;
+    transaction_done_t done;
+    uint32_t wait_ms = 0;
+
+    //off the queue before sending, the callbacks may submit again
+    memcpy(cmd.frame, this->queue[cls].front().frame, this->queue[cls].front().frame[1]);
+    cmd.submit_ms = this->queue[cls].front().submit_ms;
+    cmd.done.swap(this->queue[cls].front().done);
+    this->queue[cls].pop_front();
+
+    wait_ms = now - cmd.submit_ms;
+    this->metrics[cls].sent++;
+    this->metrics[cls].wait_ms_sum += wait_ms;
+    if(wait_ms > this->metrics[cls].wait_ms_max)
+    {
+        this->metrics[cls].wait_ms_max = wait_ms;
+    }
+
+    if(1 == cmd.done.size())
+    {
+        done = cmd.done[0];
+    }
+    else if(cmd.done.size() > 1)
+    {
+        std::vector<transaction_done_t> all;
+        all.swap(cmd.done);
+        done = [all](int result)
+        {
+            for(size_t i = 0; i < all.size(); i++)
+            {
+                if(all[i])
+                {
+                    all[i](result);
+                }
+            }
+        };
+    }
+    this->transactions->Begin(cmd.frame, done);
+}
+
+/*
+ * Critical frames go out at once. The other classes wait while
+ * SCHED_INFLIGHT_MAX frames are unanswered, so a critical frame never
+ * queues behind a burst on the wire, and each spends its own tokens.
+ * Called after every submit and on every loop tick.
+ */
+void CommandScheduler::Dispatch(void)
+{
+    uint64_t now = transaction_now_ms();
+
+    if(!this->link_up || this->dispatching || (NULL == this->transactions))
+    {
+        return;
+    }
+    this->dispatching = true;
+    for(int cls = 0; cls < SCHED_CLASS_NUM; cls++)
+    {
+        while(!this->queue[cls].empty())
+        {
+            if((SCHED_CLASS_CRITICAL != cls) && (this->transactions->PendingCount() >= SCHED_INFLIGHT_MAX))
+            {
+                break;
+            }
+            if(!this->TakeToken(cls, now))
+            {
+                break;
+            }
+            this->Send(cls, now);
+        }
+    }
+    this->dispatching = false;
+}
+
+/*
+ * When Dispatch() can send a command held back by its token bucket, 0 when
+ * none is. Commands waiting for frames in flight go out after a reply or
+ * timeout, which wakes the loop anyway.
+ */
+uint64_t CommandScheduler::NextDispatch(uint64_t now)
+{
+    uint64_t next = 0;
+
+    if(!this->link_up || (NULL == this->transactions))
+    {
+        return 0;
+    }
+    for(int cls = 0; cls < SCHED_CLASS_NUM; cls++)
+    {
+        const sched_class_policy_t *class_policy = &this->class_policy[cls];
+        uint64_t tokens = 0;
+        uint64_t at = now;
+
+        if(this->queue[cls].empty())
+        {
+            continue;
+        }
+        if((SCHED_CLASS_CRITICAL != cls) && (this->transactions->PendingCount() >= SCHED_INFLIGHT_MAX))
+        {
+            continue;
+        }
+        if(0 != class_policy->rate)
+        {
+            tokens = this->tokens[cls] + (now - this->refill_ms[cls]) * class_policy->rate;
+            if(tokens < 1000)
+            {
+                at = now + (1000 - tokens + class_policy->rate - 1) / class_policy->rate;
+            }
+        }
+        if((0 == next) || (at < next))
+        {
+            next = at;
+        }
+    }
+    return next;
+}
+
+//commands submitted while the link is down wait for it
+void CommandScheduler::SetLinkUp(bool up)
+{
+    this->link_up = up;
+    this->Dispatch();
+}
+
+void CommandScheduler::Abort(int result)
+{
+    for(int cls = 0; cls < SCHED_CLASS_NUM; cls++)
+    {
+        while(!this->queue[cls].empty())
+        {
+            std::vector<transaction_done_t> done;
+            done.swap(this->queue[cls].front().done);
+            this->queue[cls].pop_front();
+            for(size_t i = 0; i < done.size(); i++)
+            {
+                if(done[i])
+                {
+                    done[i](result);
+                }
+            }
+        }
+    }
+}
+
+void CommandScheduler::GetMetrics(int cls, sched_metrics_t *metrics, bool reset)
+{
+    this->metrics[cls].depth = this->queue[cls].size();
+    *metrics = this->metrics[cls];
+    if(reset)
+    {
+        memset(&this->metrics[cls], 0, sizeof(sched_metrics_t));
+    }
+}
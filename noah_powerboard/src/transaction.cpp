@@ -0,0 +1,193 @@
+#include "ros/ros.h"
+#include <string.h>
+#include <time.h>
+#include "../include/noah_powerboard/transaction.h"
+
+uint64_t transaction_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / (1000 * 1000);
+}
+
+TransactionTable::TransactionTable()
+{
+    for(int i = 0; i < TRANSACTION_TYPE_NUM; i++)
+    {
+        memset(&this->queue[i].policy, 0, sizeof(transaction_policy_t));
+        this->queue[i].head = 0;
+        this->queue[i].count = 0;
+    }
+    this->stats = NULL;
+}
+
+void TransactionTable::Init(const transaction_policy_t *policy, int policy_num, transaction_send_t send)
+{
+    for(int i = 0; i < policy_num; i++)
+    {
+        if(policy[i].frame_type < TRANSACTION_TYPE_NUM)
+        {
+            this->queue[policy[i].frame_type].policy = policy[i];
+        }
+    }
+    this->send = send;
+}
+
+void TransactionTable::SetStats(LinkStats *stats)
+{
+    this->stats = stats;
+}
+
+transaction_queue_t *TransactionTable::GetQueue(uint8_t frame_type)
+{
+    if((frame_type >= TRANSACTION_TYPE_NUM) || (0 == this->queue[frame_type].policy.timeout_ms))
+    {
+        return NULL;
+    }
+    return &this->queue[frame_type];
+}
+
+void TransactionTable::Pop(transaction_queue_t *queue, int result)
+{
+    transaction_done_t done;
+
+    if(0 == queue->count)
+    {
+        return;
+    }
+    //pop before calling back, the callback is allowed to start a new transaction
+    done.swap(queue->slot[queue->head].done);
+    queue->head = (queue->head + 1) % TRANSACTION_QUEUE_DEPTH;
+    queue->count--;
+    if(done)
+    {
+        done(result);
+    }
+}
+
+/*
+ * Send the frame right away and remember it until the reply with the same
+ * frame type arrives. Replies of one type come back in order, so several
+ * commands of one type can be in flight and are matched in FIFO order.
+ */
+int TransactionTable::Begin(const uint8_t *frame, transaction_done_t done)
+{
+    transaction_queue_t *queue = NULL;
+    transaction_t *transaction = NULL;
+    uint8_t frame_len = frame[1];
+    int error = -1;
+
+    error = this->send(frame, frame_len);
+
+    queue = this->GetQueue(frame[2]);
+    if(NULL == queue)
+    {
+        //no reply expected for this frame type
+        return error;
+    }
+
+    if(TRANSACTION_QUEUE_DEPTH == queue->count)
+    {
+        ROS_ERROR("frame type %02x: too many commands in flight, drop the oldest", frame[2]);
+        this->Pop(queue, TRANSACTION_ERR_DROPPED);
+    }
+
+    transaction = &queue->slot[(queue->head + queue->count) % TRANSACTION_QUEUE_DEPTH];
+    memcpy(transaction->frame, frame, frame_len);
+    transaction->retries_left = queue->policy.retry_times;
+    transaction->deadline_ms = transaction_now_ms() + queue->policy.timeout_ms;
+    transaction->sent_us = link_stats_now_us();
+    transaction->done = done;
+    queue->count++;
+
+    return error;
+}
+
+void TransactionTable::Complete(uint8_t frame_type, int result)
+{
+    transaction_queue_t *queue = this->GetQueue(frame_type);
+    if((NULL == queue) || (0 == queue->count))
+    {
+        return;
+    }
+    if((NULL != this->stats) && (result >= 0))
+    {
+        this->stats->AddRtt(frame_type, link_stats_now_us() - queue->slot[queue->head].sent_us);
+    }
+    this->Pop(queue, result);
+}
+
+void TransactionTable::CheckTimeout(void)
+{
+    uint64_t now = transaction_now_ms();
+
+    for(int i = 0; i < TRANSACTION_TYPE_NUM; i++)
+    {
+        transaction_queue_t *queue = &this->queue[i];
+        transaction_t *transaction = NULL;
+
+        if((0 == queue->count) || (now < queue->slot[queue->head].deadline_ms))
+        {
+            continue;
+        }
+
+        transaction = &queue->slot[queue->head];
+        if(transaction->retries_left > 0)
+        {
+            transaction->retries_left--;
+            transaction->deadline_ms = now + queue->policy.timeout_ms;
+            ROS_ERROR("frame type %02x: no reply, start to resend", i);
+            transaction->sent_us = link_stats_now_us();
+            this->send(transaction->frame, transaction->frame[1]);
+            if(NULL != this->stats)
+            {
+                this->stats->retries.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            if(NULL != this->stats)
+            {
+                this->stats->timeouts.fetch_add(1, std::memory_order_relaxed);
+            }
+            this->Pop(queue, TRANSACTION_ERR_TIMEOUT);
+        }
+    }
+}
+
+//fail everything in flight, e.g. when the device went away
+void TransactionTable::Abort(int result)
+{
+    for(int i = 0; i < TRANSACTION_TYPE_NUM; i++)
+    {
+        while(this->queue[i].count > 0)
+        {
+            this->Pop(&this->queue[i], result);
+        }
+    }
+}
+
+int TransactionTable::PendingCount(void)
+{
+    int count = 0;
+    for(int i = 0; i < TRANSACTION_TYPE_NUM; i++)
+    {
+        count += this->queue[i].count;
+    }
+    return count;
+}
+
+//earliest reply deadline in flight, 0 when nothing is
+uint64_t TransactionTable::NextDeadline(void)
+{
+    uint64_t deadline = 0;
+    for(int i = 0; i < TRANSACTION_TYPE_NUM; i++)
+    {
+        transaction_queue_t *queue = &this->queue[i];
+        if((queue->count > 0) && ((0 == deadline) || (queue->slot[queue->head].deadline_ms < deadline)))
+        {
+            deadline = queue->slot[queue->head].deadline_ms;
+        }
+    }
+    return deadline;
+}
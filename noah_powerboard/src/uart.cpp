@@ -152,7 +152,9 @@ int open_com_device(char *dev)
     int    fd = open(dev, O_RDWR );         //| O_NOCTTY | O_NDELAY    
     if (-1 == fd)    
     {             
-        ROS_ERROR("Can't Open Serial Port");        
+        int err = errno;    //callers tell an absent device from other failures
+        ROS_ERROR("Can't Open Serial Port %s: %s", dev, strerror(err));
+        errno = err;
     }    
     
     return fd;
@@ -9,6 +9,13 @@
 #define FORCE_UPDATE_LEN  (8)
 #define DOWNLOAD_BUF_SIZE  (10)
 
+#define DOWNLOAD_DIR  "/home/robot/catkin_ws/download/"   //the upgrade steps in system.cpp look here
+#define DOWNLOAD_PART_SUFFIX  ".part"     //a file being received, <part>.md5 tells which image it is
+#define DOWNLOAD_RATE  (256)              //KiB/s for all downloads together, ~download_rate overrides, 0 no cap
+#define DOWNLOAD_TRIES  (3)               //transfers of one file per round, each resumes the last
+#define DOWNLOAD_STALL_TIME  (60)         //s without a byte before a transfer is given up
+#define DOWNLOAD_WAIT_MS  (100)
+
 
 typedef struct{
     unsigned char name[NAME_LEN];
@@ -40,7 +47,15 @@ typedef struct{
 
 
 
+extern void reset_cloud_params(void);
 extern int set_avalible_cloud_buf(module_upgrade_t *upgrade);
 extern download_t *get_download_buf(int i);
+//percent of download_buf[i] received, -1 while not known or after a failure; any thread
+extern int get_download_progress(int i);
+extern void set_download_rate(int kib_per_s);
+//where the files go, DOWNLOAD_DIR unless a bench runs the downloader elsewhere
+extern void set_download_dir(const char *dir);
+//every file set_avalible_cloud_buf() queued, returns when each is received or failed; worker thread
+extern void download_waiting_files(void);
 
 #endif 
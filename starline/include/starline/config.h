@@ -260,6 +260,7 @@ typedef struct{
     unsigned char download_index;
     unsigned char upgrade_status;
     unsigned char upgrade_md5[MD5_SIZE];
+    unsigned char upgrade_version[VERSION_LEN];
     unsigned char upgrade_result;
 }sensor_t;
 
@@ -321,6 +322,7 @@ typedef struct{
     unsigned char download_index;
     unsigned char upgrade_status;
     unsigned char upgrade_md5[MD5_SIZE];
+    unsigned char upgrade_version[VERSION_LEN];
     unsigned char upgrade_result;
 	unsigned char move_sensor_state;
 
@@ -432,6 +434,7 @@ typedef struct{
     unsigned char download_index;
     unsigned char upgrade_status;
     unsigned char upgrade_md5[MD5_SIZE];
+    unsigned char upgrade_version[VERSION_LEN];
     unsigned char upgrade_result;
 
 	int error_power_status;
@@ -449,7 +452,6 @@ typedef struct{
     int upgrade_file_size;
     int upgrade_file_rcv_size;
     char upgrade_file_name[32];
-    char *upgrade_file;
     unsigned char upgrade_file_crc;
 }upgrade_t;
 
@@ -647,13 +649,6 @@ typedef enum{
 
 
 typedef struct{
-    int handle_upper_com_flag;
-
-    int need_read_flag;
-    int read_num;
-    unsigned char upper_com_buf[UPPER_COM_HANDLE_LEN];
-
-
     com_state_e com_state;
     int com_device;
     char dev[DEVICE_NAME_LEN];
@@ -675,6 +670,12 @@ typedef struct{
 
 }upper_com_sys_t;
 
+//the part of upper_com_sys the main loop reads
+typedef struct{
+    int socket_status;
+    int work_normal;
+}upper_com_state_t;
+
 extern void set_speed(int fd, int speed);
 extern int set_parity(int fd,int databits,int stopbits,int parity);
 extern int open_com_device(char *dev);
@@ -685,16 +686,20 @@ extern int handle_upgrade_file_begin(system_t *sys, unsigned char *buf);
 extern int handle_upgrade_file_data(system_t *sys, unsigned char *buf);
 extern int handle_upgrade_file_done(system_t *sys, unsigned char *buf);
 extern int check_upgrade_system(system_t *sys,env_t *env,unsigned char *data,int *force);
-extern upper_com_sys_t* get_upper_com_system_info(void);
+extern void get_upper_com_state(upper_com_state_t *state);
+extern int read_upper_com_data(unsigned char *buf,int len);
 extern int send_status_back(unsigned char *buf,int num);
 
 //upper_com.cpp
 extern void set_upper_beat_flag(int data);
 extern int upper_socket_status(void);
-extern void *upper_com_thread_start(void *);
+extern int upper_tx_free(void);
+extern uint64_t upper_tx_mark(unsigned int *epoch);
+extern int upper_tx_flushed(uint64_t mark,unsigned int epoch);
+extern int upper_com_start(void);
 extern unsigned int get_upper_server_ip(void);
 
 //cloud.cpp
-extern void *cloud_com_thread_start(void *);
+extern int cloud_com_start(void);
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include "../include/starline/config.h"
+#include "../include/starline/report.h"
+
+/*
+ * Events waiting for the upper, oldest first. Each event is kept as the
+ * record check system sends: level,module,function,len and len data
+ * bytes, packed one after another in a byte ring. A hash of the record
+ * finds an event that is still pending in O(1), so a repeated event is
+ * not queued twice.
+ *
+ * With a spool file the pending events also survive a lost socket and
+ * a restart: the records go to the file once a second, and at once when
+ * the ring is full. The ring is refilled from the file as the events are
+ * delivered, and the file is emptied when nothing is pending.
+ *
+ * Any thread may put events; peek/consume/sync are for the main loop.
+ */
+#define EVENT_REC_HEAD          (4)                     //level,module,function,len
+#define EVENT_REC_MAX           (EVENT_REC_HEAD + 255)
+#define EVENT_STORE_LEN         (64*1024)               //ring, power of two
+#define EVENT_SPOOL_MAX         (4*1024*1024)           //spool file, beyond it events are dropped and counted
+#define EVENT_SPOOL_HEAD        (8)                     //spool offset of the first pending record
+
+extern int event_store_init(const char *spool_path);
+//0 when queued or already pending, -1 when dropped
+extern int event_store_put(const ans_status_t *ans);
+//copies up to max_num whole records from the oldest on into buf, returns the bytes
+extern int event_store_peek(unsigned char *buf,int len,int max_num,int *num);
+//buf and used as peek returned them, the records were delivered
+extern void event_store_consume(const unsigned char *buf,int used);
+extern void event_store_sync(void);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef STARLINE_FRAMES_H
+#define STARLINE_FRAMES_H
+
+#include "mcu_com/frame_codec.h"
+
+/*
+ * Requests starline sends to its MCUs, payload fields in wire order.
+ * The file transfer frames of an upgrade carry a variable length chunk
+ * and are still put together by hand.
+ */
+
+//upgrade frames are the same on every board, fw_upgrade.cpp sends them with EncodeAs()
+//under the board's upgrade type
+//upgrade start: 0, md5 of the file, file size
+typedef FrameSchema<0x00, FrameU8, FrameBytes<16>, FrameBe<uint32_t> > UpgradeReadyFrame;
+//upgrade end: 2, 0
+typedef FrameSchema<0x00, FrameU8, FrameU8> UpgradeEndFrame;
+//upgrade resume: 3, md5 of the file, file bytes the board already holds
+typedef FrameSchema<0x00, FrameU8, FrameBytes<16>, FrameBe<uint32_t> > UpgradeResumeFrame;
+
+//movebase
+typedef FrameSchema<0x60> MoveClearOpenSignalFrame;
+typedef FrameSchema<0x61> MoveGetOpenSignalFrame;
+typedef FrameSchema<0x62, FrameU8, FrameU8> MoveSetLimitFrame;              //high, low in mm
+typedef FrameSchema<0x63> MoveGetLimitFrame;
+typedef FrameSchema<0x64, FrameU8> MoveSetSensorFunctionFrame;
+typedef FrameSchema<0x65> MoveGetSensorFunctionFrame;
+typedef FrameSchema<0x66> MoveClearErrorFrame;
+typedef FrameSchema<0x67> MoveGetErrorFrame;
+typedef FrameSchema<0x68, FrameBe<int16_t>, FrameBe<int16_t> > MoveSpeedFrame;  //vx mm/s, vth mrad/s
+typedef FrameSchema<0x69, FrameU8> MoveHandspikeFrame;                      //0 stop, 1 lift, 2 down, 3 power
+typedef FrameSchema<0x6E> MoveGetVersionFrame;
+
+//sensor board
+typedef FrameSchema<0x01, FrameBytes<10> > SensorSetSafeDistanceFrame;      //cm, one byte per sensor
+typedef FrameSchema<0x02, FrameU8> SensorGetSafeDistanceFrame;
+typedef FrameSchema<0x03, FrameU8> SensorGetDataFrame;
+typedef FrameSchema<0x0D, FrameU8, FrameU8> SensorCaliFrame;                //command, parameter
+typedef FrameSchema<0x0E, FrameU8> SensorGetVersionFrame;
+
+//led and power board
+typedef FrameSchema<0x01, FrameU8, FrameBe<uint16_t> > LedEffectFrame;      //LED_POWER_TYPE, LED_EFFECT_TYPE
+typedef FrameSchema<0x02, FrameU8> LedGetSysStatusFrame;
+typedef FrameSchema<0x03, FrameU8> LedGetModuleSwitchFrame;
+typedef FrameSchema<0x04, FrameU8> LedGetCurrentFaultFrame;
+typedef FrameSchema<0x05, FrameU8, FrameU8> LedPowerFunctionFrame;          //module, command
+typedef FrameSchema<0x06, FrameU8, FrameU8> LedInfraredFrame;               //type, light
+typedef FrameSchema<0x08, FrameU8> LedFanFrame;
+typedef FrameSchema<0x0A, FrameU8, FrameU8, FrameU8> LedGetCurrentFrame;
+typedef FrameSchema<0x0B, FrameU8> LedGetErrorFrame;
+typedef FrameSchema<0x0E, FrameU8> LedGetVersionFrame;
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef FW_UPGRADE_H
+#define FW_UPGRADE_H
+
+#include <stdint.h>
+#include "../include/starline/config.h"
+
+/*
+ * Firmware transfer to the movebase, sensor and led/power boards, which
+ * share one upgrade protocol: a ready frame (0), the file in data frames
+ * (1), an end frame (2), each answered by the board with its type and
+ * a result byte, 0 for success.
+ *
+ * The data frames carry no offset and their acks no sequence number,
+ * the board appends every frame it accepts. So up to a window of frames
+ * is sent ahead and the acks are matched to them in order; a failed ack
+ * sends everything from that frame on again. A lost ack shows only when
+ * the acks stop, and by then the board may hold frames counted as not
+ * acked: the acks still on their way are dropped, and with more than one
+ * frame outstanding the board is put back at the first of them with a
+ * resume frame, or started over with a ready frame and a window of 1.
+ * A window of 1 is safe with any board firmware, a wider one needs a
+ * board that drops the frames after a failed one; a frame lost on the
+ * way is not noticed by such a board and only fails the end check.
+ *
+ * The transfer runs on a worker thread and waits for the acks, which
+ * fw_upgrade_ack() hands over from the reactor thread.
+ *
+ * While a file is sent, the bytes the board acked are saved next to it in
+ * <file>.ckpt with the file md5 and the board version. A later try asks
+ * the board to resume (3) there instead of sending a ready frame; a board
+ * that answers anything but 0, or nothing, gets the whole file again.
+ * The board version is asked for on the reactor thread, which hands the
+ * reply over with fw_upgrade_version().
+ */
+#define FW_UPGRADE_READY            0
+#define FW_UPGRADE_DATA             1
+#define FW_UPGRADE_END              2
+#define FW_UPGRADE_RESUME           3
+
+#define FW_UPGRADE_WINDOW           1       //frames in flight unless ~upgrade_window says otherwise
+#define FW_UPGRADE_WINDOW_MAX       16
+#define FW_UPGRADE_ACK_MS           500     //a data frame without ack by then is sent again
+#define FW_UPGRADE_RESUME_WAIT_MS   500     //boards without resume do not answer it
+#define FW_UPGRADE_VERSION_TRIES    10      //version requests before the board counts as unknown
+#define FW_UPGRADE_VERSION_WAIT_MS  60      //for the answer to one version request
+
+#define FW_CHECKPOINT_SUFFIX        ".ckpt"
+#define FW_CHECKPOINT_FRAMES        32      //acked frames between two checkpoint writes
+
+typedef struct fw_upgrade_s fw_upgrade_t;
+//sends one whole frame to the board, frame[1] is its length
+typedef int (*fw_upgrade_send_t)(unsigned char *frame);
+//asks the board for its version, reactor thread
+typedef void (*fw_upgrade_version_t)(void);
+
+//name for the log, type of the board's upgrade frames, file bytes per data frame, seconds for the whole file,
+//longest waits for the ready and the end ack
+extern fw_upgrade_t *fw_upgrade_create(const char *name,unsigned char type,int frame_len,int deadline_s,
+    int ready_wait_ms,int end_wait_ms,fw_upgrade_send_t send,fw_upgrade_version_t request_version);
+//the board answered an upgrade frame, reactor thread
+extern void fw_upgrade_ack(fw_upgrade_t *up,int upgrade_type,int rlt);
+//the board reported its software version, reactor thread
+extern void fw_upgrade_version(fw_upgrade_t *up,const unsigned char *version,int len);
+
+//one try at flashing path, version is the one the image brings and may be empty for not known;
+//0 flashed or the board runs version already, >0 the end ack of a board that refused the image,
+//-1 the file can not be read, -2 ready ack 1, -3 ready ack 2, -8 other ready ack,
+//-4 deadline passed, -6 no ready ack, -7 no end ack; the ready errors also when a board that
+//lost its place in the file had to start over
+extern int fw_upgrade_run(fw_upgrade_t *up,const char *path,const char *md5,const char *version);
+//percent of the file the board has acked, -1 before the first transfer
+extern int fw_upgrade_progress(fw_upgrade_t *up);
+
+extern void set_fw_upgrade_window(int window);
+
+#endif
@@ -143,6 +143,7 @@ typedef enum{
     PKG_REPORT_NAV_FINISHED = 0x8300,
     PKG_REPORT_DANCE_FINISHED = 0x8301,
     PKG_REPORT_SHUTDOWN = 0x8302,
+    PKG_REPORT_EVENTS = 0x8303,
 
     PKG_REPORT_AI_WORDS = 0x8340,
 }UPPER_CMD_TYPE;
@@ -153,6 +154,7 @@ typedef enum{
 extern int send_pkg_back(unsigned short int pkg_type,system_t *sys,
     motion_t *motion,env_t *env,int data,int type,unsigned char *str);
 extern void handle_upper_com_cmd(system_t *sys,motion_t *motion,env_t *env);
+extern void init_upper_cmd_table(void);
 
 
 
@@ -1,21 +1,19 @@
 #ifndef LED_H
 #define LED_H
 
+#include <atomic>
+
 #define POWER_CURRENT_LEN 33
 #define LED_UPGRADE_FILE_FRAME_LEN 240
 #define LED_UPGRADE_OVER_TIME 5*60
 #define LED_HARDWARE_VER_LEN 2
 #define LED_SOFTWARE_VER_LEN 11
-#define LED_READY_UPGRADE_SLEEP_TIME 5000*1000
-#define LED_END_UPGRADE_SLEEP_TIME 5000*1000
-#define LED_SLEEP_TIME 60*1000
+#define LED_READY_UPGRADE_WAIT_MS 5000    //longest wait for the ready/end ack
+#define LED_END_UPGRADE_WAIT_MS 5000
+#define LED_SLEEP_TIME (60*1000)
 #define POWER_ERROR_DATA_LEN 2
 
 typedef struct{
-    int handle_data_flag;
-
-    unsigned char heart_beat_flag;
-
     unsigned char pkg_type;
     unsigned int work_flag;
     LED_POWER_TYPE cmd_mode;           //command
@@ -65,6 +63,7 @@ typedef struct{
     char version_flag;
 	char name[FILE_PATH_LEN];
 	char md5[MD5_SIZE];
+	char upgrade_version[VERSION_LEN];	//of the image to flash
 	unsigned char upgrade_status;
 	int upgrade_result;
 	
@@ -79,13 +78,9 @@ typedef struct{
 	int recv_len;
 	int current_ctrl_type;
 	int current_ctrl_rlt;
-	int ctrl_power_ack;
+	std::atomic<int> ctrl_power_ack;	//written by the reactor, polled by set_led_power_function()
 	int get_power_current_ack;
 	int fan_switch_ack;
-	int upgrade_type;
-	int upgrade_ready_rlt;
-	int upgrade_recv_rlt;
-	int upgrade_end_rlt;
 	int power_current_temp_err;
 	unsigned char err1;
     unsigned char err2;
@@ -94,19 +89,23 @@ typedef struct{
 	unsigned char power_i_freq;
 }led_info_t;
 
-extern int led_upgrade(char * path,char * md5char);
+extern int led_upgrade(const char * path,const char * md5char,const char * version);
 extern void get_led_version(void);
 extern int set_led_power_function(int module,int command);
 extern int set_led_power_effect(LED_POWER_TYPE mode,LED_EFFECT_TYPE effect);
 extern void infrared_light_ctrl(int type,int light);
 extern void fan_switch_ctrl(int fan_switch);
 
-extern led_power_sys_t *get_led_power_info(void);
-extern void *led_thread_start(void *);
+extern void get_led_power_info(led_power_sys_t *info);
+extern int swap_led_heart_beat_flag(int flag);
+extern int led_start(void);
+class LinkStats;
+extern LinkStats *get_led_link_stats(void);
 extern void set_led_prior(int type,int value);
 extern int get_led_prior(void);
-extern int set_power_upgrade(char *str,char *md5);
+extern int set_power_upgrade(char *str,char *md5,char *version);
 extern int get_power_upgrade_status(void);
+extern int get_power_upgrade_progress(void);
 extern int get_power_upgrade_result(void);
 
 extern void set_get_power_flag(void);
@@ -41,6 +41,10 @@ typedef struct
   a += b; \
 }                                            
 
+//a digest over data that comes in pieces: init once, update per piece, final once
+extern void init_md5(md5_ctx *context);
+extern void update_md5(md5_ctx *context, unsigned char *input, unsigned int inputlen);
+extern void final_md5(md5_ctx *context, unsigned char digest[16]);
 extern int compute_md5(unsigned char *data,int len,unsigned char *md5_value);
 extern int md5_string_to_hex(unsigned char *md5,unsigned char *value);
 
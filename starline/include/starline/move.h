@@ -1,13 +1,17 @@
 #ifndef MOVE_H
 #define MOVE_H
 
+#include <atomic>
+
 #define MOVE_UPGRADE_FILE_FRAME_LEN 240
 #define MOVE_UPGRADE_OVER_TIME 5*60
 #define MOVE_HARDWARE_VER_LEN 4
 #define MOVE_SOFTWARE_VER_LEN 11
-#define MOVE_READY_UPGRADE_SLEEP_TIME 3000*1000
-#define MOVE_END_UPGRADE_SLEEP_TIME  5000*1000
-#define MOVE_SLEEP_TIME 60*1000
+#define MOVE_READY_UPGRADE_WAIT_MS 3000    //longest wait for the ready/end ack
+#define MOVE_END_UPGRADE_WAIT_MS 5000
+#define MOVE_SLEEP_TIME (60*1000)
+#define MOVE_FRAME_VEL_MAX 32.767      //m/s and rad/s, the speed frame carries mm/s and mrad/s in int16
+#define MOVE_EXPRESS_WARN_US 1000      //cmd_vel reception to write
 
 typedef struct{
     point_t odom;
@@ -29,7 +33,6 @@ typedef struct{
     unsigned char cmd;
     unsigned char move_sensor_state;
 	int move_open_station;
-    int handle_data_flag;
     int work_normal;
     int com_rssi;       //the interface judge com communication
     int rec_num;
@@ -40,6 +43,7 @@ typedef struct{
 	unsigned char software_version[MOVE_SOFTWARE_VER_LEN];
 	char name[FILE_PATH_LEN];
 	char md5[MD5_SIZE];
+	char upgrade_version[VERSION_LEN];	//of the image to flash
 	unsigned char upgrade_status;
 	int upgrade_result;
 }move_sys_t;
@@ -48,21 +52,22 @@ typedef struct{
     int recv_type;
 	int recv_len;
 	
-	unsigned char move_open_station_ack;
-	double high_limit_ack;
-	double low_limit_ack;
-	unsigned char sensor_state_ack;
+	//written by the reactor, polled by the request helpers on other threads
+	std::atomic<unsigned char> move_open_station_ack;
+	std::atomic<double> high_limit_ack;
+	std::atomic<double> low_limit_ack;
+	std::atomic<unsigned char> sensor_state_ack;
 	unsigned char motor_status_ack[BASE_MOTOR_NUM];
-	
-	int upgrade_type;
-	int upgrade_ready_rlt;
-	int upgrade_recv_rlt;
-	int upgrade_end_rlt;
 }move_info_t;
 
-extern void set_movebase_cmd_vel(vel_t vel);
-extern move_sys_t *get_movebase_info(void);
-extern void *movebase_thread_start(void *);
+extern void set_movebase_vel_stop(int stop);
+extern int express_movebase_cmd_vel(vel_t vel,uint64_t rx_us,uint64_t stamp_age_us);
+extern void get_movebase_info(move_sys_t *info);
+class LinkStats;
+class LinkHistogram;
+extern LinkStats *get_movebase_link_stats(void);
+extern const LinkHistogram *get_movebase_vel_latency(int from_stamp);
+extern int movebase_start(void);
 
 extern int clear_open_signal(void);
 extern void get_open_sigal(void);
@@ -77,9 +82,10 @@ extern void handspike_down_send_frame(void);
 extern void handspike_stop_send_frame(void);
 extern void handspike_power_send_frame(void);
 extern void get_move_version(void);
-extern int move_upgrade(char * path,char * md5char);
-extern int set_movebase_upgrade(char *str,char *md5);
+extern int move_upgrade(const char * path,const char * md5char,const char * version);
+extern int set_movebase_upgrade(char *str,char *md5,char *version);
 extern int get_movebase_upgrade_status(void);
+extern int get_movebase_upgrade_progress(void);
 extern int get_movebase_upgrade_result(void);
 
 extern unsigned char baseStateData[];
@@ -0,0 +1,40 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <functional>
+
+/*
+ * One thread multiplexes every serial device, the upper socket and the
+ * periodic work of the device modules with epoll. Handlers run on that
+ * thread when their fd is ready or their timer expires, so they must not
+ * block: anything that sleeps or waits for a reply (upgrades, downloads,
+ * request/ack exchanges) goes to the worker pool and hands its result
+ * back with reactor_post().
+ *
+ * reactor_add_fd/mod_fd/del_fd and reactor_add_timer are called from the reactor
+ * thread, or before it is started.
+ */
+#define REACTOR_MAX_EVENTS          16
+#define REACTOR_WAIT_MS             200     //bounds how long a ros shutdown goes unnoticed
+#define REACTOR_WORKER_NUM          4       //short request/ack exchanges, minutes long jobs use worker_spawn()
+
+typedef std::function<void(uint32_t events)> reactor_fd_cb_t;
+typedef std::function<void(void)> reactor_job_t;
+
+extern int reactor_init(void);
+extern int reactor_add_fd(int fd, uint32_t events, reactor_fd_cb_t cb);
+extern int reactor_mod_fd(int fd, uint32_t events);
+extern int reactor_del_fd(int fd);
+extern int reactor_add_timer(double freq, reactor_job_t cb);
+extern void reactor_at_exit(reactor_job_t job);
+
+//both may be called from any thread
+extern void reactor_post(reactor_job_t job);
+extern void worker_post(reactor_job_t job);
+extern void worker_spawn(reactor_job_t job);
+
+extern void *reactor_thread_start(void *);
+
+#endif
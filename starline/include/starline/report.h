@@ -6,7 +6,10 @@
 #define SENSOR_LASER_ERR_LIMIT (2.1)
 #define SENSOR_SONAR_ERR_LIMIT (2.1)
 
-typedef enum{
+#define ANS_DATA_LEN (256)          //len is one byte
+#define EVENT_SPOOL_FILE "/home/robot/catkin_ws/starline_event.spool"
+
+typedef enum{
     MODULE_PAD = 1,
     MODULE_DLP,
     MODULE_NAV,
@@ -35,22 +38,16 @@ typedef struct{
     module_e module;
     unsigned char function;
     unsigned char len;
-    unsigned char data[SOCKET_PKG_LEN];
+    unsigned char data[ANS_DATA_LEN];
 }ans_status_t;
 
-typedef struct{
-    ans_status_t ans;
-    int flag;
-}event_t;
-
 
-extern int report_event(ans_status_t *ans);
 extern int handle_report_status(ask_status_t ask,ans_status_t *ans,system_t *sys,
            motion_t *motion, env_t *env);
 extern int set_event_buffer(ans_status_t *ans);
 extern void handle_report_event(void);
 
-extern void init_event_buf(void);
+extern void init_event_buf(const char *spool_path,int batch);
 
 
 
@@ -6,9 +6,9 @@
 #define SENSOR_HARDWARE_VER_LEN 4
 #define SENSOR_SOFTWARE_VER_LEN 11
 #define SENSOR_NUM 10
-#define SENSOR_READY_UPGRADE_SLEEP_TIME 600*1000
-#define SENSOR_END_UPGRADE_SLEEP_TIME 600*1000
-#define SENSOR_SLEEP_TIME 60*1000
+#define SENSOR_READY_UPGRADE_WAIT_MS 600    //longest wait for the ready/end ack
+#define SENSOR_END_UPGRADE_WAIT_MS 600
+#define SENSOR_SLEEP_TIME (60*1000)
 
 #include "starline/SensorMsg.h"
 #include <sensor_msgs/PointCloud2.h>
@@ -21,7 +21,6 @@ enum{
 };
 
 typedef struct{
-    int handle_data_flag;
     double estop_limit;
     double estop_fb_limit;
     double laser_len[LASER_NUM];
@@ -44,6 +43,7 @@ typedef struct{
     unsigned char software_version[SENSOR_SOFTWARE_VER_LEN];
     char name[FILE_PATH_LEN];
     char md5[MD5_SIZE];
+    char upgrade_version[VERSION_LEN];	//of the image to flash
     unsigned char upgrade_status;
 	int upgrade_result;
 
@@ -62,23 +62,21 @@ typedef struct{
 	int function_cali_cmd_rlt;
 	int function_cali_param_rlt;
 	int set_function_cali_ack;
-	
-	int upgrade_type;
-	int upgrade_ready_rlt;
-	int upgrade_recv_rlt;
-	int upgrade_end_rlt;
 }sensor_info_t;
 
-extern void *sensor_thread_start(void *);
+extern int sensor_start(void);
+class LinkStats;
+extern LinkStats *get_sensor_link_stats(void);
 extern int get_sensor_data(system_t *sys);
 
 extern void set_safe_distance(double safe_distance);
 extern void get_safe_distance(void);
 extern void set_function_cali(int function_cali_cmd, int function_cali_param);
 extern void get_sensor_version(void);
-extern int sensor_upgrade(char * path,char * md5char);
-extern int set_sensor_upgrade(char *str,char *md5);
+extern int sensor_upgrade(const char * path,const char * md5char,const char * version);
+extern int set_sensor_upgrade(char *str,char *md5,char *version);
 extern int get_sensor_upgrade_status(void);
+extern int get_sensor_upgrade_progress(void);
 extern int get_sensor_upgrade_result(void);
 
 #endif
@@ -27,8 +27,6 @@ extern int cmp_equal(int a,int b);
 extern int cmp_inequal(int a,int b);
 extern int  set_upper_server_ip(unsigned int ip);
 extern int upgrade_replace_nav_file(void);
-extern int set_base_high_limit(double limit);
-extern int set_base_low_limit(double limit);
 
 extern int send_pkg(unsigned short int pkg_type,int data,int type,unsigned char * str);
 extern int handle_led_power(system_t *sys);
@@ -0,0 +1,50 @@
+#ifndef UPPER_CMD_H
+#define UPPER_CMD_H
+
+#include <string>
+#include "../include/starline/config.h"
+
+/*
+ * Upper com packets are looked up by pkg_type in two tables filled at
+ * startup: commands from the pad, each with its handler, and the packets
+ * starline sends, each with the encoder of its data. A new packet type
+ * only needs a register_upper_cmd()/register_upper_pkg() call.
+ *
+ * Commands are dispatched from the main loop only. Packets are encoded
+ * from any thread; their buffers come from a small pool.
+ */
+#define PKG_LEN_INDEX  (1)
+#define PKG_INDEX_INDEX (3)
+#define PKG_TYPE_INDEX  (4)
+#define PKG_DATA_INDEX   (6)
+
+#define PKG_BASE_LEN  (26)              //feedback pkg without data
+#define PKG_CMD_BASE_LEN (9)            //command pkg without data
+
+#define UPPER_CMD_NO_REPLY (1)          //handler return: no feedback pkg for this command
+#define UPPER_PKG_POOL_NUM (8)
+
+typedef struct{
+    int fb_data;
+    int type;
+    unsigned char *cdata;       //SOCKET_PKG_LEN bytes from the pool, all zero
+    int cdata_len;              //how much of cdata the handler wrote
+}upper_reply_t;
+
+//buf is the whole command pkg with at least min_len data bytes, returns 0 to send the feedback
+typedef int (*upper_cmd_handler_t)(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply);
+//fills the data of a pkg, returns the length of the whole pkg, 0 when there is nothing to send
+typedef int (*upper_pkg_encoder_t)(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str);
+
+extern int register_upper_cmd(unsigned short int pkg_type,const char *name,int min_len,upper_cmd_handler_t handler);
+extern int register_upper_pkg(unsigned short int pkg_type,upper_pkg_encoder_t encoder);
+extern upper_pkg_encoder_t find_upper_pkg(unsigned short int pkg_type);
+extern int dispatch_upper_cmd(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env);
+
+//SOCKET_PKG_LEN bytes, all zero; give back how many were written so only those are cleared
+extern unsigned char *get_pkg_buf(void);
+extern void put_pkg_buf(unsigned char *buf,int used);
+
+extern std::string dump_upper_cmd_stats(void);
+
+#endif
@@ -7,6 +7,11 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 #include "../include/starline/config.h"
 #include "../include/starline/system.h"
@@ -15,8 +20,13 @@
 #include "../include/starline/md5.h"
 
 #include "../include/starline/cloud.h"
+#include "../include/starline/reactor.h"
+
+#define CLOUD_TICK_FREQ (1.0)
 
 static cloud_t gcloud;
+static std::atomic<int> download_progress[DOWNLOAD_BUF_SIZE];  //of download_buf, read by the diagnostics
+static int downloading = 0;         //handle_download() is running on a worker, reactor thread only
 
 void reset_cloud_params(void)
 {
@@ -26,6 +36,7 @@ void reset_cloud_params(void)
 	for(i=0;i<DOWNLOAD_BUF_SIZE;i++)
 	{
 	    gcloud.download_buf[i].download_status = FINISHED;
+	    download_progress[i] = -1;
 	}
 	return;
 }
@@ -80,46 +91,36 @@ static int check_download_files(cloud_t *sys)
 	}
 	return 0;
 }
-static int write_data(char *buffer,size_t size, size_t nitems,void *outstream)
-{
-    int written = fwrite(buffer, size, nitems, (FILE*)outstream);
-    return written;
-}
+//one file of a download round, the part file holds what has been received of it
+typedef struct{
+    download_t *download;
+    CURL *curl;
+    FILE *fd;
+    md5_ctx md5;                //of the part file as far as it is written
+    long long offset;           //part file size when this transfer started
+    long long got;              //written by this transfer
+    int tries;
+    int paused;                 //waits for the bandwidth cap
+    int progress_logged;
+    char path[FILE_PATH_LEN];
+    char part_path[FILE_PATH_LEN + 8];
+}transfer_t;
 
-static int cal_file_md5(download_t *download)
+//all downloads of a round share one token bucket, worker only
+typedef struct{
+    double tokens;              //bytes that may be written now
+    std::chrono::steady_clock::time_point last;
+}rate_bucket_t;
+
+static std::atomic<long> download_rate(DOWNLOAD_RATE * 1024L);
+static char download_dir[FILE_PATH_LEN] = DOWNLOAD_DIR;     //set before the first round
+static rate_bucket_t bucket;
+
+//md5_cal_value is the digest taken while the file was written
+static int check_download_md5(download_t *download,unsigned char *md5_cal_value)
 {
-    FILE* fd = NULL;
-	char path[128]="/home/robot/catkin_ws/download/";
-	unsigned char md5_cal_value[MD5_SIZE] = {0,};
 	unsigned char md5_upper_value[MD5_SIZE] = {0,};
 	int i = 0;
-	int file_size = 0;
-	unsigned char *tmp = NULL;
-
-	strcat(path,(char *)download->module.name);
-    fd = fopen(path, "rb" );
-	if(NULL == fd)
-	{
-	    ROS_ERROR("open download file failed!");
-	    return -1;
-	}
-	fseek(fd,0,SEEK_END);
-	file_size = ftell(fd);
-	fseek(fd,0,SEEK_SET);
-	tmp = (unsigned char *)malloc(file_size*sizeof(char));
-	i = fread(tmp,sizeof(char),file_size,fd);
-    fclose(fd);
-    if(0 > i)
-	{
-	    ROS_ERROR("fread file_size failed!");
-		return -1;
-	}
-	i = compute_md5(tmp,file_size,md5_cal_value);
-	if(0 != i)
-	{
-	    ROS_ERROR("compute file md5 failed!");
-		return -1;
-	}
 
 	i = md5_string_to_hex(download->module.md5,md5_upper_value);
 	if(0 != i)
@@ -138,124 +139,394 @@ static int cal_file_md5(download_t *download)
 
     return 0;
 }
-static int download_file(download_t *download)
+
+static void bucket_refill(void)
 {
-    int i = 0;
-	CURLcode r = CURLE_GOT_NOTHING;
-	CURL* curl = NULL;
-	FILE* fd = NULL;
-	char path[128]="/home/robot/catkin_ws/download/";
-	
-	if(NULL == download)
-	{
-	    return -1;
-	}
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    long rate = download_rate.load();
+    //a short burst only, so the upper socket never waits behind a second of downloads
+    double burst = std::max(rate / 10.0, (double)CURL_MAX_WRITE_SIZE);
 
-    //check download folder and create it,if does not exist.
-    i = access(path,F_OK);
-	if(0 != i)
-	{
-	    i = mkdir(path,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
-		if(0 != i)
-		{
-		    ROS_ERROR("download folder can not create");
-		    return -1;
-		}
-	}
+    bucket.tokens += rate * std::chrono::duration<double>(now - bucket.last).count();
+    bucket.tokens = std::min(bucket.tokens, burst);
+    bucket.last = now;
+}
 
-	//download file
-    curl = curl_easy_init();
-	strcat(path,(char *)download->module.name);
-    fd = fopen(path, "wb" );
-	if(NULL == fd)
-	{
-	    curl_easy_cleanup(curl);
-		ROS_ERROR("open upgrade file:%s failed!",path);
-		return -1;
-	}
+static void set_progress(download_t *download,int progress)
+{
+    download_progress[download - gcloud.download_buf] = progress;
+}
+
+static void update_progress(transfer_t *t)
+{
+    int progress = -1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t len = -1;
+    curl_easy_getinfo(t->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+#else
+    double len = -1;
+    curl_easy_getinfo(t->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &len);
+#endif
+    if(len <= 0)
+    {
+        return;
+    }
+    progress = (int)((t->offset + t->got) * 100 / (t->offset + (long long)len));
+    set_progress(t->download, progress);
+    if(progress / 10 != t->progress_logged / 10)
+    {
+        t->progress_logged = progress;
+        ROS_INFO("download %s %d%%", (char *)t->download->module.name, progress);
+    }
+}
+
+static size_t write_data(char *buffer,size_t size, size_t nitems,void *outstream)
+{
+    transfer_t *t = (transfer_t *)outstream;
+    size_t written = 0;
 
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)fd );
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 1);  // 
-    //curl_easy_setopt(curl, CURLOPT_URL, "www.google.com.hk");
-    //curl_easy_setopt(curl, CURLOPT_URL, "http://www.myee.online/push/100/driver/v0.0.8/starline");
-    curl_easy_setopt(curl, CURLOPT_URL, download->module.web);
-    r = curl_easy_perform(curl);
+    if((download_rate.load() > 0) && (bucket.tokens <= 0))
+    {
+        //curl keeps the data and hands it over again once resumed
+        t->paused = 1;
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    written = fwrite(buffer, size, nitems, t->fd) * size;
+    update_md5(&(t->md5), (unsigned char *)buffer, written);
+    t->got += written;
+    bucket.tokens -= written;
+    update_progress(t);
+    return written;
+}
+
+//the part file belongs to the image with the md5 kept next to it, any other is started over
+static int open_part(transfer_t *t)
+{
+    char md5_path[FILE_PATH_LEN + 16];
+    unsigned char md5_str[MD5_STRING_LEN] = {0,};
+    unsigned char buf[4096];
+    FILE *fd = NULL;
+    size_t len = 0;
+    int same = 0;
+
+    snprintf(md5_path, sizeof(md5_path), "%s.md5", t->part_path);
+    fd = fopen(md5_path, "rb");
+    if(NULL != fd)
+    {
+        same = (MD5_STRING_LEN == fread(md5_str, 1, MD5_STRING_LEN, fd))
+            && (0 == memcmp(md5_str, t->download->module.md5, MD5_STRING_LEN));
+        fclose(fd);
+    }
+
+    init_md5(&(t->md5));
+    t->offset = 0;
+    if(same)
+    {
+        t->fd = fopen(t->part_path, "a+b");
+        if(NULL == t->fd)
+        {
+            return -1;
+        }
+        //the digest goes on from the bytes already there
+        rewind(t->fd);
+        while((len = fread(buf, 1, sizeof(buf), t->fd)) > 0)
+        {
+            update_md5(&(t->md5), buf, len);
+            t->offset += len;
+        }
+        return 0;
+    }
+
+    t->fd = fopen(t->part_path, "wb");
+    fd = fopen(md5_path, "wb");
+    if((NULL == t->fd) || (NULL == fd)
+        || (MD5_STRING_LEN != fwrite(t->download->module.md5, 1, MD5_STRING_LEN, fd)))
+    {
+        ROS_ERROR("open download file %s failed", t->part_path);
+        if(NULL != fd)
+        {
+            fclose(fd);
+        }
+        if(NULL != t->fd)
+        {
+            fclose(t->fd);
+        }
+        return -1;
+    }
     fclose(fd);
-    curl_easy_cleanup(curl);
-    if(CURLE_OK != r)
+    return 0;
+}
+
+static void remove_part(transfer_t *t)
+{
+    char md5_path[FILE_PATH_LEN + 16];
+
+    snprintf(md5_path, sizeof(md5_path), "%s.md5", t->part_path);
+    unlink(t->part_path);
+    unlink(md5_path);
+}
+
+static void start_transfer(transfer_t *t,CURLM *multi)
+{
+    if(t->offset > 0)
+    {
+        ROS_INFO("download %s resumes at %lld", (char *)t->download->module.name, t->offset);
+    }
+    t->got = 0;
+    t->paused = 0;
+    curl_easy_setopt(t->curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)t->offset);
+    curl_multi_add_handle(multi, t->curl);
+}
+
+static int open_transfer(transfer_t *t,download_t *download,CURLM *multi)
+{
+    memset(t, 0, sizeof(*t));
+    t->download = download;
+    t->progress_logged = -10;
+    set_progress(download, -1);
+    snprintf(t->path, sizeof(t->path), "%s%s", download_dir, (char *)download->module.name);
+    snprintf(t->part_path, sizeof(t->part_path), "%s%s", t->path, DOWNLOAD_PART_SUFFIX);
+    if(open_part(t) < 0)
+    {
+        return -1;
+    }
+    t->curl = curl_easy_init();
+    if(NULL == t->curl)
+    {
+        fclose(t->fd);
+        return -1;
+    }
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, (void *)t);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, (void *)t);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_data);
+    curl_easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT, 1);
+    //an error page must not end up in the part file
+    curl_easy_setopt(t->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_LOW_SPEED_TIME, (long)DOWNLOAD_STALL_TIME);
+    curl_easy_setopt(t->curl, CURLOPT_URL, download->module.web);
+    start_transfer(t, multi);
+    return 0;
+}
+
+//returns 0 when the file is complete and checked, 1 when it is sent again
+static int finish_transfer(transfer_t *t,CURLM *multi,CURLcode r)
+{
+    unsigned char md5_cal_value[MD5_SIZE] = {0,};
+    long code = 0;
+    int i = 0;
+
+    curl_multi_remove_handle(multi, t->curl);
+    fflush(t->fd);
+    curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+    //416: nothing left after the offset, the part file was complete
+    if((CURLE_OK != r) && !((416 == code) && (t->offset > 0)))
+    {
+        t->offset += t->got;
+        if((CURLE_RANGE_ERROR == r) && (0 == ftruncate(fileno(t->fd), 0)))
+        {
+            //the server can not resume, the next try starts over; a "wb" part file
+            //would go on writing at the old offset and leave a hole of zeros
+            rewind(t->fd);
+            t->offset = 0;
+            init_md5(&(t->md5));
+        }
+        if(++t->tries < DOWNLOAD_TRIES)
+        {
+            ROS_INFO("download %s: %s, trying again", (char *)t->download->module.name, curl_easy_strerror(r));
+            start_transfer(t, multi);
+            return 1;
+        }
+        ROS_ERROR("download %s failed: %s", (char *)t->download->module.name, curl_easy_strerror(r));
+        //kept for the next round
+        fclose(t->fd);
+        return -1;
+    }
+    fclose(t->fd);
+
+    final_md5(&(t->md5), md5_cal_value);
+    if(0 != check_download_md5(t->download, md5_cal_value))
+    {
+        ROS_ERROR("download %s md5 check failed", (char *)t->download->module.name);
+        remove_part(t);
+        return -1;
+    }
+    if(0 != rename(t->part_path, t->path))
     {
-        ROS_ERROR("curl error:%s",curl_easy_strerror(r));
-		return -1;
+        ROS_ERROR("rename %s failed: %s", t->part_path, strerror(errno));
+        return -1;
     }
-	if(0 == strcmp((char *)download->module.name,"starline"))
+    remove_part(t);
+    set_progress(t->download, 100);
+	if(0 == strcmp((char *)t->download->module.name,"starline"))
 	{
-	    i = chmod(path,S_IRWXU|S_IRWXG|S_IROTH|S_IWOTH|S_IXOTH);
+	    i = chmod(t->path,S_IRWXU|S_IRWXG|S_IROTH|S_IWOTH|S_IXOTH);
 		if(0 != i)
 		{
 		    ROS_ERROR("chmod starline failed");
 		    return -1;
 		}
 	}
-	return 0;
+    return 0;
 }
 
+//all waiting files at once, each resumed from what an earlier round left
 static void handle_download(cloud_t *sys)
 {
+    transfer_t transfers[DOWNLOAD_BUF_SIZE];
+    download_t *download = NULL;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+    transfer_t *t = NULL;
+    long rate = 0;
+    int running = 0;
+    int active = 0;
+    int left = 0;
     int i = 0;
-	int flag = 0;
 
-	for(i=0;i<DOWNLOAD_BUF_SIZE;i++)
+    memset(transfers, 0, sizeof(transfers));
+
+    //check download folder and create it,if does not exist.
+    if((0 != access(download_dir,F_OK)) && (0 != mkdir(download_dir,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH)))
+    {
+        ROS_ERROR("download folder can not create");
+    }
+    multi = curl_multi_init();
+    for(i=0;i<DOWNLOAD_BUF_SIZE;i++)
 	{
-	    if((WAIT_DOWNLOAD == sys->download_buf[i].download_status) ||
-			(DOWNLOADING == sys->download_buf[i].download_status))
+	    download = &(sys->download_buf[i]);
+	    if((WAIT_DOWNLOAD != download->download_status) && (DOWNLOADING != download->download_status))
 		{
-		    flag = download_file(&(sys->download_buf[i]));
-			if(0 == flag)
-			{
-			    //cal file md5
-			    flag = cal_file_md5(&(sys->download_buf[i]));
-				if(0 != flag)
-				{
-				    //report download module file failed!
-				    sys->download_buf[i].result_flag = 1;
-				}
-				else
-				{
-				    //report download module file success!
-				    sys->download_buf[i].result_flag = 0;
-				}
-			}
-			else
-			{
-			    //report download module file failed!
-			    sys->download_buf[i].result_flag = 1;
-			}
-			
-			sys->download_buf[i].download_status = FINISHED;
+		    continue;
+		}
+		if((NULL != multi) && (0 == open_transfer(&transfers[active],download,multi)))
+		{
+		    download->download_status = DOWNLOADING;
+		    active++;
+		}
+		else
+		{
+		    //report download module file failed!
+		    download->result_flag = 1;
+		    download->download_status = FINISHED;
 		}
 	}
+
+    bucket.tokens = 0;
+    bucket.last = std::chrono::steady_clock::now();
+    while(active > 0)
+    {
+        curl_multi_perform(multi, &running);
+        while(NULL != (msg = curl_multi_info_read(multi, &left)))
+        {
+            if(CURLMSG_DONE != msg->msg)
+            {
+                continue;
+            }
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+            i = finish_transfer(t, multi, msg->data.result);
+            if(1 == i)
+            {
+                continue;
+            }
+            curl_easy_cleanup(t->curl);
+            t->curl = NULL;
+            //report download module file success or failed
+            t->download->result_flag = (0 == i) ? 0 : 1;
+            if(0 != i)
+            {
+                set_progress(t->download, -1);
+            }
+            t->download->download_status = FINISHED;
+            active--;
+        }
+
+        bucket_refill();
+        rate = download_rate.load();
+        if((rate > 0) && (bucket.tokens <= 0))
+        {
+            //every transfer pauses now, sleep until there are tokens again
+            usleep(std::min((long)(-bucket.tokens * 1000 / rate) + 1, (long)DOWNLOAD_WAIT_MS) * 1000);
+            continue;
+        }
+        for(i=0;i<DOWNLOAD_BUF_SIZE;i++)
+        {
+            if((NULL != transfers[i].curl) && transfers[i].paused)
+            {
+                transfers[i].paused = 0;
+                curl_easy_pause(transfers[i].curl, CURLPAUSE_CONT);
+            }
+        }
+        curl_multi_wait(multi, NULL, 0, DOWNLOAD_WAIT_MS, NULL);
+    }
+    if(NULL != multi)
+    {
+        curl_multi_cleanup(multi);
+    }
     return;
 }
 
-void *cloud_com_thread_start(void *)
+void set_download_rate(int kib_per_s)
+{
+    download_rate = (kib_per_s > 0) ? kib_per_s * 1024L : 0;
+}
+
+void set_download_dir(const char *dir)
+{
+    size_t len = strlen(dir);
+
+    //the file names are appended to it
+    snprintf(download_dir, sizeof(download_dir), "%s%s", dir, ((len > 0) && ('/' == dir[len - 1])) ? "" : "/");
+}
+
+void download_waiting_files(void)
+{
+    handle_download(&gcloud);
+}
+
+int get_download_progress(int i)
+{
+    if((i < 0) || (i >= DOWNLOAD_BUF_SIZE))
+    {
+        return -1;
+    }
+    return download_progress[i].load();
+}
+
+static void cloud_com_tick(void)
 {
     int tmp = 0;
-    ros::Rate loop_rate(1.0);
-    while(ros::ok())
-	{
-	    gcloud.cloud_flag = 1;
 
-		//check need download upgrade files
-		tmp = check_download_files(&gcloud);
-        if(1 == tmp)
-		{
-		    handle_download(&gcloud);
-		}
-	    ros::spinOnce();
-        loop_rate.sleep();
+    gcloud.cloud_flag = 1;
+    if(0 != downloading)
+    {
+        return;
+    }
+
+	//check need download upgrade files
+	tmp = check_download_files(&gcloud);
+    if(1 == tmp)
+	{
+	    downloading = 1;
+	    worker_spawn([]
+	    {
+	        download_waiting_files();
+	        reactor_post([]{ downloading = 0; });
+	    });
 	}
-	gcloud.cloud_flag = 0;
+}
+
+int cloud_com_start(void)
+{
+    for(int i = 0; i < DOWNLOAD_BUF_SIZE; i++)
+    {
+        download_progress[i] = -1;
+    }
+    reactor_at_exit([]{ gcloud.cloud_flag = 0; });
+    if(reactor_add_timer(CLOUD_TICK_FREQ,cloud_com_tick) < 0)
+    {
+        return -1;
+    }
     return 0;
 }
 
@@ -0,0 +1,215 @@
+/*
+ * Runs the cloud downloader of cloud.cpp off the robot, usually against
+ * download_sim, and checks what it saved:
+ *
+ *   range:     download_sim -d /tmp/www -x 200000 &
+ *              download_bench -d /tmp/www a.bin
+ *              the first reply is cut, the retry asks for the rest
+ *   drop:      download_sim -d /tmp/www -x 200000 -c 3 &
+ *              download_bench -d /tmp/www -n 2 a.bin
+ *              every try of the first round is cut, the second round resumes the part file
+ *   no range:  download_sim -d /tmp/www -x 200000 -n &
+ *              download_bench -d /tmp/www a.bin
+ *              the retry gets the whole file again and starts the part file over
+ *   rate cap:  download_sim -d /tmp/www &
+ *              download_bench -d /tmp/www -r 64 a.bin b.bin
+ *              all files share the cap, compare the KiB/s printed with it
+ *
+ * usage: download_bench [-u url] [-d served_dir] [-o download_dir] [-r kib_per_s] [-n rounds] file...
+ *
+ * -u  where download_sim serves the files, default http://127.0.0.1:8765/
+ * -d  the directory it serves them from, to take the md5 of each
+ * -o  where the downloader saves them, default /tmp/download_bench/
+ * -r  KiB/s for all files together, 0 no cap, default DOWNLOAD_RATE
+ * -n  rounds, a failed file is downloaded again in the next one as the node does
+ *
+ * Every file has to end up in the download dir with the md5 of the served one.
+ * Files and part files of the same names left there by an earlier run are removed.
+ * Does not need a ROS master.
+ */
+#include "ros/ros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "../include/starline/config.h"
+#include "../include/starline/md5.h"
+#include "../include/starline/cloud.h"
+
+#define BENCH_URL                   "http://127.0.0.1:8765/"
+#define BENCH_DOWNLOAD_DIR          "/tmp/download_bench/"
+
+typedef struct
+{
+    std::string     name;
+    std::string     md5;            //of the served file, as the upper sends it
+    long long       size;
+    bool            done;
+}bench_file_t;
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+//lower case hex md5 of a whole file, empty when it can not be read
+static std::string file_md5(const std::string &path, long long *size)
+{
+    unsigned char buf[4096];
+    unsigned char digest[MD5_SIZE];
+    char hex[MD5_STRING_LEN + 1];
+    md5_ctx ctx;
+    FILE *file = fopen(path.c_str(), "rb");
+    size_t len = 0;
+
+    *size = 0;
+    if(NULL == file)
+    {
+        return "";
+    }
+    init_md5(&ctx);
+    while((len = fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        update_md5(&ctx, buf, len);
+        *size += len;
+    }
+    fclose(file);
+    final_md5(&ctx, digest);
+    for(int i = 0; i < MD5_SIZE; i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    return hex;
+}
+
+static long long file_size(const std::string &path)
+{
+    struct stat st;
+
+    return (0 == stat(path.c_str(), &st)) ? (long long)st.st_size : -1;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<bench_file_t> files;
+    const char *url = BENCH_URL;
+    const char *served_dir = ".";
+    const char *download_dir = BENCH_DOWNLOAD_DIR;
+    int rate = DOWNLOAD_RATE;
+    int rounds = 1;
+    int failed = 0;
+    int c = 0;
+
+    while((c = getopt(argc, argv, "u:d:o:r:n:")) != -1)
+    {
+        switch(c)
+        {
+            case 'u': url = optarg; break;
+            case 'd': served_dir = optarg; break;
+            case 'o': download_dir = optarg; break;
+            case 'r': rate = atoi(optarg); break;
+            case 'n': rounds = atoi(optarg); break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-u url] [-d served_dir] [-o download_dir] [-r kib_per_s] [-n rounds] file...\n", argv[0]);
+        return 1;
+    }
+    for(int i = optind; (i < argc) && ((int)files.size() < DOWNLOAD_BUF_SIZE); i++)
+    {
+        bench_file_t file;
+
+        file.name = argv[i];
+        file.md5 = file_md5(std::string(served_dir) + "/" + file.name, &file.size);
+        file.done = false;
+        if(file.md5.empty() || (file.name.size() >= NAME_LEN) || (strlen(url) + file.name.size() >= WEB_LEN))
+        {
+            fprintf(stderr, "%s/%s can not be served\n", served_dir, argv[i]);
+            return 1;
+        }
+        files.push_back(file);
+    }
+
+    //nothing left from an earlier run, each run starts without part files
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        std::string path = std::string(download_dir) + "/" + files[i].name;
+
+        unlink(path.c_str());
+        unlink((path + DOWNLOAD_PART_SUFFIX).c_str());
+        unlink((path + DOWNLOAD_PART_SUFFIX + ".md5").c_str());
+    }
+    set_download_dir(download_dir);
+    set_download_rate(rate);
+    for(int round = 1; round <= rounds; round++)
+    {
+        long long bytes = 0;
+        uint64_t start_us = 0;
+        double seconds = 0;
+        int queued = 0;
+
+        reset_cloud_params();
+        for(size_t i = 0; i < files.size(); i++)
+        {
+            module_upgrade_t module;
+
+            if(files[i].done)
+            {
+                continue;
+            }
+            memset(&module, 0, sizeof(module));
+            strncpy((char *)module.name, files[i].name.c_str(), NAME_LEN - 1);
+            snprintf((char *)module.web, WEB_LEN, "%s%s", url, files[i].name.c_str());
+            memcpy(module.md5, files[i].md5.c_str(), MD5_STRING_LEN);
+            set_avalible_cloud_buf(&module);
+            bytes += files[i].size;
+            queued++;
+        }
+        if(0 == queued)
+        {
+            break;
+        }
+
+        start_us = now_us();
+        download_waiting_files();
+        seconds = (now_us() - start_us) / 1e6;
+
+        failed = 0;
+        for(size_t i = 0; i < files.size(); i++)
+        {
+            std::string path = std::string(download_dir) + "/" + files[i].name;
+            long long size = 0;
+
+            if(files[i].done)
+            {
+                continue;
+            }
+            files[i].done = (file_md5(path, &size) == files[i].md5);
+            if(!files[i].done)
+            {
+                failed++;
+            }
+            printf("  %-24s %s, %lld bytes, part file %lld\n", files[i].name.c_str(),
+                    files[i].done ? "ok" : "failed", files[i].size, file_size(path + DOWNLOAD_PART_SUFFIX));
+        }
+        //bytes of the whole files, resumed ones took fewer over the wire
+        printf("round %d: %d of %d files, %lld KiB in %.2f s, %.1f KiB/s, cap %d KiB/s\n",
+                round, queued - failed, queued, bytes / 1024, seconds, (seconds > 0) ? bytes / 1024.0 / seconds : 0.0, rate);
+        if(0 == failed)
+        {
+            break;
+        }
+    }
+    return (0 == failed) ? 0 : 1;
+}
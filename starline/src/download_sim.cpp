@@ -0,0 +1,246 @@
+/*
+ * Download server stand-in for the cloud downloader.
+ *
+ * Serves the files of one directory over HTTP on localhost, with range
+ * requests like the upgrade server, and can misbehave the ways a real one
+ * does, so download_bench can run cloud.cpp without a network:
+ *
+ *   download_sim -d /tmp/www -x 200000 &
+ *   download_bench -d /tmp/www -o /tmp/download a.bin b.bin
+ *
+ * usage: download_sim [-p port] [-d dir] [-x cut_bytes] [-c cuts] [-n] [-v]
+ *
+ * -p  port on 127.0.0.1, default 8765
+ * -d  directory the files are served from, default .
+ * -x  a reply is cut after this many body bytes and the connection closed
+ * -c  replies of each file that are cut, default 1 when -x is given
+ * -n  no range support, a range request gets the whole file with 200
+ *
+ * Plain Linux program, it does not need ROS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define SIM_PORT                8765
+#define SIM_REQUEST_MAX         4096
+#define SIM_CHUNK               16384
+
+typedef struct
+{
+    int             port;
+    const char      *dir;
+    long long       cut_bytes;
+    int             cuts;
+    int             no_range;
+    int             verbose;
+}sim_option_t;
+
+static sim_option_t opt = {SIM_PORT, ".", 0, 0, 0, 0};
+static std::mutex cut_lock;
+static std::map<std::string, int> cut_count;    //replies cut so far, per file
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if(n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void send_head(int fd, int code, const char *text, long long len, const char *extra)
+{
+    char head[512];
+
+    snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\n%sConnection: close\r\n\r\n",
+            code, text, len, extra);
+    write_all(fd, head, strlen(head));
+}
+
+//true when this reply of name is one to cut
+static bool take_cut(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(cut_lock);
+
+    if((opt.cut_bytes <= 0) || (cut_count[name] >= opt.cuts))
+    {
+        return false;
+    }
+    cut_count[name]++;
+    return true;
+}
+
+static void serve(int fd)
+{
+    char req[SIM_REQUEST_MAX + 1] = {0};
+    char name[256] = {0};
+    char path[512];
+    char extra[128] = {0};
+    char buf[SIM_CHUNK];
+    const char *range = NULL;
+    struct stat st;
+    long long start = 0;
+    long long left = 0;
+    size_t got = 0;
+    int file = -1;
+    bool cut = false;
+
+    //the request head, curl sends no body with a GET
+    while((got < SIM_REQUEST_MAX) && (NULL == strstr(req, "\r\n\r\n")))
+    {
+        ssize_t n = recv(fd, req + got, SIM_REQUEST_MAX - got, 0);
+        if(n <= 0)
+        {
+            close(fd);
+            return;
+        }
+        got += n;
+        req[got] = 0;
+    }
+    if(1 != sscanf(req, "GET /%255[^ ?]", name))
+    {
+        send_head(fd, 400, "Bad Request", 0, "");
+        close(fd);
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s", opt.dir, name);
+    file = open(path, O_RDONLY | O_CLOEXEC);
+    if((file < 0) || (fstat(file, &st) < 0))
+    {
+        send_head(fd, 404, "Not Found", 0, "");
+        if(file >= 0)
+        {
+            close(file);
+        }
+        close(fd);
+        return;
+    }
+
+    range = strstr(req, "Range: bytes=");
+    if((NULL != range) && !opt.no_range)
+    {
+        start = atoll(range + strlen("Range: bytes="));
+    }
+    if(start >= st.st_size)
+    {
+        send_head(fd, 416, "Range Not Satisfiable", 0, "");
+        close(file);
+        close(fd);
+        return;
+    }
+    left = st.st_size - start;
+    if(start > 0)
+    {
+        snprintf(extra, sizeof(extra), "Content-Range: bytes %lld-%lld/%lld\r\n",
+                start, (long long)st.st_size - 1, (long long)st.st_size);
+        send_head(fd, 206, "Partial Content", left, extra);
+    }
+    else
+    {
+        send_head(fd, 200, "OK", left, "");
+    }
+
+    cut = (left > opt.cut_bytes) && take_cut(name);
+    if(cut)
+    {
+        left = opt.cut_bytes;
+    }
+    if(opt.verbose)
+    {
+        printf("GET %s from %lld%s%s\n", name, start, (NULL != range) && opt.no_range ? ", range ignored" : "",
+                cut ? ", cut" : "");
+        fflush(stdout);
+    }
+    while(left > 0)
+    {
+        ssize_t n = pread(file, buf, (left < SIM_CHUNK) ? left : SIM_CHUNK, start);
+        if((n <= 0) || (write_all(fd, buf, n) < 0))
+        {
+            break;
+        }
+        start += n;
+        left -= n;
+    }
+    close(file);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    int listen_fd = -1;
+    int one = 1;
+    int c = 0;
+
+    while((c = getopt(argc, argv, "p:d:x:c:nv")) != -1)
+    {
+        switch(c)
+        {
+            case 'p': opt.port = atoi(optarg); break;
+            case 'd': opt.dir = optarg; break;
+            case 'x': opt.cut_bytes = atoll(optarg); break;
+            case 'c': opt.cuts = atoi(optarg); break;
+            case 'n': opt.no_range = 1; break;
+            case 'v': opt.verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-d dir] [-x cut_bytes] [-c cuts] [-n] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    if((opt.cut_bytes > 0) && (0 == opt.cuts))
+    {
+        opt.cuts = 1;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listen_fd, 16) < 0))
+    {
+        printf("listen on port %d failed: %s\n", opt.port, strerror(errno));
+        return 1;
+    }
+    printf("download server on http://127.0.0.1:%d/ serving %s%s\n", opt.port, opt.dir,
+            opt.no_range ? ", no ranges" : "");
+    fflush(stdout);
+
+    //one thread per connection, the downloader keeps several open and pauses them
+    while(1)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            printf("accept failed: %s\n", strerror(errno));
+            break;
+        }
+        std::thread(serve, fd).detach();
+    }
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,398 @@
+#include "ros/ros.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+#include "../include/starline/config.h"
+#include "../include/starline/system.h"
+#include "../include/starline/report.h"
+#include "../include/starline/event_store.h"
+#include "../include/starline/reactor.h"
+
+//positions count event bytes since start, [head, tail) is pending
+typedef struct
+{
+    std::mutex lock;
+    std::unordered_map<uint64_t, uint64_t> index;   //record hash -> position of the pending record
+    uint64_t head;
+    uint64_t mem_end;           //the ring holds [head, mem_end)
+    uint64_t tail;
+    uint64_t file_base;         //the spool holds [file_base, synced)
+    uint64_t synced;            //mem_end or synced is tail, the rest of the pending records is in the other
+    unsigned int dropped;       //events lost since the last drop warning
+    unsigned char ring[EVENT_STORE_LEN];
+}event_store_t;
+
+//zeroed here, events may be put before event_store_init()
+static event_store_t *store = new event_store_t();
+static int spool_fd = -1;
+
+//fnv-1a, a collision only costs one event not being queued
+static uint64_t rec_hash(const unsigned char *rec,int len)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for(int i = 0; i < len; i++)
+    {
+        h = (h ^ rec[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+//len bytes of the ring from pos on, split where it wraps
+static int ring_spans(uint64_t pos,uint64_t len,struct iovec iov[2])
+{
+    size_t off = pos & (EVENT_STORE_LEN - 1);
+    size_t first = (len < EVENT_STORE_LEN - off) ? len : EVENT_STORE_LEN - off;
+
+    if(0 == len)
+    {
+        return 0;
+    }
+    iov[0].iov_base = store->ring + off;
+    iov[0].iov_len = first;
+    if(first == len)
+    {
+        return 1;
+    }
+    iov[1].iov_base = store->ring;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+static void ring_copy(uint64_t pos,unsigned char *data,int len,int to_ring)
+{
+    struct iovec iov[2];
+    int n = ring_spans(pos, len, iov);
+
+    for(int i = 0; i < n; i++)
+    {
+        if(to_ring)
+        {
+            memcpy(iov[i].iov_base, data, iov[i].iov_len);
+        }
+        else
+        {
+            memcpy(data, iov[i].iov_base, iov[i].iov_len);
+        }
+        data += iov[i].iov_len;
+    }
+}
+
+static void spool_set_head(void)
+{
+    uint64_t off = store->head - store->file_base;
+
+    if(pwrite(spool_fd, &off, sizeof(off), 0) != sizeof(off))
+    {
+        ROS_ERROR("event spool head write failed: %s", strerror(errno));
+    }
+}
+
+static void spool_truncate(void)
+{
+    if(ftruncate(spool_fd, EVENT_SPOOL_HEAD) < 0)
+    {
+        ROS_ERROR("event spool truncate failed: %s", strerror(errno));
+    }
+    spool_set_head();
+}
+
+//everything in the spool was delivered, start it over at head
+static void spool_reset(void)
+{
+    int used = (store->synced != store->file_base);
+
+    store->file_base = store->head;
+    store->synced = store->head;
+    if((spool_fd >= 0) && used)
+    {
+        spool_truncate();
+    }
+}
+
+//ring records not in the spool yet, [synced, mem_end)
+static int spool_write_ring(void)
+{
+    struct iovec iov[2];
+    uint64_t len = store->mem_end - store->synced;
+    int n = ring_spans(store->synced, len, iov);
+
+    if(pwritev(spool_fd, iov, n, EVENT_SPOOL_HEAD + store->synced - store->file_base) != (ssize_t)len)
+    {
+        ROS_ERROR("event spool write failed: %s", strerror(errno));
+        return -1;
+    }
+    store->synced = store->mem_end;
+    return 0;
+}
+
+//moves spooled records behind the ring back into it as it empties
+static void store_refill(void)
+{
+    struct iovec iov[2];
+    uint64_t len = store->tail - store->mem_end;
+    uint64_t room = EVENT_STORE_LEN - (store->mem_end - store->head);
+    ssize_t got = 0;
+    int n = 0;
+
+    if((0 == len) || (spool_fd < 0))
+    {
+        return;
+    }
+    if(len > room)
+    {
+        len = room;
+    }
+    n = ring_spans(store->mem_end, len, iov);
+    got = preadv(spool_fd, iov, n, EVENT_SPOOL_HEAD + store->mem_end - store->file_base);
+    if(got < 0)
+    {
+        ROS_ERROR("event spool read failed: %s", strerror(errno));
+        return;
+    }
+    store->mem_end += got;
+}
+
+static int store_append(const unsigned char *rec,int len)
+{
+    uint64_t pos = store->tail;
+
+    if((store->mem_end == store->tail) && (store->tail - store->head + len <= EVENT_STORE_LEN))
+    {
+        ring_copy(pos, (unsigned char *)rec, len, 1);
+        store->mem_end += len;
+        store->tail += len;
+    }
+    else
+    {
+        //the ring is full or already has records behind it in the spool, keep the order
+        if((spool_fd < 0) || (store->tail - store->file_base + len > EVENT_SPOOL_MAX))
+        {
+            return -1;
+        }
+        if((store->synced < store->tail) && (spool_write_ring() < 0))
+        {
+            return -1;
+        }
+        if(pwrite(spool_fd, rec, len, EVENT_SPOOL_HEAD + store->tail - store->file_base) != len)
+        {
+            ROS_ERROR("event spool write failed: %s", strerror(errno));
+            return -1;
+        }
+        store->tail += len;
+        store->synced = store->tail;
+    }
+    store->index[rec_hash(rec, len)] = pos;
+    return 0;
+}
+
+//what used to be the buffer full warning, with the number of events lost
+static void store_drop_warning(void)
+{
+    unsigned char rec[EVENT_REC_HEAD + 4];
+
+    if(0 == store->dropped)
+    {
+        return;
+    }
+    rec[0] = LEVEL_WARN;
+    rec[1] = MODULE_NAV;
+    rec[2] = 24;
+    rec[3] = 4;
+    set_int_buf(rec + EVENT_REC_HEAD, store->dropped);
+    if(0 == store_append(rec, sizeof(rec)))
+    {
+        ROS_INFO("event store has room again, %u events were dropped", store->dropped);
+        store->dropped = 0;
+    }
+}
+
+//takes over the records left in the spool by the last run
+int event_store_init(const char *spool_path)
+{
+    std::lock_guard<std::mutex> lock(store->lock);
+    std::vector<unsigned char> recs;
+    struct stat st;
+    uint64_t off = 0;
+    uint64_t len = 0;
+    uint64_t i = 0;
+    int rlen = 0;
+    int n = 0;
+
+    if((NULL == spool_path) || (0 == spool_path[0]))
+    {
+        ROS_INFO("events are not spooled");
+        return 0;
+    }
+    spool_fd = open(spool_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(spool_fd < 0)
+    {
+        ROS_ERROR("open event spool %s failed: %s", spool_path, strerror(errno));
+        return -1;
+    }
+    //a new or broken spool is started over
+    if((0 == fstat(spool_fd, &st)) && (st.st_size >= EVENT_SPOOL_HEAD)
+        && (pread(spool_fd, &off, sizeof(off), 0) == sizeof(off))
+        && (off <= (uint64_t)st.st_size - EVENT_SPOOL_HEAD))
+    {
+        len = st.st_size - EVENT_SPOOL_HEAD - off;
+        if(len > EVENT_SPOOL_MAX)
+        {
+            len = EVENT_SPOOL_MAX;
+        }
+        recs.resize(len);
+        if((len > 0) && (pread(spool_fd, recs.data(), len, EVENT_SPOOL_HEAD + off) != (ssize_t)len))
+        {
+            len = 0;
+        }
+    }
+
+    //the spool is written again from the ring, compacted
+    store->file_base = store->head;
+    store->synced = store->head;
+    spool_truncate();
+    //a record cut short by a crash is dropped with everything after it
+    while(i + EVENT_REC_HEAD <= len)
+    {
+        rlen = EVENT_REC_HEAD + recs[i + 3];
+        if(i + rlen > len)
+        {
+            break;
+        }
+        if((0 == store->index.count(rec_hash(&recs[i], rlen))) && (0 == store_append(&recs[i], rlen)))
+        {
+            n++;
+        }
+        i += rlen;
+    }
+    //on disk again before anything else runs, a crash right after a restart must not lose them
+    if((store->synced < store->mem_end) && (spool_write_ring() < 0))
+    {
+        ROS_ERROR("events left from the last run are not spooled again");
+    }
+    if(fdatasync(spool_fd) < 0)
+    {
+        ROS_ERROR("event spool sync failed: %s", strerror(errno));
+    }
+    if(n > 0)
+    {
+        ROS_INFO("%d events left from the last run", n);
+    }
+    return 0;
+}
+
+int event_store_put(const ans_status_t *ans)
+{
+    unsigned char rec[EVENT_REC_MAX];
+    int len = 0;
+
+    if(NULL == ans)
+    {
+        return -1;
+    }
+    rec[0] = ans->level;
+    rec[1] = ans->module;
+    rec[2] = ans->function;
+    rec[3] = ans->len;
+    memcpy(rec + EVENT_REC_HEAD, ans->data, ans->len);
+    len = EVENT_REC_HEAD + ans->len;
+
+    std::lock_guard<std::mutex> lock(store->lock);
+    if(store->index.count(rec_hash(rec, len)))
+    {
+        return 0;
+    }
+    store_drop_warning();
+    if(store_append(rec, len) < 0)
+    {
+        if(0 == store->dropped)
+        {
+            ROS_ERROR("event store is full, events are dropped");
+        }
+        store->dropped++;
+        return -1;
+    }
+    return 0;
+}
+
+int event_store_peek(unsigned char *buf,int len,int max_num,int *num)
+{
+    std::lock_guard<std::mutex> lock(store->lock);
+    uint64_t pos = 0;
+    int used = 0;
+    int rlen = 0;
+    int n = 0;
+
+    store_refill();
+    pos = store->head;
+    while((pos + EVENT_REC_HEAD <= store->mem_end) && (n < max_num))
+    {
+        rlen = EVENT_REC_HEAD + store->ring[(pos + 3) & (EVENT_STORE_LEN - 1)];
+        if((pos + rlen > store->mem_end) || (used + rlen > len))
+        {
+            break;
+        }
+        ring_copy(pos, buf + used, rlen, 0);
+        used += rlen;
+        pos += rlen;
+        n++;
+    }
+    if(NULL != num)
+    {
+        *num = n;
+    }
+    return used;
+}
+
+void event_store_consume(const unsigned char *buf,int used)
+{
+    std::lock_guard<std::mutex> lock(store->lock);
+    std::unordered_map<uint64_t, uint64_t>::iterator it;
+    int rlen = 0;
+
+    for(int i = 0; i + EVENT_REC_HEAD <= used; i += rlen)
+    {
+        rlen = EVENT_REC_HEAD + buf[i + 3];
+        //a newer copy queued since then stays indexed
+        it = store->index.find(rec_hash(buf + i, rlen));
+        if((it != store->index.end()) && (it->second == store->head))
+        {
+            store->index.erase(it);
+        }
+        store->head += rlen;
+    }
+    if(store->head >= store->synced)
+    {
+        spool_reset();
+    }
+    else if(spool_fd >= 0)
+    {
+        spool_set_head();
+    }
+    store_drop_warning();
+}
+
+//once a second from the main loop, the flush to disk runs on a worker
+void event_store_sync(void)
+{
+    std::lock_guard<std::mutex> lock(store->lock);
+    int fd = spool_fd;
+
+    if((spool_fd < 0) || (store->synced >= store->mem_end))
+    {
+        return;
+    }
+    if(0 == spool_write_ring())
+    {
+        worker_post([fd]{ fdatasync(fd); });
+    }
+}
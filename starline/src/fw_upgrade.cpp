@@ -0,0 +1,515 @@
+#include "ros/ros.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "mcu_com/frame_parser.h"
+#include "../include/starline/fw_upgrade.h"
+#include "../include/starline/frames.h"
+#include "../include/starline/reactor.h"
+
+struct fw_upgrade_s
+{
+    const char *name;
+    unsigned char type;
+    int frame_len;
+    int deadline_s;
+    int ready_wait_ms;
+    int end_wait_ms;
+    fw_upgrade_send_t send;
+    fw_upgrade_version_t request_version;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    int rlt[FW_UPGRADE_RESUME + 1];     //ready, end and resume acks, -1 while waiting
+    std::deque<int> data_acks;          //not matched to a frame yet, oldest first
+    unsigned char version[VERSION_LEN]; //the board's last answer
+    bool version_got;
+    std::atomic<int> frames_done;
+    std::atomic<int> frames_total;
+};
+
+typedef struct{
+    unsigned char md5[MD5_SIZE];
+    unsigned char version[VERSION_LEN];     //the board's when the file was started, other firmware makes it stale
+    uint32_t offset;                        //file bytes the board acked
+}fw_checkpoint_t;
+
+static std::atomic<int> fw_upgrade_window(FW_UPGRADE_WINDOW);
+
+//never freed, one per board
+fw_upgrade_t *fw_upgrade_create(const char *name,unsigned char type,int frame_len,int deadline_s,
+    int ready_wait_ms,int end_wait_ms,fw_upgrade_send_t send,fw_upgrade_version_t request_version)
+{
+    fw_upgrade_t *up = new fw_upgrade_t;
+
+    up->name = name;
+    up->type = type;
+    up->frame_len = frame_len;
+    up->deadline_s = deadline_s;
+    up->ready_wait_ms = ready_wait_ms;
+    up->end_wait_ms = end_wait_ms;
+    up->send = send;
+    up->request_version = request_version;
+    for(int i = 0; i <= FW_UPGRADE_RESUME; i++)
+    {
+        up->rlt[i] = -1;
+    }
+    memset(up->version, 0, sizeof(up->version));
+    up->version_got = false;
+    up->frames_done = 0;
+    up->frames_total = 0;
+    return up;
+}
+
+void fw_upgrade_ack(fw_upgrade_t *up,int upgrade_type,int rlt)
+{
+    {
+        std::lock_guard<std::mutex> lock(up->lock);
+        if(FW_UPGRADE_DATA == upgrade_type)
+        {
+            up->data_acks.push_back(rlt);
+        }
+        else if((upgrade_type >= FW_UPGRADE_READY) && (upgrade_type <= FW_UPGRADE_RESUME))
+        {
+            up->rlt[upgrade_type] = rlt;
+        }
+        else
+        {
+            return;
+        }
+    }
+    up->cond.notify_all();
+}
+
+void fw_upgrade_version(fw_upgrade_t *up,const unsigned char *version,int len)
+{
+    {
+        std::lock_guard<std::mutex> lock(up->lock);
+        memset(up->version, 0, sizeof(up->version));
+        memcpy(up->version, version, std::min(len, (int)sizeof(up->version)));
+        up->version_got = true;
+    }
+    up->cond.notify_all();
+}
+
+//asks the board for its version through the reactor, false when it does not answer;
+//version is all zeros then
+static bool request_version(fw_upgrade_t *up,unsigned char *version)
+{
+    std::unique_lock<std::mutex> lock(up->lock);
+
+    up->version_got = false;
+    for(int i = 0; (i < FW_UPGRADE_VERSION_TRIES) && !up->version_got; i++)
+    {
+        lock.unlock();
+        reactor_post(up->request_version);
+        lock.lock();
+        up->cond.wait_for(lock, std::chrono::milliseconds(FW_UPGRADE_VERSION_WAIT_MS),
+            [up]{ return up->version_got; });
+    }
+    if(!up->version_got)
+    {
+        memset(version, 0, VERSION_LEN);
+        return false;
+    }
+    memcpy(version, up->version, VERSION_LEN);
+    return true;
+}
+
+//sends a ready, end or resume frame and waits for its ack, returns the result byte or -1 without ack
+static int fw_upgrade_request(fw_upgrade_t *up,int upgrade_type,unsigned char *frame,int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(up->lock);
+
+    up->rlt[upgrade_type] = -1;
+    lock.unlock();
+    if(up->send(frame) < 0)
+    {
+        return -1;
+    }
+    lock.lock();
+    //the board may take long, erasing its flash or checking the image, but answers once done
+    up->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+        [up, upgrade_type]{ return -1 != up->rlt[upgrade_type]; });
+    return up->rlt[upgrade_type];
+}
+
+//data frame: head, len, type, 1, file bytes, sum, tail; -1 only when the file can not be read
+static int send_data_frame(fw_upgrade_t *up,int fd,int index,off_t size,unsigned char *frame)
+{
+    off_t off = (off_t)index * up->frame_len;
+    int len = (size - off < up->frame_len) ? (int)(size - off) : up->frame_len;
+    unsigned char sum = 0;
+
+    if(pread(fd, frame + 4, len, off) != len)
+    {
+        ROS_ERROR("%s upgrade file read failed: %s", up->name, strerror(errno));
+        return -1;
+    }
+    frame[0] = MCU_FRAME_HEAD;
+    frame[1] = len + 6;
+    frame[2] = up->type;
+    frame[3] = FW_UPGRADE_DATA;
+    for(int i = 0; i < len + 4; i++)
+    {
+        sum += frame[i];
+    }
+    frame[len + 4] = sum;
+    frame[len + 5] = MCU_FRAME_TAIL;
+    //a frame that does not get out is not acked and sent again
+    up->send(frame);
+    return 0;
+}
+
+static int send_ready(fw_upgrade_t *up,const char *md5,uint32_t size)
+{
+    unsigned char frame[UpgradeReadyFrame::len];
+
+    UpgradeReadyFrame::EncodeAs(up->type, frame, FW_UPGRADE_READY, (const uint8_t *)md5, size);
+    return fw_upgrade_request(up, FW_UPGRADE_READY, frame, up->ready_wait_ms);
+}
+
+//a board that can not resume does not answer
+static int send_resume(fw_upgrade_t *up,const char *md5,uint32_t offset)
+{
+    unsigned char frame[UpgradeResumeFrame::len];
+
+    UpgradeResumeFrame::EncodeAs(up->type, frame, FW_UPGRADE_RESUME, (const uint8_t *)md5, offset);
+    return fw_upgrade_request(up, FW_UPGRADE_RESUME, frame, FW_UPGRADE_RESUME_WAIT_MS);
+}
+
+static int send_end(fw_upgrade_t *up)
+{
+    unsigned char frame[UpgradeEndFrame::len];
+
+    UpgradeEndFrame::EncodeAs(up->type, frame, FW_UPGRADE_END, 0);
+    return fw_upgrade_request(up, FW_UPGRADE_END, frame, up->end_wait_ms);
+}
+
+static void checkpoint_path(const char *path,char *ckpt_path)
+{
+    snprintf(ckpt_path, FILE_PATH_LEN + sizeof(FW_CHECKPOINT_SUFFIX), "%s%s", path, FW_CHECKPOINT_SUFFIX);
+}
+
+//one small write at 0, a crash leaves the last one or this one
+static void checkpoint_save(int fd,const fw_checkpoint_t *ckpt)
+{
+    if((fd < 0) || (pwrite(fd, ckpt, sizeof(*ckpt), 0) != (ssize_t)sizeof(*ckpt)) || (fdatasync(fd) < 0))
+    {
+        ROS_DEBUG("upgrade checkpoint write failed: %s", strerror(errno));
+    }
+}
+
+//the checkpoint of path for this md5 and board version, ckpt->offset is 0 when there is none
+static void fw_checkpoint_load(const char *path,const char *md5,const unsigned char *version,fw_checkpoint_t *ckpt)
+{
+    char ckpt_path[FILE_PATH_LEN + sizeof(FW_CHECKPOINT_SUFFIX)];
+    fw_checkpoint_t saved;
+    int fd = -1;
+    ssize_t len = 0;
+
+    memcpy(ckpt->md5, md5, MD5_SIZE);
+    memcpy(ckpt->version, version, VERSION_LEN);
+    ckpt->offset = 0;
+
+    checkpoint_path(path, ckpt_path);
+    fd = open(ckpt_path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return;
+    }
+    len = pread(fd, &saved, sizeof(saved), 0);
+    close(fd);
+    //another image or firmware since, the board does not hold those bytes
+    if((len == (ssize_t)sizeof(saved)) && (0 == memcmp(saved.md5, ckpt->md5, MD5_SIZE))
+        && (0 == memcmp(saved.version, ckpt->version, VERSION_LEN)))
+    {
+        ckpt->offset = saved.offset;
+    }
+}
+
+static void fw_checkpoint_clear(const char *path)
+{
+    char ckpt_path[FILE_PATH_LEN + sizeof(FW_CHECKPOINT_SUFFIX)];
+
+    checkpoint_path(path, ckpt_path);
+    if((unlink(ckpt_path) < 0) && (ENOENT != errno))
+    {
+        ROS_ERROR("remove upgrade checkpoint %s failed: %s", ckpt_path, strerror(errno));
+    }
+}
+
+//true when the board reports version, which may be empty for not known
+static bool fw_version_match(const unsigned char *board_version,const char *version)
+{
+    if((NULL == version) || (0 == version[0]))
+    {
+        return false;
+    }
+    return 0 == strncmp((const char *)board_version, version, VERSION_LEN);
+}
+
+//fw_upgrade_run's result for a ready frame that was not acked with 0
+static int ready_error(int ready)
+{
+    if(-1 == ready)
+    {
+        return -6;
+    }
+    return (1 == ready) ? -2 : ((2 == ready) ? -3 : -8);
+}
+
+//waits until no data ack came for FW_UPGRADE_ACK_MS and drops them, they belong to frames sent before
+static void drain_data_acks(fw_upgrade_t *up,std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(up->lock);
+
+    do
+    {
+        up->data_acks.clear();
+    }
+    while(up->cond.wait_until(lock, std::min(std::chrono::steady_clock::now() + std::chrono::milliseconds(FW_UPGRADE_ACK_MS), deadline),
+        [up]{ return !up->data_acks.empty(); }));
+}
+
+//sends the file from ckpt->offset on, which follows the acks; 0 when every frame was acked,
+//-1 the file can not be read, -4 deadline passed, a ready error when the board had to start over
+static int fw_upgrade_send_file(fw_upgrade_t *up,const char *path,fw_checkpoint_t *ckpt)
+{
+    char ckpt_path[FILE_PATH_LEN + sizeof(FW_CHECKPOINT_SUFFIX)];
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(up->deadline_s);
+    std::chrono::steady_clock::time_point ack_by;
+    unsigned char frame[MCU_FRAME_MAX_LEN];
+    struct stat st;
+    int window = fw_upgrade_window.load();
+    int frames = 0;
+    int base = 0;           //oldest frame not acked
+    int next = 0;           //next frame to send
+    int skip = 0;           //acks of frames sent after a failed one, they are sent again
+    int resent = 0;
+    int ack = 0;
+    int rlt = 0;
+    int fd = -1;
+    int ckpt_fd = -1;
+
+    if(up->frame_len + 6 > MCU_FRAME_MAX_LEN)
+    {
+        return -1;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if((fd < 0) || (fstat(fd, &st) < 0))
+    {
+        ROS_ERROR("open %s upgrade file %s failed: %s", up->name, path, strerror(errno));
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    frames = (st.st_size + up->frame_len - 1) / up->frame_len;
+    //a whole number of frames, or the whole file when only the end frame was missing
+    if((ckpt->offset > st.st_size) || ((0 != ckpt->offset % up->frame_len) && (ckpt->offset != st.st_size)))
+    {
+        ckpt->offset = 0;
+    }
+    base = (ckpt->offset + up->frame_len - 1) / up->frame_len;
+    next = base;
+    checkpoint_path(path, ckpt_path);
+    ckpt_fd = open(ckpt_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    checkpoint_save(ckpt_fd, ckpt);
+    up->frames_done = base;
+    up->frames_total = frames;
+    {
+        std::lock_guard<std::mutex> lock(up->lock);
+        up->data_acks.clear();
+    }
+    ROS_INFO("%s upgrade: %d frames from %d on, window %d", up->name, frames, base, window);
+
+    while((base < frames) && (0 == rlt))
+    {
+        if(std::chrono::steady_clock::now() >= deadline)
+        {
+            ROS_ERROR("send %s upgrade file over time, %d of %d frames acked", up->name, base, frames);
+            rlt = -4;
+            break;
+        }
+        for(; (next < frames) && (next - base < window) && (0 == rlt); next++)
+        {
+            rlt = send_data_frame(up, fd, next, st.st_size, frame);
+        }
+        if(0 != rlt)
+        {
+            break;
+        }
+
+        ack_by = std::min(std::chrono::steady_clock::now() + std::chrono::milliseconds(FW_UPGRADE_ACK_MS), deadline);
+        {
+            std::unique_lock<std::mutex> lock(up->lock);
+            up->cond.wait_until(lock, ack_by, [up]{ return !up->data_acks.empty(); });
+            if(up->data_acks.empty())
+            {
+                ack = -1;
+            }
+            else
+            {
+                ack = up->data_acks.front();
+                up->data_acks.pop_front();
+            }
+        }
+
+        if((skip > 0) && (-1 != ack))
+        {
+            skip--;
+            continue;
+        }
+        if(0 == ack)
+        {
+            base++;
+            if((base * 10 / frames) != ((base - 1) * 10 / frames))
+            {
+                ROS_INFO("%s upgrade %d%%", up->name, base * 100 / frames);
+            }
+            up->frames_done = base;
+            if(0 == base % FW_CHECKPOINT_FRAMES)
+            {
+                ckpt->offset = (uint32_t)base * up->frame_len;
+                checkpoint_save(ckpt_fd, ckpt);
+            }
+            continue;
+        }
+        if(-1 != ack)
+        {
+            //failed, the board drops the frames sent after it until this one comes again
+            ROS_DEBUG("%s upgrade frame %d failed, sending %d frames again", up->name, base, next - base);
+            skip = next - base - 1;
+            resent += next - base;
+            next = base;
+            continue;
+        }
+        //not acked; a lost ack shows only now, the acks since were taken for the frames before theirs
+        //and the board may hold frames after base already
+        ROS_DEBUG("%s upgrade frame %d not acked, sending %d frames again", up->name, base, next - base);
+        drain_data_acks(up, deadline);
+        skip = 0;
+        if((next - base > 1) && (0 != send_resume(up, (const char *)ckpt->md5, (uint32_t)base * up->frame_len)))
+        {
+            //it can not be put back at base, start over one frame at a time, which any board takes
+            ROS_INFO("%s upgrade can not resume at frame %d, starting over", up->name, base);
+            rlt = send_ready(up, (const char *)ckpt->md5, (uint32_t)st.st_size);
+            if(0 != rlt)
+            {
+                rlt = ready_error(rlt);
+                break;
+            }
+            window = 1;
+            base = 0;
+            up->frames_done = 0;
+            ckpt->offset = 0;
+            checkpoint_save(ckpt_fd, ckpt);
+        }
+        resent += next - base;
+        next = base;
+    }
+    close(fd);
+    ckpt->offset = std::min((off_t)base * up->frame_len, st.st_size);
+    checkpoint_save(ckpt_fd, ckpt);
+    if(ckpt_fd >= 0)
+    {
+        close(ckpt_fd);
+    }
+    if(0 == rlt)
+    {
+        ROS_INFO("%s upgrade file sent, %d frames, %d sent again", up->name, frames, resent);
+    }
+    return rlt;
+}
+
+int fw_upgrade_run(fw_upgrade_t *up,const char *path,const char *md5,const char *version)
+{
+    unsigned char board_version[VERSION_LEN];
+    fw_checkpoint_t ckpt;
+    struct stat st;
+    int ready = -1;
+    int end = -1;
+    int rlt = 0;
+
+    //verify only, as when the end ack of the last try was lost
+    if(request_version(up, board_version) && fw_version_match(board_version, version))
+    {
+        ROS_INFO("%s already runs %.*s, not flashed again", up->name, VERSION_LEN, version);
+        fw_checkpoint_clear(path);
+        return 0;
+    }
+    if((stat(path, &st) < 0) || (0 == st.st_size))
+    {
+        ROS_ERROR("%s upgrade file %s can not be read", up->name, path);
+        return -1;
+    }
+    fw_checkpoint_load(path, md5, board_version, &ckpt);
+    if((ckpt.offset > 0) && (0 == send_resume(up, md5, ckpt.offset)))
+    {
+        ROS_INFO("%s upgrade resumes at byte %u", up->name, ckpt.offset);
+        ready = 0;
+    }
+    else
+    {
+        //the ready frame erases what the checkpoint counted
+        fw_checkpoint_clear(path);
+        ckpt.offset = 0;
+        ready = send_ready(up, md5, (uint32_t)st.st_size);
+    }
+    ROS_DEBUG("%s upgrade ready rlt:%d", up->name, ready);
+    if(0 != ready)
+    {
+        return ready_error(ready);
+    }
+
+    rlt = fw_upgrade_send_file(up, path, &ckpt);
+    if(rlt < 0)
+    {
+        return rlt;
+    }
+    end = send_end(up);
+    if(-1 == end)
+    {
+        return -7;
+    }
+    //flashed or rejected, nothing to resume either way
+    fw_checkpoint_clear(path);
+    return end;
+}
+
+int fw_upgrade_progress(fw_upgrade_t *up)
+{
+    int total = up->frames_total.load();
+
+    if(0 == total)
+    {
+        return -1;
+    }
+    return up->frames_done.load() * 100 / total;
+}
+
+void set_fw_upgrade_window(int window)
+{
+    if(window < 1)
+    {
+        window = 1;
+    }
+    if(window > FW_UPGRADE_WINDOW_MAX)
+    {
+        window = FW_UPGRADE_WINDOW_MAX;
+    }
+    fw_upgrade_window = window;
+}
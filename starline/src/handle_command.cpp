@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <vector>
 #include <pthread.h>
+#include <atomic>
 #include "../include/starline/Id.h"
 #include "../include/starline/config.h"
 #include "../include/starline/system.h"
@@ -18,14 +19,7 @@
 #include "../include/starline/navigation.h"
 #include "../include/starline/handle_command.h"
 #include "../include/starline/led.h"
-
-#define PKG_LEN_INDEX  (1)
-#define PKG_INDEX_INDEX (3)
-#define PKG_TYPE_INDEX  (4)
-#define PKG_DATA_INDEX   (6)
-
-#define PKG_BASE_LEN  (26)
-#define PKG_CMD_BASE_LEN (9)
+#include "../include/starline/upper_cmd.h"
 
 inline void restore_long_int_buf(unsigned char *buf,long int *data)
 {
@@ -561,1566 +555,1757 @@ int set_system_params(system_t *sys,motion_t *motion,env_t *env,int type,unsigne
 }
 
 
-//
-int send_pkg_back(unsigned short int pkg_type,system_t *sys,motion_t *motion,
-          env_t *env,int data,int type,unsigned char *str)
+static int pkg_empty(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    return PKG_BASE_LEN;
+}
+
+//result byte of most feedbacks
+static int pkg_byte(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    send_buf[PKG_DATA_INDEX] = data;
+    return PKG_BASE_LEN + 1;
+}
+
+//result byte and the type it answers
+static int pkg_byte_type(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    return PKG_BASE_LEN + 2;
+}
+
+static int pkg_int(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    set_int_buf(&(send_buf[PKG_DATA_INDEX]),data);
+    return PKG_BASE_LEN + 4;
+}
+
+static int pkg_mode(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    //feedback:current mode
+    send_buf[PKG_DATA_INDEX] = sys->auto_enable;
+    return PKG_BASE_LEN + 1;
+}
+
+static int pkg_real_vel(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
 {
-    static unsigned char send_num = 1;
     int itmp = 0;
-    int start = 0;
-	unsigned short int pkg_len = 0;
-	unsigned short int check = 0;
-    unsigned char send_buf[SOCKET_PKG_LEN] = {0,};
-    char tmp_buf[BUF_LEN] = {0,};
-    char buf_map[8] = {'X','Y','Z','T','E','M','P','G'};
-    
-    if((NULL == sys) || (NULL == motion))
+
+    //feedback:real vel
+    itmp = sys->real_vel.vx * 1000.0;
+    set_int_buf(&(send_buf[PKG_DATA_INDEX]),itmp);
+
+    itmp = sys->real_vel.vth * 1000.0;
+    set_int_buf(&(send_buf[PKG_DATA_INDEX+4]),itmp);
+    return PKG_BASE_LEN + 4*2;
+}
+
+static int pkg_init_map(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    //feedback:initial mode status
+    if(MANUAL_MAP_MODE == sys->manual_work_mode)
     {
-        ROS_DEBUG("sys or motion NULL!");
-        return -1;
+        send_buf[PKG_DATA_INDEX] = 1;
     }
-    
-    send_buf[0] = 0x55;
-	//send_buf[PKG_LEN_INDEX+1] = 0;
-    send_buf[PKG_INDEX_INDEX] = send_num;
-    send_num++;
-    send_buf[PKG_TYPE_INDEX] = pkg_type&0x00ff;   //low byte before high byte
-    send_buf[PKG_TYPE_INDEX+1] = (pkg_type&0xff00)>>8;
-    switch(pkg_type)
-    {
-        case PKG_FB_MODE:
-            //feedback:current mode
-            pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = sys->auto_enable;
-            break;
-            
-        case PKG_FB_REAL_VEL:
-            //feedback:real vel
-            pkg_len = PKG_BASE_LEN + 4*2;
-            itmp = sys->real_vel.vx * 1000.0;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),itmp);
-
-            itmp = sys->real_vel.vth * 1000.0;    
-            set_int_buf(&(send_buf[PKG_DATA_INDEX+4]),itmp);
-            break;
-            
-        case PKG_FB_INIT_MAP:
-            //feedback:initial mode status
-			pkg_len = PKG_BASE_LEN + 1;
-            if(MANUAL_MAP_MODE == sys->manual_work_mode)
-            {
-                send_buf[PKG_DATA_INDEX] = 1;
-            }
-            else
-            {
-                send_buf[PKG_DATA_INDEX] = 0;
-            }
-            break;
-        case PKG_FB_CAL_MARK:
-            //feedback:mark flag
-            send_buf[PKG_DATA_INDEX] = data;//result
-			pkg_len = PKG_BASE_LEN + 1;
-            break;
-        case PKG_FB_CAL_TPOINT:
-            //feedback:tpoint flag
-            //send_buf[PKG_LEN_INDEX] = 25;
-            pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_CAL_GOAL:
-            //feedback:goal flag
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_REPORT_ERROR:
-            //report error to do
-            //send_buf[PKG_LEN_INDEX] = 28;
-			pkg_len = PKG_BASE_LEN + 4;
-            itmp = data;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),itmp);
-            break;
-        case PKG_FB_CURRENT_GOAL:
-            //send_buf[PKG_LEN_INDEX] = 28;
-			pkg_len = PKG_BASE_LEN + 4;
-            itmp = data;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),itmp);
-            break;
-        case PKG_FB_CURRENT_DANCE:
-            //start dance cmd feedback
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-		case PKG_FB_REBOOT_SYSTEM:
-            //send_buf[PKG_LEN_INDEX] = 24;
-			pkg_len = PKG_BASE_LEN;
-            break;
-        case PKG_FB_SHUTDOWN:
-            //send_buf[PKG_LEN_INDEX] = 24;
-			pkg_len = PKG_BASE_LEN;
-            break;
-        case PKG_FB_STOP_DANCE:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_DANCE_STATUS:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_PREPARE_DANCE:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_BACK_DANCE_START_POINT:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_ENTER_DANCE_MODE:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_EXIT_DANCE_MODE:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_PREPARE_NAV:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_NAV_STATUS:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_STOP_NAV:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-            break;
-        case PKG_FB_UPDATE_DANCE_START_POINT:
-            //send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-            send_buf[PKG_DATA_INDEX] = data;
-			break;
-		case PKG_FB_SEND_MAP_INFO_BEGIN:
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-            send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			break;
-		case PKG_FB_SEND_MAP_INFO:
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-		    break;
-		case PKG_FB_SEND_MAP_INFO_END:
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-		    break;
-		case PKG_FB_READ_SENSE_DATA:
-			//feedback sense data
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-		    switch(type)
-		    {
-		        case 0:
-					itmp = 1;//todo
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 1:
-					for(itmp = 0;itmp < LASER_NUM;itmp++)
-					{
-					    set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4])
-							,(float)sys->sensor.laser_len[itmp]);
-					}
-					//send_buf[PKG_LEN_INDEX] = 26 + 4*LASER_NUM;
-					pkg_len = PKG_BASE_LEN + 2 + 4*LASER_NUM;
-					break;
-				case 2:
-					for(itmp = 0;itmp < SONAR_NUM;itmp++)
-					{
-					    set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4])
-							,(float)sys->sensor.sonar_len[itmp]);
-					}
-					//send_buf[PKG_LEN_INDEX] = 26 + 4*SONAR_NUM;
-					pkg_len = PKG_BASE_LEN + 2 + 4*SONAR_NUM;
-					break;
-				case 3:
-					send_buf[PKG_DATA_INDEX+2] = sys->sensor.infrared_flag;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-                    //ROS_DEBUG("infrade flag :%x,%x",send_buf[7],sys->sensor.infrared_flag);
-					break;
-				case 4:
-					itmp = sys->sensor.work_normal;
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 5:
-					send_buf[PKG_DATA_INDEX+2] = sys->sensor.estop_io_flag;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-                    ROS_DEBUG("estop io flag :%x",send_buf[PKG_DATA_INDEX+2]);
-					break;
-				case 6:
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),
-						(float)sys->sensor.estop_fb_limit);
-					//send_buf[PKG_LEN_INDEX] = 30;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 7:
-					//sensor version
-					for(itmp=0;itmp<VERSION_LEN;itmp++)
-					{
-					    send_buf[PKG_DATA_INDEX+2+itmp] = sys->sensor.version[itmp];
-					}
-					pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
-					break;
-				default:
-					break;
-		    }
-			break;
-		case PKG_FB_READ_BASE_DATA:
-			//feedback base data
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			switch(type)
-			{
-			    case 0:
-					itmp = 1;//todo base status
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 1:
-					send_buf[PKG_DATA_INDEX+2] = sys->base.estop_sensor_flag;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 2:
-					for(itmp = 0;itmp < BASE_LASER_NUM;itmp++)
-					{
-					    set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4]),
-							(float)sys->base.laser[itmp]);
-					}
-					//send_buf[PKG_LEN_INDEX] = 26 + 4*BASE_LASER_NUM;
-					pkg_len = PKG_BASE_LEN + 2 + 4*BASE_LASER_NUM;
-					break;
-				case 3:
-					if(sys->base.move_status&0x78)
-					{
-					    send_buf[PKG_DATA_INDEX+2] = 1;
-					}
-					else
-					{
-					    send_buf[PKG_DATA_INDEX+2] = 0;
-					}
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 4:
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.odom.x);
-				    set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.odom.y);
-				    set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->base.odom.th);
-					//send_buf[PKG_LEN_INDEX] = 38;
-					pkg_len = PKG_BASE_LEN + 2 + 4*3;
-		            break;
-				case 5:
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.fb_vel.vx);
-				    set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.fb_vel.vth);
-					//send_buf[PKG_LEN_INDEX] = 34;
-					pkg_len = PKG_BASE_LEN + 2 + 4*2;
-					break;
-				case 6:
-					//todo base self-test reserved
-					itmp = sys->base.work_normal;
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 7:
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.fb_cmd_vel.vx);
-				    set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.fb_cmd_vel.vth);
-					//send_buf[PKG_LEN_INDEX] = 34;
-					pkg_len = PKG_BASE_LEN + 2 + 4*2;
-					break;
-				case 8:
-					for(itmp=0;itmp<BASE_MOTOR_NUM;itmp++)
-					{
-					    send_buf[PKG_DATA_INDEX+2+itmp] = sys->base.motor_status[itmp];
-					}
-					//send_buf[PKG_LEN_INDEX] = 26+BASE_MOTOR_NUM;
-					pkg_len = PKG_BASE_LEN + 2 + BASE_MOTOR_NUM;
-					break;
-				case 9:
-					send_buf[PKG_DATA_INDEX+2] = sys->base.move_status;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 10:
-					send_buf[PKG_DATA_INDEX+2] = sys->base.move_rssi;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 11:
-					send_buf[PKG_DATA_INDEX+2] = sys->base.power_v;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 12:
-					//base version
-					for(itmp=0;itmp<VERSION_LEN;itmp++)
-					{
-					    send_buf[PKG_DATA_INDEX+2+itmp] = sys->base.version[itmp];
-					}
-					pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
-					break;
-				case 13:
-					send_buf[PKG_DATA_INDEX+2] = sys->base.move_sensor_state;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-				default:
-					break;
-			}
-			break;
-		case PKG_FB_READ_LED_POWER_DATA:
-			//feedback led and power data
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-		    switch(type)
-		    {
-		        case 0:
-					itmp = ((int)sys->led_power.power_status2<<8)|((int)sys->led_power.power_status1);
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 1:
-					itmp = 0;
-					itmp = ((int)sys->led_power.power_v2<<8)|((int)sys->led_power.power_v1);
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 2:
-					//todo led and power self-test reserved
-					itmp =0;
-					itmp = sys->led_power.work_normal;
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 3:
-					//actual led mode
-					send_buf[PKG_DATA_INDEX+2] = sys->led_power.act_mode;
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 4:
-					//actual led effect
-					send_buf[PKG_DATA_INDEX+2] = sys->led_power.act_effect&0x0ff;
-					send_buf[PKG_DATA_INDEX+3] = (sys->led_power.act_effect&0xff00)>>8;
-					//send_buf[PKG_LEN_INDEX] = 28;
-					pkg_len = PKG_BASE_LEN + 2 + 2;
-					break;
-				case 5:
-					//power switch status
-					itmp = 0;
-					itmp = (((int)sys->led_power.power_switch_status4)<<24)|(((int)sys->led_power.power_switch_status1)<<16)
-						       |(((int)sys->led_power.power_switch_status1)<<8)|((int)sys->led_power.power_switch_status1);
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
-					//send_buf[PKG_LEN_INDEX] = 27;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 6:
-					//power current 
-					for(itmp=0;itmp<POWER_CURRENT_NUM*2;itmp++)
-					{
-					    send_buf[PKG_DATA_INDEX+2+itmp] = sys->led_power.power_i[itmp];
-					}
-					//send_buf[PKG_LEN_INDEX] = 26 + POWER_CURRENT_NUM;
-					pkg_len = PKG_BASE_LEN + 2 + POWER_CURRENT_NUM*2;
-					break;
-				case 7:
-					//get power temp current info
-					pkg_len = PKG_BASE_LEN + 2;
-					set_get_power_flag();
-				    break;
-				case 8:
-					//power version
-					for(itmp=0;itmp<VERSION_LEN;itmp++)
-					{
-					    send_buf[PKG_DATA_INDEX+2+itmp] = sys->led_power.version[itmp];
-					}
-					pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
-					break;
-				case 9:
-					//set led red long
-					pkg_len = PKG_BASE_LEN + 2;
-					sys->led_power.mmi_test_flag = 1;
-					set_led_power_effect(LED_POWER_FREEDOM,LED_RED_LONG);
-				    break;
-				case 10:
-					//set led green long
-					pkg_len = PKG_BASE_LEN + 2;
-					sys->led_power.mmi_test_flag = 1;
-					set_led_power_effect(LED_POWER_FREEDOM,LED_GREEN_LONG);
-				    break;
-				case 11:
-					//set led blue long
-					pkg_len = PKG_BASE_LEN + 2;
-					sys->led_power.mmi_test_flag = 1;
-					set_led_power_effect(LED_POWER_FREEDOM,LED_BLUE_LONG);
-				    break;
-				case 12:
-					//shut down mmi led test
-					pkg_len = PKG_BASE_LEN + 2;
-					sys->led_power.mmi_test_flag = 0;
-					set_led_power_effect(LED_POWER_FREEDOM,LED_NORMAL);
-				    break;
-				default:
-					break;
-		    }
-			break;
-		case PKG_FB_READ_CAMERA_DATA:
-			//read camera data
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			switch(type)
-			{
-			    case 0:
-					//camera state.
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->camera.state);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 1:
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->camera.id);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->camera.point.x);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->camera.point.y);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)sys->camera.point.z);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+18]),(float)sys->camera.point.th);
-					//send_buf[PKG_LEN_INDEX] = 46;//26+4*5
-					pkg_len = PKG_BASE_LEN + 2 + 4*5;
-					break;
-				default:
-					break;
-			}
-			break;
-		case PKG_FB_READ_CONTROLLER_DATA:
-			//read controller data
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			switch(type)
-			{
-			    case 0:
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->sys_status);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 1:
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->err_num);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 2:
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->warn_num);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 3:
-					//obstacle scale
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->obstacle_scale);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 4:
-					//nav finish status
-					send_buf[PKG_DATA_INDEX+2] = motion->path.path_finish;
-					//send_buf[PKG_LEN_INDEX] = 26+1;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 5:
-					//nav goal id
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),motion->path.goal_id);
-					//send_buf[PKG_LEN_INDEX] = 26 + 4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 6:
-					//dance finish status
-					send_buf[PKG_DATA_INDEX+2] = sys->dance.dance_state;
-					//send_buf[PKG_LEN_INDEX] = 26+1;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 7:
-					//dance id
-					set_long_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->dance.dance_id);
-					//send_buf[PKG_LEN_INDEX] = 26 + 8;
-					pkg_len = PKG_BASE_LEN + 2 + 8;
-					break;
-				case 8:
-					// build cord flag
-					send_buf[PKG_DATA_INDEX+2] = sys->build_cord_flag;
-					//send_buf[PKG_LEN_INDEX] = 26+1;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 9:
-					//current position
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)motion->current.x);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)motion->current.y);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)motion->current.z);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)motion->current.th);
-					//send_buf[PKG_LEN_INDEX] = 42;
-					pkg_len = PKG_BASE_LEN + 2 + 4*4;
-					break;
-				case 10:
-					//dance start point
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_start_point.x);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->dance.dance_start_point.y);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->dance.dance_start_point.z);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)sys->dance.dance_start_point.th);
-					//send_buf[PKG_LEN_INDEX] = 42;
-					pkg_len = PKG_BASE_LEN + 2 + 4*4;
-					break;
-				case 11:
-					// build cord flag
-					send_buf[PKG_DATA_INDEX+2] = sys->dance.dance_start_point_set;
-					//send_buf[PKG_LEN_INDEX] = 26+1;
-					pkg_len = PKG_BASE_LEN + 2 + 1;
-					break;
-				case 12:
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->real_vel.vx);
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->real_vel.vth);
-					//send_buf[PKG_LEN_INDEX] = 26+8;
-					pkg_len = PKG_BASE_LEN + 2 + 4*2;
-					break;
-				case 13:
-					//video center x
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.x);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 14:
-					//slow dist
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.slow_limit);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 15:
-					//estop dist
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.estop_limit);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 16:
-					//min z
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->min_z);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 17:
-					//max z
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_z);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 18:
-					//observe dist
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->observe_dist);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 19:
-					//tpoint tolerance
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->tolerance_pass);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 20:
-					//goal tolerance
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->tolerance_goal);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 21:
-					//max manual vx
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_manual_vx);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 22:
-					//max manual vth
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_manual_vth);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 23:
-					//max auto vx
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_vx);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 24:
-					//max auto vth
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_vth);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 25:
-					//max acc_x
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_accx);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 26:
-					//max acc_th
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_accth);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 27:
-					//dance start point xy range
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_xy_range);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 28:
-					//dance start point scale
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_xy_scale);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 29:
-					//dance start point th range
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_th_range);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 30:
-					//upper controller ip
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),(int)get_upper_server_ip());
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 31:
-					//internal develop version num
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),DEVELOP_VERSION_CODE);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 32:
-					//official version num
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),OFFICIAL_VERSION_CODE);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 33:
-					//sonar event limit
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.sonar_event1_limit);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 34:
-					//manual control overtime
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)(sys->manual_control_over_time));
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 35:
-					//video center y
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.y);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 36:
-					//video center th
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.th);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 37:
-					//enter event type
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->enter_event_type);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 38:
-					//enter event limit
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->enter_event_limit);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 39:
-					//nav over time 
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->nav_over_time);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 40:
-					//nav goal nearby range
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->goal_nearby_range);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 41:
-					//upgrade overtime range
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),UPGRADE_OVER_TIME);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-                    break;
-				case 42:
-					//enter sonar num
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->enter_sonar_num);
-					//send_buf[1] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-                case 43:
-					//nav goal nearby th
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->goal_nearby_th);
-                    //send_buf[1] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 44:
-					//product id 
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),PRODUCT_ID);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-                    break;
-				case 45:
-					//system type id 
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),SYSTEM_TYPE_ID);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-                    break;
-				case 200:
-					//reserve_int_1
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->reserve_int_1);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 201:
-					//reserve_int_1
-					set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->reserve_int_2);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 202:
-					//reserve_double_3
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->reserve_double_3);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				case 203:
-					//reserve_double_4
-					set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->reserve_double_4);
-					//send_buf[PKG_LEN_INDEX] = 26+4;
-					pkg_len = PKG_BASE_LEN + 2 + 4;
-					break;
-				default:
-					break;
-			}
-			break;
-		case PKG_FB_SET_CONTROLLER_PARAMS:
-			//set controller params
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_DANCE_FILE_BEGIN:
-			//feedback dance file begin
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_DANCE_FILE:
-			//feedback dance file send
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_DANCE_FILE_END:
-			//feedback dance file end
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_UPGRADE_FILE_BEGIN:
-			//upgrade begin
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_UPGRADE_FILE:
-			//upgrade 
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_SEND_UPGRADE_FILE_END:
-			//upgrade end
-			send_buf[PKG_DATA_INDEX] = data;
-			send_buf[PKG_DATA_INDEX+1] = type;
-			//send_buf[PKG_LEN_INDEX] = 26;
-			pkg_len = PKG_BASE_LEN + 2;
-			break;
-		case PKG_FB_READ_DEVELOP_VERSION:
-			//version 
-			//send_buf[PKG_LEN_INDEX] = 28;
-			pkg_len = PKG_BASE_LEN + 4;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),DEVELOP_VERSION_CODE);
-			break;
-		case PKG_FB_CHECK_SYSTEM:
-			//check system
-			//send_buf[PKG_LEN_INDEX] = 24+data;
-			pkg_len = PKG_BASE_LEN + data;
-			for(itmp=0;itmp<data;itmp++)
-			{
-			    send_buf[PKG_DATA_INDEX+itmp] = str[itmp];
-			}
-			break;
-		case PKG_FB_READ_OFFICIAL_VERSION:
-			//official version
-			//send_buf[PKG_LEN_INDEX] = 28;
-			pkg_len = PKG_BASE_LEN + 4;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),OFFICIAL_VERSION_CODE);
-			break;
-		case PKG_SEND_HEART_BEAT:
-			//send_buf[PKG_LEN_INDEX] = 24;
-			pkg_len = PKG_BASE_LEN;
-			break;
-		case PKG_FB_REBOOT_ROBOT:
-			//send_buf[PKG_LEN_INDEX] = 24;
-			pkg_len = PKG_BASE_LEN;
-			break;
-		case PKG_FB_RELOAD_MAP_FILES:
-			ROS_DEBUG("reload map files result:%d",data);
-			send_buf[PKG_DATA_INDEX] = data;
-			//send_buf[PKG_LEN_INDEX] = 25;
-			pkg_len = PKG_BASE_LEN + 1;
-			break;
-        case PKG_FB_REQUEST_UPGRADE:
-            pkg_len = PKG_BASE_LEN + 4;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),data);
-            break;
-        case PKG_FB_START_UPGRADE:
-            pkg_len = PKG_BASE_LEN + 4;
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),data);
-		case PKG_REPORT_NAV_FINISHED:
-			//send_buf[PKG_LEN_INDEX] = 28;
-			pkg_len = PKG_BASE_LEN + 4;
-            //goal finished 
-            set_int_buf(&(send_buf[PKG_DATA_INDEX]),motion->path.goal_id);
-			break;
-		case PKG_REPORT_DANCE_FINISHED:
-			//send_buf[PKG_LEN_INDEX] = 32;
-			pkg_len = PKG_BASE_LEN + 8;
-            //dance finished 
-            set_long_int_buf(&(send_buf[PKG_DATA_INDEX]),sys->dance.dance_id);
-			break;
-		case PKG_REPORT_SHUTDOWN:
-			//send_buf[PKG_LEN_INDEX] = 24;
-			pkg_len = PKG_BASE_LEN;
-			//power close,shut down 
-			break;
-		case PKG_REPORT_AI_WORDS:
-			//send_buf[PKG_LEN_INDEX] = 24+data;
-			pkg_len = PKG_BASE_LEN + data;
-			memcpy(&(send_buf[PKG_DATA_INDEX]),str,data);
-			ROS_DEBUG("send ai words");
-			break;
-        default:
-            break;
+    else
+    {
+        send_buf[PKG_DATA_INDEX] = 0;
     }
+    return PKG_BASE_LEN + 1;
+}
 
-    send_buf[PKG_LEN_INDEX] = pkg_len&0x0ff;
-	send_buf[PKG_LEN_INDEX+1] = (pkg_len&0xff00)>>8;
-    //start = send_buf[PKG_LEN_INDEX] - 19;
-    itmp = sizeof(float)*4+1+2+1;
-    start = pkg_len - itmp;
-    set_float_buf(&(send_buf[start]),(float)motion->current.x);
-    set_float_buf(&(send_buf[start+4]),(float)motion->current.y);
-    set_float_buf(&(send_buf[start+8]),(float)motion->current.z);
-    set_float_buf(&(send_buf[start+12]),(float)motion->current.th);
+static int pkg_reload_map_files(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    ROS_DEBUG("reload map files result:%d",data);
+    send_buf[PKG_DATA_INDEX] = data;
+    return PKG_BASE_LEN + 1;
+}
 
-    set_robot_state_buf(&(send_buf[start+16]),sys);
-    
-    //send_buf[start+17] = 0;
-    check = 0;
-    for(itmp = 0;itmp < pkg_len - 3;itmp++)
-    {
-        //ROS_DEBUG("send_buf[%d]:%x",itmp,send_buf[itmp]);
-        check += send_buf[itmp];
-    }
-	send_buf[pkg_len - 3] = check&0x0ff;
-	send_buf[pkg_len - 2] = (check&0xff00)>>8;
-	
-    send_buf[pkg_len - 1] = 0xaa;
-    for(int i=0;i<pkg_len;i++)
+static int pkg_develop_version(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
 {
-    //ROS_DEBUG("send_pkg_back:%02x",send_buf[i]);
-}	
-    itmp = send_status_back(send_buf, (int)pkg_len);
-    
-    return itmp;
+    set_int_buf(&(send_buf[PKG_DATA_INDEX]),DEVELOP_VERSION_CODE);
+    return PKG_BASE_LEN + 4;
 }
 
+static int pkg_official_version(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    set_int_buf(&(send_buf[PKG_DATA_INDEX]),OFFICIAL_VERSION_CODE);
+    return PKG_BASE_LEN + 4;
+}
 
-static int handle_cmd(unsigned char *buf,system_t*sys,motion_t *motion,env_t *env)
+//data bytes of str as they are, check system answers and ai words
+static int pkg_str(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
 {
-    int itmp = 0;
-    int data = 0;
-    int fb_data = 0;
-    int type = 0;
-    int i = 0;
-    int j = 0;
-	long int index = 0;
-    unsigned short int pkg_type = 0;
-	unsigned short int pkg_len = 0;
-    unsigned char cdata[SOCKET_PKG_BUF_SIZE] = {0,};
-	ask_status_t ask;
-	ans_status_t ans;
-    
-    if((NULL == buf) || (NULL == sys) || (NULL == motion) || (NULL == env))
+    //check_upper_pkg() takes less than SOCKET_PKG_LEN
+    if((NULL == str) || (data < 0) || (data > SOCKET_PKG_LEN - PKG_BASE_LEN - 1))
     {
-        ROS_DEBUG("handle_cmd:buf,sys,motion,env is NULL");
-        return -1;
+        return 0;
     }
-    pkg_len = (buf[PKG_LEN_INDEX+1]<<8)|(buf[PKG_LEN_INDEX]);
-    pkg_type = (buf[PKG_TYPE_INDEX+1]<<8)|(buf[PKG_TYPE_INDEX]);
+    memcpy(&(send_buf[PKG_DATA_INDEX]),str,data);
+    return PKG_BASE_LEN + data;
+}
 
-    if(1 == motion->path.info_flag)
-    {
-        motion->path.info_flag = 0;
-    }
-    if(1 == sys->dance.dance_info_flag)
+//event records, their number first
+static int pkg_events(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    if((NULL == str) || (data < 0) || (data > SOCKET_PKG_LEN - PKG_BASE_LEN - 2))
     {
-        sys->dance.dance_info_flag = 0;
+        return 0;
     }
+    send_buf[PKG_DATA_INDEX] = type;
+    memcpy(&(send_buf[PKG_DATA_INDEX+1]),str,data);
+    return PKG_BASE_LEN + 1 + data;
+}
+
+static int pkg_nav_finished(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    //goal finished
+    set_int_buf(&(send_buf[PKG_DATA_INDEX]),motion->path.goal_id);
+    return PKG_BASE_LEN + 4;
+}
+
+static int pkg_dance_finished(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    //dance finished
+    set_long_int_buf(&(send_buf[PKG_DATA_INDEX]),sys->dance.dance_id);
+    return PKG_BASE_LEN + 8;
+}
+
+static int pkg_read_sense_data(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    int itmp = 0;
+    int pkg_len = 0;
 
-    switch(pkg_type)
+    //feedback sense data
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    switch(type)
     {
-        case PKG_SET_MODE:
-            //cmd:set auto mode or manual mode
-            data = buf[PKG_DATA_INDEX];
-            if(0 == data)
-            {
-                //if((1 == sys->auto_enable) && (AUTO_BASIC_MODE == sys->auto_work_mode))
-                if(1 == sys->auto_enable)
-                {
-                    sys->auto_enable = 0;
-                    sys->auto_work_mode = AUTO_BASIC_MODE;
-					fb_data = 1;
-                }
-            }
-            else
-            {
-                if((0 == sys->auto_enable) && (MANUAL_BASIC_MODE == sys->manual_work_mode))
-                {
-                    sys->auto_enable = 1;
-					fb_data = 1;
-                }
-            }
-            ROS_DEBUG("handle_cmd:set auto enable:%d",data);
+        case 0:
+            itmp = 1;//todo
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
             break;
-        case PKG_SET_MANUAL_VEL:
-            //cmd:set vel
-            if(0 == sys->auto_enable)
+        case 1:
+            for(itmp = 0;itmp < LASER_NUM;itmp++)
             {
-                sys->manual_overtime_flag = 0;
-                data = (((int)buf[PKG_DATA_INDEX+3])<<24)|
-					(((int)buf[PKG_DATA_INDEX+2])<<16)|
-					(((int)buf[PKG_DATA_INDEX+1])<<8)|
-					((int)buf[PKG_DATA_INDEX]); 
-                sys->tele_vel.vx = ((double)data)/1000.0;     //manual vel of x axes
-                if(fabs(sys->tele_vel.vx) > sys->max_manual_vx)
-                {
-                    sys->tele_vel.vx = sys->max_manual_vx * sys->tele_vel.vx 
-						/fabs(sys->tele_vel.vx);
-                }
-                
-                data = (((int)buf[PKG_DATA_INDEX+7])<<24)|
-					(((int)buf[PKG_DATA_INDEX+6])<<16)|
-					(((int)buf[PKG_DATA_INDEX+5])<<8)|
-					((int)buf[PKG_DATA_INDEX+4]); 
-                sys->tele_vel.vth = ((double)data)/1000.0;    //manual vel of th rotation axes
-                if(fabs(sys->tele_vel.vth) > sys->max_manual_vth)
-                {
-                    sys->tele_vel.vth = sys->max_manual_vth * sys->tele_vel.vth
-						/fabs(sys->tele_vel.vth);
-                }
-                fb_data = 1;
+                set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4])
+                    ,(float)sys->sensor.laser_len[itmp]);
             }
-            ROS_DEBUG("handle_cmd:set vx:%f,vth:%f",sys->tele_vel.vx,sys->tele_vel.vth);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4*LASER_NUM;
+            pkg_len = PKG_BASE_LEN + 2 + 4*LASER_NUM;
             break;
-        case PKG_ENABLE_INIT_MAP:
-            //cmd:set initial map mode
-            data = buf[PKG_DATA_INDEX];
-            if(1 == data)
+        case 2:
+            for(itmp = 0;itmp < SONAR_NUM;itmp++)
             {
-                if((0 == sys->auto_enable) && (MANUAL_BASIC_MODE == sys->manual_work_mode))
-                {
-                    sys->manual_work_mode = MANUAL_MAP_MODE;
-					fb_data = 1;
-                }
-            }
-            else
-            {
-                if((0 == sys->auto_enable) && (MANUAL_MAP_MODE == sys->manual_work_mode))
-                {
-                    sys->manual_work_mode = MANUAL_BASIC_MODE;
-					fb_data = 1;
-                }
+                set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4])
+                    ,(float)sys->sensor.sonar_len[itmp]);
             }
-            ROS_DEBUG("handle_cmd:initial map:%d",data);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4*SONAR_NUM;
+            pkg_len = PKG_BASE_LEN + 2 + 4*SONAR_NUM;
             break;
-        case PKG_CAL_MARK:
-            //cmd:get a mark point
-            ROS_DEBUG("handle_cmd:save mark to g_env.env_mark");
-            if(MANUAL_MAP_MODE == sys->manual_work_mode)
-            {
-                //save mark to g_env.env_mark
-                sys->set_mark_flag = 1;
-                sys->mark_count = 1;
-                return 0;
-            }
+        case 3:
+            send_buf[PKG_DATA_INDEX+2] = sys->sensor.infrared_flag;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            //ROS_DEBUG("infrade flag :%x,%x",send_buf[7],sys->sensor.infrared_flag);
             break;
-        case PKG_CAL_TPOINT:
-            //cmd:get a tpoint point 
-            ROS_DEBUG("handle_cmd:save tpoint,tpoint num:%d",sys->tpoint_num);
-            if(MANUAL_MAP_MODE == sys->manual_work_mode)
-            {
-                //i = find_unused_tpoint(sys,env);
-                //j = check_same_tpoint(sys,env,&(motion->current));
-                if((i >= 0) && (i < sys->tpoint_num) && (0 == j))
-                {
-                    env->env_tpoint[i].point.x = motion->current.x;
-                    env->env_tpoint[i].point.y = motion->current.y;
-                    env->env_tpoint[i].point.z = motion->current.z;
-                    env->env_tpoint[i].point.th = motion->current.th;
-                    env->env_tpoint[i].set_flag = 1;
-                    env->env_tpoint[i].id = sys->tpoint_count;
-                    sys->tpoint_count++;
-                    fb_data = 1;
-                    type = i;
-                }
-                else
-                {
-                    ROS_DEBUG("save tpoint to g_env.env_tpoint failed!\n");
-                }
-            }
-			ROS_DEBUG("handle_cmd:save tpoint fb_data:%d,i:%d\n",fb_data,i);
+        case 4:
+            itmp = sys->sensor.work_normal;
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
             break;
-        case PKG_CAL_GOAL:
-            //0x06,cmd:get a goal point
-            ROS_DEBUG("handle_cmd:save goal,goal num:%d",sys->goal_num);
-            if(MANUAL_MAP_MODE == sys->manual_work_mode)
-            {
-                //i = find_unused_goal(sys,env);
-                //j = check_same_goal(sys,env,&(motion->current));
-                if((i >= 0) && (i < sys->goal_num) && (0 == j))
-                {
-                    env->env_goal[i].point.x = motion->current.x;
-                    env->env_goal[i].point.y = motion->current.y;
-                    env->env_goal[i].point.z = motion->current.z;
-                    env->env_goal[i].point.th = motion->current.th;
-                    env->env_goal[i].set_flag = 1;
-                    env->env_goal[i].id = sys->goal_count;
-                    sys->goal_count++;
-                    fb_data = 1;
-                    type = i;
-                }
-                else
-                {
-                    ROS_DEBUG("save goal to g_env.env_goal failed!\n");
-                }
-            }
-			ROS_DEBUG("handle_cmd:save goal fb_data:%d,i:%d\n",fb_data,i);
-            break;
-        case PKG_SET_NAV_GOAL:
-			ROS_DEBUG("handle_cmd:set navigation goal");
-            data = (((int)buf[PKG_DATA_INDEX+3])<<24)|
-				(((int)buf[PKG_DATA_INDEX+2])<<16)|
-				(((int)buf[PKG_DATA_INDEX+1])<<8)|((int)buf[PKG_DATA_INDEX]);
-            fb_data = -1;
-            if((data >= 0) && (1 == sys->auto_enable) 
-				&& (AUTO_BASIC_MODE == sys->auto_work_mode))
-            {
-                //itmp = find_goal_index_by_id(env->env_goal,data,sys->goal_num);
-                if(sys->goal_num == itmp)
-                {
-                    ROS_DEBUG("set nav goal failed,can not find goal:%x",data);
-                    break;
-                }
-                ROS_DEBUG("setup goal[%d]:%d for goal!\n",itmp,data);
-                //itmp = cal_path(motion,itmp,env,sys);
-                if(0 == itmp)
-                {
-                    fb_data = data;
-					motion->path.goal_id = data;
-                    set_led_power_effect(LED_POWER_FREEDOM,LED_NAV);
-                }
-            }
+        case 5:
+            send_buf[PKG_DATA_INDEX+2] = sys->sensor.estop_io_flag;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            ROS_DEBUG("estop io flag :%x",send_buf[PKG_DATA_INDEX+2]);
             break;
-        case PKG_START_DANCE:
-			ROS_DEBUG("handle_cmd:start dance");
-            if((1 == sys->auto_enable)&&(AUTO_DANCE_MODE == sys->auto_work_mode))
-            {
-				//get dance index and find dance file,then read dance file and load to sys->dance struct.
-			    if(DANCE_FINISHED == sys->dance.dance_state)
-			    {
-					restore_long_int_buf(&(buf[PKG_DATA_INDEX]),&index);
-					//itmp = load_dance_file(sys,index);
-					if(0 == itmp)
-					{
-					    if(0 == sys->dance.dance_start_point_set)
-	                    {
-	                        //set_dance_start_point(sys,motion);
-	                    }
-	                    sys->dance.dance_state = DANCING;
-						sys->dance.dance_seq.time = 0.0;
-						sys->dance.dance_seq.start_time = 0.0;
-						sys->dance.dance_rotate_flag = 0;
-						sys->dance.led_seq.set_led_effect_flag = 0;
-						sys->dance.dance_seq.dance_move_index = 0;
-					    fb_data = 1;
-						//for dance everywhere and when,even if pushed or estop key
-						//sys->event_stop_flag = 0;
-					}
-			    }
-				else
-				{
-				    ROS_DEBUG("dance unfinished!");
-				}
-            }
-            else
-            {
-                ROS_DEBUG("system is not  in dance mode");
-            }
-			ROS_DEBUG("handle set dance:%d",fb_data);
-            break;
-		case PKG_REBOOT_SYSTEM:
-			ROS_DEBUG("reboot system");
-			send_pkg_back(PKG_FB_REBOOT_SYSTEM,sys,motion,env,0,0,NULL);
-			sleep(2);
-			itmp = system("sudo shutdown -r now");
-			ROS_DEBUG("reboot navigation controller,result:%d",itmp);
-			break;
-        case PKG_SHUTDOWN_SYSTEM:
-            ROS_DEBUG("shutdown the system");
-            send_pkg_back(PKG_FB_SHUTDOWN,sys,motion,env,0,0,NULL);
-			//set_led_power_effect(LED_POWER_FREEDOM,LED_DEFAULT);
-            //sleep(2);
-            //itmp = system("sudo shutdown -h now");
-			//ROS_DEBUG("shut down navigation controller,result:%d",itmp);
-            break;
-        case PKG_STOP_DANCE:
-            ROS_DEBUG("stop dance mode");
-            if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode))
-            {
-                sys->dance.dance_state = DANCE_FINISHED;
-                sys->dance.dance_rotate_flag = 0;
-                fb_data = 1;
-            }
+        case 6:
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),
+                (float)sys->sensor.estop_fb_limit);
+            //send_buf[PKG_LEN_INDEX] = 30;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
             break;
-        case PKG_REQUEST_DANCE_STATUS:
-            ROS_DEBUG("request dance state");
-            if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode)
-                && (DANCE_ERROR != sys->dance.dance_state))
-            {
-                fb_data = 0;
-            }
-            else
+        case 7:
+            //sensor version
+            for(itmp=0;itmp<VERSION_LEN;itmp++)
             {
-                fb_data = 1;
+                send_buf[PKG_DATA_INDEX+2+itmp] = sys->sensor.version[itmp];
             }
+            pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
             break;
-        case PKG_ASK_PREPARE_DANCE:
-            ROS_DEBUG("handle_cmd: ask dance prepare ok?");
-            //fb_data = check_dance_status(motion,sys);
+        default:
             break;
-        case PKG_BACK_DANCE_START_POINT:
-            ROS_DEBUG("handle_cmd:back start point");
-            if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode))
-            {
-                if((0 != sys->dance.dance_start_point_set) 
-						&& (DANCE_FINISHED == sys->dance.dance_state))
-                {
-                    //
-                    ROS_DEBUG("dance back to start point now!");
-                    sys->dance.dance_state = DANCE_BACK_START;
-                    fb_data = 1;
-                }
-            }
+    }
+    return pkg_len;
+}
+
+static int pkg_read_base_data(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    int itmp = 0;
+    int pkg_len = 0;
+
+    //feedback base data
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    switch(type)
+    {
+        case 0:
+            itmp = 1;//todo base status
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
             break;
-        case PKG_ENTER_DANCE_MODE:
-			ROS_DEBUG("handle_cmd:enter dance mode");
-            if((AUTO_BASIC_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
-            {
-                sys->auto_work_mode = AUTO_DANCE_MODE;
-                fb_data = 1;
-            }
-            else if((AUTO_DANCE_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
-            {
-                fb_data = 1;
-            }
+        case 1:
+            send_buf[PKG_DATA_INDEX+2] = sys->base.estop_sensor_flag;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
             break;
-        case PKG_EXIT_DANCE_MODE:
-			ROS_DEBUG("exit dance mode!");
-            if((AUTO_DANCE_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
+        case 2:
+            for(itmp = 0;itmp < BASE_LASER_NUM;itmp++)
             {
-                sys->auto_work_mode = AUTO_BASIC_MODE;
-                sys->dance.dance_state = DANCE_FINISHED;
-                sys->dance.dance_rotate_flag = 0;
-                fb_data = 1;
+                set_float_buf(&(send_buf[PKG_DATA_INDEX+2+itmp*4]),
+                    (float)sys->base.laser[itmp]);
             }
+            //send_buf[PKG_LEN_INDEX] = 26 + 4*BASE_LASER_NUM;
+            pkg_len = PKG_BASE_LEN + 2 + 4*BASE_LASER_NUM;
             break;
-        case PKG_ASK_PREPARE_NAV:
-            ROS_DEBUG("handle_cmd: ask nav prepare ok?");
-			fb_data = 0;
-            if((1 != sys->auto_enable) || (AUTO_BASIC_MODE != sys->auto_work_mode))
+        case 3:
+            if(sys->base.move_status&0x78)
             {
-                ROS_DEBUG("system mode is not right");
-                fb_data = 1;
+                send_buf[PKG_DATA_INDEX+2] = 1;
             }
             else
             {
-                if(0 == motion->path.path_finish)
-                {
-                    ROS_DEBUG("last nav unfinished");
-                    fb_data = 2;
-                }
-                else if(0 == sys->build_cord_flag)
-                {
-                    ROS_DEBUG("system not find valid mark");
-                    fb_data = 3;
-                }
-				else
-				{
-					if(1 == sys->camera.lose_mark_flag)
-	                {
-	                    ROS_DEBUG("system lost mark");
-	                    fb_data = 100;
-	                }
-				}
+                send_buf[PKG_DATA_INDEX+2] = 0;
             }
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
             break;
-        case PKG_REQUEST_NAV_STATUS:
-            ROS_DEBUG("handle_cmd: request nav state");
-            if((1 != sys->auto_enable) || (AUTO_BASIC_MODE != sys->auto_work_mode))
+        case 4:
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.odom.x);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.odom.y);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->base.odom.th);
+            //send_buf[PKG_LEN_INDEX] = 38;
+            pkg_len = PKG_BASE_LEN + 2 + 4*3;
+            break;
+        case 5:
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.fb_vel.vx);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.fb_vel.vth);
+            //send_buf[PKG_LEN_INDEX] = 34;
+            pkg_len = PKG_BASE_LEN + 2 + 4*2;
+            break;
+        case 6:
+            //todo base self-test reserved
+            itmp = sys->base.work_normal;
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 7:
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->base.fb_cmd_vel.vx);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->base.fb_cmd_vel.vth);
+            //send_buf[PKG_LEN_INDEX] = 34;
+            pkg_len = PKG_BASE_LEN + 2 + 4*2;
+            break;
+        case 8:
+            for(itmp=0;itmp<BASE_MOTOR_NUM;itmp++)
             {
-                ROS_DEBUG("system mode is not right,nav failed");
-                fb_data = 2;
+                send_buf[PKG_DATA_INDEX+2+itmp] = sys->base.motor_status[itmp];
             }
-            else if(sys->obstacle_scale < OBSTACLE_SLOW_SCALE)
-            {
-                ROS_DEBUG("nav ok,but find obstacle");
-                fb_data = 1;
-            }    
+            //send_buf[PKG_LEN_INDEX] = 26+BASE_MOTOR_NUM;
+            pkg_len = PKG_BASE_LEN + 2 + BASE_MOTOR_NUM;
+            break;
+        case 9:
+            send_buf[PKG_DATA_INDEX+2] = sys->base.move_status;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 10:
+            send_buf[PKG_DATA_INDEX+2] = sys->base.move_rssi;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 11:
+            send_buf[PKG_DATA_INDEX+2] = sys->base.power_v;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
             break;
-        case PKG_STOP_NAV:
-            ROS_DEBUG("handle_cmd: stop nav");
-            if((AUTO_BASIC_MODE == sys->auto_work_mode) && (1 == sys->auto_enable))
+        case 12:
+            //base version
+            for(itmp=0;itmp<VERSION_LEN;itmp++)
             {
-                motion->path.path_finish = 1;
-                fb_data = 1;
+                send_buf[PKG_DATA_INDEX+2+itmp] = sys->base.version[itmp];
             }
+            pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
             break;
-        case PKG_UPDATE_DANCE_START_POINT:
-            ROS_DEBUG("handle_cmd: setup new dance start point");
-            if(1 == sys->build_cord_flag)
+        case 13:
+            send_buf[PKG_DATA_INDEX+2] = sys->base.move_sensor_state;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+        default:
+            break;
+    }
+    return pkg_len;
+}
+
+static int pkg_read_led_power_data(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    int itmp = 0;
+    int pkg_len = 0;
+
+    //feedback led and power data
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    switch(type)
+    {
+        case 0:
+            itmp = ((int)sys->led_power.power_status2<<8)|((int)sys->led_power.power_status1);
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 1:
+            itmp = 0;
+            itmp = ((int)sys->led_power.power_v2<<8)|((int)sys->led_power.power_v1);
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 2:
+            //todo led and power self-test reserved
+            itmp =0;
+            itmp = sys->led_power.work_normal;
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 3:
+            //actual led mode
+            send_buf[PKG_DATA_INDEX+2] = sys->led_power.act_mode;
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 4:
+            //actual led effect
+            send_buf[PKG_DATA_INDEX+2] = sys->led_power.act_effect&0x0ff;
+            send_buf[PKG_DATA_INDEX+3] = (sys->led_power.act_effect&0xff00)>>8;
+            //send_buf[PKG_LEN_INDEX] = 28;
+            pkg_len = PKG_BASE_LEN + 2 + 2;
+            break;
+        case 5:
+            //power switch status
+            itmp = 0;
+            itmp = (((int)sys->led_power.power_switch_status4)<<24)|(((int)sys->led_power.power_switch_status1)<<16)
+                       |(((int)sys->led_power.power_switch_status1)<<8)|((int)sys->led_power.power_switch_status1);
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),itmp);
+            //send_buf[PKG_LEN_INDEX] = 27;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 6:
+            //power current 
+            for(itmp=0;itmp<POWER_CURRENT_NUM*2;itmp++)
             {
-                //set_dance_start_point(sys,motion);
-                i = write_system_file(sys);
-				if(0 == i)
-				{
-					//i = read_system_file(sys);
-				    if(0 == i)
-				    {
-				        fb_data = 1;
-				    }
-					else
-					{
-					    ROS_DEBUG("re-read system file failed!");
-                        fb_data = 2;
-					}
-				}
-				else
-				{
-				    ROS_DEBUG("write to system file failed!");
-				    sys->err_num = WRITE_SYS_FILE_ERR;
-                    fb_data = 3;
-				}
+                send_buf[PKG_DATA_INDEX+2+itmp] = sys->led_power.power_i[itmp];
             }
-            else
+            //send_buf[PKG_LEN_INDEX] = 26 + POWER_CURRENT_NUM;
+            pkg_len = PKG_BASE_LEN + 2 + POWER_CURRENT_NUM*2;
+            break;
+        case 7:
+            //get power temp current info
+            pkg_len = PKG_BASE_LEN + 2;
+            set_get_power_flag();
+            break;
+        case 8:
+            //power version
+            for(itmp=0;itmp<VERSION_LEN;itmp++)
             {
-                fb_data = 4;
+                send_buf[PKG_DATA_INDEX+2+itmp] = sys->led_power.version[itmp];
             }
+            pkg_len = PKG_BASE_LEN + 2 + VERSION_LEN;
             break;
-        case PKG_SEND_MAP_INFO_BEGIN:
-            ROS_DEBUG("handle_cmd:begin send map file");
-            type = buf[PKG_DATA_INDEX];
-            data = (((int)buf[PKG_DATA_INDEX+4])<<24)|
-				(((int)buf[PKG_DATA_INDEX+3])<<16)|
-				(((int)buf[PKG_DATA_INDEX+2])<<8)|((int)buf[PKG_DATA_INDEX+1]);
-           // i = handle_map_files(sys,env,(FILE_TYPE)type,data);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_MAP_INFO:
-			ROS_DEBUG("handle_cmd:send map file");
-			type = buf[PKG_DATA_INDEX];
-			itmp = pkg_len - PKG_CMD_BASE_LEN - 1;
-			//i = copy_map_files_mem(env,(char *)&(buf[PKG_DATA_INDEX+1]),itmp,(FILE_TYPE)type);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_MAP_INFO_END:
-			ROS_DEBUG("handle_cmd: send map file end");
-			type = buf[PKG_DATA_INDEX];
-			//i = check_map_file(env,(char)buf[PKG_DATA_INDEX+1],(FILE_TYPE)type);
-			ROS_DEBUG("check map file:%d",i);
-			if(0 == i)
-			{
-			    //i = write_to_map_files(env,(FILE_TYPE)type);
-				if(0 == i)
-				{
-				    fb_data = 1;
-				}
-				else
-				{
-				    ROS_DEBUG("write to map files failed!");
-				    sys->err_num = WRITE_MAP_FILE_ERR;
-				}
-			}
-			else
-			{
-			    ROS_DEBUG("check map file failed!");
-			}
-			break;
-		case PKG_READ_SENSE_DATA:
-			ROS_DEBUG("handle_cmd: read sensor data");
-			fb_data = 1;
-			type = buf[PKG_DATA_INDEX];
-			break;
-		case PKG_READ_BASE_DATA:
-			ROS_DEBUG("handle_cmd: read base data");
-			fb_data = 1;
-			type = buf[PKG_DATA_INDEX];
-			break;
-		case PKG_READ_LED_POWER_DATA:
-			ROS_DEBUG("handle_cmd: read led and power data");
-			fb_data = 1;
-			type = buf[PKG_DATA_INDEX];
-			break;
-		case PKG_READ_CAMERA_DATA:
-			ROS_DEBUG("handle_cmd: read camera data");
-			fb_data = 1;
-			type = buf[PKG_DATA_INDEX];
-			break;
-		case PKG_READ_CONTROLLER_DATA:
-			ROS_DEBUG("handle_cmd: read controller data,type:%d",buf[PKG_DATA_INDEX]);
-			fb_data = 1;
-			type = buf[PKG_DATA_INDEX];
-			break;
-		case PKG_SET_CONTROLLER_DATA:
-			ROS_DEBUG("handle_cmd: set controller params,type:%d",buf[PKG_DATA_INDEX]);
-			type = buf[PKG_DATA_INDEX];
-			i = set_system_params(sys,motion,env,type,&(buf[PKG_DATA_INDEX+1]));
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_DANCE_FILE_BEGIN:
-			ROS_DEBUG("handle_cmd: send dance file begin");
-			type = buf[PKG_DATA_INDEX];
-			//i = handle_dance_file_init(sys, buf);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_DANCE_FILE:
-			ROS_DEBUG("handle_cmd: send dance file");
-			type = buf[PKG_DATA_INDEX];
-			//i = handle_dance_file_data(sys, buf);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_DANCE_FILE_END:
-			ROS_DEBUG("handle_cmd: send dance file end");
-			type = buf[PKG_DATA_INDEX];
-			//i = handle_dance_file_done(sys, buf);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-		    break;
-		case PKG_SEND_UPGRADE_FILE_BEGIN:
-			ROS_DEBUG("handle_cmd:send upgrade file begin");
-			type = buf[PKG_DATA_INDEX];
-			i = handle_upgrade_file_begin(sys,buf);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_UPGRADE_FILE:
-			ROS_DEBUG("handle_cmd: send upgrade file");
-			type = buf[PKG_DATA_INDEX];
-			i = handle_upgrade_file_data(sys, buf);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_SEND_UPGRADE_FILE_END:
-			ROS_DEBUG("handle_cmd: send upgrade file end");
-			type = buf[PKG_DATA_INDEX];
-			i = handle_upgrade_file_done(sys, buf);
-			if(0 == i)
-			{
-				if(SYSTEM_FILE == sys->upgrade.type)
-				{
-				    i = upgrade_replace_nav_file();
-					if(0 == i)
-					{
-					    fb_data = 1;
-					}
-				}
-			}
-			else
-			{
-			    ROS_DEBUG("write upgrade file failed");
-			}
-			break;
-		case PKG_READ_DEVELOP_VERSION:
-			ROS_DEBUG("handle_cmd: read develop version");
-			fb_data = 1;
-			break;
-		case PKG_CHECK_SYSTEM:
-			ROS_DEBUG("handle_cmd: check system");
-			ask.module_group = (module_e)buf[PKG_DATA_INDEX];
-			ask.module = (module_e)buf[PKG_DATA_INDEX+1];
-			ask.function = buf[PKG_DATA_INDEX+2];
-			i = handle_report_status(ask,&ans,sys,motion,env);
-			if(0 != i)
-			{
-			    ans.level = LEVEL_ERROR;
-				ans.module = MODULE_NAV;
-				ans.function = 23;
-				ans.len = 4;
-				set_int_buf(ans.data,4);
-			}
-			cdata[0] = (unsigned char)ans.level;
-			cdata[1] = (unsigned char)ans.module;
-			cdata[2] = ans.function;
-			cdata[3] = ans.len;
-			for(i=0;i<ans.len;i++)
-			{
-			    cdata[4+i] = ans.data[i];
-			}
-			fb_data = ans.len + 4;
-            ROS_DEBUG("check system:module:%x,function:%x",cdata[1],cdata[2]);
-			break;
-		case PKG_READ_OFFICIAL_VERSION:
-			ROS_DEBUG("handle_cmd: read official version");
-			fb_data = 1;
-			break;
-		case PKG_HEART_BEAT_FB:
-			ROS_DEBUG("handle_cmd:receive heart beat back pkg");
-			set_upper_beat_flag(1);
-			return 0;
-			break;
-		case PKG_REBOOT_ROBOT:
-			ROS_DEBUG("handle_cmd:reboot robot");//
-            i = set_led_power_function(0,1);
+        case 9:
+            //set led red long
+            pkg_len = PKG_BASE_LEN + 2;
+            sys->led_power.mmi_test_flag = 1;
+            set_led_power_effect(LED_POWER_FREEDOM,LED_RED_LONG);
+            break;
+        case 10:
+            //set led green long
+            pkg_len = PKG_BASE_LEN + 2;
+            sys->led_power.mmi_test_flag = 1;
+            set_led_power_effect(LED_POWER_FREEDOM,LED_GREEN_LONG);
+            break;
+        case 11:
+            //set led blue long
+            pkg_len = PKG_BASE_LEN + 2;
+            sys->led_power.mmi_test_flag = 1;
+            set_led_power_effect(LED_POWER_FREEDOM,LED_BLUE_LONG);
+            break;
+        case 12:
+            //shut down mmi led test
+            pkg_len = PKG_BASE_LEN + 2;
+            sys->led_power.mmi_test_flag = 0;
+            set_led_power_effect(LED_POWER_FREEDOM,LED_NORMAL);
+            break;
+        default:
+            break;
+    }
+    return pkg_len;
+}
+
+static int pkg_read_camera_data(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    int pkg_len = 0;
+
+    //read camera data
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    switch(type)
+    {
+        case 0:
+            //camera state.
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->camera.state);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 1:
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->camera.id);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->camera.point.x);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->camera.point.y);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)sys->camera.point.z);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+18]),(float)sys->camera.point.th);
+            //send_buf[PKG_LEN_INDEX] = 46;//26+4*5
+            pkg_len = PKG_BASE_LEN + 2 + 4*5;
+            break;
+        default:
+            break;
+    }
+    return pkg_len;
+}
+
+static int pkg_read_controller_data(unsigned char *send_buf,system_t *sys,motion_t *motion,int data,int type,unsigned char *str)
+{
+    int pkg_len = 0;
+
+    //read controller data
+    send_buf[PKG_DATA_INDEX] = data;
+    send_buf[PKG_DATA_INDEX+1] = type;
+    switch(type)
+    {
+        case 0:
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->sys_status);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 1:
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->err_num);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 2:
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->warn_num);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 3:
+            //obstacle scale
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->obstacle_scale);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 4:
+            //nav finish status
+            send_buf[PKG_DATA_INDEX+2] = motion->path.path_finish;
+            //send_buf[PKG_LEN_INDEX] = 26+1;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 5:
+            //nav goal id
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),motion->path.goal_id);
+            //send_buf[PKG_LEN_INDEX] = 26 + 4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 6:
+            //dance finish status
+            send_buf[PKG_DATA_INDEX+2] = sys->dance.dance_state;
+            //send_buf[PKG_LEN_INDEX] = 26+1;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 7:
+            //dance id
+            set_long_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->dance.dance_id);
+            //send_buf[PKG_LEN_INDEX] = 26 + 8;
+            pkg_len = PKG_BASE_LEN + 2 + 8;
+            break;
+        case 8:
+            // build cord flag
+            send_buf[PKG_DATA_INDEX+2] = sys->build_cord_flag;
+            //send_buf[PKG_LEN_INDEX] = 26+1;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 9:
+            //current position
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)motion->current.x);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)motion->current.y);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)motion->current.z);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)motion->current.th);
+            //send_buf[PKG_LEN_INDEX] = 42;
+            pkg_len = PKG_BASE_LEN + 2 + 4*4;
+            break;
+        case 10:
+            //dance start point
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_start_point.x);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->dance.dance_start_point.y);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+10]),(float)sys->dance.dance_start_point.z);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+14]),(float)sys->dance.dance_start_point.th);
+            //send_buf[PKG_LEN_INDEX] = 42;
+            pkg_len = PKG_BASE_LEN + 2 + 4*4;
+            break;
+        case 11:
+            // build cord flag
+            send_buf[PKG_DATA_INDEX+2] = sys->dance.dance_start_point_set;
+            //send_buf[PKG_LEN_INDEX] = 26+1;
+            pkg_len = PKG_BASE_LEN + 2 + 1;
+            break;
+        case 12:
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->real_vel.vx);
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+6]),(float)sys->real_vel.vth);
+            //send_buf[PKG_LEN_INDEX] = 26+8;
+            pkg_len = PKG_BASE_LEN + 2 + 4*2;
+            break;
+        case 13:
+            //video center x
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.x);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 14:
+            //slow dist
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.slow_limit);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 15:
+            //estop dist
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.estop_limit);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 16:
+            //min z
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->min_z);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 17:
+            //max z
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_z);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 18:
+            //observe dist
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->observe_dist);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 19:
+            //tpoint tolerance
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->tolerance_pass);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 20:
+            //goal tolerance
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->tolerance_goal);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 21:
+            //max manual vx
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_manual_vx);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 22:
+            //max manual vth
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_manual_vth);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 23:
+            //max auto vx
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_vx);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 24:
+            //max auto vth
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_vth);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 25:
+            //max acc_x
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_accx);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 26:
+            //max acc_th
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->max_accth);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 27:
+            //dance start point xy range
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_xy_range);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 28:
+            //dance start point scale
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_xy_scale);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 29:
+            //dance start point th range
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->dance.dance_th_range);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 30:
+            //upper controller ip
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),(int)get_upper_server_ip());
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 31:
+            //internal develop version num
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),DEVELOP_VERSION_CODE);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 32:
+            //official version num
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),OFFICIAL_VERSION_CODE);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 33:
+            //sonar event limit
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->sensor.sonar_event1_limit);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 34:
+            //manual control overtime
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)(sys->manual_control_over_time));
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 35:
+            //video center y
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.y);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 36:
+            //video center th
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->video_to_center.th);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 37:
+            //enter event type
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->enter_event_type);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 38:
+            //enter event limit
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->enter_event_limit);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 39:
+            //nav over time 
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->nav_over_time);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 40:
+            //nav goal nearby range
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->goal_nearby_range);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 41:
+            //upgrade overtime range
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),UPGRADE_OVER_TIME);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 42:
+            //enter sonar num
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->enter_sonar_num);
+            //send_buf[1] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 43:
+            //nav goal nearby th
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->goal_nearby_th);
+            //send_buf[1] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 44:
+            //product id 
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),PRODUCT_ID);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 45:
+            //system type id 
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),SYSTEM_TYPE_ID);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 200:
+            //reserve_int_1
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->reserve_int_1);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 201:
+            //reserve_int_1
+            set_int_buf(&(send_buf[PKG_DATA_INDEX+2]),sys->reserve_int_2);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 202:
+            //reserve_double_3
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->reserve_double_3);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        case 203:
+            //reserve_double_4
+            set_float_buf(&(send_buf[PKG_DATA_INDEX+2]),(float)sys->reserve_double_4);
+            //send_buf[PKG_LEN_INDEX] = 26+4;
+            pkg_len = PKG_BASE_LEN + 2 + 4;
+            break;
+        default:
+            break;
+    }
+    return pkg_len;
+}
+
+//
+int send_pkg_back(unsigned short int pkg_type,system_t *sys,motion_t *motion,
+          env_t *env,int data,int type,unsigned char *str)
+{
+    //main loop, reactor and worker threads all send
+    static std::atomic<unsigned char> send_num(1);
+    upper_pkg_encoder_t encoder = NULL;
+    unsigned char *send_buf = NULL;
+    int itmp = 0;
+    int start = 0;
+	unsigned short int pkg_len = 0;
+	unsigned short int check = 0;
+    
+    if((NULL == sys) || (NULL == motion))
+    {
+        ROS_DEBUG("sys or motion NULL!");
+        return -1;
+    }
+    encoder = find_upper_pkg(pkg_type);
+    if(NULL == encoder)
+    {
+        ROS_DEBUG("send_pkg_back:no encoder for %x",pkg_type);
+        return -1;
+    }
+    send_buf = get_pkg_buf();
+    if(NULL == send_buf)
+    {
+        ROS_ERROR("send_pkg_back:pkg pool empty, %x dropped",pkg_type);
+        return -1;
+    }
+    
+    send_buf[0] = 0x55;
+    send_buf[PKG_INDEX_INDEX] = send_num++;
+    send_buf[PKG_TYPE_INDEX] = pkg_type&0x00ff;   //low byte before high byte
+    send_buf[PKG_TYPE_INDEX+1] = (pkg_type&0xff00)>>8;
+    pkg_len = encoder(send_buf,sys,motion,data,type,str);
+    if(pkg_len < PKG_BASE_LEN)
+    {
+        ROS_DEBUG("send_pkg_back:nothing to send for %x,type:%d",pkg_type,type);
+        put_pkg_buf(send_buf,SOCKET_PKG_LEN);
+        return -1;
+    }
+
+    send_buf[PKG_LEN_INDEX] = pkg_len&0x0ff;
+	send_buf[PKG_LEN_INDEX+1] = (pkg_len&0xff00)>>8;
+    itmp = sizeof(float)*4+1+2+1;
+    start = pkg_len - itmp;
+    set_float_buf(&(send_buf[start]),(float)motion->current.x);
+    set_float_buf(&(send_buf[start+4]),(float)motion->current.y);
+    set_float_buf(&(send_buf[start+8]),(float)motion->current.z);
+    set_float_buf(&(send_buf[start+12]),(float)motion->current.th);
+
+    set_robot_state_buf(&(send_buf[start+16]),sys);
+    
+    check = 0;
+    for(itmp = 0;itmp < pkg_len - 3;itmp++)
+    {
+        check += send_buf[itmp];
+    }
+	send_buf[pkg_len - 3] = check&0x0ff;
+	send_buf[pkg_len - 2] = (check&0xff00)>>8;
+	
+    send_buf[pkg_len - 1] = 0xaa;
+    itmp = send_status_back(send_buf, (int)pkg_len);
+    put_pkg_buf(send_buf,pkg_len);
+    
+    return itmp;
+}
+
+
+static int cmd_set_mode(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int data = 0;
+
+    //cmd:set auto mode or manual mode
+    data = buf[PKG_DATA_INDEX];
+    if(0 == data)
+    {
+        //if((1 == sys->auto_enable) && (AUTO_BASIC_MODE == sys->auto_work_mode))
+        if(1 == sys->auto_enable)
+        {
+            sys->auto_enable = 0;
+            sys->auto_work_mode = AUTO_BASIC_MODE;
+            reply->fb_data = 1;
+        }
+    }
+    else
+    {
+        if((0 == sys->auto_enable) && (MANUAL_BASIC_MODE == sys->manual_work_mode))
+        {
+            sys->auto_enable = 1;
+            reply->fb_data = 1;
+        }
+    }
+    ROS_DEBUG("handle_cmd:set auto enable:%d",data);
+    return 0;
+}
+
+static int cmd_set_manual_vel(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int data = 0;
+
+    //cmd:set vel
+    if(0 == sys->auto_enable)
+    {
+        sys->manual_overtime_flag = 0;
+        data = (((int)buf[PKG_DATA_INDEX+3])<<24)|
+            (((int)buf[PKG_DATA_INDEX+2])<<16)|
+            (((int)buf[PKG_DATA_INDEX+1])<<8)|
+            ((int)buf[PKG_DATA_INDEX]); 
+        sys->tele_vel.vx = ((double)data)/1000.0;     //manual vel of x axes
+        if(fabs(sys->tele_vel.vx) > sys->max_manual_vx)
+        {
+            sys->tele_vel.vx = sys->max_manual_vx * sys->tele_vel.vx 
+                /fabs(sys->tele_vel.vx);
+        }
+
+        data = (((int)buf[PKG_DATA_INDEX+7])<<24)|
+            (((int)buf[PKG_DATA_INDEX+6])<<16)|
+            (((int)buf[PKG_DATA_INDEX+5])<<8)|
+            ((int)buf[PKG_DATA_INDEX+4]); 
+        sys->tele_vel.vth = ((double)data)/1000.0;    //manual vel of th rotation axes
+        if(fabs(sys->tele_vel.vth) > sys->max_manual_vth)
+        {
+            sys->tele_vel.vth = sys->max_manual_vth * sys->tele_vel.vth
+                /fabs(sys->tele_vel.vth);
+        }
+        reply->fb_data = 1;
+    }
+    ROS_DEBUG("handle_cmd:set vx:%f,vth:%f",sys->tele_vel.vx,sys->tele_vel.vth);
+    return 0;
+}
+
+static int cmd_enable_init_map(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int data = 0;
+
+    //cmd:set initial map mode
+    data = buf[PKG_DATA_INDEX];
+    if(1 == data)
+    {
+        if((0 == sys->auto_enable) && (MANUAL_BASIC_MODE == sys->manual_work_mode))
+        {
+            sys->manual_work_mode = MANUAL_MAP_MODE;
+            reply->fb_data = 1;
+        }
+    }
+    else
+    {
+        if((0 == sys->auto_enable) && (MANUAL_MAP_MODE == sys->manual_work_mode))
+        {
+            sys->manual_work_mode = MANUAL_BASIC_MODE;
+            reply->fb_data = 1;
+        }
+    }
+    ROS_DEBUG("handle_cmd:initial map:%d",data);
+    return 0;
+}
+
+static int cmd_cal_mark(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    //cmd:get a mark point
+    ROS_DEBUG("handle_cmd:save mark to g_env.env_mark");
+    if(MANUAL_MAP_MODE == sys->manual_work_mode)
+    {
+        //save mark to g_env.env_mark
+        sys->set_mark_flag = 1;
+        sys->mark_count = 1;
+        return UPPER_CMD_NO_REPLY;
+    }
+    return 0;
+}
+
+static int cmd_cal_tpoint(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+    int j = 0;
+
+    //cmd:get a tpoint point 
+    ROS_DEBUG("handle_cmd:save tpoint,tpoint num:%d",sys->tpoint_num);
+    if(MANUAL_MAP_MODE == sys->manual_work_mode)
+    {
+        //i = find_unused_tpoint(sys,env);
+        //j = check_same_tpoint(sys,env,&(motion->current));
+        if((i >= 0) && (i < sys->tpoint_num) && (0 == j))
+        {
+            env->env_tpoint[i].point.x = motion->current.x;
+            env->env_tpoint[i].point.y = motion->current.y;
+            env->env_tpoint[i].point.z = motion->current.z;
+            env->env_tpoint[i].point.th = motion->current.th;
+            env->env_tpoint[i].set_flag = 1;
+            env->env_tpoint[i].id = sys->tpoint_count;
+            sys->tpoint_count++;
+            reply->fb_data = 1;
+            reply->type = i;
+        }
+        else
+        {
+            ROS_DEBUG("save tpoint to g_env.env_tpoint failed!\n");
+        }
+    }
+    ROS_DEBUG("handle_cmd:save tpoint fb_data:%d,i:%d\n",reply->fb_data,i);
+    return 0;
+}
+
+static int cmd_cal_goal(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+    int j = 0;
+
+    //0x06,cmd:get a goal point
+    ROS_DEBUG("handle_cmd:save goal,goal num:%d",sys->goal_num);
+    if(MANUAL_MAP_MODE == sys->manual_work_mode)
+    {
+        //i = find_unused_goal(sys,env);
+        //j = check_same_goal(sys,env,&(motion->current));
+        if((i >= 0) && (i < sys->goal_num) && (0 == j))
+        {
+            env->env_goal[i].point.x = motion->current.x;
+            env->env_goal[i].point.y = motion->current.y;
+            env->env_goal[i].point.z = motion->current.z;
+            env->env_goal[i].point.th = motion->current.th;
+            env->env_goal[i].set_flag = 1;
+            env->env_goal[i].id = sys->goal_count;
+            sys->goal_count++;
+            reply->fb_data = 1;
+            reply->type = i;
+        }
+        else
+        {
+            ROS_DEBUG("save goal to g_env.env_goal failed!\n");
+        }
+    }
+    ROS_DEBUG("handle_cmd:save goal fb_data:%d,i:%d\n",reply->fb_data,i);
+    return 0;
+}
+
+static int cmd_set_nav_goal(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int itmp = 0;
+    int data = 0;
+
+    ROS_DEBUG("handle_cmd:set navigation goal");
+    data = (((int)buf[PKG_DATA_INDEX+3])<<24)|
+        (((int)buf[PKG_DATA_INDEX+2])<<16)|
+        (((int)buf[PKG_DATA_INDEX+1])<<8)|((int)buf[PKG_DATA_INDEX]);
+    reply->fb_data = -1;
+    if((data >= 0) && (1 == sys->auto_enable) 
+        && (AUTO_BASIC_MODE == sys->auto_work_mode))
+    {
+        //itmp = find_goal_index_by_id(env->env_goal,data,sys->goal_num);
+        if(sys->goal_num == itmp)
+        {
+            ROS_DEBUG("set nav goal failed,can not find goal:%x",data);
+            return 0;
+        }
+        ROS_DEBUG("setup goal[%d]:%d for goal!\n",itmp,data);
+        //itmp = cal_path(motion,itmp,env,sys);
+        if(0 == itmp)
+        {
+            reply->fb_data = data;
+            motion->path.goal_id = data;
+            set_led_power_effect(LED_POWER_FREEDOM,LED_NAV);
+        }
+    }
+    return 0;
+}
+
+static int cmd_start_dance(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int itmp = 0;
+    long int index = 0;
+
+    ROS_DEBUG("handle_cmd:start dance");
+    if((1 == sys->auto_enable)&&(AUTO_DANCE_MODE == sys->auto_work_mode))
+    {
+        //get dance index and find dance file,then read dance file and load to sys->dance struct.
+        if(DANCE_FINISHED == sys->dance.dance_state)
+        {
+            restore_long_int_buf(&(buf[PKG_DATA_INDEX]),&index);
+            //itmp = load_dance_file(sys,index);
+            if(0 == itmp)
+            {
+                if(0 == sys->dance.dance_start_point_set)
+                {
+                    //set_dance_start_point(sys,motion);
+                }
+                sys->dance.dance_state = DANCING;
+                sys->dance.dance_seq.time = 0.0;
+                sys->dance.dance_seq.start_time = 0.0;
+                sys->dance.dance_rotate_flag = 0;
+                sys->dance.led_seq.set_led_effect_flag = 0;
+                sys->dance.dance_seq.dance_move_index = 0;
+                reply->fb_data = 1;
+                //for dance everywhere and when,even if pushed or estop key
+                //sys->event_stop_flag = 0;
+            }
+        }
+        else
+        {
+            ROS_DEBUG("dance unfinished!");
+        }
+    }
+    else
+    {
+        ROS_DEBUG("system is not  in dance mode");
+    }
+    ROS_DEBUG("handle set dance:%d",reply->fb_data);
+    return 0;
+}
+
+static int cmd_reboot_system(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int itmp = 0;
+
+    ROS_DEBUG("reboot system");
+    send_pkg_back(PKG_FB_REBOOT_SYSTEM,sys,motion,env,0,0,NULL);
+    sleep(2);
+    itmp = system("sudo shutdown -r now");
+    ROS_DEBUG("reboot navigation controller,result:%d",itmp);
+    return 0;
+}
+
+static int cmd_shutdown_system(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("shutdown the system");
+    send_pkg_back(PKG_FB_SHUTDOWN,sys,motion,env,0,0,NULL);
+    //set_led_power_effect(LED_POWER_FREEDOM,LED_DEFAULT);
+    //sleep(2);
+    //itmp = system("sudo shutdown -h now");
+    //ROS_DEBUG("shut down navigation controller,result:%d",itmp);
+    return 0;
+}
+
+static int cmd_stop_dance(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("stop dance mode");
+    if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode))
+    {
+        sys->dance.dance_state = DANCE_FINISHED;
+        sys->dance.dance_rotate_flag = 0;
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_request_dance_status(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("request dance state");
+    if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode)
+        && (DANCE_ERROR != sys->dance.dance_state))
+    {
+        reply->fb_data = 0;
+    }
+    else
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_ask_prepare_dance(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: ask dance prepare ok?");
+    //fb_data = check_dance_status(motion,sys);
+    return 0;
+}
+
+static int cmd_back_dance_start_point(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd:back start point");
+    if((1 == sys->auto_enable) && (AUTO_DANCE_MODE == sys->auto_work_mode))
+    {
+        if((0 != sys->dance.dance_start_point_set) 
+                && (DANCE_FINISHED == sys->dance.dance_state))
+        {
+            //
+            ROS_DEBUG("dance back to start point now!");
+            sys->dance.dance_state = DANCE_BACK_START;
+            reply->fb_data = 1;
+        }
+    }
+    return 0;
+}
+
+static int cmd_enter_dance_mode(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd:enter dance mode");
+    if((AUTO_BASIC_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
+    {
+        sys->auto_work_mode = AUTO_DANCE_MODE;
+        reply->fb_data = 1;
+    }
+    else if((AUTO_DANCE_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_exit_dance_mode(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("exit dance mode!");
+    if((AUTO_DANCE_MODE == sys->auto_work_mode)&&(1 == sys->auto_enable))
+    {
+        sys->auto_work_mode = AUTO_BASIC_MODE;
+        sys->dance.dance_state = DANCE_FINISHED;
+        sys->dance.dance_rotate_flag = 0;
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_ask_prepare_nav(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: ask nav prepare ok?");
+    reply->fb_data = 0;
+    if((1 != sys->auto_enable) || (AUTO_BASIC_MODE != sys->auto_work_mode))
+    {
+        ROS_DEBUG("system mode is not right");
+        reply->fb_data = 1;
+    }
+    else
+    {
+        if(0 == motion->path.path_finish)
+        {
+            ROS_DEBUG("last nav unfinished");
+            reply->fb_data = 2;
+        }
+        else if(0 == sys->build_cord_flag)
+        {
+            ROS_DEBUG("system not find valid mark");
+            reply->fb_data = 3;
+        }
+        else
+        {
+            if(1 == sys->camera.lose_mark_flag)
+            {
+                ROS_DEBUG("system lost mark");
+                reply->fb_data = 100;
+            }
+        }
+    }
+    return 0;
+}
+
+static int cmd_request_nav_status(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: request nav state");
+    if((1 != sys->auto_enable) || (AUTO_BASIC_MODE != sys->auto_work_mode))
+    {
+        ROS_DEBUG("system mode is not right,nav failed");
+        reply->fb_data = 2;
+    }
+    else if(sys->obstacle_scale < OBSTACLE_SLOW_SCALE)
+    {
+        ROS_DEBUG("nav ok,but find obstacle");
+        reply->fb_data = 1;
+    }    
+    return 0;
+}
+
+static int cmd_stop_nav(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: stop nav");
+    if((AUTO_BASIC_MODE == sys->auto_work_mode) && (1 == sys->auto_enable))
+    {
+        motion->path.path_finish = 1;
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_update_dance_start_point(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: setup new dance start point");
+    if(1 == sys->build_cord_flag)
+    {
+        //set_dance_start_point(sys,motion);
+        i = write_system_file(sys);
+        if(0 == i)
+        {
+            //i = read_system_file(sys);
             if(0 == i)
             {
-                fb_data = 1;
+                reply->fb_data = 1;
             }
-			break;
-		case PKG_RELOAD_MAP_FILES:
-			ROS_DEBUG("handle_cmd:reload map files");
-			//i = reload_map_files(sys,env);
-			if(0 == i)
-			{
-			    fb_data = 1;
-			}
-			break;
-		case PKG_REQUEST_UPGRADE:
-			ROS_DEBUG("handle_cmd:request upgrade");
-			fb_data = 0;
-			if(pkg_len < SOCKET_PKG_BUF_SIZE)
-			{
-				memcpy(cdata,&(buf[PKG_DATA_INDEX]),pkg_len-PKG_CMD_BASE_LEN);
-				cdata[pkg_len-PKG_CMD_BASE_LEN] = 0;
-				i = check_upgrade_system(sys,env,cdata,&type);
-                ROS_DEBUG("check_upgrade_system result:%d",i);
-				if(0 == i)
-				{
-				    fb_data |= 0x01;
-				}
-				if(1 == type)
-				{
-				    fb_data |= 0x02;
-				}
-			}
-			break;
-		case PKG_START_UPGRADE:
-			ROS_DEBUG("handle_cmd:start upgrade");
-			sys->system_upgrade_flag = 1;
-            fb_data = 0;
-			break;
-	    default:
-			ROS_DEBUG("handle_cmd:default:%x",pkg_type);
-			return -1;
-            break;
+            else
+            {
+                ROS_DEBUG("re-read system file failed!");
+                reply->fb_data = 2;
+            }
+        }
+        else
+        {
+            ROS_DEBUG("write to system file failed!");
+            sys->err_num = WRITE_SYS_FILE_ERR;
+            reply->fb_data = 3;
+        }
+    }
+    else
+    {
+        reply->fb_data = 4;
+    }
+    return 0;
+}
+
+static int cmd_send_map_info_begin(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int data = 0;
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd:begin send map file");
+    reply->type = buf[PKG_DATA_INDEX];
+    data = (((int)buf[PKG_DATA_INDEX+4])<<24)|
+        (((int)buf[PKG_DATA_INDEX+3])<<16)|
+        (((int)buf[PKG_DATA_INDEX+2])<<8)|((int)buf[PKG_DATA_INDEX+1]);
+    // i = handle_map_files(sys,env,(FILE_TYPE)type,data);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
     }
-    ROS_DEBUG("pkg_type:%x,fbdata:%d",pkg_type,fb_data);
-    send_pkg_back(pkg_type|PKG_TRANSFORM,sys,motion,env,fb_data,type,cdata);
+    return 0;
+}
+
+static int cmd_send_map_info(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    unsigned short int pkg_len = (buf[PKG_LEN_INDEX+1]<<8)|(buf[PKG_LEN_INDEX]);
+    int itmp = 0;
+    int i = 0;
 
+    ROS_DEBUG("handle_cmd:send map file");
+    reply->type = buf[PKG_DATA_INDEX];
+    itmp = pkg_len - PKG_CMD_BASE_LEN - 1;
+    //i = copy_map_files_mem(env,(char *)&(buf[PKG_DATA_INDEX+1]),itmp,(FILE_TYPE)type);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
     return 0;
 }
 
-void handle_upper_com_cmd(system_t *sys,motion_t *motion,env_t *env)
+static int cmd_send_map_info_end(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send map file end");
+    reply->type = buf[PKG_DATA_INDEX];
+    //i = check_map_file(env,(char)buf[PKG_DATA_INDEX+1],(FILE_TYPE)type);
+    ROS_DEBUG("check map file:%d",i);
+    if(0 == i)
+    {
+        //i = write_to_map_files(env,(FILE_TYPE)type);
+        if(0 == i)
+        {
+            reply->fb_data = 1;
+        }
+        else
+        {
+            ROS_DEBUG("write to map files failed!");
+            sys->err_num = WRITE_MAP_FILE_ERR;
+        }
+    }
+    else
+    {
+        ROS_DEBUG("check map file failed!");
+    }
+    return 0;
+}
+
+static int cmd_read_sense_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read sensor data");
+    reply->fb_data = 1;
+    reply->type = buf[PKG_DATA_INDEX];
+    return 0;
+}
+
+static int cmd_read_base_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read base data");
+    reply->fb_data = 1;
+    reply->type = buf[PKG_DATA_INDEX];
+    return 0;
+}
+
+static int cmd_read_led_power_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read led and power data");
+    reply->fb_data = 1;
+    reply->type = buf[PKG_DATA_INDEX];
+    return 0;
+}
+
+static int cmd_read_camera_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read camera data");
+    reply->fb_data = 1;
+    reply->type = buf[PKG_DATA_INDEX];
+    return 0;
+}
+
+static int cmd_read_controller_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read controller data,type:%d",buf[PKG_DATA_INDEX]);
+    reply->fb_data = 1;
+    reply->type = buf[PKG_DATA_INDEX];
+    return 0;
+}
+
+static int cmd_set_controller_data(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: set controller params,type:%d",buf[PKG_DATA_INDEX]);
+    reply->type = buf[PKG_DATA_INDEX];
+    i = set_system_params(sys,motion,env,reply->type,&(buf[PKG_DATA_INDEX+1]));
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_dance_file_begin(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send dance file begin");
+    reply->type = buf[PKG_DATA_INDEX];
+    //i = handle_dance_file_init(sys, buf);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_dance_file(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send dance file");
+    reply->type = buf[PKG_DATA_INDEX];
+    //i = handle_dance_file_data(sys, buf);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_dance_file_end(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send dance file end");
+    reply->type = buf[PKG_DATA_INDEX];
+    //i = handle_dance_file_done(sys, buf);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_upgrade_file_begin(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd:send upgrade file begin");
+    reply->type = buf[PKG_DATA_INDEX];
+    i = handle_upgrade_file_begin(sys,buf);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_upgrade_file(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send upgrade file");
+    reply->type = buf[PKG_DATA_INDEX];
+    i = handle_upgrade_file_data(sys, buf);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_send_upgrade_file_end(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd: send upgrade file end");
+    reply->type = buf[PKG_DATA_INDEX];
+    i = handle_upgrade_file_done(sys, buf);
+    if(0 == i)
+    {
+        if(SYSTEM_FILE == sys->upgrade.type)
+        {
+            i = upgrade_replace_nav_file();
+            if(0 == i)
+            {
+                reply->fb_data = 1;
+            }
+        }
+    }
+    else
+    {
+        ROS_DEBUG("write upgrade file failed");
+    }
+    return 0;
+}
+
+static int cmd_read_develop_version(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read develop version");
+    reply->fb_data = 1;
+    return 0;
+}
+
+static int cmd_check_system(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+	ask_status_t ask;
+	ans_status_t ans;
+
+    ROS_DEBUG("handle_cmd: check system");
+    ask.module_group = (module_e)buf[PKG_DATA_INDEX];
+    ask.module = (module_e)buf[PKG_DATA_INDEX+1];
+    ask.function = buf[PKG_DATA_INDEX+2];
+    i = handle_report_status(ask,&ans,sys,motion,env);
+    if(0 != i)
+    {
+        ans.level = LEVEL_ERROR;
+        ans.module = MODULE_NAV;
+        ans.function = 23;
+        ans.len = 4;
+        set_int_buf(ans.data,4);
+    }
+    reply->cdata[0] = (unsigned char)ans.level;
+    reply->cdata[1] = (unsigned char)ans.module;
+    reply->cdata[2] = ans.function;
+    reply->cdata[3] = ans.len;
+    for(i=0;i<ans.len;i++)
+    {
+        reply->cdata[4+i] = ans.data[i];
+    }
+    reply->fb_data = ans.len + 4;
+    reply->cdata_len = ans.len + 4;
+    ROS_DEBUG("check system:module:%x,function:%x",reply->cdata[1],reply->cdata[2]);
+    return 0;
+}
+
+static int cmd_read_official_version(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd: read official version");
+    reply->fb_data = 1;
+    return 0;
+}
+
+static int cmd_heart_beat_fb(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd:receive heart beat back pkg");
+    set_upper_beat_flag(1);
+    return UPPER_CMD_NO_REPLY;
+}
+
+static int cmd_reboot_robot(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd:reboot robot");//
+    i = set_led_power_function(0,1);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_reload_map_files(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    int i = 0;
+
+    ROS_DEBUG("handle_cmd:reload map files");
+    //i = reload_map_files(sys,env);
+    if(0 == i)
+    {
+        reply->fb_data = 1;
+    }
+    return 0;
+}
+
+static int cmd_request_upgrade(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
 {
-    upper_com_sys_t *upper_sys = NULL;
-    unsigned char *buf = NULL;
+    unsigned short int pkg_len = (buf[PKG_LEN_INDEX+1]<<8)|(buf[PKG_LEN_INDEX]);
     int i = 0;
+
+    ROS_DEBUG("handle_cmd:request upgrade");
+    reply->fb_data = 0;
+    if(pkg_len < SOCKET_PKG_BUF_SIZE)
+    {
+        memcpy(reply->cdata,&(buf[PKG_DATA_INDEX]),pkg_len-PKG_CMD_BASE_LEN);
+        reply->cdata[pkg_len-PKG_CMD_BASE_LEN] = 0;
+        reply->cdata_len = pkg_len-PKG_CMD_BASE_LEN+1;
+        i = check_upgrade_system(sys,env,reply->cdata,&reply->type);
+        ROS_DEBUG("check_upgrade_system result:%d",i);
+        if(0 == i)
+        {
+            reply->fb_data |= 0x01;
+        }
+        if(1 == reply->type)
+        {
+            reply->fb_data |= 0x02;
+        }
+    }
+    return 0;
+}
+
+static int cmd_start_upgrade(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env,upper_reply_t *reply)
+{
+    ROS_DEBUG("handle_cmd:start upgrade");
+    sys->system_upgrade_flag = 1;
+    reply->fb_data = 0;
+    return 0;
+}
+
+static int handle_cmd(unsigned char *buf,system_t*sys,motion_t *motion,env_t *env)
+{
+    if((NULL == buf) || (NULL == sys) || (NULL == motion) || (NULL == env))
+    {
+        ROS_DEBUG("handle_cmd:buf,sys,motion,env is NULL");
+        return -1;
+    }
+
+    if(1 == motion->path.info_flag)
+    {
+        motion->path.info_flag = 0;
+    }
+    if(1 == sys->dance.dance_info_flag)
+    {
+        sys->dance.dance_info_flag = 0;
+    }
+    return dispatch_upper_cmd(buf,sys,motion,env);
+}
+
+//min_len is the data bytes a handler reads, shorter commands are dropped before it runs
+void init_upper_cmd_table(void)
+{
+    register_upper_cmd(PKG_SET_MODE,"set_mode",1,cmd_set_mode);
+    register_upper_cmd(PKG_SET_MANUAL_VEL,"set_manual_vel",8,cmd_set_manual_vel);
+    register_upper_cmd(PKG_ENABLE_INIT_MAP,"enable_init_map",1,cmd_enable_init_map);
+    register_upper_cmd(PKG_CAL_MARK,"cal_mark",0,cmd_cal_mark);
+    register_upper_cmd(PKG_CAL_TPOINT,"cal_tpoint",0,cmd_cal_tpoint);
+    register_upper_cmd(PKG_CAL_GOAL,"cal_goal",0,cmd_cal_goal);
+    register_upper_cmd(PKG_SET_NAV_GOAL,"set_nav_goal",4,cmd_set_nav_goal);
+    register_upper_cmd(PKG_START_DANCE,"start_dance",8,cmd_start_dance);
+    register_upper_cmd(PKG_REBOOT_SYSTEM,"reboot_system",0,cmd_reboot_system);
+    register_upper_cmd(PKG_SHUTDOWN_SYSTEM,"shutdown_system",0,cmd_shutdown_system);
+    register_upper_cmd(PKG_STOP_DANCE,"stop_dance",0,cmd_stop_dance);
+    register_upper_cmd(PKG_REQUEST_DANCE_STATUS,"request_dance_status",0,cmd_request_dance_status);
+    register_upper_cmd(PKG_ASK_PREPARE_DANCE,"ask_prepare_dance",0,cmd_ask_prepare_dance);
+    register_upper_cmd(PKG_BACK_DANCE_START_POINT,"back_dance_start_point",0,cmd_back_dance_start_point);
+    register_upper_cmd(PKG_ENTER_DANCE_MODE,"enter_dance_mode",0,cmd_enter_dance_mode);
+    register_upper_cmd(PKG_EXIT_DANCE_MODE,"exit_dance_mode",0,cmd_exit_dance_mode);
+    register_upper_cmd(PKG_ASK_PREPARE_NAV,"ask_prepare_nav",0,cmd_ask_prepare_nav);
+    register_upper_cmd(PKG_REQUEST_NAV_STATUS,"request_nav_status",0,cmd_request_nav_status);
+    register_upper_cmd(PKG_STOP_NAV,"stop_nav",0,cmd_stop_nav);
+    register_upper_cmd(PKG_UPDATE_DANCE_START_POINT,"update_dance_start_point",0,cmd_update_dance_start_point);
+    register_upper_cmd(PKG_SEND_MAP_INFO_BEGIN,"send_map_info_begin",5,cmd_send_map_info_begin);
+    register_upper_cmd(PKG_SEND_MAP_INFO,"send_map_info",1,cmd_send_map_info);
+    register_upper_cmd(PKG_SEND_MAP_INFO_END,"send_map_info_end",1,cmd_send_map_info_end);
+    register_upper_cmd(PKG_READ_SENSE_DATA,"read_sense_data",1,cmd_read_sense_data);
+    register_upper_cmd(PKG_READ_BASE_DATA,"read_base_data",1,cmd_read_base_data);
+    register_upper_cmd(PKG_READ_LED_POWER_DATA,"read_led_power_data",1,cmd_read_led_power_data);
+    register_upper_cmd(PKG_READ_CAMERA_DATA,"read_camera_data",1,cmd_read_camera_data);
+    register_upper_cmd(PKG_READ_CONTROLLER_DATA,"read_controller_data",1,cmd_read_controller_data);
+    register_upper_cmd(PKG_SET_CONTROLLER_DATA,"set_controller_data",2,cmd_set_controller_data);
+    register_upper_cmd(PKG_SEND_DANCE_FILE_BEGIN,"send_dance_file_begin",1,cmd_send_dance_file_begin);
+    register_upper_cmd(PKG_SEND_DANCE_FILE,"send_dance_file",1,cmd_send_dance_file);
+    register_upper_cmd(PKG_SEND_DANCE_FILE_END,"send_dance_file_end",1,cmd_send_dance_file_end);
+    register_upper_cmd(PKG_SEND_UPGRADE_FILE_BEGIN,"send_upgrade_file_begin",1,cmd_send_upgrade_file_begin);
+    register_upper_cmd(PKG_SEND_UPGRADE_FILE,"send_upgrade_file",1,cmd_send_upgrade_file);
+    register_upper_cmd(PKG_SEND_UPGRADE_FILE_END,"send_upgrade_file_end",1,cmd_send_upgrade_file_end);
+    register_upper_cmd(PKG_READ_DEVELOP_VERSION,"read_develop_version",0,cmd_read_develop_version);
+    register_upper_cmd(PKG_CHECK_SYSTEM,"check_system",3,cmd_check_system);
+    register_upper_cmd(PKG_READ_OFFICIAL_VERSION,"read_official_version",0,cmd_read_official_version);
+    register_upper_cmd(PKG_HEART_BEAT_FB,"heart_beat_fb",0,cmd_heart_beat_fb);
+    register_upper_cmd(PKG_REBOOT_ROBOT,"reboot_robot",0,cmd_reboot_robot);
+    register_upper_cmd(PKG_RELOAD_MAP_FILES,"reload_map_files",0,cmd_reload_map_files);
+    register_upper_cmd(PKG_REQUEST_UPGRADE,"request_upgrade",0,cmd_request_upgrade);
+    register_upper_cmd(PKG_START_UPGRADE,"start_upgrade",0,cmd_start_upgrade);
+
+    register_upper_pkg(PKG_FB_MODE,pkg_mode);
+    register_upper_pkg(PKG_FB_REAL_VEL,pkg_real_vel);
+    register_upper_pkg(PKG_FB_INIT_MAP,pkg_init_map);
+    register_upper_pkg(PKG_FB_CAL_MARK,pkg_byte);
+    register_upper_pkg(PKG_FB_CAL_TPOINT,pkg_byte);
+    register_upper_pkg(PKG_FB_CAL_GOAL,pkg_byte);
+    register_upper_pkg(PKG_FB_CURRENT_DANCE,pkg_byte);
+    register_upper_pkg(PKG_FB_STOP_DANCE,pkg_byte);
+    register_upper_pkg(PKG_FB_DANCE_STATUS,pkg_byte);
+    register_upper_pkg(PKG_FB_PREPARE_DANCE,pkg_byte);
+    register_upper_pkg(PKG_FB_BACK_DANCE_START_POINT,pkg_byte);
+    register_upper_pkg(PKG_FB_ENTER_DANCE_MODE,pkg_byte);
+    register_upper_pkg(PKG_FB_EXIT_DANCE_MODE,pkg_byte);
+    register_upper_pkg(PKG_FB_PREPARE_NAV,pkg_byte);
+    register_upper_pkg(PKG_FB_NAV_STATUS,pkg_byte);
+    register_upper_pkg(PKG_FB_STOP_NAV,pkg_byte);
+    register_upper_pkg(PKG_FB_UPDATE_DANCE_START_POINT,pkg_byte);
+    register_upper_pkg(PKG_FB_REPORT_ERROR,pkg_int);
+    register_upper_pkg(PKG_FB_CURRENT_GOAL,pkg_int);
+    register_upper_pkg(PKG_FB_REQUEST_UPGRADE,pkg_int);
+    register_upper_pkg(PKG_FB_START_UPGRADE,pkg_int);
+    register_upper_pkg(PKG_FB_REBOOT_SYSTEM,pkg_empty);
+    register_upper_pkg(PKG_FB_SHUTDOWN,pkg_empty);
+    register_upper_pkg(PKG_FB_REBOOT_ROBOT,pkg_empty);
+    register_upper_pkg(PKG_SEND_HEART_BEAT,pkg_empty);
+    register_upper_pkg(PKG_REPORT_SHUTDOWN,pkg_empty);
+    register_upper_pkg(PKG_FB_SEND_MAP_INFO_BEGIN,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_MAP_INFO,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_MAP_INFO_END,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SET_CONTROLLER_PARAMS,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_DANCE_FILE_BEGIN,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_DANCE_FILE,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_DANCE_FILE_END,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_UPGRADE_FILE_BEGIN,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_UPGRADE_FILE,pkg_byte_type);
+    register_upper_pkg(PKG_FB_SEND_UPGRADE_FILE_END,pkg_byte_type);
+    register_upper_pkg(PKG_FB_READ_SENSE_DATA,pkg_read_sense_data);
+    register_upper_pkg(PKG_FB_READ_BASE_DATA,pkg_read_base_data);
+    register_upper_pkg(PKG_FB_READ_LED_POWER_DATA,pkg_read_led_power_data);
+    register_upper_pkg(PKG_FB_READ_CAMERA_DATA,pkg_read_camera_data);
+    register_upper_pkg(PKG_FB_READ_CONTROLLER_DATA,pkg_read_controller_data);
+    register_upper_pkg(PKG_FB_READ_DEVELOP_VERSION,pkg_develop_version);
+    register_upper_pkg(PKG_FB_READ_OFFICIAL_VERSION,pkg_official_version);
+    register_upper_pkg(PKG_FB_CHECK_SYSTEM,pkg_str);
+    register_upper_pkg(PKG_FB_RELOAD_MAP_FILES,pkg_reload_map_files);
+    register_upper_pkg(PKG_REPORT_NAV_FINISHED,pkg_nav_finished);
+    register_upper_pkg(PKG_REPORT_DANCE_FINISHED,pkg_dance_finished);
+    register_upper_pkg(PKG_REPORT_AI_WORDS,pkg_str);
+    register_upper_pkg(PKG_REPORT_EVENTS,pkg_events);
+}
+
+//length and checksum of the packet at pkg, 0 when not a whole valid one yet
+static int check_upper_pkg(unsigned char *pkg,int avail)
+{
     unsigned short int j = 0;
     int k = 0;
-    int num = 0;
-    int buf_start = 0;
 	unsigned short int check_sum = 0;
 	unsigned short int check = 0;
 
+    if(avail < PKG_LEN_INDEX + 2)
+    {
+        return 0;
+    }
+    j = (pkg[PKG_LEN_INDEX+1]<<8)|(pkg[PKG_LEN_INDEX]);
+    if((j >= SOCKET_PKG_LEN) || (j <= 6))
+    {
+        return -1;
+    }
+    if(j > avail)
+    {
+        return 0;
+    }
+    if(0xAA != pkg[j-1])
+    {
+        return -1;
+    }
+    for(k=0;k<j-3;k++)
+    {
+        check_sum += pkg[k];
+    }
+	check = (pkg[j-2]<<8)|(pkg[j-3]);
+    if(check_sum != check)
+    {
+        ROS_DEBUG("handle pkg,check_sum:%x,check:%x",check_sum,check);
+        return -1;
+    }
+    return j;
+}
+
+void handle_upper_com_cmd(system_t *sys,motion_t *motion,env_t *env)
+{
+    //packets are handled where they lie, buf[start..end) is not parsed yet
+    static unsigned char buf[UPPER_COM_HANDLE_LEN];
+    static int start = 0;
+    static int end = 0;
+    upper_com_state_t upper_state;
+    int recv_num = 0;
+    int len = 0;
+
     if((NULL == sys) || (NULL == motion) ||(NULL == env))
     {
         ROS_DEBUG("sys or motion or env NULL!");
@@ -2128,83 +2313,50 @@ void handle_upper_com_cmd(system_t *sys,motion_t *motion,env_t *env)
     }
     
     //read upper_com  info to decide handle
-    upper_sys = get_upper_com_system_info();
-    if(NULL != upper_sys)
+    get_upper_com_state(&upper_state);
+    if(5 != upper_state.socket_status)
+    {
+        sys->err_num = UPPER_MODULE_ERR;
+    }
+    sys->upper_work_normal = upper_state.work_normal;
+
+    do
     {
-        upper_sys->handle_upper_com_flag = 1;
-				
-        if(5 != upper_sys->socket_status)
+        //only a partial packet is ever moved, and only when the tail of buf is used up
+        if((UPPER_COM_HANDLE_LEN == end) && (0 != start))
         {
-            sys->err_num = UPPER_MODULE_ERR;
+            memmove(buf,buf+start,end-start);
+            end -= start;
+            start = 0;
         }
-        sys->upper_work_normal = upper_sys->work_normal;
-				
-        if(1 == upper_sys->need_read_flag)
+        recv_num = read_upper_com_data(buf+end,UPPER_COM_HANDLE_LEN-end);
+        end += recv_num;
+        while(start < end)
         {
-            upper_sys->need_read_flag = 0;
-            
-            num = upper_sys->read_num;
-            buf = upper_sys->upper_com_buf;
-            i = 0;
-            buf_start = 0;
-			//ROS_DEBUG("com cmd i:%d,num:%d",i,num);
-            while(i < num)
+            if(0x55 != buf[start])
             {
-                while((buf[i] != 0x55)&&(i < num))
-                {
-                    i++;
-                }
-                if(i == num)
-                {
-                    break;
-                }
-                j = (buf[i+PKG_LEN_INDEX+1]<<8)|(buf[i+PKG_LEN_INDEX]);
-				//ROS_DEBUG("handle pkg,i:%d,j:%d,:%x",i,j,buf[i+j-1]);
-                if((0xAA == buf[i+j-1]) && (i+j <= num) && (j < SOCKET_PKG_LEN) && (j > 6))
-                {
-                    check_sum = 0;
-                    for(k=0;k<j-3;k++)
-                    {
-                        //ROS_DEBUG("handle pkg,buf[i+%d]:%x,c_tmp:%x\n",k,buf[i+k],c_tmp);
-                        check_sum += buf[i+k];
-                    }
-					check = (buf[i+j-2]<<8)|(buf[i+j-3]);
-                    //ROS_DEBUG("handle pkg,c_tmp:%x,buf[j-2]:%x\n",c_tmp,buf[i+j-2]);
-                    if(check_sum == check)
-                    {
-                        handle_cmd(&(buf[i]),sys,motion,env);
-                        i += j;    
-                        buf_start = i;
-                    }
-                    else
-                    {
-                        ROS_DEBUG("handle pkg,check_sum:%x,check:%x",check_sum,check);
-                        i++;
-                    }
-                }
-                else
-                {
-                    i++;
-                }
+                start++;
+                continue;
             }
-            //ROS_DEBUG("buf_start:%d,num:%d",buf_start,num);
-            if(buf_start != num)
+            len = check_upper_pkg(&(buf[start]),end-start);
+            if(0 == len)
             {
-                for(k=buf_start;k<num;k++)
-                {
-                    buf[k-buf_start] = buf[k];
-                }
+                break;
             }
-            upper_sys->read_num -= buf_start;
-            if(upper_sys->read_num > UPPER_COM_RECV_LEN)
+            if(len < 0)
             {
-               upper_sys->read_num = 0; 
+                start++;
+                continue;
             }
-            //ROS_DEBUG("read_num:%d",upper_com_sys->read_num);
+            handle_cmd(&(buf[start]),sys,motion,env);
+            start += len;
         }
-              
-        upper_sys->handle_upper_com_flag = 0;       
-    }
+        if(start == end)
+        {
+            start = 0;
+            end = 0;
+        }
+    }while(recv_num > 0);
 }
 
 
@@ -13,17 +13,35 @@
 #include <errno.h>     
 #include <string.h>
 #include <time.h>
-#include <signal.h>
+#include <atomic>
+#include <vector>
 
 #include "../include/starline/config.h"
+#include "mcu_com/frame_parser.h"
+#include "mcu_com/seqlock.h"
+#include "../include/starline/frames.h"
 #include "../include/starline/led.h"
+#include "../include/starline/reactor.h"
+#include "../include/starline/fw_upgrade.h"
+
+#define LED_STEP_FREQ               (1000.0 * 1000 / LED_SLEEP_TIME)    //one polled request per LED_SLEEP_TIME
+#define LED_POLL_STEPS              7
 
 
 static led_info_t led_info;
+static int send_upgrade_frame(unsigned char *frame);
+static void request_led_version(void);
+static fw_upgrade_t *led_fw = fw_upgrade_create("led",0x0F,LED_UPGRADE_FILE_FRAME_LEN,LED_UPGRADE_OVER_TIME,
+    LED_READY_UPGRADE_WAIT_MS,LED_END_UPGRADE_WAIT_MS,send_upgrade_frame,request_led_version);
 static led_power_sys_t led_sys;
-static int led_over_time_flag = 0;
-static int last_unread_bytes = 0;
-static unsigned char recv_buf_last[BUF_LEN] = {0};
+static Seqlock<led_power_sys_t> led_snapshot;     //what the main loop sees, stored once per cycle
+static std::atomic<int> heart_beat_flag(0);
+static int led_step = LED_POLL_STEPS;          //next request of this cycle, reactor thread only
+static int upgrade_running = 0;                 //reactor thread only
+static std::atomic<int> upgrade_pending(0);     //get_power_upgrade_status(), 1 from set to done
+static std::atomic<int> upgrade_result(0);      //of the last upgrade, stored before upgrade_pending drops
+static FrameParser frame_parser;
+static LinkStats link_stats("led");
 
 static void handle_rev_frame(led_power_sys_t *sys,unsigned char * frame_buf)
 {
@@ -31,19 +49,8 @@ static void handle_rev_frame(led_power_sys_t *sys,unsigned char * frame_buf)
 	int i = 0;
 	int j = 0;
 	int command = 0; 
-	unsigned char check_data = 0;
 	frame_len = frame_buf[1];
 
-    for(i=0;i<frame_len-2;i++)
-    {
-        check_data += frame_buf[i];
-    }
-
-	if(check_data != frame_buf[frame_len-2] || 0xA5 != frame_buf[frame_len -1])
-	{
-        ROS_DEBUG("led receive frame check error");
-		return;
-	}
 for(i =0;i<frame_len;i++){
 //ROS_DEBUG("led receive:%02x",frame_buf[i]);
 }
@@ -51,9 +58,7 @@ for(i =0;i<frame_len;i++){
     {
          sys->work_normal = 2;
     }
-	if(0 == sys->handle_data_flag)
     {
-         sys->handle_data_flag = 1;
 		 led_info.recv_type = frame_buf[2];
 
 		 switch (led_info.recv_type)
@@ -124,6 +129,7 @@ for(i =0;i<frame_len;i++){
 
 			 case 0x05:
 			 	sys->ctrl_power_ack = frame_buf[3];
+			 	led_info.ctrl_power_ack = frame_buf[3];
 				break;
 
 			 case 0x06:
@@ -184,48 +190,22 @@ for(i =0;i<frame_len;i++){
 				{
                     sys->software_version[j] = frame_buf[6+j]; 
 				}
+				fw_upgrade_version(led_fw,&frame_buf[6],LED_SOFTWARE_VER_LEN);
 				break;
 
 			 case 0x0F:
-				led_info.upgrade_type = (int)frame_buf[3];
-				switch(led_info.upgrade_type)
-				{
-                      case 0x00:
-                         led_info.upgrade_ready_rlt = (int)frame_buf[4];
-						 break;
-										  
-					  case 0x01:                    
-						 led_info.upgrade_recv_rlt = (int)frame_buf[4];
-						 break;
-
-					  case 0x02:
-						 led_info.upgrade_end_rlt = (int)frame_buf[4];
-                         break;
-
-					  default:
-                         break;
-				}
+				fw_upgrade_ack(led_fw,(int)frame_buf[3],(int)frame_buf[4]);
 				break;
 				
 			 default:
                 break;
 		}
-        sys->handle_data_flag = 0;
         sys->rec_num++;
     }
 }
 
 static int handle_receive_data(led_power_sys_t *sys)
 {
-    int nread = 0;
-    int i = 0;
-	int j = 0;
-    int data_Len = 0;
-    int frame_len = 0;
-    unsigned char recv_buf[BUF_LEN] = {0};
-	unsigned char recv_buf_complete[BUF_LEN] = {0};
-    unsigned char recv_buf_temp[BUF_LEN] = {0};
-
 	struct stat file_info;
 	
     if(NULL == sys)
@@ -238,64 +218,18 @@ static int handle_receive_data(led_power_sys_t *sys)
         ROS_DEBUG("led_handle_receive_data: com_state != COM_RUN_OK && COM_CHECK_VERSION");
         return -1;
     }
-    if(0 != last_unread_bytes)
+    if(frame_parser.Fill(sys->com_device) > 0)
     {
-        for(j=0;j<last_unread_bytes;j++)
+        //frames are handled in place, the parser already checked sum and tail
+        frame_parser.Parse([sys](uint8_t *frame, int len)
         {
-            recv_buf_complete [j] = recv_buf_last[j];
-        }
-    }
-    if((nread = read(sys->com_device, recv_buf, BUF_LEN))>0)
-    { 
-        //ROS_DEBUG("led nread:%d",nread);
-        //ROS_DEBUG("led last_unread_bytes:%d",last_unread_bytes);
-        
-        memcpy(recv_buf_complete+last_unread_bytes,recv_buf,nread);
-        data_Len = last_unread_bytes + nread;
-        last_unread_bytes = 0;
-
-        while(i<data_Len)
-        {
-            if(0x5A == recv_buf_complete [i])
-            {
-                
-                 frame_len = recv_buf_complete[i+1]; 
-                 if(i+frame_len <= data_Len)
-                 {
-                      if(0xA5 == recv_buf_complete[i+frame_len-1])
-                      {
-                           for(j=0;j<frame_len;j++)
-                           {
-                               recv_buf_temp[j] = recv_buf_complete[i+j];
-                           }
-                           handle_rev_frame(sys,recv_buf_temp);
-                           i = i+ frame_len;
-                      }
-                      else
-                      {
-                           i++;
-                      }
-                 }
-                 else
-                 {
-                      last_unread_bytes = data_Len - i;
-                      for(j=0;j<last_unread_bytes;j++)
-                      {
-                           recv_buf_last[j] = recv_buf_complete[i+j];
-                      }
-                      break;
-                 }
-            }
-            else 
-            {
-                 i++;
-            }
-        }
+            link_stats.MarkReply(frame[2]);
+            handle_rev_frame(sys, frame);
+        });
     }
     else 
     {
-        i = stat(sys->dev,&file_info);
-        if(-1 == i)
+        if(-1 == stat(sys->dev,&file_info))
         {
             sys->com_state = COM_CLOSING;
         }
@@ -303,6 +237,7 @@ static int handle_receive_data(led_power_sys_t *sys)
     return 0;
 }
 
+//reactor thread only, other threads go through post_serial()
 static int send_serial(unsigned char *send_buf,led_power_sys_t *sys)
 {
     int len = 0;
@@ -333,6 +268,9 @@ for(int i =0;i<send_buf_len;i++){
     len = write(sys->com_device,send_buf,send_buf_len);
     if (len == send_buf_len)
     {
+         link_stats.AddTx(send_buf_len);
+         link_stats.MarkSent(send_buf[2]);
+         LinkCapture::Instance().Record(CAPTURE_LINK_LED, CAPTURE_DIR_TX, send_buf, send_buf_len);
          //ROS_DEBUG("led send ok");
          return 0;
     }     
@@ -347,19 +285,44 @@ for(int i =0;i<send_buf_len;i++){
     }
 }
 
-void get_led_version(void)
+//frames of the other threads, the reactor writes them so they never interleave with its own
+static void post_serial(unsigned char *send_buf)
 {
-	unsigned char data[6]={0};
+    std::vector<unsigned char> frame(send_buf, send_buf + send_buf[1]);
+
+    reactor_post([frame]() mutable { send_serial(frame.data(),&led_sys); });
+}
+
+static void request_led_version(void)
+{
+	unsigned char data[LedGetVersionFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x0E;
-	data[3] = 0;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-	data[5] = 0xA5;
+	LedGetVersionFrame::Encode(data, 0);
 	send_serial(data,&led_sys);
+}
+
+void get_led_version(void)
+{
+	reactor_post(request_led_version);
     usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
+}
+
+static void led_readable(uint32_t events)
+{
+    if(events & (EPOLLERR | EPOLLHUP))
+    {
+        ROS_DEBUG("led com device hang up");
+        led_sys.com_state = COM_CLOSING;
+    }
+    else
+    {
+        handle_receive_data(&led_sys);
+    }
+    //stop polling a dead device until the next tick closes it
+    if(COM_CLOSING == led_sys.com_state)
+    {
+        reactor_del_fd(led_sys.com_device);
+    }
 }
 
 static bool check_version(void)
@@ -414,9 +377,6 @@ static void led_init (void)
     led_info.ctrl_power_ack = -1;
 	led_info.get_power_current_ack = 1;
 	led_info.current_ctrl_rlt = -1;
-	led_info.upgrade_ready_rlt = -1;
-	led_info.upgrade_recv_rlt = -1;
-	led_info.upgrade_end_rlt = -1;
 	led_info.power_current_temp_err = 0;
 }
 
@@ -450,6 +410,7 @@ static void update_led_power_state(led_power_sys_t *sys)
             }
             last_file_flag = i;
             sys->com_device = open_com_device(sys->dev);
+            frame_parser.Reset();
             if(-1 != sys->com_device)
             {
                 sys->com_state = COM_CHECK_VERSION;
@@ -465,20 +426,26 @@ static void update_led_power_state(led_power_sys_t *sys)
             
             set_speed(sys->com_device,115200);
             set_parity(sys->com_device,8,1,'N');  
+            reactor_add_fd(sys->com_device,EPOLLIN,led_readable);
             break;
             
         case COM_CHECK_VERSION:
-            get_led_version();
+            //the reply is parsed as it comes in and checked on the next tick
             if(check_version())
             {
                  sys->com_state = COM_RUN_OK;
             }
+            else
+            {
+                request_led_version();
+            }
             break;
  
         case COM_RUN_OK:
             break;
             
         case COM_CLOSING:
+            reactor_del_fd(sys->com_device);
             close(sys->com_device);
             sys->com_state = COM_OPENING;
             sys->com_rssi = 0;
@@ -490,208 +457,28 @@ static void update_led_power_state(led_power_sys_t *sys)
     return;
 }
 
-static long get_upgrade_size(char* path)
-{
-	FILE *file;
-	
-	long len = 0;
-	
-	file = fopen(path,"rb");
-	if(NULL == file)
-	{
-		ROS_DEBUG("get upgrade size failed");
-        return 0;
-	}
-	
-	fseek(file,0,SEEK_END);
-	len = ftell(file);
-	fclose(file);	
-	return len;
-}
-
-static int send_ready_upgrade(char * path, char * md5char)
+static int send_upgrade_frame(unsigned char *frame)
 {
-	unsigned char data[26] = {0};
-    union {
-        unsigned long lnum;
-        unsigned char cnum[4];
-    }filesize;
-	int i = 0;
-
-	data[0] = 0x5A;
-	data[1] = 0x1A;
-	data[2] = 0x0F;
-	data[3] = 0x00;
-											 
-	for(i=0; i<16; i++)
-	{
-		data[i+4] = md5char[i];
-	}
-  
-    //big end or small end convert socket frame
-    filesize.lnum = htonl(get_upgrade_size(path));
-	if(0 == filesize.lnum)
-    {
-       ROS_DEBUG("led upgrade file is 0\n");   
-	   return -1;
-	}
-
-	for(i=0; i<4; i++)
-	{
-        data[i+20] = filesize.cnum[i];
-	}
-
-	for(i=0; i<24; i++)
-	{
-		data[24] += data[i];
-
-	}
-	data[25] = 0xA5;  
-	send_serial(data,&led_sys);
-	usleep(LED_READY_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&led_sys);
-    ROS_DEBUG("send_ready_upgrade over");
-	return 0;
+    //a frame lost on the way is not acked and sent again
+    post_serial(frame);
+    return 0;
 }
 
-static int send_upgrade_file_frame(char* buffer,int len)
+int led_upgrade_one_count(const char * path,const char * md5char,const char * version)
 {
-     unsigned char data[LED_UPGRADE_FILE_FRAME_LEN+6]={0};
-	 int i = 0;
-	 data[0] = 0x5A; 
-	 data[1] = len+6;
-	 data[2] = 0x0F;
-	 data[3] = 0x01;
-	 for(i=0; i<len; i++)
-	 {
-        data[i+4] = buffer[i];
-	 }
-	 for(i=0; i<len+4; i++)
-     {
-	    data[len+4] += data[i];
-	 }
-     data[len+5] = 0xA5;     
-	 send_serial(data,&led_sys); 
-	 return 0;
-}
-
-static void send_file_over_time(int sig)
-{    
-    led_over_time_flag =1;
-}
+    int rlt = fw_upgrade_run(led_fw,path,md5char,version);
 
-static int send_upgrade_file(char* path)
-{	
-	char buffer[LED_UPGRADE_FILE_FRAME_LEN]={0};
-	FILE *file;
-    int len = 0;
-    int i =0;
-    file = fopen(path,"rb");
-    if(NULL == file)
+    //the board refused the image, its end ack tells why
+    if(0x01 == rlt)
     {
-        ROS_DEBUG("open led update file failed");
-        return -1;
+        rlt = -5;
     }
-	
-    signal(SIGALRM, send_file_over_time);
-    alarm(LED_UPGRADE_OVER_TIME);
-	
-    while(!feof(file))
-    { 
-        ROS_DEBUG("send led upgrade file count:%d",i++);
-        len = fread(buffer,1,LED_UPGRADE_FILE_FRAME_LEN,file);
-        ROS_DEBUG("led upgrade_file len:%d",len);
-	    send_upgrade_file_frame(buffer,len);
-		bzero(buffer,LED_UPGRADE_FILE_FRAME_LEN);  
-		usleep(LED_SLEEP_TIME);
-
-		handle_receive_data(&led_sys); 
-
-		ROS_DEBUG("led upgrade_recv_rlt:%d",led_info.upgrade_recv_rlt);
-		if(led_info.upgrade_recv_rlt != 0x00)
-		{
-            //if send fail then resend pre frame
-            ROS_DEBUG("led upgrade_recv_rlt fail");
-			fseek(file,-LED_UPGRADE_FILE_FRAME_LEN,SEEK_CUR);
-		}
-
-		if(1 == led_over_time_flag)
-        {
-            ROS_DEBUG("send led upgrade file over time!!");
-            fclose(file);
-            led_over_time_flag = 0;
-            return -4;
-        }
-        led_info.upgrade_recv_rlt =-1;
-    }
-    alarm(0);
-	fclose(file);
-    ROS_DEBUG("send led upgrade file over");
-	return 0;
-}
-
-static int send_end_upgrade(void)
-{
-    unsigned char data[7] = {0};
-	data[0] = 0x5A;
-	data[1] = 0x07;
-    data[2] = 0x0F;
-	data[3] = 0x02;
-	data[4] = 0;
-	data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-	data[6] = 0xA5;
-	send_serial(data,&led_sys);
-	usleep(LED_END_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&led_sys);
-	return 0;
-}
-
-int led_upgrade_one_count(char * path,char * md5char)
-{
-    int rlt = 0;
-	rlt = send_ready_upgrade(path, md5char);
-    ROS_DEBUG("led upgrade_ready_rlt:%d",rlt);
-	if((rlt >= 0) && (0x00 == led_info.upgrade_ready_rlt))
-	{
-        rlt = send_upgrade_file(path);
-        if(rlt >= 0)
-        {
-           send_end_upgrade();
-           if(0x00 == led_info.upgrade_end_rlt)
-		   {
-               rlt = 0;
-		   }
-		   else if(0x01 == led_info.upgrade_end_rlt)
-		   {
-               rlt = -5;
-		   }
-           else
-           {
-               rlt = -7;
-           }
-		}
-	}
-	else if(led_info.upgrade_ready_rlt >0)
-	{
-	    if(0x01 == led_info.upgrade_ready_rlt)
-        {
-           rlt = -2;
-	    }
-		else if(0x02 == led_info.upgrade_ready_rlt)
-		{
-           rlt = -3;
-		}
-		else
-		{
-           rlt = -8;
-		}
-	}
-    else if(-1 == led_info.upgrade_ready_rlt)
+    else if(rlt > 0)
     {
-        rlt = -6;
+        rlt = -7;
     }
-    ROS_DEBUG("led_upgrade_rlt:%d",rlt); 
-	return rlt;
+    ROS_DEBUG("led_upgrade_rlt:%d",rlt);
+    return rlt;
 }
 
 /*
@@ -703,13 +490,13 @@ int led_upgrade_one_count(char * path,char * md5char)
  *       -6:nv have not ready frame
  *       -7:nv have not end frame
  */
-int led_upgrade(char * path,char * md5char)
+int led_upgrade(const char * path,const char * md5char,const char * version)
 {
     int upgrade_count = 0;
     int rlt = -1;
     while(upgrade_count < 3)
     {
-        rlt = led_upgrade_one_count(path,md5char);
+        rlt = led_upgrade_one_count(path,md5char,version);
         if(rlt < 0)
         {
             upgrade_count++;
@@ -735,18 +522,11 @@ int set_led_power_effect(LED_POWER_TYPE mode,LED_EFFECT_TYPE effect)
 int set_led_power_function(int module,int command)
 {
     int rlt = -1;
-	unsigned char data[7]={0};
+	unsigned char data[LedPowerFunctionFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x07;
-	data[2] = 0x05;
-	data[3] = module;
-	data[4] = command;
-	data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-	data[6] = 0xA5;
-	send_serial(data,&led_sys);
+	LedPowerFunctionFrame::Encode(data, module, command);
+	post_serial(data);
     usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	if(1 == led_info.ctrl_power_ack)
 	{
         rlt = 0;
@@ -757,139 +537,62 @@ int set_led_power_function(int module,int command)
 
 static void get_power_current(led_power_sys_t *sys)
 {    
-	unsigned char data[8]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedGetCurrentFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x08;
-	data[2] = 0x0A;
-	data[3] = 0x01;
-	data[4] = 0x01;
-	data[5] = 0x00;
-	for(int i=0; i<6; i++)
-	{
-	    check_data += data[i];
-    }
-	data[6] = check_data;
-	data[7] = 0xA5;
+	LedGetCurrentFrame::Encode(data, 0x01, 0x01, 0x00);
 	send_serial(data,&led_sys);
-    usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 static void get_power_error_data(led_power_sys_t *sys)
 {
-	unsigned char data[6]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedGetErrorFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x0B;
-	data[3] = 0x00;
-
-	for(int i=0; i<4; i++)
-	{
-	    check_data += data[i];
-    }
-	data[4] = check_data;
-	data[5] = 0xA5;
+	LedGetErrorFrame::Encode(data, 0x00);
 	send_serial(data,&led_sys);
-    usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 static void get_sysstatus_voltage(led_power_sys_t *sys,int voltage_type)
 {    
-	unsigned char data[6]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedGetSysStatusFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x02;
-	data[3] = voltage_type;
-	for(int i=0; i<4; i++)
-	{
-	    check_data += data[i];
-    }
-	data[4] = check_data;
-	data[5] = 0xA5;
+	LedGetSysStatusFrame::Encode(data, voltage_type);
 	send_serial(data,&led_sys);
-	usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 static void get_sysstatus_power_percent(led_power_sys_t *sys,int percent_type)
 {
-    unsigned char data[6]={0};
-    unsigned char check_data = 0;
-
-    data[0] = 0x5A;
-    data[1] = 0x06;
-    data[2] = 0x02;
-    data[3] = percent_type;
-    for(int i=0; i<4; i++)
-    {
-        check_data += data[i];
-    }
-    data[4] = check_data;
-    data[5] = 0xA5;
+    unsigned char data[LedGetSysStatusFrame::len];
+
+    LedGetSysStatusFrame::Encode(data, percent_type);
     send_serial(data,&led_sys);
-    usleep(LED_SLEEP_TIME);
-    handle_receive_data(&led_sys);
     return;
 }
 
 static void get_module_switch(led_power_sys_t *sys,int switch_type)
 {    
-	unsigned char data[6]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedGetModuleSwitchFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x03;
-	data[3] = switch_type;
-	for(int i=0; i<4; i++)
-	{
-	    check_data += data[i];
-    }
-	data[4] = check_data;
-	data[5] = 0xA5;
+	LedGetModuleSwitchFrame::Encode(data, switch_type);
 	send_serial(data,&led_sys);
-	usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 static void get_current_fault(led_power_sys_t *sys,int fault_type)
 {    
-	unsigned char data[6]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedGetCurrentFaultFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x04;
-	data[3] = fault_type;
-	for(int i=0; i<4; i++)
-	{
-	    check_data += data[i];
-    }
-	data[4] = check_data;
-	data[5] = 0xA5;
+	LedGetCurrentFaultFrame::Encode(data, fault_type);
 	send_serial(data,&led_sys);
-	usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 void send_led_power_pkg(led_power_sys_t *sys)
 {
     static int init_flag = 0;
-    int i = 0;
-    unsigned char data[8]={0};
-	unsigned char check_data = 0;
+    unsigned char data[LedEffectFrame::len];
 
 	if(0 == init_flag)
 	{
@@ -904,76 +607,38 @@ void send_led_power_pkg(led_power_sys_t *sys)
 	    }
 	}
 
-    data[0] = 0x5A;
-	data[1] = 0x08;
-	data[2] = 0x01;
     if(1 == sys->work_flag)
     {
-		data[3] = (unsigned char)sys->cmd_mode;
-		data[4] = (sys->cmd_effect & 0xff00)>>8;
-		data[5] = sys->cmd_effect & 0x0ff;
+		LedEffectFrame::Encode(data, (unsigned char)sys->cmd_mode, sys->cmd_effect);
     }
 	else
 	{
-		data[3] = 0;
-		data[4] = 0;
-		data[5] = 0;
+		LedEffectFrame::Encode(data, 0, 0);
 	}
-	for(i=0; i<6; i++)
-	{
-	     check_data += data[i];
-    }
-	data[6] = check_data;
-	data[7] = 0xA5;
 	if(0 == send_serial(data,sys))
 	{
          sys->work_flag = 0;
 	}
-    usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
     return;
 }
 
 void infrared_light_ctrl(int type,int light)
 {    
-	unsigned char data[7]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedInfraredFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x07;
-	data[2] = 0x06;
-	data[3] = type;
-	data[4] = light;
-	for(int i=0; i<5; i++)
-	{
-	    check_data += data[i];
-    }
-	data[5] = check_data;
-	data[6] = 0xA5;
-	send_serial(data,&led_sys);
+	LedInfraredFrame::Encode(data, type, light);
+	post_serial(data);
 	usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
 void fan_switch_ctrl(int fan_switch)
 {    
-	unsigned char data[6]={0};
-	unsigned char check_data = 0;
+	unsigned char data[LedFanFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x08;
-	data[3] = fan_switch;
-	for(int i=0; i<4; i++)
-	{
-	    check_data += data[i];
-    }
-	data[4] = check_data;
-	data[5] = 0xA5;
-	send_serial(data,&led_sys);
+	LedFanFrame::Encode(data, fan_switch);
+	post_serial(data);
 	usleep(LED_SLEEP_TIME);
-	handle_receive_data(&led_sys);
 	return;
 }
 
@@ -1016,83 +681,139 @@ void clear_error_data(void)
 	}
 }
 
-void *led_thread_start(void *)
+LinkStats *get_led_link_stats(void)
 {
-    int send_num = 0;
-	static int flag = 0;
-    led_sys.com_state = COM_OPENING;
-    update_led_power_state(&led_sys);
-    if((led_sys.led_freq <= 0) || (led_sys.led_freq >2))
+    return &link_stats;
+}
+
+//the old led loop body, the polled requests are sent by led_step_tick()
+static void led_tick(void)
+{
+    static int send_num = 0;
+
+    if(0 == led_sys.upgrade_status)
     {
-        led_sys.led_freq = 2.0;
-    }
-    ros::Rate loop_rate(led_sys.led_freq);
+         update_led_power_state(&led_sys);
 
-    while(ros::ok()) 
-    {  
-        if(0 == led_sys.upgrade_status)
+         if(COM_RUN_OK == led_sys.com_state)
+         {
+             check_com_rssi(send_num,&led_sys);
+             led_step = 0;
+	         send_num=(send_num + 1)%10;
+         }
+    }
+	else if((1 == led_sys.upgrade_status) && (0 == upgrade_running))
+	{
+        //waits for the acks the reactor parses, so it must not run here
+        upgrade_running = 1;
+        led_step = LED_POLL_STEPS;
+        std::string path(led_sys.name,strnlen(led_sys.name,FILE_PATH_LEN));
+        std::string md5(led_sys.md5,MD5_SIZE);
+        std::string version(led_sys.upgrade_version,strnlen(led_sys.upgrade_version,VERSION_LEN));
+        worker_spawn([path,md5,version]
         {
-             update_led_power_state(&led_sys);
-             handle_receive_data(&led_sys);
-
-             if(COM_RUN_OK == led_sys.com_state)
-             {
-                 check_com_rssi(send_num,&led_sys);
-                 send_led_power_pkg(&led_sys);
-				 get_sysstatus_voltage(&led_sys,0);	
-				 get_sysstatus_power_percent(&led_sys,2);
-				 get_module_switch(&led_sys,1);
-				 get_current_fault(&led_sys,1);
-                 //set_led_power_function(3,0);
-                 //infrared_light_ctrl(0,10);
-                 //fan_switch_ctrl(1);
-                 //set_led_power_effect(LED_POWER_FREEDOM,LED_GREEN_LONG);
-				 if(led_sys.power_current_temp_err == 1)
-				 {
-                     clear_error_data();
-					 get_power_error_data(&led_sys);
-				 }
-				 if(led_sys.get_power_flag == 1)
-				 {
-                     get_power_current(&led_sys);
-				 }
-		         send_num=(send_num + 1)%10;
-             }
-             ros::spinOnce();
-             loop_rate.sleep();
-        }
-		else if(1 == led_sys.upgrade_status)
-		{
-             if(flag == 0){
-			 	 flag = 1;
-                 led_sys.upgrade_result = led_upgrade(led_sys.name,led_sys.md5);
-			     led_sys.upgrade_status = 0;
-				 flag = 0;
-             }
-		}
+            int rlt = led_upgrade(path.c_str(),md5.data(),version.c_str());
+            reactor_post([rlt]
+            {
+                led_sys.upgrade_result = rlt;
+                led_sys.upgrade_status = 0;
+                upgrade_running = 0;
+                upgrade_result = rlt;
+                upgrade_pending = 0;
+            });
+        });
+	}
+    led_snapshot.Store(led_sys);
+}
+
+//one request per step, the board answers each before the next one is sent
+static void led_step_tick(void)
+{
+    if((led_step >= LED_POLL_STEPS) || (COM_RUN_OK != led_sys.com_state) || (0 != led_sys.upgrade_status))
+    {
+        return;
     }
-	
+    switch(led_step++)
+    {
+        case 0:
+            send_led_power_pkg(&led_sys);
+            break;
+        case 1:
+			get_sysstatus_voltage(&led_sys,0);	
+            break;
+        case 2:
+			get_sysstatus_power_percent(&led_sys,2);
+            break;
+        case 3:
+			get_module_switch(&led_sys,1);
+            break;
+        case 4:
+			get_current_fault(&led_sys,1);
+            //set_led_power_function(3,0);
+            //infrared_light_ctrl(0,10);
+            //fan_switch_ctrl(1);
+            //set_led_power_effect(LED_POWER_FREEDOM,LED_GREEN_LONG);
+            break;
+        case 5:
+			if(led_sys.power_current_temp_err == 1)
+			{
+                clear_error_data();
+				get_power_error_data(&led_sys);
+			}
+            break;
+        case 6:
+			if(led_sys.get_power_flag == 1)
+			{
+                get_power_current(&led_sys);
+			}
+            break;
+        default:
+            break;
+    }
+}
+
+static void led_exit(void)
+{
 	set_led_power_effect(LED_POWER_FREEDOM,LED_DEFAULT);
 	send_led_power_pkg(&led_sys);
     sleep(2);
+    reactor_del_fd(led_sys.com_device);
     close(led_sys.com_device);
 	led_sys.com_state = COM_OPENING;
     led_sys.com_rssi = 0;
 	led_sys.work_normal = 0;
-    
-    return 0;
+    led_snapshot.Store(led_sys);
 }
 
-led_power_sys_t *get_led_power_info(void)
+int led_start(void)
 {
-    if(0 == led_sys.handle_data_flag)
+    led_sys.com_state = COM_OPENING;
+    frame_parser.SetStats(&link_stats);
+    frame_parser.SetCapture(CAPTURE_LINK_LED);
+    update_led_power_state(&led_sys);
+    if((led_sys.led_freq <= 0) || (led_sys.led_freq >2))
     {
-        return &led_sys;
+        led_sys.led_freq = 2.0;
     }
-    else
+    reactor_at_exit(led_exit);
+    if((reactor_add_timer(led_sys.led_freq,led_tick) < 0)
+        || (reactor_add_timer(LED_STEP_FREQ,led_step_tick) < 0))
     {
-        return NULL;
+        return -1;
     }
+    return 0;
+}
+
+//copies the state of the last led cycle, never blocks the led thread
+void get_led_power_info(led_power_sys_t *info)
+{
+    led_snapshot.Load(*info);
+}
+
+//set by the main loop every LED_POWER_COM_PERIOD, returns the last value
+int swap_led_heart_beat_flag(int flag)
+{
+    return heart_beat_flag.exchange(flag);
 }
 
 void set_led_prior(int type,int value)
@@ -1140,20 +861,33 @@ int get_led_prior(void)
     return led_sys.prior_led;
 }
 
-int set_power_upgrade(char *str,char *md5)
+//version is the one the image brings, empty when not known
+int set_power_upgrade(char *str,char *md5,char *version)
 {
+    int idle = 0;
+
     if((NULL == str) || (NULL == md5))
 	{
 	    return -1;
 	}
-    if(0 == led_sys.upgrade_status)
-	{
-		memcpy(led_sys.name,str,strlen(str));
-		memcpy(led_sys.md5,md5,MD5_SIZE);
-		led_sys.upgrade_status = 1;
-		return 0;
-	}
-    return 1;
+    if(!upgrade_pending.compare_exchange_strong(idle,1))
+    {
+        return 1;
+    }
+    //copied here, the reactor owns led_sys and the caller may reuse its buffers
+    std::string path(str,strnlen(str,FILE_PATH_LEN - 1));
+    std::string sum(md5,MD5_SIZE);
+    std::string image_version = (NULL != version) ? std::string(version,strnlen(version,VERSION_LEN)) : std::string();
+    reactor_post([path,sum,image_version]
+    {
+        memset(led_sys.name,0,FILE_PATH_LEN);
+        memcpy(led_sys.name,path.data(),path.size());
+        memcpy(led_sys.md5,sum.data(),MD5_SIZE);
+        memset(led_sys.upgrade_version,0,VERSION_LEN);
+        memcpy(led_sys.upgrade_version,image_version.data(),image_version.size());
+        led_sys.upgrade_status = 1;
+    });
+    return 0;
 }
 
 void set_get_power_flag(void)
@@ -1173,12 +907,16 @@ void clear_error_power_status(void)
 
 int get_power_upgrade_result(void)
 {
-    int i = led_sys.upgrade_result;
-    return i;
+    return upgrade_result;
 }
 
 int get_power_upgrade_status(void)
 {
-    int i = led_sys.upgrade_status;
-    return i;
+    return upgrade_pending;
+}
+
+//percent of the file the board acked, -1 before the first upgrade
+int get_power_upgrade_progress(void)
+{
+    return fw_upgrade_progress(led_fw);
 }
@@ -1,4 +1,5 @@
 #include "ros/ros.h"
+#include "ros/callback_queue.h"
 #include "std_msgs/String.h"
 #include "std_msgs/UInt8MultiArray.h"
 #include "nav_msgs/Odometry.h"
@@ -13,6 +14,8 @@
 #include <stdio.h>
 #include <vector>
 #include <pthread.h>
+#include <errno.h>
+#include <string.h>
 #include "../include/starline/Id.h"
 #include "../include/starline/config.h"
 #include "../include/starline/system.h"
@@ -21,6 +24,16 @@
 #include "../include/starline/handle_command.h"
 #include "../include/starline/sensor.h"
 #include "../include/starline/move.h"
+#include "../include/starline/led.h"
+#include "../include/starline/upper_cmd.h"
+#include "../include/starline/fw_upgrade.h"
+#include "../include/starline/cloud.h"
+#include "mcu_com/link_stats.h"
+#include "mcu_com/capture.h"
+#include "mcu_com/link_diagnostics.h"
+#include "mcu_com/seqlock.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+#include "std_srvs/Trigger.h"
 
 #include <std_msgs/Int8.h>
 
@@ -31,11 +44,49 @@ motion_t g_motion;
 //int cmd_hs;
 FILE *fp = NULL;
 
+typedef struct{
+    vel_t vel;
+    unsigned int seq;
+}cmd_vel_msg_t;
+
+static Seqlock<cmd_vel_msg_t> cmd_vel_msg;
+
+//runs on the cmd_vel spinner, the movebase gets the speed before the main loop sees it
 void vel_callback(const geometry_msgs::TwistStamped& cmdvel)
 {
-     g_system.real_vel.vx = cmdvel.twist.linear.x;
-     g_system.real_vel.vy = cmdvel.twist.linear.y;
-     g_system.real_vel.vth = cmdvel.twist.angular.z;
+    static unsigned int seq = 0;
+    uint64_t rx_us = link_stats_now_us();
+    uint64_t stamp_age_us = 0;
+    cmd_vel_msg_t msg;
+
+    if(!cmdvel.header.stamp.isZero())
+    {
+        double age = (ros::Time::now() - cmdvel.header.stamp).toSec();
+        if(age > 0.0)
+        {
+            stamp_age_us = (uint64_t)(age * 1000 * 1000);
+        }
+    }
+    msg.vel.vx = cmdvel.twist.linear.x;
+    msg.vel.vy = cmdvel.twist.linear.y;
+    msg.vel.vth = cmdvel.twist.angular.z;
+    msg.seq = ++seq;
+    cmd_vel_msg.Store(msg);
+    express_movebase_cmd_vel(msg.vel,rx_us,stamp_age_us);
+}
+
+//real_vel only changes when a new cmd_vel came in, handle_vel() may have zeroed it since
+static void load_cmd_vel(system_t *sys)
+{
+    static unsigned int last_seq = 0;
+    cmd_vel_msg_t msg;
+
+    cmd_vel_msg.Load(msg);
+    if(msg.seq != last_seq)
+    {
+        last_seq = msg.seq;
+        sys->real_vel = msg.vel;
+    }
 }
 
 void handspike_callback(std_msgs::Int8 cmd_handspike)
@@ -99,6 +150,137 @@ void pub_baseState(ros::Publisher &basestate_pub )
 	basestate_pub.publish(baseState_msg);
 }
 
+#define LINK_NUM            3
+#define DIAG_PERIOD         1.0     //s
+
+static LinkStats *get_link_stats(int link)
+{
+    switch(link)
+    {
+        case 0:
+            return get_movebase_link_stats();
+        case 1:
+            return get_sensor_link_stats();
+        default:
+            return get_led_link_stats();
+    }
+}
+
+static int get_upgrade_progress(int link)
+{
+    switch(link)
+    {
+        case 0:
+            return get_movebase_upgrade_progress();
+        case 1:
+            return get_sensor_upgrade_progress();
+        default:
+            return get_power_upgrade_progress();
+    }
+}
+
+static void diag_add_percent(diagnostic_msgs::DiagnosticStatus *status,const std::string &key,int percent)
+{
+    diagnostic_msgs::KeyValue kv;
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%d", percent);
+    kv.key = key;
+    kv.value = buf;
+    status->values.push_back(kv);
+}
+
+//percent of the image each board acked and of each download, false before the first of either
+static bool upgrade_to_diagnostic(diagnostic_msgs::DiagnosticStatus *status)
+{
+    char key[32];
+    int progress = 0;
+    bool running = false;
+
+    status->name = ros::this_node::getName() + ": firmware upgrade";
+    status->hardware_id = "upgrade";
+    status->level = diagnostic_msgs::DiagnosticStatus::OK;
+    status->values.clear();
+    for(int i = 0; i < LINK_NUM; i++)
+    {
+        progress = get_upgrade_progress(i);
+        if(progress < 0)
+        {
+            continue;
+        }
+        running = running || (progress < 100);
+        diag_add_percent(status, std::string(get_link_stats(i)->name) + " %", progress);
+    }
+    for(int i = 0; i < DOWNLOAD_BUF_SIZE; i++)
+    {
+        progress = get_download_progress(i);
+        if(progress < 0)
+        {
+            continue;
+        }
+        running = running || (progress < 100);
+        snprintf(key, sizeof(key), "download %d %%", i);
+        diag_add_percent(status, key, progress);
+    }
+    status->message = running ? "upgrading" : "done";
+    return !status->values.empty();
+}
+
+//serial link counters of the movebase, sensor and led threads, upgrades and the capture
+void pub_link_diagnostics(ros::Publisher &diag_pub)
+{
+    static link_diag_last_t last[LINK_NUM];
+    diagnostic_msgs::DiagnosticArray msg;
+    diagnostic_msgs::DiagnosticStatus status;
+
+    msg.header.stamp = ros::Time::now();
+    msg.status.resize(LINK_NUM);
+    for(int i = 0; i < LINK_NUM; i++)
+    {
+        link_stats_to_diagnostic(*get_link_stats(i), ros::this_node::getName(), &last[i], &msg.status[i]);
+    }
+    if(upgrade_to_diagnostic(&status))
+    {
+        msg.status.push_back(status);
+    }
+    if(LinkCapture::Instance().Enabled())
+    {
+        capture_to_diagnostic(LinkCapture::Instance(), ros::this_node::getName(), &status);
+        msg.status.push_back(status);
+    }
+    diag_pub.publish(msg);
+}
+
+static std::string dump_vel_latency(void)
+{
+    const char *from[2] = {"reception", "stamp"};
+    char line[256];
+    std::string out("[cmd_vel]\n");
+
+    for(int i = 0; i < 2; i++)
+    {
+        const LinkHistogram &h = *get_movebase_vel_latency(i);
+        snprintf(line, sizeof(line), "  %s to write: n %llu mean %.0f p50 %llu p99 %llu max %llu us\n",
+                from[i], (unsigned long long)h.Count(), h.Mean(), (unsigned long long)h.Percentile(50),
+                (unsigned long long)h.Percentile(99), (unsigned long long)h.Max());
+        out += line;
+    }
+    return out;
+}
+
+bool dump_link_stats_callback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
+{
+    res.message.clear();
+    for(int i = 0; i < LINK_NUM; i++)
+    {
+        res.message += get_link_stats(i)->Dump();
+    }
+    res.message += dump_vel_latency();
+    res.message += dump_upper_cmd_stats();
+    res.success = true;
+    return true;
+}
+
 //20170815,Zero,for load motor
 void loadMotorCallback(std_msgs::UInt8MultiArray app_data)
 {
@@ -119,7 +301,12 @@ int main(int argc, char **argv)
     ros::init(argc, argv, "starline");
     ros::NodeHandle n;
 
-    ros::Subscriber vel_sub = n.subscribe("cmd_vel",1000,vel_callback);
+    //cmd_vel has its own queue and spinner, a slow main loop cycle never holds it back
+    ros::NodeHandle vel_n;
+    ros::CallbackQueue vel_queue;
+    vel_n.setCallbackQueue(&vel_queue);
+    ros::Subscriber vel_sub = vel_n.subscribe("cmd_vel",1,vel_callback,ros::TransportHints().tcpNoDelay());
+    ros::AsyncSpinner vel_spinner(1,&vel_queue);
     ros::Subscriber handspike_sub = n.subscribe("handspike_handle",1000,handspike_callback);
     ros::Publisher odom_pub = n.advertise<nav_msgs::Odometry>("/odom",1000);
     ros::Publisher power_pub = n.advertise<std_msgs::UInt8MultiArray>("power",1);
@@ -131,12 +318,52 @@ int main(int argc, char **argv)
     //20170815,Zero ,for load motor
     ros::Subscriber loadMotor_sub = n.subscribe("cmd_loadMotor",1,loadMotorCallback);
 
+    ros::Publisher diag_pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics",1);
+    ros::ServiceServer dump_link_stats_srv = n.advertiseService("starline/dump_link_stats",dump_link_stats_callback);
+    ros::Time last_diag_time = ros::Time::now();
+
+    //every byte of the mcu links and the upper socket, for capture_replay
+    std::string capture_file;
+    ros::param::param<std::string>("~capture_file", capture_file, "");
+    if(!capture_file.empty())
+    {
+        if(LinkCapture::Instance().Start(capture_file.c_str()) < 0)
+        {
+            ROS_ERROR("capture to %s failed: %s", capture_file.c_str(), strerror(errno));
+        }
+        else
+        {
+            ROS_INFO("capturing link traffic to %s", capture_file.c_str());
+        }
+    }
+
+    //pending events are kept here over socket outages and restarts, empty keeps them in memory only
+    std::string event_spool;
+    //1 sends them as PKG_REPORT_EVENTS, only for pads that know it
+    int event_batch = 0;
+    ros::param::param<std::string>("~event_spool", event_spool, EVENT_SPOOL_FILE);
+    ros::param::param<int>("~event_batch", event_batch, 0);
+
+    //firmware frames in flight during a board upgrade, more than 1 needs board support
+    int upgrade_window = FW_UPGRADE_WINDOW;
+    ros::param::param<int>("~upgrade_window", upgrade_window, FW_UPGRADE_WINDOW);
+    set_fw_upgrade_window(upgrade_window);
+
+    //KiB/s all cloud downloads share, so they leave room for the upper socket; 0 lifts the cap
+    int download_rate = DOWNLOAD_RATE;
+    ros::param::param<int>("~download_rate", download_rate, DOWNLOAD_RATE);
+    set_download_rate(download_rate);
+
     /*
      *!!! CLEAR ALL PARAMETERS FIRST  !!!
      */
     init_system_param(&g_system,&g_motion,&g_env);
+    init_upper_cmd_table();
+    //before the threads start, they report events
+    init_event_buf(event_spool.c_str(),event_batch);
     init_sys_thread(&g_system);
-    init_event_buf();
+    //the movebase has to be up to take the first cmd_vel
+    vel_spinner.start();
 
     ros::NodeHandle nh("base");
     nh.param("pub_base_tf", g_system.pub_base_tf_, 1);  //enable by default
@@ -166,12 +393,11 @@ int main(int argc, char **argv)
         //handle system status ,include err
         handle_system_status(&g_system,&g_motion,&g_env);
 
-        //handle vel based acc and mode,then set to movebase
+        //handle vel based acc and mode,the movebase applies the stop to every speed frame
+        load_cmd_vel(&g_system);
         handle_vel(&g_system);
 
         //handle_handspike(&g_system);
-
-        set_movebase_cmd_vel(g_system.real_vel);
 				
         //set sensors params
         set_sensors_cmd(&g_system);
@@ -198,10 +424,16 @@ int main(int argc, char **argv)
         pub_power(power_pub);
          //20170712,Zero
         pub_baseState(basestate_pub);
+        if(ros::Time::now() - last_diag_time >= ros::Duration(DIAG_PERIOD))
+        {
+            last_diag_time = ros::Time::now();
+            pub_link_diagnostics(diag_pub);
+        }
         ros::spinOnce();
         loop_rate.sleep();
     }
     fclose(fp);
+    LinkCapture::Instance().Stop();
     ROS_DEBUG("end the application!\n");
     return 0;
 }
@@ -17,15 +17,12 @@ static unsigned char padding[] =
 
 
 
-static void init_md5(md5_ctx *context);
-static void update_md5(md5_ctx *context, unsigned char *input, unsigned int inputlen);
-static void final_md5(md5_ctx *context, unsigned char digest[16]);
 static void transform_md5(unsigned int state[4], unsigned char block[64]);
 static void encode_md5(unsigned char *output, unsigned int *input, unsigned int len);
 static void decode_md5(unsigned int *output, unsigned char *input, unsigned int len);
 
 
-static void init_md5(md5_ctx *context)
+void init_md5(md5_ctx *context)
 {
   context->count[0] = 0;
   context->count[1] = 0;
@@ -35,7 +32,7 @@ static void init_md5(md5_ctx *context)
   context->state[3] = 0x10325476;
 }
 
-static void update_md5(md5_ctx *context, unsigned char *input, unsigned int inputlen)
+void update_md5(md5_ctx *context, unsigned char *input, unsigned int inputlen)
 {
   unsigned int i = 0;
   unsigned int index = 0;
@@ -66,7 +63,7 @@ static void update_md5(md5_ctx *context, unsigned char *input, unsigned int inpu
   memcpy(&context->buffer[index], &input[i], inputlen-i);
 }
 
-static void final_md5(md5_ctx *context, unsigned char digest[16])
+void final_md5(md5_ctx *context, unsigned char digest[16])
 {
   unsigned int index = 0,padlen = 0;
   unsigned char bits[8];
@@ -18,16 +18,33 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include <signal.h>
+#include <cmath>
+#include <atomic>
+#include <vector>
 
 #include "../include/starline/config.h"
+#include "mcu_com/frame_parser.h"
+#include "mcu_com/seqlock.h"
+#include "../include/starline/frames.h"
 #include "../include/starline/move.h"
+#include "../include/starline/reactor.h"
+#include "../include/starline/fw_upgrade.h"
 
 static move_sys_t move_sys;
+static int upgrade_running = 0;                 //reactor thread only
+static std::atomic<int> upgrade_pending(0);     //get_movebase_upgrade_status(), 1 from set to done
+static std::atomic<int> upgrade_result(0);      //of the last upgrade, stored before upgrade_pending drops
+static Seqlock<move_sys_t> move_snapshot;     //what the main loop sees, stored once per cycle
 static move_info_t move_info;
-static int move_over_time_flag = 0;
-static int last_unread_bytes = 0;
-static unsigned char recv_buf_last[BUF_LEN] = {0};
+static int send_upgrade_frame(unsigned char *frame);
+static void request_move_version(void);
+static fw_upgrade_t *move_fw = fw_upgrade_create("movebase",0x6F,MOVE_UPGRADE_FILE_FRAME_LEN,MOVE_UPGRADE_OVER_TIME,
+    MOVE_READY_UPGRADE_WAIT_MS,MOVE_END_UPGRADE_WAIT_MS,send_upgrade_frame,request_move_version);
+static FrameParser frame_parser;
+static LinkStats link_stats("movebase");
+static std::atomic<int> vel_stop(0);            //set by handle_vel() from the main loop
+static LinkHistogram vel_rx_latency;            //cmd_vel reception to write, reactor thread only
+static LinkHistogram vel_stamp_latency;         //cmd_vel header stamp to write
 
 
 //20170706,Zero
@@ -42,19 +59,8 @@ static void handle_rev_frame(move_sys_t *sys,unsigned char * frame_buf)
 	int i = 0;
     int j = 0;
     float tmp = 0.0;
-	unsigned char check_data = 0;
 	frame_len = frame_buf[1];
 
-    for(i=0;i<frame_len-2;i++)
-    {
-        check_data += frame_buf[i];
-    }
-
-	if(check_data != frame_buf[frame_len-2] || 0xA5 != frame_buf[frame_len -1])
-	{
-        ROS_DEBUG("receive frame check error");
-		return;
-	}
 /*for(i =0;i<frame_len;i++){
 ROS_DEBUG("move receive:%02x",frame_buf[i]);
 }*/
@@ -62,9 +68,7 @@ ROS_DEBUG("move receive:%02x",frame_buf[i]);
     {
          sys->work_normal = 2;
     }
-	if(0 == sys->handle_data_flag)
     {
-         sys->handle_data_flag = 1;
 		 move_info.recv_type = frame_buf[2];
 
 		 switch (move_info.recv_type)
@@ -187,50 +191,22 @@ ROS_DEBUG("move receive:%02x",frame_buf[i]);
 				{
                     sys->software_version[j] = frame_buf[7+j];
 				}
+				fw_upgrade_version(move_fw,&frame_buf[7],MOVE_SOFTWARE_VER_LEN);
 				break;
 				
 			case 0x6F:
-				move_info.upgrade_type = (int)frame_buf[3];
-				switch(move_info.upgrade_type)
-				{
-                      case 0x00:
-                         move_info.upgrade_ready_rlt = (int)frame_buf[4];
-                         ROS_DEBUG("move_info.upgrade_ready_rlt:%02x",move_info.upgrade_ready_rlt);
-						 break;
-										  
-					  case 0x01:                    
-						 move_info.upgrade_recv_rlt = (int)frame_buf[4];
-						 break;
-
-					  case 0x02:
-						 move_info.upgrade_end_rlt = (int)frame_buf[4];
-                         ROS_DEBUG("move_info.upgrade_end_rlt:%02x",move_info.upgrade_end_rlt);
-                         break;
-
-				      default:
-                         break;
-				}
+				fw_upgrade_ack(move_fw,(int)frame_buf[3],(int)frame_buf[4]);
 				break;
 
 			default:
                 break;
 		}
-        sys->handle_data_flag = 0;
         sys->rec_num++;
     } 
 }
 
 static int handle_receive_data(move_sys_t *sys)
 {
-    int nread = 0;
-    int i = 0;
-	int j = 0;
-    int data_Len = 0;
-    int frame_len = 0;
-    unsigned char recv_buf[BUF_LEN] = {0};
-	unsigned char recv_buf_complete[BUF_LEN] = {0};
-    unsigned char recv_buf_temp[BUF_LEN] = {0};
-
 	struct stat file_info;
 	
     if(NULL == sys)
@@ -243,65 +219,18 @@ static int handle_receive_data(move_sys_t *sys)
         ROS_DEBUG("move_handle_receive_data: com_state != COM_RUN_OK && COM_CHECK_VERSION");
         return -1;
     }
-    if(0 != last_unread_bytes)
+    if(frame_parser.Fill(sys->com_device) > 0)
     {
-        for(j=0;j<last_unread_bytes;j++)
+        //frames are handled in place, the parser already checked sum and tail
+        frame_parser.Parse([sys](uint8_t *frame, int len)
         {
-            recv_buf_complete [j] = recv_buf_last[j];
-        }
-    }
-    if((nread = read(sys->com_device, recv_buf, BUF_LEN))>0)
-    { 
-        //ROS_DEBUG("move nread:%d",nread);
-        //ROS_DEBUG("move last_unread_bytes:%d",last_unread_bytes);
-        
-        memcpy(recv_buf_complete+last_unread_bytes,recv_buf,nread);
-        data_Len = last_unread_bytes + nread;
-        last_unread_bytes = 0;
-
-        while(i<data_Len)
-        {
-            if(0x5A == recv_buf_complete [i])
-            {
-                
-                 frame_len = recv_buf_complete[i+1]; 
-                 if(i+frame_len <= data_Len)
-                 {
-                      if(0xA5 == recv_buf_complete[i+frame_len-1])
-                      {
-                           for(j=0;j<frame_len;j++)
-                           {
-                               recv_buf_temp[j] = recv_buf_complete[i+j];
-                           }
-                           handle_rev_frame(sys,recv_buf_temp);
-                           i = i+ frame_len;
-                      }
-                      else
-                      {
-                           i++;
-                      }
-                 }
-                 else
-                 {
-                      last_unread_bytes = data_Len - i;
-                      for(j=0;j<last_unread_bytes;j++)
-                      {
-                           recv_buf_last[j] = recv_buf_complete[i+j];
-                      }
-                      break;
-                 }
-            }
-            else 
-            {
-                 i++;
-            }
-        }
-    
+            link_stats.MarkReply(frame[2]);
+            handle_rev_frame(sys, frame);
+        });
     }
     else 
     {
-        i = stat(sys->dev,&file_info);
-        if(-1 == i)
+        if(-1 == stat(sys->dev,&file_info))
         {
             sys->com_state = COM_CLOSING;
         }
@@ -309,6 +238,7 @@ static int handle_receive_data(move_sys_t *sys)
     return 0;
 }
 
+//reactor thread only, other threads go through post_serial()
 static int send_serial(unsigned char *send_buf,move_sys_t *sys)
 {
     int len = 0;
@@ -339,6 +269,9 @@ static int send_serial(unsigned char *send_buf,move_sys_t *sys)
     len = write(sys->com_device,send_buf,send_buf_len);
     if (len == send_buf_len)
     {
+         link_stats.AddTx(send_buf_len);
+         link_stats.MarkSent(send_buf[2]);
+         LinkCapture::Instance().Record(CAPTURE_LINK_MOVEBASE, CAPTURE_DIR_TX, send_buf, send_buf_len);
          return 0;
     }     
     else   
@@ -352,18 +285,44 @@ static int send_serial(unsigned char *send_buf,move_sys_t *sys)
     }
 }
 
-void get_move_version(void)
+//frames of the other threads, the reactor writes them so they never interleave with its own
+static void post_serial(unsigned char *send_buf)
 {
-	unsigned char data[5]={0};
-	
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x6E;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
+    std::vector<unsigned char> frame(send_buf, send_buf + send_buf[1]);
+
+    reactor_post([frame]() mutable { send_serial(frame.data(),&move_sys); });
+}
+
+static void request_move_version(void)
+{
+	unsigned char data[MoveGetVersionFrame::len];
+
+	MoveGetVersionFrame::Encode(data);
 	send_serial(data,&move_sys);
+}
+
+void get_move_version(void)
+{
+	reactor_post(request_move_version);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
+}
+
+static void movebase_readable(uint32_t events)
+{
+    if(events & (EPOLLERR | EPOLLHUP))
+    {
+        ROS_DEBUG("move com device hang up");
+        move_sys.com_state = COM_CLOSING;
+    }
+    else
+    {
+        handle_receive_data(&move_sys);
+    }
+    //stop polling a dead device until the next tick closes it
+    if(COM_CLOSING == move_sys.com_state)
+    {
+        reactor_del_fd(move_sys.com_device);
+    }
 }
 
 static bool check_version(void)
@@ -399,9 +358,6 @@ static void move_info_init(void)
 	move_sys.work_normal = 0;
 
     move_info.move_open_station_ack =-1;
-	move_info.upgrade_ready_rlt = -1;
-	move_info.upgrade_recv_rlt = -1;
-	move_info.upgrade_end_rlt = -1;
    
 }
 
@@ -435,6 +391,7 @@ static void update_system_state(move_sys_t *sys)
             }
             last_file_flag = i;
             sys->com_device = open_com_device(sys->dev);
+            frame_parser.Reset();
             if(-1 != sys->com_device)
             {
                 sys->com_state = COM_CHECK_VERSION;
@@ -450,16 +407,21 @@ static void update_system_state(move_sys_t *sys)
             }
             set_speed(sys->com_device,115200);
             set_parity(sys->com_device,8,1,'N');
+            reactor_add_fd(sys->com_device,EPOLLIN,movebase_readable);
              
             break;
             
         case COM_CHECK_VERSION:
-            get_move_version();
+            //the reply is parsed as it comes in and checked on the next tick
             if(check_version())
             {
                  sys->com_state = COM_RUN_OK;
                  //close io stop
-                 set_sensor_function(0x0A);
+                 worker_post([]{ set_sensor_function(0x0A); });
+            }
+            else
+            {
+                request_move_version();
             }
             break;
 
@@ -468,6 +430,7 @@ static void update_system_state(move_sys_t *sys)
             break;
             
         case COM_CLOSING:
+            reactor_del_fd(sys->com_device);
             close(sys->com_device);
             sys->com_state = COM_OPENING;
             sys->com_rssi = 0;
@@ -519,216 +482,40 @@ static int check_move_rssi(int send_num,move_sys_t *sys)
     return 0;
 }
 
-static long get_upgrade_size(char* path)
+static int send_upgrade_frame(unsigned char *frame)
 {
-	FILE *file;
-	
-	long len = 0;
-	
-	file = fopen(path,"rb");
-	if(NULL == file)
-	{
-		ROS_DEBUG("get move upgrade size failed");
-        return 0;
-	}
-	
-	fseek(file,0,SEEK_END);
-	len = ftell(file);
-	fclose(file);	
-	return len;
-}
-
-static int send_ready_upgrade(char * path, char * md5char)
-{
-	unsigned char data[26] = {0};
-    union {
-        unsigned long lnum;
-        unsigned char cnum[4];
-    }filesize;
-	int i = 0;
-	
-	data[0] = 0x5A;
-	data[1] = 0x1A;
-	data[2] = 0x6F;
-	data[3] = 0x00;
-											 
-	for(i=0; i<16; i++)
-	{
-		data[i+4] = md5char[i];
-	}
-    
-    //big end or small end convert socket frame
-    filesize.lnum = htonl(get_upgrade_size(path));
-    ROS_DEBUG("get_upgrade_size:%ld",filesize.lnum);
-	if(0 == filesize.lnum){
-       ROS_DEBUG("move upgrade file is 0\n");   
-	   return -1;
-	}
-
-	for(i=0; i<4; i++)
-	{
-        data[i+20] = filesize.cnum[i];
-        ROS_DEBUG("move upgrade file size:%c",filesize.cnum[i]);  
-	}
-    
-	for(i=0; i<24; i++)
-	{
-		data[24] += data[i];
-	}
-	data[25] = 0xA5;  
-	send_serial(data,&move_sys);
-	usleep(MOVE_READY_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
-	return 0;
+    //a frame lost on the way is not acked and sent again
+    post_serial(frame);
+    return 0;
 }
 
-static int send_upgrade_file_frame(char* buffer,int len)
+static int move_upgrade_one_count(const char * path,const char * md5char,const char * version)
 {
-     unsigned char data[MOVE_UPGRADE_FILE_FRAME_LEN+6]={0};
-	 int i = 0;
-	 
-	 data[0] = 0x5A; 
-	 data[1] = len+6;
-	 data[2] = 0x6F;
-	 data[3] = 0x01;
-	 for(i=0; i<len; i++)
-	 {
-        data[i+4] = buffer[i];     
-	 }
-	 for(i=0; i<len+4; i++)
-     {
-	    data[len+4] += data[i];
-	 }
-     data[len+5] = 0xA5;     
-	 send_serial(data,&move_sys); 
-	 return 0;
-}
+    int rlt = fw_upgrade_run(move_fw,path,md5char,version);
 
-static void send_file_over_time(int sig)
-{    
-    move_over_time_flag =1;
-}
-
-static int send_upgrade_file(char* path)
-{	
-	char buffer[MOVE_UPGRADE_FILE_FRAME_LEN]={0};
-	FILE *file;
-    int len = 0;
-    int i =0;
-
-    file = fopen(path,"rb");
-    if(NULL == file)
+    //the board refused the image, its end ack tells why
+    if(0x01 == rlt)
     {
-        ROS_DEBUG("open move update file failed");
-        return -1;
+        rlt = -5;
     }
-    signal(SIGALRM, send_file_over_time);
-    alarm(MOVE_UPGRADE_OVER_TIME);
-    while(!feof(file))
-    { 
-        ROS_DEBUG("send move upgrade file count:%d",i++);
-        len = fread(buffer,1,MOVE_UPGRADE_FILE_FRAME_LEN,file);
-        ROS_DEBUG("move upgrade_file len:%d",len);
-        
-	    send_upgrade_file_frame(buffer,len);
-		
-		usleep(MOVE_SLEEP_TIME);
-		handle_receive_data(&move_sys); 
-		ROS_DEBUG("move upgrade_recv_rlt:%d",move_info.upgrade_recv_rlt);
-		if(move_info.upgrade_recv_rlt != 0x00)
-		{
-            //if send fail then resend pre frame
-            ROS_DEBUG("move upgrade_recv_rlt fail");
-			fseek(file,-MOVE_UPGRADE_FILE_FRAME_LEN,SEEK_CUR);
-		}
-		if(1 == move_over_time_flag){
-            ROS_DEBUG("send move upgrade file over time!!");
-            fclose(file);
-            move_over_time_flag = 0;
-            return -4;
-        }
-        bzero(buffer,MOVE_UPGRADE_FILE_FRAME_LEN);  
-        move_info.upgrade_recv_rlt =-1;
+    else if(0x02 == rlt)
+    {
+        rlt = -9;
     }
-    alarm(0);
-	fclose(file);
-    ROS_DEBUG("send upgrade file over");
-	return 0;
-}
-
-static int send_end_upgrade(void)
-{
-    unsigned char data[7] = {0};
-	data[0] = 0x5A;
-	data[1] = 0x07;
-    data[2] = 0x6F;
-	data[3] = 0x02;
-	data[4] = 0;
-	data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-	data[6] = 0xA5;
-	send_serial(data,&move_sys);
-	usleep(MOVE_END_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
-	return 0;
-}
-
-static int move_upgrade_one_count(char * path,char * md5char)
-{
-    int rlt = 0;
-	rlt = send_ready_upgrade(path, md5char);
-    ROS_DEBUG("move upgrade_ready_rlt:%d",rlt);
-	if((rlt >= 0) && (0x00 == move_info.upgrade_ready_rlt))
-	{
-        rlt = send_upgrade_file(path);
-        if(rlt >= 0){
-           send_end_upgrade();
-           if(0x00 == move_info.upgrade_end_rlt)
-		   {
-               rlt = 0;
-		   }
-		   else if(0x01 == move_info.upgrade_end_rlt)
-		   {
-               rlt = -5;
-		   }
-           else if(0x02 == move_info.upgrade_end_rlt)
-		   {
-               rlt = -9;
-		   }
-		   else if(0x04 == move_info.upgrade_end_rlt)
-		   {
-               rlt = -10;
-		   }
-		   else if(0x08 == move_info.upgrade_end_rlt)
-		   {
-               rlt = -11;
-		   }
-           else
-           {
-               rlt = -12;
-           }
-		}
-	}
-	else if(move_info.upgrade_ready_rlt >0)
-	{
-	    if(0x01 == move_info.upgrade_ready_rlt)
-        {
-           rlt = -2;
-	    }
-		else if(0x02 == move_info.upgrade_ready_rlt)
-		{
-           rlt = -3;
-		}
-        else
-		{
-           rlt = -8;
-		}
-	}
-    else if(-1 == move_info.upgrade_ready_rlt)
+    else if(0x04 == rlt)
     {
-        rlt = -6;
+        rlt = -10;
     }
-    ROS_DEBUG("move_upgrade_rlt:%d",rlt); 
-	return rlt;
+    else if(0x08 == rlt)
+    {
+        rlt = -11;
+    }
+    else if(rlt > 0)
+    {
+        rlt = -12;
+    }
+    ROS_DEBUG("move_upgrade_rlt:%d",rlt);
+    return rlt;
 }
 
 /*
@@ -742,14 +529,14 @@ static int move_upgrade_one_count(char * path,char * md5char)
  *       -8:ready frame erase flash fail
  *       -9:data flash erase fail
  */
-int move_upgrade(char * path,char * md5char)
+int move_upgrade(const char * path,const char * md5char,const char * version)
 {
     int upgrade_count = 0;
 
     int rlt = -1;
     while(upgrade_count < 3)
     {
-        rlt = move_upgrade_one_count(path,md5char);
+        rlt = move_upgrade_one_count(path,md5char,version);
         if(rlt < 0)
         {
             upgrade_count++;
@@ -767,15 +554,10 @@ int move_upgrade(char * path,char * md5char)
 int clear_open_signal(void)
 {
     int rlt =-1;
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x60;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveClearOpenSignalFrame::len];
+	MoveClearOpenSignalFrame::Encode(data);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 
 	if(0 == move_info.move_open_station_ack)
 	{
@@ -787,31 +569,19 @@ int clear_open_signal(void)
 
 void get_open_sigal(void)
 {
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x61;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveGetOpenSignalFrame::len];
+	MoveGetOpenSignalFrame::Encode(data);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 int set_base_limit(double high_limit,double low_limit)
 {
     int rlt = -1;
-	unsigned char data[7]={0};
-	data[0] = 0x5A;
-	data[1] = 0x07;
-	data[2] = 0x62;
-	data[3] = (unsigned char)high_limit*LEN_M_TO_MM;
-	data[4] = (unsigned char)low_limit*LEN_M_TO_MM;
-	data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-	data[6] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveSetLimitFrame::len];
+	MoveSetLimitFrame::Encode(data, (unsigned char)high_limit*LEN_M_TO_MM, (unsigned char)low_limit*LEN_M_TO_MM);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
     if(move_info.high_limit_ack == high_limit*LEN_M_TO_MM
 		&& move_info.low_limit_ack == low_limit*LEN_M_TO_MM)
     {
@@ -822,30 +592,19 @@ int set_base_limit(double high_limit,double low_limit)
 
 void get_base_limit(void)
 {
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x63;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveGetLimitFrame::len];
+	MoveGetLimitFrame::Encode(data);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 int set_sensor_function(unsigned char senor_state)
 {
     int rlt = -1;
-	unsigned char data[6]={0};
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x64;
-	data[3] = senor_state;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-	data[5] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveSetSensorFunctionFrame::len];
+	MoveSetSensorFunctionFrame::Encode(data, senor_state);
+	post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
     if(move_info.sensor_state_ack == senor_state)
     {
         rlt = 0; 
@@ -855,275 +614,297 @@ int set_sensor_function(unsigned char senor_state)
 
 void get_sensor_function(void)
 {
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x65;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveGetSensorFunctionFrame::len];
+	MoveGetSensorFunctionFrame::Encode(data);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 int clear_error_state(void)
 {
     int rlt = 0;
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x66;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveClearErrorFrame::len];
+	MoveClearErrorFrame::Encode(data);
+	post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
     //mcu do not support clear
 	return rlt;
 }
 
 void get_error_state(void)
 {
-	unsigned char data[5]={0};
-	data[0] = 0x5A;
-	data[1] = 0x05;
-	data[2] = 0x67;
-	data[3] = data[0]+data[1]+data[2];
-	data[4] = 0xA5;
-	send_serial(data,&move_sys);
+	unsigned char data[MoveGetErrorFrame::len];
+	MoveGetErrorFrame::Encode(data);
+	post_serial(data);
 	usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 static void move_send_frame(move_sys_t *sys)
 {
-    short int stmp = 0;
-    unsigned char data[9]={0};
+    short int vx = (short int)(sys->cmd_vel.vx*1000.0);
+    short int vth = (short int)(sys->cmd_vel.vth*1000.0);
+    unsigned char data[MoveSpeedFrame::len];
 	
-	data[0] = 0x5A;
-    data[1] = 0x09;
-	data[2] = 0x68;
-	stmp = (short int)(sys->cmd_vel.vx*1000.0);
-	data[3] = (stmp & 0xff00)>>8;
-    data[4] = (stmp & 0x0ff);
-    stmp = (short int)(sys->cmd_vel.vth*1000.0);
-    ROS_DEBUG("vth,stmp is :%d\n",stmp);
-    data[5] = (stmp & 0xff00)>>8;
-    data[6] = (stmp & 0x0ff);
-	data[7] = data[0]+data[1]+data[2]+data[3]+data[4]+data[5]+data[6];
-	data[8] = 0xA5;
+    ROS_DEBUG("vth,stmp is :%d\n",vth);
+	MoveSpeedFrame::Encode(data, vx, vth);
 
 	send_serial(data,&move_sys);
 }
 
+static void apply_vel_stop(move_sys_t *sys)
+{
+    if(1 == vel_stop.load(std::memory_order_relaxed))
+    {
+        sys->cmd_vel.vx = 0.0;
+        sys->cmd_vel.vth = 0.0;
+    }
+}
+
+static double clamp_frame_vel(double v)
+{
+    if(v > MOVE_FRAME_VEL_MAX)
+    {
+        return MOVE_FRAME_VEL_MAX;
+    }
+    if(v < -MOVE_FRAME_VEL_MAX)
+    {
+        return -MOVE_FRAME_VEL_MAX;
+    }
+    return v;
+}
+
+//the stop handle_vel() works out each main loop cycle, applied to every speed frame
+void set_movebase_vel_stop(int stop)
+{
+    vel_stop.store(stop ? 1 : 0, std::memory_order_relaxed);
+}
+
+/*
+ * Called from the cmd_vel spinner as soon as a message arrives. The frame
+ * is written by the reactor thread right away instead of waiting for the
+ * main loop and the next movebase tick; the tick keeps resending it.
+ */
+int express_movebase_cmd_vel(vel_t vel,uint64_t rx_us,uint64_t stamp_age_us)
+{
+    if(!std::isfinite(vel.vx) || !std::isfinite(vel.vth))
+    {
+        ROS_ERROR("cmd_vel %f %f is not a number, dropped",vel.vx,vel.vth);
+        return -1;
+    }
+    vel.vx = clamp_frame_vel(vel.vx);
+    vel.vth = clamp_frame_vel(vel.vth);
+    reactor_post([vel,rx_us,stamp_age_us]
+    {
+        uint64_t us = 0;
+
+        move_sys.cmd_vel.vx = vel.vx;
+        move_sys.cmd_vel.vth = vel.vth;
+        move_sys.cmd_vel.vy = 0.0;
+        apply_vel_stop(&move_sys);
+        if((COM_RUN_OK != move_sys.com_state) || (0 != move_sys.upgrade_status))
+        {
+            return;
+        }
+        move_send_frame(&move_sys);
+        us = link_stats_now_us() - rx_us;
+        vel_rx_latency.Add(us);
+        if(0 != stamp_age_us)
+        {
+            vel_stamp_latency.Add(us + stamp_age_us);
+        }
+        if(us > MOVE_EXPRESS_WARN_US)
+        {
+            ROS_WARN_THROTTLE(1.0,"cmd_vel took %llu us to reach the movebase",(unsigned long long)us);
+        }
+    });
+    return 0;
+}
+
+//0: reception to write, 1: header stamp to write, only stamped messages
+const LinkHistogram *get_movebase_vel_latency(int from_stamp)
+{
+    return from_stamp ? &vel_stamp_latency : &vel_rx_latency;
+}
+
 void handspike_power_send_frame(void)
 {
-    unsigned char data[6]={0};
-	data[0] = 0x5A;
-    data[1] = 0x06;
-	data[2] = 0x69;
-	data[3] = 0x03;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-    data[5] = 0xA5;
+    unsigned char data[MoveHandspikeFrame::len];
+	MoveHandspikeFrame::Encode(data, 0x03);
 
-	send_serial(data,&move_sys);
+	post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 void handspike_lift_send_frame(void)
 {
-    unsigned char data[6]={0};
-	data[0] = 0x5A;
-    data[1] = 0x06;
-	data[2] = 0x69;
-	data[3] = 0x01;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-    data[5] = 0xA5;
+    unsigned char data[MoveHandspikeFrame::len];
+	MoveHandspikeFrame::Encode(data, 0x01);
 
-	send_serial(data,&move_sys);
+	post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 void handspike_down_send_frame(void)
 {
-    unsigned char data[6]={0};
-	data[0] = 0x5A;
-    data[1] = 0x06;
-	data[2] = 0x69;
-	data[3] = 0x02;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-    data[5] = 0xA5;
-
-  send_serial(data,&move_sys);
+    unsigned char data[MoveHandspikeFrame::len];
+	MoveHandspikeFrame::Encode(data, 0x02);
+
+  post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 void handspike_stop_send_frame(void)
 {
-    unsigned char data[6]={0};
-	data[0] = 0x5A;
-    data[1] = 0x06;
-	data[2] = 0x69;
-	data[3] = 0x00;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-    data[5] = 0xA5;
+    unsigned char data[MoveHandspikeFrame::len];
+	MoveHandspikeFrame::Encode(data, 0x00);
 
-	send_serial(data,&move_sys);
+	post_serial(data);
     usleep(MOVE_SLEEP_TIME);
-	handle_receive_data(&move_sys);
 }
 
 
 
-void *movebase_thread_start(void *)
+LinkStats *get_movebase_link_stats(void)
 {
-    int send_num = 0;  
-	static int flag = 0;
-    move_sys.com_state = COM_OPENING;
-    update_system_state(&move_sys);
-    if((move_sys.move_freq <= 0) || (move_sys.move_freq >20))
+    return &link_stats;
+}
+
+//the old movebase loop body, the device itself is read by movebase_readable()
+static void movebase_tick(void)
+{
+    static int send_num = 0;
+
+	if(1 == loadFlag )
+	{
+		unsigned char cmd = loadCMD;
+		worker_post([cmd]{ loadMotorCMD(cmd); });
+		loadFlag = 0;
+	}
+    else if(0 == move_sys.upgrade_status)
     {
-        move_sys.move_freq = 20;
+        update_system_state(&move_sys);
+
+        if(COM_RUN_OK == move_sys.com_state)
+        {
+	        check_move_rssi(send_num,&move_sys); 
+            apply_vel_stop(&move_sys);
+            move_send_frame(&move_sys);
+            send_num=(send_num + 1)%10;
+        }
     }
-    ros::Rate loop_rate(move_sys.move_freq);
-    ROS_DEBUG("movebase thread is running!");
-    
-    while(ros::ok()) 
-    {  
-	
-		if(1 == loadFlag )
-		{
-			loadMotorCMD(loadCMD);
-			loadFlag = 0;
-		}
-        else if(0 == move_sys.upgrade_status)
+	else if((1 == move_sys.upgrade_status) && (0 == upgrade_running))
+	{
+        //waits for the acks the reactor parses, so it must not run here
+        upgrade_running = 1;
+        std::string path(move_sys.name,strnlen(move_sys.name,FILE_PATH_LEN));
+        std::string md5(move_sys.md5,MD5_SIZE);
+        std::string version(move_sys.upgrade_version,strnlen(move_sys.upgrade_version,VERSION_LEN));
+        worker_spawn([path,md5,version]
         {
-            update_system_state(&move_sys);
-            handle_receive_data(&move_sys);
-
-            if(COM_RUN_OK == move_sys.com_state)
+            int rlt = move_upgrade(path.c_str(),md5.data(),version.c_str());
+            reactor_post([rlt]
             {
-		        check_move_rssi(send_num,&move_sys); 
-                move_send_frame(&move_sys);
-                send_num=(send_num + 1)%10;
-            }
-        }
-		else if(1 == move_sys.upgrade_status)
-		{
-             if(flag == 0)
-             {
-                 flag = 1;
-                 move_sys.upgrade_result = move_upgrade(move_sys.name,move_sys.md5);
-			     move_sys.upgrade_status = 0;
-				 flag = 0;
-             }		 
-		}
+                move_sys.upgrade_result = rlt;
+                move_sys.upgrade_status = 0;
+                upgrade_running = 0;
+                upgrade_result = rlt;
+                upgrade_pending = 0;
+            });
+        });
+	}
+    move_snapshot.Store(move_sys);
+}
 
-        ros::spinOnce();
-        loop_rate.sleep(); 
-    }
+static void movebase_exit(void)
+{
+    reactor_del_fd(move_sys.com_device);
     close(move_sys.com_device);
 	move_sys.com_state = COM_OPENING;
     move_sys.com_rssi = 0;
     move_sys.work_normal = 0;
-    return 0; 
+    move_snapshot.Store(move_sys);
 }
 
-void set_movebase_cmd_vel(vel_t vel)
-{  
-    move_sys.cmd_vel.vx = vel.vx;
-    move_sys.cmd_vel.vth = vel.vth;
-    move_sys.cmd_vel.vy = 0.0;
-    return;
-}
-
-move_sys_t *get_movebase_info(void)
+int movebase_start(void)
 {
-    if(0 == move_sys.handle_data_flag)
+    move_sys.com_state = COM_OPENING;
+    frame_parser.SetStats(&link_stats);
+    frame_parser.SetCapture(CAPTURE_LINK_MOVEBASE);
+    update_system_state(&move_sys);
+    if((move_sys.move_freq <= 0) || (move_sys.move_freq >20))
     {
-        return &move_sys;
+        move_sys.move_freq = 20;
     }
-    else
+    reactor_at_exit(movebase_exit);
+    if(reactor_add_timer(move_sys.move_freq,movebase_tick) < 0)
     {
-        return NULL;
+        return -1;
     }
+    ROS_DEBUG("movebase is running!");
+    return 0;
 }
 
-int set_base_high_limit(double limit)
+//copies the state of the last movebase cycle, never blocks the movebase thread
+void get_movebase_info(move_sys_t *info)
 {
-    if(0 == move_sys.handle_data_flag)
-    {
-        move_sys.handle_data_flag = 1;
-    	move_sys.high_limit = limit;
-		move_sys.handle_data_flag = 0;
-		return 0;
-    }
-	return -1;
+    move_snapshot.Load(*info);
 }
 
-int set_base_low_limit(double limit)
+//version is the one the image brings, empty when not known
+int set_movebase_upgrade(char *str,char *md5,char *version)
 {
-    if(0 == move_sys.handle_data_flag)
-    {
-        move_sys.handle_data_flag = 1;
-    	move_sys.low_limit = limit;
-		move_sys.handle_data_flag = 0;
-		return 0;
-    }
-	return -1;
-}
+    int idle = 0;
 
-int set_movebase_upgrade(char *str,char *md5)
-{
     if((NULL == str) || (NULL == md5))
 	{
 	    return -1;
 	}
-    if(0 == move_sys.upgrade_status)
-	{
-		memcpy(move_sys.name,str,strlen(str));
-		memcpy(move_sys.md5,md5,MD5_SIZE);
-		move_sys.upgrade_status = 1;
-		return 0;
-	}
-    return 1;
+    if(!upgrade_pending.compare_exchange_strong(idle,1))
+    {
+        return 1;
+    }
+    //copied here, the reactor owns move_sys and the caller may reuse its buffers
+    std::string path(str,strnlen(str,FILE_PATH_LEN - 1));
+    std::string sum(md5,MD5_SIZE);
+    std::string image_version = (NULL != version) ? std::string(version,strnlen(version,VERSION_LEN)) : std::string();
+    reactor_post([path,sum,image_version]
+    {
+        memset(move_sys.name,0,FILE_PATH_LEN);
+        memcpy(move_sys.name,path.data(),path.size());
+        memcpy(move_sys.md5,sum.data(),MD5_SIZE);
+        memset(move_sys.upgrade_version,0,VERSION_LEN);
+        memcpy(move_sys.upgrade_version,image_version.data(),image_version.size());
+        move_sys.upgrade_status = 1;
+    });
+    return 0;
 }
 
 int get_movebase_upgrade_result(void)
 {
-    int i = move_sys.upgrade_result;
-    return i;
+    return upgrade_result;
 }
 
 int get_movebase_upgrade_status(void)
 {
-    int i = move_sys.upgrade_status;
-    return i;
+    return upgrade_pending;
+}
+
+//percent of the file the board acked, -1 before the first upgrade
+int get_movebase_upgrade_progress(void)
+{
+    return fw_upgrade_progress(move_fw);
 }
 
 
 //20170815,Zero
 static void loadMotorCMD(uint8_t cmd)
 {
-  uint8_t txData[6];
-  txData[0] = 0x5A;
-  txData[1] = 0x06;
-  txData[2] = 0x69;
-  txData[3] = cmd;
-  txData[4] = 0x00;
-  for(int i =0 ; i < 4 ; i++)
-  {
-    txData[4] += txData[i] ;
-  }
-  txData[5] = 0xA5 ;
+  uint8_t txData[MoveHandspikeFrame::len];
+  MoveHandspikeFrame::Encode(txData, cmd);
 	
-  for(int i = 0 ; i< 6; i++)
+  for(int i = 0 ; i< MoveHandspikeFrame::len; i++)
 	ROS_INFO("txData[%d] = %x" ,i,txData[i]);
-  send_serial(txData,&move_sys);
+  post_serial(txData);
   usleep(MOVE_SLEEP_TIME);
-  handle_receive_data(&move_sys);
 
 }
@@ -0,0 +1,250 @@
+#include "ros/ros.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "../include/starline/reactor.h"
+
+typedef struct
+{
+    std::map<int, reactor_fd_cb_t> handlers;        //reactor thread only
+    std::vector<reactor_job_t> exit_jobs;
+
+    std::mutex post_lock;
+    std::deque<reactor_job_t> post_jobs;            //run on the reactor thread
+
+    std::mutex worker_lock;
+    std::condition_variable worker_cond;
+    std::deque<reactor_job_t> worker_jobs;
+}reactor_t;
+
+static int epoll_fd = -1;
+static int wake_fd = -1;
+//never freed, the workers still wait on it while the process exits
+static reactor_t *reactor = new reactor_t;
+
+static void worker_run(void)
+{
+    reactor_job_t job;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(reactor->worker_lock);
+            reactor->worker_cond.wait(lock, []{ return !reactor->worker_jobs.empty(); });
+            job = reactor->worker_jobs.front();
+            reactor->worker_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+static void handle_wake(uint32_t)
+{
+    uint64_t count = 0;
+    std::deque<reactor_job_t> jobs;
+
+    if(read(wake_fd, &count, sizeof(count)) < 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reactor->post_lock);
+        jobs.swap(reactor->post_jobs);
+    }
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        jobs[i]();
+    }
+}
+
+int reactor_init(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0)
+    {
+        ROS_ERROR("epoll_create1 failed: %s", strerror(errno));
+        return -1;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wake_fd < 0)
+    {
+        ROS_ERROR("eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+    if(reactor_add_fd(wake_fd, EPOLLIN, handle_wake) < 0)
+    {
+        return -1;
+    }
+    for(int i = 0; i < REACTOR_WORKER_NUM; i++)
+    {
+        std::thread(worker_run).detach();
+    }
+    return 0;
+}
+
+int reactor_add_fd(int fd, uint32_t events, reactor_fd_cb_t cb)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        ROS_ERROR("epoll add fd %d failed: %s", fd, strerror(errno));
+        return -1;
+    }
+    reactor->handlers[fd] = cb;
+    return 0;
+}
+
+//changes the events watched on an fd already added, the handler stays
+int reactor_mod_fd(int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        ROS_ERROR("epoll mod fd %d failed: %s", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+//fine to call for an fd that is not registered, returns -1 then
+int reactor_del_fd(int fd)
+{
+    if(0 == reactor->handlers.erase(fd))
+    {
+        return -1;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    return 0;
+}
+
+//calls cb freq times a second, returns the timer fd
+int reactor_add_timer(double freq, reactor_job_t cb)
+{
+    struct itimerspec spec;
+    long period_ns = (long)(1000.0 * 1000 * 1000 / freq);
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(fd < 0)
+    {
+        ROS_ERROR("timerfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+    spec.it_interval.tv_sec = period_ns / (1000 * 1000 * 1000);
+    spec.it_interval.tv_nsec = period_ns % (1000 * 1000 * 1000);
+    spec.it_value = spec.it_interval;
+    if(timerfd_settime(fd, 0, &spec, NULL) < 0)
+    {
+        ROS_ERROR("timerfd_settime failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    //expirations missed while a handler ran are dropped, not replayed
+    if(reactor_add_fd(fd, EPOLLIN, [fd, cb](uint32_t)
+        {
+            uint64_t expirations = 0;
+            if(read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            {
+                cb();
+            }
+        }) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//run on the reactor thread once ros shuts down, in the order added
+void reactor_at_exit(reactor_job_t job)
+{
+    reactor->exit_jobs.push_back(job);
+}
+
+void reactor_post(reactor_job_t job)
+{
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(reactor->post_lock);
+        reactor->post_jobs.push_back(job);
+    }
+    if(write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        ROS_ERROR("wake reactor failed: %s", strerror(errno));
+    }
+}
+
+void worker_post(reactor_job_t job)
+{
+    {
+        std::lock_guard<std::mutex> lock(reactor->worker_lock);
+        reactor->worker_jobs.push_back(job);
+    }
+    reactor->worker_cond.notify_one();
+}
+
+/*
+ * Upgrades and downloads hold a thread for minutes. Each gets one of its own,
+ * so they never take the pool from the short exchanges; every module runs at
+ * most one at a time.
+ */
+void worker_spawn(reactor_job_t job)
+{
+    std::thread(job).detach();
+}
+
+void *reactor_thread_start(void *)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    std::map<int, reactor_fd_cb_t>::iterator it;
+    reactor_fd_cb_t cb;
+    int n = 0;
+
+    ROS_DEBUG("reactor thread is running!");
+    while(ros::ok())
+    {
+        n = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, REACTOR_WAIT_MS);
+        if((n < 0) && (EINTR != errno))
+        {
+            ROS_ERROR("epoll_wait failed: %s", strerror(errno));
+            continue;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            //an earlier handler of this round may have removed the fd
+            it = reactor->handlers.find(events[i].data.fd);
+            if(it == reactor->handlers.end())
+            {
+                continue;
+            }
+            //a copy, the handler may remove itself
+            cb = it->second;
+            cb(events[i].events);
+        }
+    }
+    for(size_t i = 0; i < reactor->exit_jobs.size(); i++)
+    {
+        reactor->exit_jobs[i]();
+    }
+    return 0;
+}
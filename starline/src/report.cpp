@@ -16,13 +16,21 @@
 #include "../include/starline/system.h"
 #include "../include/starline/report.h"
 #include "../include/starline/handle_command.h"
+#include "../include/starline/upper_cmd.h"
+#include "../include/starline/event_store.h"
 
 
-#define EVENT_BUFFER_SIZE (100)
 #define EVENT_COUNT_NUM (20)
+#define EVENT_BATCH_LEN (SOCKET_PKG_LEN - PKG_BASE_LEN - 2)     //records of one PKG_REPORT_EVENTS, after their number
+#define EVENT_BATCH_NUM (255)
+#define EVENT_SEND_NUM (100)            //pkgs each time, the rest waits for the next one
+#define EVENT_PASS_LEN (32*1024)        //records each time, at most half of what the upper tx queue has free
 
-static event_t event_buf[EVENT_BUFFER_SIZE];
-static int event_num = 0;
+static int event_batch = 0;             //0: one PKG_FB_CHECK_SYSTEM per event, for pads without PKG_REPORT_EVENTS
+static unsigned char event_sent[EVENT_PASS_LEN];    //records of the last pass, consumed once they left the socket
+static int event_sent_len = 0;
+static uint64_t event_sent_mark = 0;
+static unsigned int event_sent_epoch = 0;
 
 int report_nav_status(unsigned char function,ans_status_t *ans,system_t *sys)
 {
@@ -379,136 +387,102 @@ int handle_report_status(ask_status_t ask,ans_status_t *ans,system_t *sys,
     return 0;
 }
 
-int report_event(ans_status_t *ans)
+int set_event_buffer(ans_status_t *ans)
 {
-    unsigned char str[BUF_LEN]={0,};
+    return event_store_put(ans);
+}
+
+/*
+ * Sends the pending events, oldest first, within half of the room left in
+ * the upper tx queue, so a replay after an outage never overflows it. The
+ * records stay in the event store until upper_com has written them to the
+ * socket; a reconnect that dropped them sends them again.
+ */
+void handle_report_event(void)
+{
+    static int count = 0;
+	int budget = 0;
+	int used = 0;
 	int len = 0;
+	int num = 0;
+	int pkg_len = 0;
+	int pkg_num = 0;
+	int rlen = 0;
+	int rlt = 0;
+	unsigned int epoch = 0;
 	int i = 0;
-		
-    if(NULL == ans)
-    {
-        return -1;
-    }
 
-    str[0] = ans->level;
-	str[1] = ans->module;
-	str[2] = ans->function;
-	str[3] = ans->len;
-	for(i=0;i<ans->len;i++)
+    count++;
+	if(0 != (count%EVENT_COUNT_NUM))
 	{
-	    str[4+i] = ans->data[i];
+	    return;
 	}
-	len = ans->len + 4;
-	
-	i = send_pkg(PKG_FB_CHECK_SYSTEM,len,0,str);
-	
-	return i;
-}
-
-static int check_same_event_msg(ans_status_t *a_msg,ans_status_t *b_msg)
-{
-    int i = 0;
-    if(a_msg->level == b_msg->level)
+	event_store_sync();
+	if(event_sent_len > 0)
 	{
-	    if(a_msg->module == b_msg->module)
+	    rlt = upper_tx_flushed(event_sent_mark,event_sent_epoch);
+	    if(0 == rlt)
 	    {
-	        if(a_msg->function == b_msg->function)
-	        {
-	            for(i=0;i<a_msg->len;i++)
-	            {
-	                if(a_msg->data[i] != b_msg->data[i])
-	                {
-	                    break;
-	                }
-	            }
-				if(i == a_msg->len)
-				{
-				    return 1;
-				}
-	        }
+	        return;
 	    }
-	}
-	return 0;
-}
-int set_event_buffer(ans_status_t *ans)
-{
-    int i = 0;
-	int j = 0;
-		
-    if(event_num >= EVENT_BUFFER_SIZE-1)
-    {
-        //event buffer is full
-        event_buf[EVENT_BUFFER_SIZE-1].ans.level = LEVEL_WARN;
-		event_buf[EVENT_BUFFER_SIZE-1].ans.module = MODULE_NAV;
-		event_buf[EVENT_BUFFER_SIZE-1].ans.function = 24;
-		event_buf[EVENT_BUFFER_SIZE-1].ans.len = 4;
-		set_int_buf(event_buf[EVENT_BUFFER_SIZE-1].ans.data,1);
-		event_buf[EVENT_BUFFER_SIZE-1].flag = 1;
-		return -1;
-    }
-	else
-	{
-	    for(i=0;i<EVENT_BUFFER_SIZE-1;i++)
+	    if(1 == rlt)
 	    {
-	        j = check_same_event_msg(&(event_buf[i].ans),ans);
-			if((1 == j) && (1 == event_buf[i].flag))
-			{
-			    return 0;
-			}
+	        event_store_consume(event_sent,event_sent_len);
 	    }
-		for(i=0;i<EVENT_BUFFER_SIZE-1;i++)
-		{
-		    if(0 == event_buf[i].flag)
-		    {
-		        break;
-		    }
-		}
-	    event_buf[i].ans.level = ans->level;
-		event_buf[i].ans.module = ans->module;
-		event_buf[i].ans.function = ans->function;
-		event_buf[i].ans.len = ans->len;
-		memcpy(event_buf[i].ans.data,ans->data,ans->len);
-		event_buf[i].flag = 1;
-		event_num++;
+	    event_sent_len = 0;
+	}
+	if(0 != upper_socket_status())
+	{
+	    return;
 	}
-	return 0;
-}
-void handle_report_event(void)
-{
-    static int count = 0;
-	int i = 0;
-	int j = 0;
 
-    count++;
-	if(0 == (count%EVENT_COUNT_NUM))
+	upper_tx_mark(&event_sent_epoch);
+	budget = upper_tx_free() / 2;
+	len = event_store_peek(event_sent,(budget < EVENT_PASS_LEN) ? budget : EVENT_PASS_LEN,EVENT_SEND_NUM * EVENT_BATCH_NUM,&num);
+	for(i=0;(i<EVENT_SEND_NUM) && (used<len);i++)
 	{
-	    i = upper_socket_status();
-	    if((event_num>0) && (event_num < EVENT_BUFFER_SIZE) && (0 == i))
+	    //whole records, in batch mode as many as fit into one pkg
+	    pkg_len = 0;
+	    pkg_num = 0;
+	    while(used + pkg_len < len)
 	    {
-	        for(i=0;i<EVENT_BUFFER_SIZE;i++)
+	        rlen = EVENT_REC_HEAD + event_sent[used + pkg_len + 3];
+	        if((pkg_num > 0) && (!event_batch || (pkg_len + rlen > EVENT_BATCH_LEN) || (pkg_num >= EVENT_BATCH_NUM)))
 	        {
-	            if(1 == event_buf[i].flag)
-	            {
-	                j = report_event(&(event_buf[i].ans));
-					if(0 == j)
-					{
-					    event_buf[i].flag = 0;
-						event_num--;
-					}
-	            }
-	            
+	            break;
 	        }
+	        pkg_len += rlen;
+	        pkg_num++;
+	    }
+	    budget -= PKG_BASE_LEN + 1 + pkg_len;
+	    if(budget < 0)
+	    {
+	        break;
+	    }
+	    if(event_batch)
+	    {
+	        rlt = send_pkg(PKG_REPORT_EVENTS,pkg_len,pkg_num,&event_sent[used]);
+	    }
+	    else
+	    {
+	        //one record is what a check system answer carries
+	        rlt = send_pkg(PKG_FB_CHECK_SYSTEM,pkg_len,0,&event_sent[used]);
+	    }
+	    if(0 != rlt)
+	    {
+	        break;
 	    }
+	    used += pkg_len;
 	}
+	event_sent_len = used;
+	//a reconnect while sending shows as a new epoch, and the pass is sent again
+	event_sent_mark = upper_tx_mark(&epoch);
     return;
 }
 
-void init_event_buf(void)
+void init_event_buf(const char *spool_path,int batch)
 {
-    int i = 0;
-    for(i=0;i<EVENT_BUFFER_SIZE;i++)
-    {
-        event_buf[i].flag = 0;
-    }
+    event_batch = batch;
+    event_store_init(spool_path);
 	return;
 }
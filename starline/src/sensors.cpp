@@ -10,24 +10,78 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include <signal.h>
+#include <vector>
+#include <atomic>
 
 #include "../include/starline/config.h"
+#include "mcu_com/frame_parser.h"
+#include "mcu_com/seqlock.h"
+#include "../include/starline/frames.h"
 #include "../include/starline/sensor.h"
+#include "../include/starline/reactor.h"
+#include "../include/starline/fw_upgrade.h"
 
 #include "../include/starline/json.hpp"
 #include "std_msgs/String.h"
 #include "std_msgs/UInt8MultiArray.h" 
-static std::string laser_frames[LASER_NUM - 3] = {"laser_frame_0","laser_frame_1","laser_frame_2","laser_frame_3","laser_frame_4","laser_frame_5",
+#include "tf/transform_listener.h"
+#include <mutex>
+
+/*
+ * All laser and sonar returns of a sensor frame go out as one PointCloud2 in
+ * base_link. Each sensor sees along its own x axis, so with the mounting
+ * transforms cached a return is just origin + axis * range.
+ */
+#define CLOUD_FRAME                 "base_link"
+#define CLOUD_LASER_NUM             (LASER_NUM - 3)     //the last three lasers are not in the cloud
+#define CLOUD_POINT_MAX             (CLOUD_LASER_NUM + SONAR_NUM)
+#define CLOUD_POINT_STEP            16                  //x, y, z, intensity as float32
+#define CLOUD_TF_RETRY_PERIOD       1.0                 //seconds between lookups of missing transforms
+
+typedef struct
+{
+    std::string frame;
+    bool        valid;
+    float       origin[3];      //sensor origin in CLOUD_FRAME
+    float       axis[3];        //sensor x axis in CLOUD_FRAME
+}cloud_sensor_t;
+
+//the part of sensor_sys the main loop reads, sensor_sys itself holds ros types
+typedef struct
+{
+    double laser_len[LASER_NUM];
+    double sonar_len[SONAR_NUM];
+    unsigned char estop_io_flag;
+    unsigned char infrared_flag;
+    unsigned char status[SENSOR_STATUS_NUM];
+    double estop_fb_limit;
+    int work_normal;
+    int com_rssi;
+    unsigned char software_version[SENSOR_SOFTWARE_VER_LEN];
+}sensor_state_t;
+
+static std::string laser_frames[CLOUD_LASER_NUM] = {"laser_frame_0","laser_frame_1","laser_frame_2","laser_frame_3","laser_frame_4","laser_frame_5",
 										      "laser_frame_6","laser_frame_7","laser_frame_8","laser_frame_9"};
 
 
 using json = nlohmann::json;
 static sensor_sys_t sensor_sys;
 static sensor_info_t sensor_info;
-static int sensor_over_time_flag = 0;
-static int last_unread_bytes = 0;
-static unsigned char recv_buf_last[BUF_LEN] = {0};
+static int send_upgrade_frame(unsigned char *frame);
+static void request_sensor_version(void);
+static fw_upgrade_t *sensor_fw = fw_upgrade_create("sensor",0x0F,SENSOR_UPGRADE_FILE_FRAME_LEN,SENSOR_UPGRADE_OVER_TIME,
+    SENSOR_READY_UPGRADE_WAIT_MS,SENSOR_END_UPGRADE_WAIT_MS,send_upgrade_frame,request_sensor_version);
+static Seqlock<sensor_state_t> sensor_snapshot;   //what the main loop sees, stored once per cycle
+static int upgrade_running = 0;                 //reactor thread only
+static std::atomic<int> upgrade_pending(0);     //get_sensor_upgrade_status(), 1 from set to done
+static std::atomic<int> upgrade_result(0);      //of the last upgrade, stored before upgrade_pending drops
+static FrameParser frame_parser;
+static LinkStats link_stats("sensor");
+static tf::TransformListener *tf_listener = NULL;
+static cloud_sensor_t cloud_sensor[CLOUD_POINT_MAX];   //lasers first, then sonars
+static sensor_msgs::PointCloud2 range_cloud;            //fields filled once, only stamp and points change
+static ros::Time cloud_tf_retry;
+static std::mutex cloud_lock;
 ros::Publisher hall_pub;
 ros::Subscriber sub_from_sensor;
 ros::Subscriber sub_from_hall;
@@ -64,6 +118,111 @@ static inline double restore_sensor_data(unsigned char *buf)
     return data;
 }
 
+static void init_range_cloud(void)
+{
+    const char *names[4] = {"x", "y", "z", "intensity"};
+    char frame[32];
+
+    for(int i = 0; i < CLOUD_POINT_MAX; i++)
+    {
+        if(i < CLOUD_LASER_NUM)
+        {
+            cloud_sensor[i].frame = laser_frames[i];
+        }
+        else
+        {
+            snprintf(frame, sizeof(frame), "sonar_frame_%d", i - CLOUD_LASER_NUM);
+            cloud_sensor[i].frame = frame;
+        }
+        cloud_sensor[i].valid = false;
+    }
+
+    range_cloud.header.frame_id = CLOUD_FRAME;
+    range_cloud.height = 1;
+    range_cloud.width = 0;
+    range_cloud.fields.resize(4);
+    for(int i = 0; i < 4; i++)
+    {
+        range_cloud.fields[i].name = names[i];
+        range_cloud.fields[i].offset = i * sizeof(float);
+        range_cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+        range_cloud.fields[i].count = 1;
+    }
+    range_cloud.is_bigendian = false;
+    range_cloud.point_step = CLOUD_POINT_STEP;
+    range_cloud.is_dense = true;
+    range_cloud.data.reserve(CLOUD_POINT_MAX * CLOUD_POINT_STEP);
+}
+
+//mounts are static, a transform is looked up until it is found once
+static void update_cloud_transforms(void)
+{
+    ros::Time now = ros::Time::now();
+    tf::StampedTransform transform;
+
+    if((NULL == tf_listener) || (now < cloud_tf_retry))
+    {
+        return;
+    }
+    cloud_tf_retry = now + ros::Duration(CLOUD_TF_RETRY_PERIOD);
+    for(int i = 0; i < CLOUD_POINT_MAX; i++)
+    {
+        if(cloud_sensor[i].valid)
+        {
+            continue;
+        }
+        try
+        {
+            tf_listener->lookupTransform(CLOUD_FRAME, cloud_sensor[i].frame, ros::Time(0), transform);
+        }
+        catch(tf::TransformException &e)
+        {
+            ROS_DEBUG("no transform from %s to %s yet: %s", cloud_sensor[i].frame.c_str(), CLOUD_FRAME, e.what());
+            continue;
+        }
+        tf::Vector3 axis = transform.getBasis() * tf::Vector3(1.0, 0.0, 0.0);
+        for(int j = 0; j < 3; j++)
+        {
+            cloud_sensor[i].origin[j] = transform.getOrigin()[j];
+            cloud_sensor[i].axis[j] = axis[j];
+        }
+        cloud_sensor[i].valid = true;
+    }
+}
+
+//one message per sensor frame, sensors without a transform yet are left out
+static void pub_range_cloud(sensor_sys_t *sys)
+{
+    std::lock_guard<std::mutex> lock(cloud_lock);
+    int points = 0;
+    float *p = NULL;
+
+    update_cloud_transforms();
+    range_cloud.data.resize(CLOUD_POINT_MAX * CLOUD_POINT_STEP);
+    p = (float *)&range_cloud.data[0];
+    for(int i = 0; i < CLOUD_POINT_MAX; i++)
+    {
+        const cloud_sensor_t *sensor = &cloud_sensor[i];
+        float range = (i < CLOUD_LASER_NUM) ? sys->laser_len[i] : sys->sonar_len[i - CLOUD_LASER_NUM];
+
+        if(!sensor->valid)
+        {
+            continue;
+        }
+        p[0] = sensor->origin[0] + sensor->axis[0] * range;
+        p[1] = sensor->origin[1] + sensor->axis[1] * range;
+        p[2] = sensor->origin[2] + sensor->axis[2] * range;
+        p[3] = 0.0f;
+        p += CLOUD_POINT_STEP / sizeof(float);
+        points++;
+    }
+    range_cloud.header.stamp = ros::Time::now();
+    range_cloud.width = points;
+    range_cloud.row_step = points * CLOUD_POINT_STEP;
+    range_cloud.data.resize(range_cloud.row_step);
+    sys->lasercloud_pub.publish(range_cloud);
+}
+
 static void pub_laser_data(sensor_sys_t *sys)
 {
 	sys->laser_data.header.stamp = ros::Time::now();
@@ -73,45 +232,8 @@ static void pub_laser_data(sensor_sys_t *sys)
 	sys->laser_data.min_range =  0.0;
 	sys->laser_data.max_range = 0.4;
 
-
-sensor_msgs::PointCloud2 cloud_out;
-	cloud_out.header.stamp = ros::Time::now();
-	cloud_out.height = 1;
-	cloud_out.width  = 1;
-	cloud_out.fields.resize (4);
-	cloud_out.fields[0].name = "x";
-	cloud_out.fields[0].offset = 0;
-	cloud_out.fields[0].datatype = sensor_msgs::PointField::FLOAT32;
-	cloud_out.fields[0].count = cloud_out.width;
-	cloud_out.fields[1].name = "y";
-	cloud_out.fields[1].offset = 4;
-	cloud_out.fields[1].datatype = sensor_msgs::PointField::FLOAT32;
-	cloud_out.fields[1].count = cloud_out.width;
-	cloud_out.fields[2].name = "z";
-	cloud_out.fields[2].offset = 8;
-	cloud_out.fields[2].datatype = sensor_msgs::PointField::FLOAT32;
-	cloud_out.fields[2].count = cloud_out.width;
-	cloud_out.fields[3].name = "intensity";
-	cloud_out.fields[3].datatype = sensor_msgs::PointField::FLOAT32;
-	cloud_out.fields[3].offset = 12;
-	cloud_out.fields[3].count = cloud_out.width;
-    cloud_out.point_step = 16;
-	cloud_out.row_step   = cloud_out.point_step * cloud_out.width;
-	cloud_out.data.resize (cloud_out.row_step   * cloud_out.height);
-	cloud_out.is_dense = false;
-
-
 	for(int i=0;i<LASER_NUM;i++)
 	{
-		if(i < LASER_NUM - 3)//bu yao dong
-		{
-			cloud_out.header.frame_id = laser_frames[i];
-			float *pstep = (float*)&cloud_out.data[0];
-			pstep[0] = (float)sys->laser_len[i];
-			pstep[1] = 0.0;
-			sys->lasercloud_pub.publish(cloud_out);
-		}	    
-				
 		sys->laser_data.range.push_back(sys->laser_len[i]);
 	}
 	sys->sensor_pub.publish(sys->laser_data);
@@ -185,19 +307,8 @@ static void handle_rev_frame(sensor_sys_t *sys,unsigned char * frame_buf)
     int frame_len = 0;
 	int i = 0;
 	int j = 0;
-	unsigned char check_data = 0;
 	frame_len = frame_buf[1];
 
-    for(i=0;i<frame_len-2;i++)
-    {
-        check_data += frame_buf[i];
-    }
-    
-	if(check_data != frame_buf[frame_len-2] || 0xA5 != frame_buf[frame_len -1])
-	{
-        ROS_INFO("sensor receive frame check error");
-		return;
-	}
     //for(i =0;i<frame_len;i++)
     //{
     //    ROS_INFO("sensor receive:%d",frame_buf[i]);
@@ -206,9 +317,7 @@ static void handle_rev_frame(sensor_sys_t *sys,unsigned char * frame_buf)
     {
          sys->work_normal = 2;
     }
-	if(0 == sys->handle_data_flag)
     {
-         sys->handle_data_flag = 1;
 		 sensor_info.recv_type = frame_buf[2];
 
 		 switch (sensor_info.recv_type)
@@ -240,6 +349,7 @@ static void handle_rev_frame(sensor_sys_t *sys,unsigned char * frame_buf)
 					sys->sonar_len[j] = restore_sensor_data(&frame_buf[3+LASER_NUM+j]);
 				}
 				pub_sonar_data(sys);
+				pub_range_cloud(sys);
                 for(j = 0; j < HALL_NUM; j++)
                 {
                     //if((frame_buf[3+SONAR_NUM+LASER_NUM+j] == 1)&& (frame_buf[3+SONAR_NUM+LASER_NUM+j] == 0))
@@ -265,48 +375,22 @@ static void handle_rev_frame(sensor_sys_t *sys,unsigned char * frame_buf)
 				{
                     sys->software_version[j] = frame_buf[7+j]; 
 				}
+				fw_upgrade_version(sensor_fw,&frame_buf[7],SENSOR_SOFTWARE_VER_LEN);
 				break;
 
 			 case 0x0F:
-				sensor_info.upgrade_type = (int)frame_buf[3];
-				switch(sensor_info.upgrade_type)
-				{
-                      case 0x00:
-                         sensor_info.upgrade_ready_rlt = (int)frame_buf[4];
-						 break;
-										  
-					  case 0x01:                    
-						 sensor_info.upgrade_recv_rlt = (int)frame_buf[4];
-						 break;
-
-					  case 0x02:
-						 sensor_info.upgrade_end_rlt = (int)frame_buf[4];
-                         break;
-
-					  default:
-                          break;
-				}
+				fw_upgrade_ack(sensor_fw,(int)frame_buf[3],(int)frame_buf[4]);
                 break;
 				
 			 default:
                 break;
 		}
-        sys->handle_data_flag = 0;
         sys->rec_num++;
     }
 }
 
 static int handle_receive_data(sensor_sys_t *sys)
 {
-    int nread = 0;
-    int i = 0;
-	int j = 0;
-    int data_Len = 0;
-    int frame_len = 0;
-    unsigned char recv_buf[BUF_LEN] = {0};
-	unsigned char recv_buf_complete[BUF_LEN] = {0};
-    unsigned char recv_buf_temp[BUF_LEN] = {0};
-
 	struct stat file_info;
 
     //ROS_INFO("in FUNC   !!!!");
@@ -321,69 +405,18 @@ static int handle_receive_data(sensor_sys_t *sys)
         //ROS_INFO("sensor_handle_receive_data: com_state != COM_RUN_OK && COM_CHECK_VERSION");
         return -1;
     }
-    if(0 != last_unread_bytes)
+    if(frame_parser.Fill(sys->com_device) > 0)
     {
-        for(j=0;j<last_unread_bytes;j++)
-        {
-            recv_buf_complete [j] = recv_buf_last[j];
-        }
-    }
-    if((nread = read(sys->com_device, recv_buf, BUF_LEN))>0)
-    { 
-        //ROS_INFO("sensor nread:%d",nread);
-        //ROS_INFO("sensor last_unread_bytes:%d",last_unread_bytes);
-        ROS_INFO("get %d!",nread);
-        memcpy(recv_buf_complete+last_unread_bytes,recv_buf,nread);
-        data_Len = last_unread_bytes + nread;
-        last_unread_bytes = 0;
-
-        while(i<data_Len)
+        //frames are handled in place, the parser already checked sum and tail
+        frame_parser.Parse([sys](uint8_t *frame, int len)
         {
-//            ROS_INFO("rcv_buf[%d]:%2x",i,recv_buf_complete[i]);
-            if(0x5A == recv_buf_complete [i])
-            {
-                
-                 frame_len = recv_buf_complete[i+1]; 
-                 ROS_INFO("frame_len:%d",frame_len);
-                 if(i+frame_len <= data_Len)
-                 {
-                      if(0xA5 == recv_buf_complete[i+frame_len-1])
-                      {
-                           for(j=0;j<frame_len;j++)
-                           {
-                               recv_buf_temp[j] = recv_buf_complete[i+j];
-                               ROS_INFO("recv_buf_temp:%x",recv_buf_temp[j]);
-                           }
-                           handle_rev_frame(sys,recv_buf_temp);
-                           i = i+ frame_len;
-                      }
-                      else
-                      {
-                           i++;
-                      }
-                 }
-                 else
-                 {
-                      last_unread_bytes = data_Len - i;
-                      for(j=0;j<last_unread_bytes;j++)
-                      {
-                           recv_buf_last[j] = recv_buf_complete[i+j];
-                           ROS_INFO("out get!");
-                      }
-                      break;
-                 }
-            }
-            else 
-            {
-                 i++;
-            }
-        }
-    
+            link_stats.MarkReply(frame[2]);
+            handle_rev_frame(sys, frame);
+        });
     }
     else 
     {
-        i = stat(sys->dev,&file_info);
-        if(-1 == i)
+        if(-1 == stat(sys->dev,&file_info))
         {
             sys->com_state = COM_CLOSING;
         }
@@ -391,6 +424,7 @@ static int handle_receive_data(sensor_sys_t *sys)
     return 0;
 }
 
+//reactor thread only, other threads go through post_serial()
 static int send_serial(unsigned char *send_buf,sensor_sys_t *sys)
 {
     int len = 0;
@@ -421,6 +455,9 @@ for(int i =0;i<send_buf_len;i++){
     len = write(sys->com_device,send_buf,send_buf_len);
     if (len == send_buf_len)
     {
+         link_stats.AddTx(send_buf_len);
+         link_stats.MarkSent(send_buf[2]);
+         LinkCapture::Instance().Record(CAPTURE_LINK_SENSOR, CAPTURE_DIR_TX, send_buf, send_buf_len);
          //ROS_INFO("sensor send ok");
          return 0;
     }     
@@ -435,19 +472,44 @@ for(int i =0;i<send_buf_len;i++){
     }
 }
 
-void get_sensor_version(void)
+//frames of the other threads, the reactor writes them so they never interleave with its own
+static void post_serial(unsigned char *send_buf)
 {
-	unsigned char data[6]={0};
+    std::vector<unsigned char> frame(send_buf, send_buf + send_buf[1]);
+
+    reactor_post([frame]() mutable { send_serial(frame.data(),&sensor_sys); });
+}
+
+static void request_sensor_version(void)
+{
+	unsigned char data[SensorGetVersionFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x0E;
-	data[3] = 0;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-	data[5] = 0xA5;
+	SensorGetVersionFrame::Encode(data, 0);
 	send_serial(data,&sensor_sys);
+}
+
+void get_sensor_version(void)
+{
+	reactor_post(request_sensor_version);
     usleep(SENSOR_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
+}
+
+static void sensor_readable(uint32_t events)
+{
+    if(events & (EPOLLERR | EPOLLHUP))
+    {
+        ROS_INFO("sensor com device hang up");
+        sensor_sys.com_state = COM_CLOSING;
+    }
+    else
+    {
+        handle_receive_data(&sensor_sys);
+    }
+    //stop polling a dead device until the next tick closes it
+    if(COM_CLOSING == sensor_sys.com_state)
+    {
+        reactor_del_fd(sensor_sys.com_device);
+    }
 }
 
 static bool check_version(void)
@@ -476,7 +538,6 @@ static void sensor_init (void)
     sensor_sys.work_normal = 0;
     
     sensor_sys.com_rssi = 0;
-    sensor_sys.handle_data_flag = 0;
 	sensor_sys.estop_limit = 0.45;
     memcpy(sensor_sys.dev,com_device_path,sizeof(com_device_path));
 
@@ -484,9 +545,6 @@ static void sensor_init (void)
 	sensor_info.function_cali_cmd_rlt = -1;
 	sensor_info.function_cali_param_rlt = -1;
 	sensor_info.set_function_cali_ack = -1;
-	sensor_info.upgrade_ready_rlt = -1;
-	sensor_info.upgrade_recv_rlt = -1;
-	sensor_info.upgrade_end_rlt = -1;
 }
 
 static void update_system_state(sensor_sys_t *sys)
@@ -519,6 +577,7 @@ static void update_system_state(sensor_sys_t *sys)
             }
             last_file_flag = i;
             sys->com_device = open_com_device(sys->dev);
+            frame_parser.Reset();
             if(-1 != sys->com_device)
             {
                 sys->com_state =  COM_RUN_OK;
@@ -534,14 +593,19 @@ static void update_system_state(sensor_sys_t *sys)
             
             set_speed(sys->com_device,115200);
             set_parity(sys->com_device,8,1,'N');/* */ 
+            reactor_add_fd(sys->com_device,EPOLLIN,sensor_readable);
             break;
 		
         case COM_CHECK_VERSION:
-            get_sensor_version();
+            //the reply is parsed as it comes in and checked on the next tick
             if(check_version())
             {
                  sys->com_state = COM_RUN_OK;
             }
+            else
+            {
+                request_sensor_version();
+            }
             break;
         	
         case COM_RUN_OK:
@@ -549,6 +613,7 @@ static void update_system_state(sensor_sys_t *sys)
             break;
             
         case COM_CLOSING:
+            reactor_del_fd(sys->com_device);
             close(sys->com_device);
             //usleep(CLOSE_WAIT_TIME);
             sys->com_state = COM_OPENING;
@@ -562,200 +627,28 @@ static void update_system_state(sensor_sys_t *sys)
     return;
 }
 
-static long get_upgrade_size(char* path)
+static int send_upgrade_frame(unsigned char *frame)
 {
-	FILE *file;
-	
-	long len = 0;
-	
-	file = fopen(path,"rb");
-	if(NULL == file)
-	{
-		ROS_INFO("get upgrade size failed");
-        return 0;
-	}
-	
-	fseek(file,0,SEEK_END);
-	len = ftell(file);
-	fclose(file);	
-	return len;
-}
-
-static int send_ready_upgrade(char * path, char * md5char)
-{
-	unsigned char data[26] = {0};
-    union {
-        unsigned long lnum;
-        unsigned char cnum[4];
-    }filesize;
-	int i = 0;
-	
-	data[0] = 0x5A;
-	data[1] = 0x1A;
-	data[2] = 0x0F;
-	data[3] = 0x00;
-											 
-	for(i=0; i<16; i++)
-	{
-		data[i+4] = md5char[i];
-	}
-  
-    //big end or small end convert socket frame
-    filesize.lnum = htonl(get_upgrade_size(path));
-	if(0 == filesize.lnum){
-       ROS_INFO("sensor upgrade file is 0\n");   
-	   return -1;
-	}
-
-	for(i=0; i<4; i++)
-	{
-        data[i+20] = filesize.cnum[i];
-	}
-
-	for(i=0; i<24; i++)
-	{
-		data[24] += data[i];
-	}
-	data[25] = 0xA5;  
-	send_serial(data,&sensor_sys);
-	usleep(SENSOR_READY_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
-    ROS_INFO("send_ready_upgrade over");
-	return 0;
+    //a frame lost on the way is not acked and sent again
+    post_serial(frame);
+    return 0;
 }
 
-static int send_upgrade_file_frame(char* buffer,int len)
+int sensor_upgrade_one_count(const char * path,const char * md5char,const char * version)
 {
-     unsigned char data[SENSOR_UPGRADE_FILE_FRAME_LEN+6]={0};
-	 int i = 0;
-	 
-	 data[0] = 0x5A; 
-	 data[1] = len+6;
-	 data[2] = 0x0F;
-	 data[3] = 0x01;
-	 for(i=0; i<len; i++)
-	 {
-        data[i+4] = buffer[i];
-	 }
-	 for(i=0; i<len+4; i++)
-     {
-	    data[len+4] += data[i];
-	 }
-     data[len+5] = 0xA5;     
-	 send_serial(data,&sensor_sys); 
-	 return 0;
-}
-
-static void send_file_over_time(int sig)
-{    
-    sensor_over_time_flag =1;
-}
+    int rlt = fw_upgrade_run(sensor_fw,path,md5char,version);
 
-static int send_upgrade_file(char* path)
-{	
-	char buffer[SENSOR_UPGRADE_FILE_FRAME_LEN]={0};
-	FILE *file;
-    int len = 0;
-    int i =0;
-    file = fopen(path,"rb");
-    if(NULL == file)
+    //the board refused the image, its end ack tells why
+    if(0x01 == rlt)
     {
-        ROS_INFO("open sensor update file failed");
-        return -1;
+        rlt = -5;
     }
-    signal(SIGALRM, send_file_over_time);
-    alarm(SENSOR_UPGRADE_OVER_TIME);
-    while(!feof(file))
-    { 
-        ROS_INFO("send sensor upgrade file count:%d",i++);
-        len = fread(buffer,1,SENSOR_UPGRADE_FILE_FRAME_LEN,file);
-        ROS_INFO("sensor upgrade_file len:%d",len);
-	    send_upgrade_file_frame(buffer,len);
-		bzero(buffer,SENSOR_UPGRADE_FILE_FRAME_LEN);  
-		usleep(SENSOR_SLEEP_TIME);
-		handle_receive_data(&sensor_sys); 
-		ROS_INFO("sensor upgrade_recv_rlt:%d",sensor_info.upgrade_recv_rlt);
-		if(sensor_info.upgrade_recv_rlt != 0x00)
-		{
-            //if send fail then resend pre frame
-            ROS_INFO("sensor upgrade_recv_rlt fail");
-			fseek(file,-SENSOR_UPGRADE_FILE_FRAME_LEN,SEEK_CUR);
-		}
-		if(1 == sensor_over_time_flag){
-            ROS_INFO("send sensor upgrade file over time!!");
-            fclose(file);
-            sensor_over_time_flag = 0;
-            return -4;
-        }
-        sensor_info.upgrade_recv_rlt =-1;
-    }
-    alarm(0);
-	fclose(file);
-    ROS_INFO("send sensor upgrade file over");
-	return 0;
-}
-
-static int send_end_upgrade(void)
-{
-    unsigned char data[7] = {0};
-	data[0] = 0x5A;
-	data[1] = 0x07;
-    data[2] = 0x0F;
-	data[3] = 0x02;
-	data[4] = 0;
-	data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-	data[6] = 0xA5;
-	send_serial(data,&sensor_sys);
-	usleep(SENSOR_END_UPGRADE_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
-	return 0;
-}
-
-int sensor_upgrade_one_count(char * path,char * md5char)
-{
-    int rlt = 0;
-	rlt = send_ready_upgrade(path, md5char);
-    ROS_INFO("sensor upgrade_ready_rlt:%d",rlt);
-	if((rlt >= 0) && (0x00 == sensor_info.upgrade_ready_rlt))
-	{
-        rlt = send_upgrade_file(path);
-        if(rlt >= 0){
-           send_end_upgrade();
-           if(0x00 == sensor_info.upgrade_end_rlt)
-		   {
-               rlt = 0;
-		   }
-		   else if(0x01 == sensor_info.upgrade_end_rlt)
-		   {
-               rlt = -5;
-		   }
-           else
-           {
-               rlt = -7;
-           }
-		}
-	}
-	else if(sensor_info.upgrade_ready_rlt >0)
-	{
-	    if(0x01 == sensor_info.upgrade_ready_rlt)
-        {
-           rlt = -2;
-	    }
-		else if(0x02 == sensor_info.upgrade_ready_rlt)
-		{
-           rlt = -3;
-		}
-		else
-		{
-           rlt = -8;
-		}
-	}
-    else if(-1 == sensor_info.upgrade_ready_rlt)
+    else if(rlt > 0)
     {
-        rlt = -6;
+        rlt = -7;
     }
-    ROS_INFO("sensor_upgrade_rlt:%d",rlt); 
-	return rlt;
+    ROS_DEBUG("sensor_upgrade_rlt:%d",rlt);
+    return rlt;
 }
 
 /*
@@ -767,14 +660,14 @@ int sensor_upgrade_one_count(char * path,char * md5char)
  *       -6:nv have not ready frame
  *       -7:nv have not end frame
  */
-int  sensor_upgrade(char * path,char * md5char)
+int  sensor_upgrade(const char * path,const char * md5char,const char * version)
 {
     int upgrade_count = 0;
     int rlt = -1;
 
     while(upgrade_count < 3)
     {
-        rlt = sensor_upgrade_one_count(path,md5char);
+        rlt = sensor_upgrade_one_count(path,md5char,version);
         if(rlt < 0)
         {
             upgrade_count++;
@@ -795,53 +688,30 @@ void set_safe_distance(double safe_distance)
 		ROS_INFO("sensor safe_distance can not be negative!");
 		return;
 	}
-	unsigned char data[15]={0};
-	int i = 0;
-	
-	data[0] = 0x5A;
-	data[1] = 0x0F;
-	data[2] = 0x01;
-	for(i=0; i<10 ;i++)
-	{
-		data[3+i] = (unsigned char)(safe_distance*LEN_M_TO_CM);
-    }
+	unsigned char data[SensorSetSafeDistanceFrame::len];
+	unsigned char distance[SensorSetSafeDistanceFrame::payload_len];
 	
-	for(i=0; i<13; i++)
-	{
-		data[13] += data[i];
-	}
-	data[14] = 0xA5;
+	memset(distance, (unsigned char)(safe_distance*LEN_M_TO_CM), sizeof(distance));
+	SensorSetSafeDistanceFrame::Encode(data, distance);
 	
-	send_serial(data,&sensor_sys);
+	post_serial(data);
     usleep(SENSOR_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
 }
 
 void get_safe_distance(void)
 {
-	unsigned char data[6]={0};
+	unsigned char data[SensorGetSafeDistanceFrame::len];
 	
-	data[0] = 0x5A;
-	data[1] = 0x06;
-	data[2] = 0x02;
-	data[3] = 0;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-	data[5] = 0xA5;
-	send_serial(data,&sensor_sys);
+	SensorGetSafeDistanceFrame::Encode(data, 0);
+	post_serial(data);
     usleep(SENSOR_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
 }
 
 static void get_sensor_send_frame()
 {
-	unsigned char data[6]={0};
+	unsigned char data[SensorGetDataFrame::len];
 	
-	data[0] = 0x5A;
-    data[1] = 0x06;
-	data[2] = 0x03;
-	data[3] = 01;
-	data[4] = data[0]+data[1]+data[2]+data[3];
-	data[5] = 0xA5;
+	SensorGetDataFrame::Encode(data, 0x01);
 
 	send_serial(data,&sensor_sys);
     ROS_INFO("get_sensor_data");
@@ -849,7 +719,7 @@ static void get_sensor_send_frame()
 
 void set_function_cali(int function_cali_cmd, int function_cali_param)
 {
-	unsigned char data[7]={0};
+	unsigned char data[SensorCaliFrame::len];
 
 	if(function_cali_cmd < 0)
 	{
@@ -860,16 +730,9 @@ void set_function_cali(int function_cali_cmd, int function_cali_param)
         function_cali_param = 0;
     }
 	
-	data[0] = 0x5A;
-	data[1] = 0x07;
-    data[2] = 0x0D;
-    data[3] = (unsigned char)function_cali_cmd;
-    data[4] = (unsigned char)function_cali_param;
-    data[5] = data[0]+data[1]+data[2]+data[3]+data[4];
-    data[6] = 0xA5;
-    send_serial(data,&sensor_sys);
+    SensorCaliFrame::Encode(data, (unsigned char)function_cali_cmd, (unsigned char)function_cali_param);
+    post_serial(data);
     usleep(SENSOR_SLEEP_TIME);
-	handle_receive_data(&sensor_sys);
 }
 
 static int check_com_rssi(int send_num,sensor_sys_t *sys)
@@ -931,70 +794,120 @@ void sub_from_sensor_cb(std_msgs::UInt8MultiArray data)
         sensor_sys.sonar_len[j] = restore_sensor_data(&data.data[LASER_NUM+j]);
     }
     pub_sonar_data(&sensor_sys);
+    pub_range_cloud(&sensor_sys);
 }
-void *sensor_thread_start(void *)
+static void store_sensor_state(void)
 {
-    int send_num = 0;
-	static int flag = 0;
-    sensor_sys.com_state = COM_OPENING;
-	ros::NodeHandle nh;
+    sensor_state_t state;
 
-    update_system_state(&sensor_sys);
-    double temp_estop_limit = 0;
-    //if((sensor_sys.sensor_freq <= 0) || (sensor_sys.sensor_freq > 50.0))
+    memcpy(state.laser_len, sensor_sys.laser_len, sizeof(state.laser_len));
+    memcpy(state.sonar_len, sensor_sys.sonar_len, sizeof(state.sonar_len));
+    state.estop_io_flag = sensor_sys.estop_io_flag;
+    state.infrared_flag = sensor_sys.infrared_flag;
+    memcpy(state.status, sensor_sys.status, sizeof(state.status));
+    state.estop_fb_limit = sensor_sys.estop_fb_limit;
+    state.work_normal = sensor_sys.work_normal;
+    state.com_rssi = sensor_sys.com_rssi;
+    memcpy(state.software_version, sensor_sys.software_version, sizeof(state.software_version));
+    sensor_snapshot.Store(state);
+}
+
+LinkStats *get_sensor_link_stats(void)
+{
+    return &link_stats;
+}
+
+//the old sensor loop body, the device itself is read by sensor_readable()
+static void sensor_tick(void)
+{
+    static int send_num = 0;
+    static double temp_estop_limit = 0;
+
+    if(0 == sensor_sys.upgrade_status)
     {
-        sensor_sys.sensor_freq = 20;
-    }
-    ros::Rate loop_rate(sensor_sys.sensor_freq);
-    sensor_sys.lasercloud_pub = nh.advertise<sensor_msgs::PointCloud2>("lasercloud", 50, true);
-	sensor_sys.sensor_pub = nh.advertise<SensorMsg>("sensor_msg", 2, true);
-    hall_pub = nh.advertise<std_msgs::String>("hall_msg",20);
-    sub_from_sensor = nh.subscribe("sensor_to_starline_node",1000,sub_from_sensor_cb);
-    sub_from_hall = nh.subscribe("hall_to_starline_node",1000,sub_from_hall_cb);
-    while(ros::ok()) 
-    {  
-        //ROS_INFO("ros OK!!");
-        if(0 == sensor_sys.upgrade_status)
+        update_system_state(&sensor_sys);//
+        if(COM_RUN_OK == sensor_sys.com_state)
         {
-            update_system_state(&sensor_sys);//
-            handle_receive_data(&sensor_sys);
-            if(COM_RUN_OK == sensor_sys.com_state)
+            check_com_rssi(send_num,&sensor_sys);
+            if(temp_estop_limit != sensor_sys.estop_limit)
             {
-                check_com_rssi(send_num,&sensor_sys);
-                if(temp_estop_limit != sensor_sys.estop_limit)
-                {
-                   set_safe_distance(sensor_sys.estop_limit);
+               double limit = sensor_sys.estop_limit;
+               worker_post([limit]
+               {
+                   set_safe_distance(limit);
                    get_safe_distance();
-                   temp_estop_limit = sensor_sys.estop_limit;
-                }
-                ROS_INFO("com_state OK!!");
-                get_sensor_send_frame();
-                send_num=(send_num + 1)%10;
+               });
+               temp_estop_limit = sensor_sys.estop_limit;
             }
+            ROS_INFO("com_state OK!!");
+            get_sensor_send_frame();
+            send_num=(send_num + 1)%10;
         }
-        else if(1 == sensor_sys.upgrade_status)
+    }
+    else if((1 == sensor_sys.upgrade_status) && (0 == upgrade_running))
+    {
+        //waits for the acks the reactor parses, so it must not run here
+        upgrade_running = 1;
+        std::string path(sensor_sys.name,strnlen(sensor_sys.name,FILE_PATH_LEN));
+        std::string md5(sensor_sys.md5,MD5_SIZE);
+        std::string version(sensor_sys.upgrade_version,strnlen(sensor_sys.upgrade_version,VERSION_LEN));
+        worker_spawn([path,md5,version]
         {
-             if(flag == 0)
-             {
-                flag = 1;
-                sensor_sys.upgrade_result = sensor_upgrade(sensor_sys.name,sensor_sys.md5);
+            int rlt = sensor_upgrade(path.c_str(),md5.data(),version.c_str());
+            reactor_post([rlt]
+            {
+                sensor_sys.upgrade_result = rlt;
                 sensor_sys.upgrade_status = 0;
-                flag = 0;
-             }
-        }
-        ros::spinOnce();
-        loop_rate.sleep();
+                upgrade_running = 0;
+                upgrade_result = rlt;
+                upgrade_pending = 0;
+            });
+        });
     }
+    store_sensor_state();
+}
+
+static void sensor_exit(void)
+{
+    reactor_del_fd(sensor_sys.com_device);
     close(sensor_sys.com_device);
     sensor_sys.work_normal = 0;
 	sensor_sys.com_state = COM_OPENING;
     sensor_sys.com_rssi = 0;
+    store_sensor_state();
+}
+
+int sensor_start(void)
+{
+    sensor_sys.com_state = COM_OPENING;
+    frame_parser.SetStats(&link_stats);
+    frame_parser.SetCapture(CAPTURE_LINK_SENSOR);
+	ros::NodeHandle nh;
+
+    update_system_state(&sensor_sys);
+    //if((sensor_sys.sensor_freq <= 0) || (sensor_sys.sensor_freq > 50.0))
+    {
+        sensor_sys.sensor_freq = 20;
+    }
+    init_range_cloud();
+    tf_listener = new tf::TransformListener();
+    sensor_sys.lasercloud_pub = nh.advertise<sensor_msgs::PointCloud2>("lasercloud", 5, true);
+	sensor_sys.sensor_pub = nh.advertise<SensorMsg>("sensor_msg", 2, true);
+    hall_pub = nh.advertise<std_msgs::String>("hall_msg",20);
+    sub_from_sensor = nh.subscribe("sensor_to_starline_node",1000,sub_from_sensor_cb);
+    sub_from_hall = nh.subscribe("hall_to_starline_node",1000,sub_from_hall_cb);
+    reactor_at_exit(sensor_exit);
+    if(reactor_add_timer(sensor_sys.sensor_freq,sensor_tick) < 0)
+    {
+        return -1;
+    }
     return 0;
 }
 
 int get_sensor_data(system_t *sys)
 {
     int i = 0;
+    sensor_state_t state;
 
     if(NULL == sys)
     {
@@ -1002,61 +915,74 @@ int get_sensor_data(system_t *sys)
         return -1;
     }
 
-    if(0 == sensor_sys.handle_data_flag)
+    sensor_snapshot.Load(state);
+    for(i=0;i < LASER_NUM;i++)
     {
-        sensor_sys.handle_data_flag = 1;
-        for(i=0;i < LASER_NUM;i++)
-        {
-            sys->sensor.laser_len[i] = sensor_sys.laser_len[i];
-        }
-        for(i=0;i < SONAR_NUM;i++)
-        {
-            sys->sensor.sonar_len[i] = sensor_sys.sonar_len[i];
-        }
-        sys->sensor.estop_io_flag = sensor_sys.estop_io_flag;
-        sys->sensor.infrared_flag = sensor_sys.infrared_flag;
-        for(i=0;i < SENSOR_STATUS_NUM;i++)
-        {
-            sys->sensor.status[i] = sensor_sys.status[i];
-        }
-		sys->sensor.estop_fb_limit = sensor_sys.estop_fb_limit;
-        sys->sensor.work_normal = sensor_sys.work_normal;
-        sys->sensor.com_rssi = sensor_sys.com_rssi;
-        for(i = 0;i<VERSION_LEN;i++)
-        {
-            sys->sensor.version[i] = sensor_sys.software_version[i];
-        }
-        sensor_sys.handle_data_flag = 0;
+        sys->sensor.laser_len[i] = state.laser_len[i];
+    }
+    for(i=0;i < SONAR_NUM;i++)
+    {
+        sys->sensor.sonar_len[i] = state.sonar_len[i];
+    }
+    sys->sensor.estop_io_flag = state.estop_io_flag;
+    sys->sensor.infrared_flag = state.infrared_flag;
+    for(i=0;i < SENSOR_STATUS_NUM;i++)
+    {
+        sys->sensor.status[i] = state.status[i];
+    }
+	sys->sensor.estop_fb_limit = state.estop_fb_limit;
+    sys->sensor.work_normal = state.work_normal;
+    sys->sensor.com_rssi = state.com_rssi;
+    for(i = 0;i<VERSION_LEN;i++)
+    {
+        sys->sensor.version[i] = state.software_version[i];
     }
     return 0;
 }
 
-int set_sensor_upgrade(char *str,char *md5)
+//version is the one the image brings, empty when not known
+int set_sensor_upgrade(char *str,char *md5,char *version)
 {
+    int idle = 0;
+
     if((NULL == str) || (NULL == md5))
 	{
 	    return -1;
 	}
-    if(0 == sensor_sys.upgrade_status)
-	{
-		memcpy(sensor_sys.name,str,strlen(str));
-		memcpy(sensor_sys.md5,md5,MD5_SIZE);
-		sensor_sys.upgrade_status = 1;//info sensors.cpp to upgrade sensor
-		return 0;
-	}
-    return 1;
+    if(!upgrade_pending.compare_exchange_strong(idle,1))
+    {
+        return 1;
+    }
+    //copied here, the reactor owns sensor_sys and the caller may reuse its buffers
+    std::string path(str,strnlen(str,FILE_PATH_LEN - 1));
+    std::string sum(md5,MD5_SIZE);
+    std::string image_version = (NULL != version) ? std::string(version,strnlen(version,VERSION_LEN)) : std::string();
+    reactor_post([path,sum,image_version]
+    {
+        memset(sensor_sys.name,0,FILE_PATH_LEN);
+        memcpy(sensor_sys.name,path.data(),path.size());
+        memcpy(sensor_sys.md5,sum.data(),MD5_SIZE);
+        memset(sensor_sys.upgrade_version,0,VERSION_LEN);
+        memcpy(sensor_sys.upgrade_version,image_version.data(),image_version.size());
+        sensor_sys.upgrade_status = 1;
+    });
+    return 0;
 }
 
 int get_sensor_upgrade_status(void)
 {
-    int i = sensor_sys.upgrade_status;
-    return i;
+    return upgrade_pending;
+}
+
+//percent of the file the board acked, -1 before the first upgrade
+int get_sensor_upgrade_progress(void)
+{
+    return fw_upgrade_progress(sensor_fw);
 }
 
 int get_sensor_upgrade_result(void)
 {
-    int i = sensor_sys.upgrade_result;
-    return i;
+    return upgrade_result;
 }
 
 int set_sensors_cmd(system_t *sys)
@@ -14,6 +14,7 @@
 #include "../include/starline/sensor.h"  
 #include "../include/starline/move.h"
 #include "../include/starline/cloud.h"
+#include "../include/starline/reactor.h"
 
 #define ENTER_EVENT_NUM (10)
 
@@ -37,6 +38,11 @@ void handle_vel(system_t *sys)
         sys->real_vel.vth = 0.0;
         sys->last_vel.vx = 0.0;
         sys->last_vel.vth = 0.0;
+        set_movebase_vel_stop(1);
+    }
+    else
+    {
+        set_movebase_vel_stop(0);
     }
     return;
 }
@@ -1252,7 +1258,7 @@ void decide_and_check_upgrade_system(system_t *sys)
 	    if(2 == sys->base.upgrade_status)
 		{
 		    //set move.cpp to upgrade movebase controller board
-		    i = set_movebase_upgrade(base_path,(char *)sys->base.upgrade_md5);
+		    i = set_movebase_upgrade(base_path,(char *)sys->base.upgrade_md5,(char *)sys->base.upgrade_version);
 			if(0 == i)
 			{
 			    sys->base.upgrade_status = 3;
@@ -1295,7 +1301,7 @@ void decide_and_check_upgrade_system(system_t *sys)
 		if(2 == sys->sensor.upgrade_status)
 		{
 		    //set sensors.cpp to upgrade movebase controller board
-		    i = set_sensor_upgrade(sensor_path,(char *)sys->sensor.upgrade_md5);
+		    i = set_sensor_upgrade(sensor_path,(char *)sys->sensor.upgrade_md5,(char *)sys->sensor.upgrade_version);
 			if(0 == i)
 			{
 			    sys->sensor.upgrade_status = 3;
@@ -1337,7 +1343,7 @@ void decide_and_check_upgrade_system(system_t *sys)
 		if(2 == sys->led_power.upgrade_status)
 		{
 		    //set led.cpp to upgrade movebase controller board
-		    i = set_power_upgrade(power_path,(char *)sys->led_power.upgrade_md5);
+		    i = set_power_upgrade(power_path,(char *)sys->led_power.upgrade_md5,(char *)sys->led_power.upgrade_version);
 			if(0 == i)
 			{
 			    sys->led_power.upgrade_status = 3;
@@ -1722,7 +1728,8 @@ void check_base_event(system_t *sys)
 void handle_movebase(system_t *sys,motion_t *motion)
 {
 	static int last_base_com = 0;
-    move_sys_t *base_sys;
+    move_sys_t base_info;
+    move_sys_t *base_sys = &base_info;
 	ans_status_t ans;
 	int i = 0;
 
@@ -1732,12 +1739,8 @@ void handle_movebase(system_t *sys,motion_t *motion)
         return;
     }
 		
-    base_sys = get_movebase_info();
-    if(NULL == base_sys)
-    {
-        ROS_DEBUG("handle_move_sys is busy now!");
-    }
-	else if(2 != base_sys->work_normal)
+    get_movebase_info(base_sys);
+	if(2 != base_sys->work_normal)
 	{
 	    sys->base.work_normal = base_sys->work_normal;
 		sys->base.move_rssi = base_sys->move_rssi;
@@ -1752,10 +1755,8 @@ void handle_movebase(system_t *sys,motion_t *motion)
 		    i = set_event_buffer(&ans);
 		}
 	}
-    else if(0 == base_sys->handle_data_flag)
+    else
     {
-        base_sys->handle_data_flag = 1;
-        
         motion->odom.x = base_sys->odom.x;
         motion->odom.y = base_sys->odom.y;
         motion->odom.th = base_sys->odom.th;
@@ -1838,11 +1839,6 @@ void handle_movebase(system_t *sys,motion_t *motion)
             sys->base.stop_status = 1;
         }
 				
-        //set cmd to handle base error
-		base_sys->cmd = (unsigned char)sys->base.cmd;
-		
-        base_sys->handle_data_flag = 0;
-
         //handle move base status
 		if(!(sys->base.move_status & BASE_POWER_ON_BIT))
 		{
@@ -1999,7 +1995,8 @@ int handle_led_power(system_t *sys)
 	static int last_led_power_com = 0;
 	ans_status_t ans;
 	int i = 0;
-	led_power_sys_t *led_power = NULL;
+	led_power_sys_t led_info;
+	led_power_sys_t *led_power = &led_info;
 		
     if(NULL == sys)
     {
@@ -2008,10 +2005,8 @@ int handle_led_power(system_t *sys)
 	
 	heart_beat_count++;
 
-    led_power = get_led_power_info();
-	if(NULL != led_power)
+    get_led_power_info(led_power);
 	{
-	    led_power->handle_data_flag = 1;
 	    sys->led_power.act_effect  = led_power->fb_effect;
 		sys->led_power.act_mode = led_power->fb_mode;
 		sys->led_power.com_state = led_power->com_state;
@@ -2054,7 +2049,8 @@ int handle_led_power(system_t *sys)
 		}
 		if(0 == (heart_beat_count % LED_POWER_COM_PERIOD))
 	    {
-	        if(1 == led_power->heart_beat_flag)
+	        //set led power board heart beat flag as 1,wait to set to 0 in led thread
+	        if(1 == swap_led_heart_beat_flag(1))
 	        {
 	            sys->led_power.led_sys_status |= 0x01;
 	        }
@@ -2062,10 +2058,7 @@ int handle_led_power(system_t *sys)
 			{
 			    sys->led_power.led_sys_status &= (~0x01);
 			}
-			//set led power board heart beat flag as 1,wait to set to 0 in led thread
-			led_power->heart_beat_flag = 1;
 	    }
-		led_power->handle_data_flag = 0;
 
         //send event power info or error power data
         check_led_power_info(sys);
@@ -2094,13 +2087,10 @@ int handle_led_power(system_t *sys)
 	return 0;
 }
 
+//all devices are served by one reactor thread, see reactor.h
 void init_sys_thread(system_t *sys)
 {
-    pthread_t sensor_thread;
-    pthread_t upper_com_thread;
-    pthread_t movebase_thread;
-    pthread_t led_thread;
-	pthread_t cloud_thread;
+    pthread_t reactor_thread;
     int tmp = 0;
 
     if(NULL == sys)
@@ -2109,39 +2099,48 @@ void init_sys_thread(system_t *sys)
         return;
     }
     
-    tmp = pthread_create(&sensor_thread,NULL,sensor_thread_start,NULL); 
-    if(0 != tmp)
+    if(0 != reactor_init())
+    {
+        ROS_DEBUG("reactor init failed!\n");
+		sys->err_num = CREATE_THREAD_ERR;
+        sys->auto_enable = 0;
+        return;
+    }
+    if(0 != sensor_start())
     {
-        ROS_DEBUG("sensor com thread failed!\n");
+        ROS_DEBUG("sensor com start failed!\n");
 		sys->err_num = CREATE_THREAD_ERR;
         sys->auto_enable = 0;
     }
-    tmp = pthread_create(&upper_com_thread,NULL,upper_com_thread_start,NULL); 
-    if(0 != tmp)
+    if(0 != upper_com_start())
     {
-        ROS_DEBUG("upper_com thread failed!\n");
+        ROS_DEBUG("upper_com start failed!\n");
 		sys->err_num = CREATE_THREAD_ERR;
         sys->auto_enable = 0;
     }
-    tmp = pthread_create(&movebase_thread,NULL,movebase_thread_start,NULL); 
-    if(0 != tmp)
+    if(0 != movebase_start())
     {
-        ROS_DEBUG("movebase thread failed!\n");
+        ROS_DEBUG("movebase start failed!\n");
 		sys->err_num = CREATE_THREAD_ERR;
         sys->auto_enable = 0;
     }
-    tmp = pthread_create(&led_thread,NULL,led_thread_start,NULL); 
-    if(0 != tmp)
+    if(0 != led_start())
     {
-        ROS_DEBUG("led thread failed!\n");
+        ROS_DEBUG("led start failed!\n");
 		sys->err_num = CREATE_THREAD_ERR;
         sys->auto_enable = 0;
     }
-    tmp = pthread_create(&cloud_thread,NULL,cloud_com_thread_start,NULL); 
+    if(0 != cloud_com_start())
+    {
+        ROS_DEBUG("cloud start failed!\n");
+		sys->err_num = CREATE_THREAD_ERR;
+    }
+    tmp = pthread_create(&reactor_thread,NULL,reactor_thread_start,NULL); 
     if(0 != tmp)
     {
-        ROS_DEBUG("cloud thread failed!\n");
+        ROS_DEBUG("reactor thread failed!\n");
 		sys->err_num = CREATE_THREAD_ERR;
+        sys->auto_enable = 0;
     }
     return;
 }
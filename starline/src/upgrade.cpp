@@ -19,6 +19,8 @@
 #include "../include/starline/cJSON.h"
 #include "../include/starline/report.h"
 
+static md5_ctx upgrade_md5;            //of the upgrade file received so far
+
 int handle_upgrade_file_begin(system_t *sys, unsigned char *buf)
 {
 	//int i = 5;
@@ -55,19 +57,9 @@ int handle_upgrade_file_begin(system_t *sys, unsigned char *buf)
 	    sys->upgrade.upgrade_file_size = filesize;
 		sys->upgrade.upgrade_file_rcv_size = 0;
 		memcpy(sys->upgrade.upgrade_file_name,&buf[10],file_name_len);
-		if(NULL != sys->upgrade.upgrade_file)
-		{
-		    free(sys->upgrade.upgrade_file);
-			sys->upgrade.upgrade_file = NULL;
-		}
-		sys->upgrade.upgrade_file = (char *)malloc(sys->upgrade.upgrade_file_size + 1);
 		ROS_DEBUG("upgrade file size :%d,%d",sys->upgrade.upgrade_file_size,filesize);
-		if(NULL == sys->upgrade.upgrade_file)
-		{
-			ROS_DEBUG("%s: malloc cfg_file failed",__func__);
-			return -1;
-		}
-		memset(sys->upgrade.upgrade_file, 0, sys->upgrade.upgrade_file_size + 1);
+		//hashed as the data comes in, nothing keeps the whole file
+		init_md5(&upgrade_md5);
 	}
 	else
 	{
@@ -97,21 +89,18 @@ int handle_upgrade_file_data(system_t *sys, unsigned char *buf)
 	
 	if(type == SYSTEM_FILE)
 	{
+		//data_len = frame_len - frame_head_len - cmd_type_len - file_type - crc_len - frame_end_len
+		data_len = buf[1] - 8;
+		if(data_len <= 0)
+		{
+		    ROS_DEBUG("data length is wrong");
+		    return -1;
+		}
 		if(sys->upgrade.upgrade_file_rcv_size + data_len 
 			<= sys->upgrade.upgrade_file_size)
 		{
-			//data_len = frame_len - frame_head_len - cmd_type_len - file_type - crc_len - frame_end_len
-			data_len = buf[1] - 8;
-			if(data_len <= 0)
-			{
-			    ROS_DEBUG("data length is wrong");
-			    return -1;
-			}
-			//ROS_DEBUG("%s: data_len %d ", __func__, data_len);
-
 			//ROS_DEBUG("received file size:%d",sys->upgrade.upgrade_file_rcv_size);
-		    memcpy(sys->upgrade.upgrade_file+sys->upgrade.upgrade_file_rcv_size,
-		                 &buf[6],data_len);
+			update_md5(&upgrade_md5,&buf[6],data_len);
 			sys->upgrade.upgrade_file_rcv_size += data_len;
 		}
 		else
@@ -142,8 +131,7 @@ int handle_upgrade_file_done(system_t *sys, unsigned char *buf)
 		return -1;
 	}
 
-    if((NULL == sys->upgrade.upgrade_file) ||
-		    (sys->upgrade.upgrade_file_size <= 0))
+    if(sys->upgrade.upgrade_file_size <= 0)
     {
         ROS_DEBUG("upgrade file is wrong");
         return -1;
@@ -168,30 +156,20 @@ int handle_upgrade_file_done(system_t *sys, unsigned char *buf)
 			ROS_DEBUG("%s: rec_size=%d, upgrade_file=%d ", __func__, 
 			  sys->upgrade.upgrade_file_rcv_size,sys->upgrade.upgrade_file_size);
 			
-			i = compute_md5((unsigned char*)(sys->upgrade.upgrade_file),
-				sys->upgrade.upgrade_file_size,md5_cal_value);
-			if(0 != i)
-			{
-			    ROS_DEBUG("compute upgrade file md5 value failed!");
-				free(sys->upgrade.upgrade_file);
-			    sys->upgrade.upgrade_file = NULL;
-			    return -1;
-			}
+			final_md5(&upgrade_md5,md5_cal_value);
+			sys->upgrade.upgrade_file_size = 0;
 			for(i=0; i<MD5_SIZE; i++)
 			{
 				if(md5_upper_value[i] != md5_cal_value[i])
 				{
 				    ROS_DEBUG("upgrade file md5 check failed!");
-					free(sys->upgrade.upgrade_file);
-			    	sys->upgrade.upgrade_file = NULL;
 				    return -1;
 				}
 			}
 		}
 		else
 		{
-			free(sys->upgrade.upgrade_file);
-			sys->upgrade.upgrade_file = NULL;
+			sys->upgrade.upgrade_file_size = 0;
 			ROS_DEBUG("%s: upgrade_file received failed.", __func__);
 			return -1;
 		}
@@ -208,8 +186,6 @@ int handle_upgrade_file_done(system_t *sys, unsigned char *buf)
 	{
 	    return -1;
 	}
-	free(sys->upgrade.upgrade_file);
-    sys->upgrade.upgrade_file = NULL;
 	return 0;
 }
 
@@ -1126,6 +1102,7 @@ int check_upgrade_system(system_t *sys,env_t *env,unsigned char *data,int *force
 		sys->base.download_index = i;
 		sys->base.upgrade_status = 1;
 		memcpy(sys->base.upgrade_md5,md5_upper_value,MD5_SIZE);
+		memcpy(sys->base.upgrade_version,upgrade.version,VERSION_LEN);
 	}
 	else if(0 == strcmp((char *)upgrade.name,"sensor"))
 	{
@@ -1165,6 +1142,7 @@ int check_upgrade_system(system_t *sys,env_t *env,unsigned char *data,int *force
 		sys->sensor.download_index = i;
 		sys->sensor.upgrade_status = 1;
 		memcpy(sys->sensor.upgrade_md5,md5_upper_value,MD5_SIZE);
+		memcpy(sys->sensor.upgrade_version,upgrade.version,VERSION_LEN);
 	}
 	else if(0 == strcmp((char *)upgrade.name,"power"))
 	{
@@ -1204,6 +1182,7 @@ int check_upgrade_system(system_t *sys,env_t *env,unsigned char *data,int *force
 		sys->led_power.download_index = i;
 		sys->led_power.upgrade_status = 1;
 		memcpy(sys->led_power.upgrade_md5,md5_upper_value,MD5_SIZE);
+		memcpy(sys->led_power.upgrade_version,upgrade.version,VERSION_LEN);
 	}
     return 0;
 }
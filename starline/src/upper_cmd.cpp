@@ -0,0 +1,195 @@
+#include "ros/ros.h"
+#include <stdio.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+
+#include "../include/starline/config.h"
+#include "../include/starline/handle_command.h"
+#include "../include/starline/upper_cmd.h"
+#include "mcu_com/link_stats.h"
+
+typedef struct{
+    const char *name;
+    int min_len;
+    upper_cmd_handler_t handler;
+    LinkHistogram time_us;          //handler and feedback pkg, main loop only
+}upper_cmd_entry_t;
+
+typedef std::unordered_map<unsigned short int, upper_cmd_entry_t *> upper_cmd_table_t;
+typedef std::unordered_map<unsigned short int, upper_pkg_encoder_t> upper_pkg_table_t;
+
+//filled before the threads start and only read afterwards, never freed so exit does not race the reactor
+static upper_cmd_table_t *cmd_table = new upper_cmd_table_t;
+static upper_pkg_table_t *pkg_table = new upper_pkg_table_t;
+
+static unsigned char pkg_pool[UPPER_PKG_POOL_NUM][SOCKET_PKG_LEN];     //zero while free
+static unsigned char *pkg_free[UPPER_PKG_POOL_NUM];
+static int pkg_free_num = -1;           //-1 until the free list is built
+static std::mutex pkg_pool_lock;
+
+int register_upper_cmd(unsigned short int pkg_type,const char *name,int min_len,upper_cmd_handler_t handler)
+{
+    upper_cmd_entry_t *cmd = NULL;
+
+    if((NULL == name) || (NULL == handler))
+    {
+        return -1;
+    }
+    if(cmd_table->count(pkg_type))
+    {
+        ROS_ERROR("upper cmd %x registered twice, %s ignored",pkg_type,name);
+        return -1;
+    }
+    cmd = new upper_cmd_entry_t;
+    cmd->name = name;
+    cmd->min_len = min_len;
+    cmd->handler = handler;
+    (*cmd_table)[pkg_type] = cmd;
+    return 0;
+}
+
+int register_upper_pkg(unsigned short int pkg_type,upper_pkg_encoder_t encoder)
+{
+    if(NULL == encoder)
+    {
+        return -1;
+    }
+    if(pkg_table->count(pkg_type))
+    {
+        ROS_ERROR("upper pkg %x registered twice",pkg_type);
+        return -1;
+    }
+    (*pkg_table)[pkg_type] = encoder;
+    return 0;
+}
+
+upper_pkg_encoder_t find_upper_pkg(unsigned short int pkg_type)
+{
+    upper_pkg_table_t::iterator it = pkg_table->find(pkg_type);
+
+    if(it == pkg_table->end())
+    {
+        return NULL;
+    }
+    return it->second;
+}
+
+unsigned char *get_pkg_buf(void)
+{
+    std::lock_guard<std::mutex> lock(pkg_pool_lock);
+
+    if(pkg_free_num < 0)
+    {
+        for(pkg_free_num = 0; pkg_free_num < UPPER_PKG_POOL_NUM; pkg_free_num++)
+        {
+            pkg_free[pkg_free_num] = pkg_pool[pkg_free_num];
+        }
+    }
+    if(0 == pkg_free_num)
+    {
+        return NULL;
+    }
+    pkg_free_num--;
+    return pkg_free[pkg_free_num];
+}
+
+void put_pkg_buf(unsigned char *buf,int used)
+{
+    if(NULL == buf)
+    {
+        return;
+    }
+    if((used < 0) || (used > SOCKET_PKG_LEN))
+    {
+        used = SOCKET_PKG_LEN;
+    }
+    memset(buf,0,used);
+
+    std::lock_guard<std::mutex> lock(pkg_pool_lock);
+    pkg_free[pkg_free_num] = buf;
+    pkg_free_num++;
+}
+
+int dispatch_upper_cmd(unsigned char *buf,system_t *sys,motion_t *motion,env_t *env)
+{
+    upper_cmd_table_t::iterator it;
+    upper_cmd_entry_t *cmd = NULL;
+    upper_reply_t reply;
+    unsigned short int pkg_len = (buf[PKG_LEN_INDEX+1]<<8)|(buf[PKG_LEN_INDEX]);
+    unsigned short int pkg_type = (buf[PKG_TYPE_INDEX+1]<<8)|(buf[PKG_TYPE_INDEX]);
+    uint64_t start = 0;
+    int rlt = 0;
+
+    it = cmd_table->find(pkg_type);
+    if(it == cmd_table->end())
+    {
+        ROS_DEBUG("handle_cmd:default:%x",pkg_type);
+        return -1;
+    }
+    cmd = it->second;
+    if(pkg_len - PKG_CMD_BASE_LEN < cmd->min_len)
+    {
+        ROS_DEBUG("handle_cmd:%s has %d data bytes, needs %d",cmd->name,pkg_len - PKG_CMD_BASE_LEN,cmd->min_len);
+        return -1;
+    }
+    reply.fb_data = 0;
+    reply.type = 0;
+    reply.cdata_len = 0;
+    reply.cdata = get_pkg_buf();
+    if(NULL == reply.cdata)
+    {
+        ROS_ERROR("handle_cmd:pkg pool empty, %s dropped",cmd->name);
+        return -1;
+    }
+
+    start = link_stats_now_us();
+    rlt = cmd->handler(buf,sys,motion,env,&reply);
+    if(0 == rlt)
+    {
+        ROS_DEBUG("pkg_type:%x,fbdata:%d",pkg_type,reply.fb_data);
+        send_pkg_back(pkg_type|PKG_TRANSFORM,sys,motion,env,reply.fb_data,reply.type,reply.cdata);
+    }
+    cmd->time_us.Add(link_stats_now_us() - start);
+
+    put_pkg_buf(reply.cdata,reply.cdata_len);
+    return (rlt < 0) ? rlt : 0;
+}
+
+static bool cmd_costs_more(const upper_cmd_table_t::value_type *a,const upper_cmd_table_t::value_type *b)
+{
+    const LinkHistogram &ha = a->second->time_us;
+    const LinkHistogram &hb = b->second->time_us;
+
+    return ha.Mean() * ha.Count() > hb.Mean() * hb.Count();
+}
+
+//commands seen so far, the most total time first
+std::string dump_upper_cmd_stats(void)
+{
+    std::vector<const upper_cmd_table_t::value_type *> seen;
+    char line[256];
+    std::string out("[upper_cmd]\n");
+
+    for(upper_cmd_table_t::const_iterator it = cmd_table->begin(); it != cmd_table->end(); ++it)
+    {
+        if(0 != it->second->time_us.Count())
+        {
+            seen.push_back(&(*it));
+        }
+    }
+    std::sort(seen.begin(), seen.end(), cmd_costs_more);
+    for(size_t i = 0; i < seen.size(); i++)
+    {
+        const LinkHistogram &h = seen[i]->second->time_us;
+        snprintf(line, sizeof(line), "  %04x %s: n %llu mean %.0f p50 %llu p99 %llu max %llu us\n",
+                seen[i]->first, seen[i]->second->name, (unsigned long long)h.Count(), h.Mean(),
+                (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(99),
+                (unsigned long long)h.Max());
+        out += line;
+    }
+    return out;
+}
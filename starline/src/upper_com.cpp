@@ -19,13 +19,146 @@
 #include "../include/starline/config.h"
 #include "../include/starline/handle_command.h"
 #include "../include/starline/system.h"
+#include "mcu_com/capture.h"
+#include "mcu_com/seqlock.h"
+#include "../include/starline/reactor.h"
+#include "mcu_com/byte_ring.h"
+#include <mutex>
+#include <atomic>
 
 
 #define LISTEN_PORT (30102)
 #define MAX_LISTEN_NUM (5)
-#define CHECK_BEAR_TIMES (1500)
+#define UPPER_COM_TICK_FREQ (10.0)
+#define CHECK_BEAR_TIMES (100)      //ticks, 10 s
+#define CONNECT_TIMEOUT_TICKS (50)  //5 s
+#define UPPER_RX_RING_LEN (16384)
+#define UPPER_TX_RING_LEN (65536)
 
+/*
+ * socket_status: 1 no socket, 2 socket ready to connect, 3 connecting,
+ * 5 connected. Everything below runs on the reactor thread except
+ * read_upper_com_data() and send_status_back(), which only touch the
+ * rings and never wait for the network.
+ */
 static upper_com_sys_t upper_com_sys;
+static int connect_ticks = 0;
+static int upper_added = 0;                 //client_socket is in the reactor
+static uint32_t upper_events = 0;           //what the reactor watches on it
+static SpscByteRing<UPPER_RX_RING_LEN> rx_ring;     //reactor -> main loop
+static SpscByteRing<UPPER_TX_RING_LEN> tx_ring;     //main loop and heart beat -> reactor
+static std::mutex tx_lock;                  //serializes the tx producers, never held over a syscall
+static std::atomic<int> rx_paused(0);       //rx_ring was full, the socket is not read until there is room
+static std::atomic<int> tx_kicked(0);       //a flush is posted and has not run yet
+static std::atomic<uint64_t> tx_queued(0);  //bytes ever written into tx_ring
+static std::atomic<uint64_t> tx_flushed(0); //of them sent to the socket or dropped on a reconnect
+static std::atomic<unsigned int> tx_epoch(0);  //reconnects that dropped tx_ring
+static Seqlock<upper_com_state_t> upper_com_snapshot;  //what the main loop sees, stored once per cycle
+
+static int handle_receive_data(upper_com_sys_t *sys);
+static int flush_send_data(upper_com_sys_t *sys);
+
+static void record_spans(int dir,struct iovec *iov,int n,int len)
+{
+    for(int i = 0; (i < n) && (len > 0); i++)
+    {
+        int part = ((int)iov[i].iov_len < len) ? (int)iov[i].iov_len : len;
+        LinkCapture::Instance().Record(CAPTURE_LINK_UPPER_COM, dir, (unsigned char *)iov[i].iov_base, part);
+        len -= part;
+    }
+}
+
+//read while rx_ring has room, write while tx_ring has data
+static void upper_watch(void)
+{
+    uint32_t events = 0;
+
+    if((0 == upper_added) || (5 != upper_com_sys.socket_status))
+    {
+        return;
+    }
+    if(0 == rx_paused.load())
+    {
+        events |= EPOLLIN;
+    }
+    if(0 != tx_ring.Size())
+    {
+        events |= EPOLLOUT;
+    }
+    if((events != upper_events) && (0 == reactor_mod_fd(upper_com_sys.client_socket,events)))
+    {
+        upper_events = events;
+    }
+}
+
+static void upper_close(upper_com_sys_t *sys)
+{
+    if(0 != upper_added)
+    {
+        reactor_del_fd(sys->client_socket);
+        upper_added = 0;
+        upper_events = 0;
+    }
+    close(sys->client_socket);
+    sys->socket_status = 1;
+}
+
+static void upper_connected(upper_com_sys_t *sys)
+{
+    {
+        //whatever was queued for the last connection is stale, upper_tx_flushed() tells its senders
+        std::lock_guard<std::mutex> lock(tx_lock);
+        size_t stale = tx_ring.Size();
+        tx_ring.Consume(stale);
+        tx_epoch++;
+        tx_flushed += stale;
+    }
+    rx_paused.store(0);
+	sys->socket_status = 5;
+	sys->work_normal = 1;
+    upper_watch();
+    ROS_DEBUG("socket connected ok!");
+}
+
+static void upper_ready(uint32_t events)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if(3 == upper_com_sys.socket_status)
+    {
+        if((getsockopt(upper_com_sys.client_socket,SOL_SOCKET,SO_ERROR,&err,&len) < 0) || (0 != err))
+        {
+            ROS_DEBUG("connect failed: %s",strerror(err));
+            upper_close(&upper_com_sys);
+            return;
+        }
+        upper_connected(&upper_com_sys);
+        return;
+    }
+    if(events & EPOLLIN)
+    {
+        handle_receive_data(&upper_com_sys);
+    }
+    if(events & EPOLLOUT)
+    {
+        flush_send_data(&upper_com_sys);
+    }
+    if(events & (EPOLLERR | EPOLLHUP))
+    {
+        ROS_DEBUG("socket hang up");
+        upper_com_sys.socket_error = 1;
+    }
+    //stop polling a broken socket until the next tick closes it
+    if(0 != upper_com_sys.socket_error)
+    {
+        reactor_del_fd(upper_com_sys.client_socket);
+        upper_added = 0;
+        upper_events = 0;
+        return;
+    }
+    upper_watch();
+}
 
 static void update_upper_state(upper_com_sys_t *sys)
 {
@@ -34,7 +167,7 @@ static void update_upper_state(upper_com_sys_t *sys)
 	{
 		case 1:
 			sys->work_normal = 0;
-			sys->client_socket = socket(AF_INET, SOCK_STREAM, 0);
+			sys->client_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 			if(sys->client_socket < 0)
 			{
 				ROS_DEBUG("socket builded failed,:%d!",sys->client_socket);
@@ -58,23 +191,35 @@ static void update_upper_state(upper_com_sys_t *sys)
 			//srv_addr.sin_addr.s_addr = inet_addr("192.168.3.6");
 			srv_addr.sin_addr.s_addr = (unsigned long)sys->server_ip;
             ROS_DEBUG("upper srv_addr.sin_addr.s_addr is :%x",srv_addr.sin_addr.s_addr);
-			if(connect(sys->client_socket, (struct sockaddr *)(&srv_addr), sizeof(srv_addr)) < 0)
-			{
-				ROS_DEBUG("connect failed!");
-			}
-			else
-			{
-				sys->socket_status = 5;
-				sys->work_normal = 1;
-                ROS_DEBUG("socket connected ok!");
-			}
+            //the socket is non-blocking, the reactor reports when the connect is done
+            if((connect(sys->client_socket, (struct sockaddr *)(&srv_addr), sizeof(srv_addr)) < 0) && (EINPROGRESS != errno))
+            {
+                ROS_DEBUG("connect failed: %s",strerror(errno));
+                upper_close(sys);
+                break;
+            }
+            if(reactor_add_fd(sys->client_socket,EPOLLOUT,upper_ready) < 0)
+            {
+                upper_close(sys);
+                break;
+            }
+            upper_added = 1;
+            upper_events = EPOLLOUT;
+            connect_ticks = 0;
+            sys->socket_status = 3;
+			break;
+		case 3:
+            if(++connect_ticks >= CONNECT_TIMEOUT_TICKS)
+            {
+                ROS_DEBUG("connect timed out!");
+                upper_close(sys);
+            }
 			break;
 		case 5:
 			if(0 != sys->socket_error)
 			{
-				sys->socket_status = 1;
 				sys->socket_error = 0;
-				close(sys->client_socket);
+				upper_close(sys);
 				ROS_DEBUG("socket error,close socket!");
 			}
 			break;
@@ -84,73 +229,84 @@ static void update_upper_state(upper_com_sys_t *sys)
 	}
 }
 
+//reads straight into rx_ring, a full ring stops reading instead of dropping bytes
 static int handle_receive_data(upper_com_sys_t *sys)
 {
     int recv_len = 0;
-	//int i = 0;
-	unsigned char buf[UPPER_COM_RECV_LEN];
+    int n = 0;
+    struct iovec iov[2];
 
 	if(5  != sys->socket_status)
 	{
 	    return -1;
 	}
-    //ROS_DEBUG("socket recv data\n");
-    if(sys->socket_status == 5)
+    n = rx_ring.WriteSpans(iov);
+    if(0 == n)
     {
-        
-		recv_len = recv(sys->client_socket, buf,UPPER_COM_RECV_LEN, MSG_DONTWAIT);
-		//ROS_DEBUG("socket recv,recv_len:%d",recv_len);
-	    if(recv_len <= 0)
-	    {
-	        
-			/*printf("errno:%d,EINTR:%d,EWOULDBLOCK:%d,EAGAIN:%d\n",
-				errno,EINTR,EWOULDBLOCK,EAGAIN);
-			perror("perror:");
-			printf("strerror:%s\n",strerror(errno));*/
-			if(0 == recv_len)
-			{
-			    ROS_DEBUG("socket 0 == recv error,errno:%d\n",errno);
-			    sys->socket_error = 1;
-			}
-			else if((EINTR != errno) && (EWOULDBLOCK != errno) && (EAGAIN != errno))
-			{
-			    ROS_DEBUG("socket recv error,errno:%d\n",errno);
-			    sys->socket_error = 1;
-			}
-			return -1;
-	    }	
-		else
-		{
-		    if(2 != sys->work_normal)
-		    {
-		        sys->work_normal = 2;
-		    }
-			if(0 == sys->handle_upper_com_flag)
-			{
-			    sys->handle_upper_com_flag = 1;
-                
-                if((sys->read_num < UPPER_COM_HANDLE_LEN - recv_len) && (recv_len < UPPER_COM_HANDLE_LEN))
-                {
-					memcpy(sys->upper_com_buf+sys->read_num,buf,recv_len);
-				    sys->read_num += recv_len;
-			        sys->need_read_flag = 1;
-                }
-				else
-				{
-				    ROS_DEBUG("read num < UPPER_COM_HANDLE_LEN\n");
-				}
-				
-				sys->handle_upper_com_flag = 0;
-			}
-			else
-			{
-			    ROS_DEBUG("handle upper com flag==1,discard socket data\n");
-			}
-		}
+        ROS_DEBUG("upper com receive ring full, wait for the main loop");
+        rx_paused.store(1);
+        return 0;
+    }
+    recv_len = readv(sys->client_socket, iov, n);
+    if(recv_len <= 0)
+    {
+        if(0 == recv_len)
+        {
+            ROS_DEBUG("socket 0 == recv error,errno:%d\n",errno);
+            sys->socket_error = 1;
+        }
+        else if((EINTR != errno) && (EWOULDBLOCK != errno) && (EAGAIN != errno))
+        {
+            ROS_DEBUG("socket recv error,errno:%d\n",errno);
+            sys->socket_error = 1;
+        }
+        return -1;
+    }
+    record_spans(CAPTURE_DIR_RX, iov, n, recv_len);
+    rx_ring.Commit(recv_len);
+    if(2 != sys->work_normal)
+    {
+        sys->work_normal = 2;
     }
 	return 0;
 }
 
+//writes as much of tx_ring as the socket takes, the rest waits for EPOLLOUT
+static int flush_send_data(upper_com_sys_t *sys)
+{
+    int send_len = 0;
+    struct msghdr msg;
+    struct iovec iov[2];
+
+    if((5 != sys->socket_status) || (0 == upper_added))
+    {
+        return -1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = tx_ring.ReadSpans(iov);
+    if(0 == msg.msg_iovlen)
+    {
+        return 0;
+    }
+    //writev() with MSG_NOSIGNAL, a peer gone away is an error and not a SIGPIPE
+    send_len = sendmsg(sys->client_socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if(send_len < 0)
+	{
+        if((EINTR == errno) || (EWOULDBLOCK == errno) || (EAGAIN == errno))
+        {
+            return 0;
+        }
+	    ROS_DEBUG("send socket failed!,send:%d\n",send_len);
+		sys->socket_error = 1;
+		return -1;
+	}
+    record_spans(CAPTURE_DIR_TX, iov, msg.msg_iovlen, send_len);
+    tx_ring.Consume(send_len);
+    tx_flushed += send_len;
+	return 0;
+}
+
 void check_upper_connect(upper_com_sys_t *sys)
 {
     static int heart_beat = 1;
@@ -179,77 +335,141 @@ void check_upper_connect(upper_com_sys_t *sys)
 	}
 	heart_beat++;
 }
-void *upper_com_thread_start(void *)
+static void store_upper_com_state(void)
+{
+    upper_com_state_t state;
+
+    state.socket_status = upper_com_sys.socket_status;
+    state.work_normal = upper_com_sys.work_normal;
+    upper_com_snapshot.Store(state);
+}
+
+//the old upper com loop body, the socket itself is served by upper_ready()
+static void upper_com_tick(void)
+{
+    update_upper_state(&upper_com_sys);
+
+    //the main loop freed room without noticing the pause
+    if((0 != rx_paused.load()) && (0 != rx_ring.Free()))
+    {
+        rx_paused.store(0);
+        upper_watch();
+    }
+
+    check_upper_connect(&upper_com_sys);
+    store_upper_com_state();
+}
+
+static void upper_com_exit(void)
+{
+    if(1 != upper_com_sys.socket_status)
+    {
+        upper_close(&upper_com_sys);
+    }
+    upper_com_sys.com_rssi = 0;
+    upper_com_sys.work_normal = 0;
+    store_upper_com_state();
+}
+
+int upper_com_start(void)
 {
 	upper_com_sys.com_rssi = 0;
-	upper_com_sys.read_num = 0;
 	upper_com_sys.socket_status = 1;
 	upper_com_sys.socket_error = 0;
 	upper_com_sys.work_normal = 0;
 	upper_com_sys.upper_beat_flag = 1;
 
-	if((upper_com_sys.upper_com_freq <= 0) || (upper_com_sys.upper_com_freq >150))
-	{
-	    upper_com_sys.upper_com_freq = 150;
-	}
-    ros::Rate loop_rate(upper_com_sys.upper_com_freq);
-    
-    while(ros::ok()) 
-    {  
-        update_upper_state(&upper_com_sys);
-        
-        handle_receive_data(&upper_com_sys);
-
-        check_upper_connect(&upper_com_sys);
-        
-        ros::spinOnce();
-        loop_rate.sleep();
+    reactor_at_exit(upper_com_exit);
+    if(reactor_add_timer(UPPER_COM_TICK_FREQ,upper_com_tick) < 0)
+    {
+        return -1;
     }
-    close(upper_com_sys.com_device);
-    upper_com_sys.com_rssi = 0;
-    upper_com_sys.work_normal = 0;
     return 0;
 }
 
-upper_com_sys_t* get_upper_com_system_info(void)
+//copies the state of the last upper com cycle, never blocks the upper com thread
+void get_upper_com_state(upper_com_state_t *state)
 {
-    if(0 == upper_com_sys.handle_upper_com_flag)
-    {
-        return &upper_com_sys;
-    }
-    else
+    upper_com_snapshot.Load(*state);
+}
+
+//main loop only, moves up to len received bytes into buf, returns how many
+int read_upper_com_data(unsigned char *buf,int len)
+{
+    int num = (int)rx_ring.Read(buf,len);
+
+    if((num > 0) && (0 != rx_paused.exchange(0)))
     {
-        return NULL;
+        reactor_post(upper_watch);
     }
+    return num;
 }
 
+//queues the packet for the reactor thread, never waits for the socket
 int send_status_back(unsigned char *buf,int num)
 {
-    int send_len = 0;
-
 	if(NULL == buf)
 	{
 	    ROS_DEBUG("buf NULL!");
 	    return -1;
 	}
 	
-    if(5 != upper_com_sys.socket_status)
+    if(0 != upper_socket_status())
     {
         //ROS_DEBUG("send socket failed!,socket status:%d",upper_com_sys.socket_status);
         return -1;
     }
-		
-    send_len = send(upper_com_sys.client_socket, buf, num, 0);
-	if(send_len < 0)
-	{
-	    ROS_DEBUG("send socket failed!,send:%d\n",send_len);
-		upper_com_sys.socket_error = 1;
-		return -1;
-	}
-	//ROS_DEBUG("send socket send:%d\n",send_len);
+    {
+        std::lock_guard<std::mutex> lock(tx_lock);
+        if(!tx_ring.Write(buf,num))
+        {
+            //the upper has not read for a long time, reconnect as a failed send did
+            ROS_DEBUG("send queue full, %d bytes dropped",num);
+            reactor_post([]{ upper_com_sys.socket_error = 1; });
+            return -1;
+        }
+        tx_queued += num;
+    }
+    if(0 == tx_kicked.exchange(1))
+    {
+        reactor_post([]
+        {
+            tx_kicked.store(0);
+            flush_send_data(&upper_com_sys);
+            upper_watch();
+        });
+    }
 	return 0;
 }
 
+//bytes send_status_back() can queue now
+int upper_tx_free(void)
+{
+    std::lock_guard<std::mutex> lock(tx_lock);
+    return tx_ring.Free();
+}
+
+//where the packets queued so far end, for upper_tx_flushed()
+uint64_t upper_tx_mark(unsigned int *epoch)
+{
+    std::lock_guard<std::mutex> lock(tx_lock);
+    *epoch = tx_epoch;
+    return tx_queued;
+}
+
+//1: everything before mark went to the socket, 0: still queued, -1: a reconnect dropped some of it
+int upper_tx_flushed(uint64_t mark,unsigned int epoch)
+{
+    //flushed first, a drop counts the epoch before it moves tx_flushed on
+    uint64_t flushed = tx_flushed;
+
+    if(epoch != tx_epoch)
+    {
+        return -1;
+    }
+    return (flushed >= mark) ? 1 : 0;
+}
+
 int  set_upper_server_ip(unsigned int ip)
 {
     ROS_DEBUG("set upper server ip:%x",ip);
@@ -270,7 +490,10 @@ void set_upper_beat_flag(int data)
 
 int upper_socket_status(void)
 {
-    if(5 != upper_com_sys.socket_status)
+    upper_com_state_t state;
+
+    upper_com_snapshot.Load(state);
+    if(5 != state.socket_status)
     {
         return -1;
     }
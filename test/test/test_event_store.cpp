@@ -0,0 +1,306 @@
+/*
+ * Host test of the starline event store, no robot or ROS master needed.
+ *
+ * The store lives in file statics, so the source is built into this test
+ * and every case starts from a fresh store and spool file. A restart is a
+ * fresh store taking over the spool the last one left.
+ */
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "../../starline/src/event_store.cpp"
+
+#define TEST_REC_DATA_LEN       (200)           //record of EVENT_REC_HEAD + 200 bytes
+#define TEST_REC_LEN            (EVENT_REC_HEAD + TEST_REC_DATA_LEN)
+#define TEST_RING_RECS          (EVENT_STORE_LEN / TEST_REC_LEN)
+
+//what the store needs of the reactor, run in place
+void worker_post(reactor_job_t job)
+{
+    job();
+}
+
+//a record told apart from the others by seq
+static ans_status_t make_event(int seq,int len)
+{
+    ans_status_t ans;
+
+    memset(&ans, 0, sizeof(ans));
+    ans.level = LEVEL_WARN;
+    ans.module = MODULE_NAV;
+    ans.function = 7;
+    ans.len = len;
+    ans.data[0] = seq & 0xff;
+    ans.data[1] = (seq >> 8) & 0xff;
+    return ans;
+}
+
+static int put_event(int seq,int len = TEST_REC_DATA_LEN)
+{
+    ans_status_t ans = make_event(seq, len);
+    return event_store_put(&ans);
+}
+
+static int rec_seq(const unsigned char *rec)
+{
+    return rec[EVENT_REC_HEAD] | (rec[EVENT_REC_HEAD + 1] << 8);
+}
+
+//delivers up to max_num records as the report loop does, returns their seqs
+static std::vector<int> take_events(int max_num)
+{
+    std::vector<int> seqs;
+    unsigned char buf[SOCKET_PKG_LEN];
+    int num = 0;
+    int len = 0;
+
+    while((int)seqs.size() < max_num)
+    {
+        len = event_store_peek(buf, sizeof(buf), max_num - seqs.size(), &num);
+        if(0 == len)
+        {
+            break;
+        }
+        for(int i = 0; i < len; i += EVENT_REC_HEAD + buf[i + 3])
+        {
+            seqs.push_back(rec_seq(buf + i));
+        }
+        event_store_consume(buf, len);
+    }
+    return seqs;
+}
+
+static std::vector<int> seq_range(int from,int to)
+{
+    std::vector<int> seqs;
+
+    for(int i = from; i < to; i++)
+    {
+        seqs.push_back(i);
+    }
+    return seqs;
+}
+
+static long long file_size(const char *path)
+{
+    struct stat st;
+
+    return (0 == stat(path, &st)) ? (long long)st.st_size : -1;
+}
+
+class EventStoreTest : public ::testing::Test
+{
+    protected:
+        virtual void SetUp()
+        {
+            strcpy(spool_path, "/tmp/event_store_test.XXXXXX");
+            close(mkstemp(spool_path));
+            NewStore();
+        }
+
+        virtual void TearDown()
+        {
+            NewStore();
+            unlink(spool_path);
+        }
+
+        //what a restart leaves: nothing in memory, the spool as it is
+        void NewStore()
+        {
+            if(spool_fd >= 0)
+            {
+                close(spool_fd);
+                spool_fd = -1;
+            }
+            delete store;
+            store = new event_store_t();
+        }
+
+        char spool_path[64];
+};
+
+TEST_F(EventStoreTest, MemoryOnlyDropsWhenRingIsFull)
+{
+    ASSERT_EQ(0, event_store_init(""));
+    for(int i = 0; i < TEST_RING_RECS; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    EXPECT_EQ(-1, put_event(TEST_RING_RECS));
+    EXPECT_EQ(seq_range(0, TEST_RING_RECS), take_events(TEST_RING_RECS));
+}
+
+//the ring fills, the rest goes to the spool and comes back in order while the ring wraps
+TEST_F(EventStoreTest, RingWrapsWithRecordsInSpool)
+{
+    std::vector<int> got;
+    std::vector<int> more;
+    int total = 3 * TEST_RING_RECS;
+
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < 2 * TEST_RING_RECS; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    EXPECT_LE(store->mem_end - store->head, (uint64_t)EVENT_STORE_LEN);
+    EXPECT_LT(store->mem_end, store->tail);
+
+    //delivered in part, what is put meanwhile queues behind the spooled records
+    got = take_events(TEST_RING_RECS / 2);
+    for(int i = 2 * TEST_RING_RECS; i < total; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    event_store_sync();
+    more = take_events(total);
+    got.insert(got.end(), more.begin(), more.end());
+
+    EXPECT_EQ(seq_range(0, total), got);
+    EXPECT_GT(store->head, (uint64_t)EVENT_STORE_LEN);
+    EXPECT_EQ(store->head, store->tail);
+}
+
+//delivering everything starts the spool over, and it is used again afterwards
+TEST_F(EventStoreTest, SpoolResetWhenDrained)
+{
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < 2 * TEST_RING_RECS; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    EXPECT_GT(file_size(spool_path), (long long)EVENT_SPOOL_HEAD);
+
+    EXPECT_EQ(seq_range(0, 2 * TEST_RING_RECS), take_events(2 * TEST_RING_RECS));
+    EXPECT_EQ((long long)EVENT_SPOOL_HEAD, file_size(spool_path));
+    EXPECT_EQ(store->head, store->file_base);
+    EXPECT_EQ(store->head, store->synced);
+
+    for(int i = 0; i < 2 * TEST_RING_RECS; i++)
+    {
+        ASSERT_EQ(0, put_event(10000 + i));
+    }
+    EXPECT_EQ(seq_range(10000, 10000 + 2 * TEST_RING_RECS), take_events(2 * TEST_RING_RECS));
+}
+
+//refill stops where the ring is full and picks up the rest on the next peek
+TEST_F(EventStoreTest, RefillFollowsDelivery)
+{
+    int half = TEST_RING_RECS / 2;
+
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < 3 * TEST_RING_RECS; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    for(int round = 0; round < 6; round++)
+    {
+        EXPECT_EQ(seq_range(round * half, (round + 1) * half), take_events(half));
+        EXPECT_LE(store->mem_end - store->head, (uint64_t)EVENT_STORE_LEN);
+    }
+}
+
+//a restart takes over what was not delivered, from the spooled head on
+TEST_F(EventStoreTest, RestartKeepsPendingEvents)
+{
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(0, put_event(i, 20));
+    }
+    event_store_sync();
+    EXPECT_EQ(seq_range(0, 3), take_events(3));
+
+    NewStore();
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_EQ(seq_range(3, 10), take_events(100));
+}
+
+//a crash in the middle of a write leaves a cut record, it and what follows are dropped
+TEST_F(EventStoreTest, TruncatedSpoolRecoveredAtInit)
+{
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(0, put_event(i, 20));
+    }
+    event_store_sync();
+    EXPECT_EQ(seq_range(0, 2), take_events(2));
+
+    NewStore();
+    ASSERT_EQ(0, truncate(spool_path, file_size(spool_path) - 5));
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_EQ(seq_range(2, 9), take_events(100));
+
+    //the spool was compacted, the next restart finds only what came since
+    ASSERT_EQ(0, put_event(100, 20));
+    event_store_sync();
+    NewStore();
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_EQ(seq_range(100, 101), take_events(100));
+}
+
+//a spool too short for its head or with a head beyond its end is started over
+TEST_F(EventStoreTest, BrokenSpoolStartedOver)
+{
+    FILE *file = fopen(spool_path, "wb");
+    uint64_t off = 1000;
+
+    ASSERT_TRUE(NULL != file);
+    fwrite(&off, sizeof(off), 1, file);
+    fwrite("abc", 3, 1, file);
+    fclose(file);
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_TRUE(take_events(100).empty());
+    EXPECT_EQ((long long)EVENT_SPOOL_HEAD, file_size(spool_path));
+
+    NewStore();
+    ASSERT_EQ(0, truncate(spool_path, 3));
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_TRUE(take_events(100).empty());
+}
+
+//a pending event is queued once, and again once it was delivered
+TEST_F(EventStoreTest, DedupeAcrossConsumeAndReput)
+{
+    unsigned char buf[SOCKET_PKG_LEN];
+    int num = 0;
+    int len = 0;
+
+    ASSERT_EQ(0, event_store_init(spool_path));
+    ASSERT_EQ(0, put_event(1, 20));
+    ASSERT_EQ(0, put_event(1, 20));
+    ASSERT_EQ(0, put_event(2, 20));
+
+    //peeked but not consumed yet, still pending
+    len = event_store_peek(buf, sizeof(buf), 1, &num);
+    ASSERT_EQ(1, num);
+    ASSERT_EQ(0, put_event(1, 20));
+    event_store_consume(buf, len);
+
+    //delivered, so it is new again and queues behind 2
+    ASSERT_EQ(0, put_event(1, 20));
+    ASSERT_EQ(0, put_event(2, 20));
+    EXPECT_EQ(std::vector<int>({2, 1}), take_events(100));
+    EXPECT_TRUE(store->index.empty());
+}
+
+//duplicates spooled by the last run are taken over once
+TEST_F(EventStoreTest, DedupeInSpoolAtInit)
+{
+    ASSERT_EQ(0, event_store_init(spool_path));
+    for(int i = 0; i < TEST_RING_RECS + 5; i++)
+    {
+        ASSERT_EQ(0, put_event(i));
+    }
+    //in the spool, behind the ring
+    ASSERT_EQ(0, put_event(TEST_RING_RECS + 2));
+    event_store_sync();
+
+    NewStore();
+    ASSERT_EQ(0, event_store_init(spool_path));
+    EXPECT_EQ(seq_range(0, TEST_RING_RECS + 5), take_events(2 * TEST_RING_RECS));
+}
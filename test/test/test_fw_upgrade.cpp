@@ -0,0 +1,475 @@
+/*
+ * Host test of the starline firmware transfer, no board or ROS master needed.
+ *
+ * The frames go to a fake board that answers like the real ones: it appends
+ * every data frame it takes, drops the frames after a failed one until that
+ * one comes again, takes a repeat of the last frame for a resend, and checks
+ * the whole image on the end frame. It also knows the image, so a frame a
+ * real board would have appended in the wrong place is counted as misplaced.
+ *
+ * The test thread runs the transfer as the worker does and stands in for
+ * the reactor: acks are handed over from inside the fake send, late ones
+ * from a thread of their own.
+ */
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "../../starline/src/fw_upgrade.cpp"
+
+#define TEST_BOARD_TYPE         0x0F
+#define TEST_FRAME_LEN          64
+#define TEST_FRAMES             100
+#define TEST_IMAGE_LEN          (TEST_FRAMES * TEST_FRAME_LEN - 47)     //the last frame is a short one
+#define TEST_WAIT_MS            200
+
+enum
+{
+    FAULT_NONE = 0,
+    FAULT_FAIL,         //the board refuses the frame, checksum error
+    FAULT_LOST,         //the board takes it, its ack is lost
+    FAULT_LATE,         //the board takes it, its ack comes after FW_UPGRADE_ACK_MS
+    FAULT_DROP,         //the frame is lost on the way, the board never sees it
+};
+
+typedef struct
+{
+    std::vector<unsigned char> image;       //what the file holds
+    std::vector<unsigned char> flash;       //what the board wrote
+    std::vector<unsigned char> last;        //last data frame it took
+    std::map<int, int> faults;              //by data frame number, counted from 1 over the whole test
+    int lose_from;                          //acks of this data frame and later ones are lost, 0 never
+    bool failed;                            //dropping frames after a failed one
+    bool resume;                            //answers resume frames
+    bool answer_version;
+    unsigned char version[VERSION_LEN];
+    long long resume_offset;                //asked for by the last resume frame, -1 none
+    int data_frames;
+    int ready_frames;
+    int misplaced;
+}fake_board_t;
+
+static fake_board_t board;
+static fw_upgrade_t *up = NULL;
+static std::vector<std::thread> late_acks;
+
+//what the board modules do on the reactor, run in place
+void reactor_post(reactor_job_t job)
+{
+    job();
+}
+
+static void fake_request_version(void)
+{
+    if(board.answer_version)
+    {
+        fw_upgrade_version(up, board.version, VERSION_LEN);
+    }
+}
+
+static void board_data(const unsigned char *data,int len)
+{
+    size_t have = board.flash.size();
+    size_t want = std::min((size_t)TEST_FRAME_LEN, board.image.size() - std::min(have, board.image.size()));
+    bool expected = ((size_t)len == want) && (0 == memcmp(data, &board.image[have], len));
+    bool repeat = ((size_t)len == board.last.size()) && (0 == memcmp(data, board.last.data(), len));
+    int fault = FAULT_NONE;
+
+    board.data_frames++;
+    if(board.faults.count(board.data_frames))
+    {
+        fault = board.faults[board.data_frames];
+    }
+    if(FAULT_DROP == fault)
+    {
+        return;
+    }
+    //the failed frame may have been a resent one too
+    if(board.failed && !expected && !repeat)
+    {
+        fw_upgrade_ack(up, FW_UPGRADE_DATA, 1);
+        return;
+    }
+    board.failed = false;
+    if(FAULT_FAIL == fault)
+    {
+        board.failed = true;
+        fw_upgrade_ack(up, FW_UPGRADE_DATA, 1);
+        return;
+    }
+
+    if(!expected && !repeat)
+    {
+        //a real board has no way to tell, it writes the frame where it is
+        board.misplaced++;
+    }
+    if(expected || !repeat)
+    {
+        board.flash.insert(board.flash.end(), data, data + len);
+    }
+    board.last.assign(data, data + len);
+
+    if((FAULT_LOST == fault) || ((0 != board.lose_from) && (board.data_frames >= board.lose_from)))
+    {
+        return;
+    }
+    if(FAULT_LATE == fault)
+    {
+        late_acks.push_back(std::thread([]
+        {
+            usleep((FW_UPGRADE_ACK_MS + 100) * 1000);
+            fw_upgrade_ack(up, FW_UPGRADE_DATA, 0);
+        }));
+        return;
+    }
+    fw_upgrade_ack(up, FW_UPGRADE_DATA, 0);
+}
+
+static int fake_send(unsigned char *frame)
+{
+    unsigned char resume[UpgradeResumeFrame::len];
+    const uint8_t *md5 = NULL;
+    uint8_t cmd = 0;
+    uint32_t offset = 0;
+
+    EXPECT_EQ(TEST_BOARD_TYPE, frame[2]);
+    switch(frame[3])
+    {
+        case FW_UPGRADE_READY:
+            board.ready_frames++;
+            board.flash.clear();
+            board.last.clear();
+            board.failed = false;
+            fw_upgrade_ack(up, FW_UPGRADE_READY, 0);
+            break;
+        case FW_UPGRADE_RESUME:
+            if(!board.resume)
+            {
+                break;
+            }
+            memcpy(resume, frame, sizeof(resume));
+            resume[2] = UpgradeResumeFrame::type;
+            EXPECT_TRUE(UpgradeResumeFrame::Decode(resume, frame[1], cmd, md5, offset));
+            EXPECT_LE(offset, board.flash.size());
+            board.resume_offset = offset;
+            board.flash.resize(std::min((size_t)offset, board.flash.size()));
+            board.last.clear();
+            board.failed = false;
+            fw_upgrade_ack(up, FW_UPGRADE_RESUME, 0);
+            break;
+        case FW_UPGRADE_DATA:
+            board_data(frame + 4, frame[1] - 6);
+            break;
+        case FW_UPGRADE_END:
+            fw_upgrade_ack(up, FW_UPGRADE_END, (board.flash == board.image) ? 0 : 1);
+            break;
+        default:
+            ADD_FAILURE() << "unknown upgrade frame " << (int)frame[3];
+            break;
+    }
+    return 0;
+}
+
+class FwUpgradeTest : public ::testing::Test
+{
+    protected:
+        virtual void SetUp()
+        {
+            strcpy(path, "/tmp/fw_upgrade_test.XXXXXX");
+            int fd = mkstemp(path);
+
+            board.image.resize(TEST_IMAGE_LEN);
+            srand(1);
+            for(size_t i = 0; i < board.image.size(); i++)
+            {
+                board.image[i] = rand() & 0xff;
+            }
+            EXPECT_EQ((ssize_t)board.image.size(), write(fd, board.image.data(), board.image.size()));
+            close(fd);
+            memset(md5, 0x11, sizeof(md5));
+
+            board.flash.clear();
+            board.last.clear();
+            board.faults.clear();
+            board.lose_from = 0;
+            board.failed = false;
+            board.resume = true;
+            board.answer_version = true;
+            memset(board.version, 0, VERSION_LEN);
+            strcpy((char *)board.version, "1.0.0");
+            board.resume_offset = -1;
+            board.data_frames = 0;
+            board.ready_frames = 0;
+            board.misplaced = 0;
+            NewUpgrade(60);
+            set_fw_upgrade_window(1);
+        }
+
+        virtual void TearDown()
+        {
+            for(size_t i = 0; i < late_acks.size(); i++)
+            {
+                late_acks[i].join();
+            }
+            late_acks.clear();
+            delete up;
+            up = NULL;
+            unlink(CheckpointPath().c_str());
+            unlink(path);
+        }
+
+        void NewUpgrade(int deadline_s)
+        {
+            delete up;
+            up = fw_upgrade_create("test", TEST_BOARD_TYPE, TEST_FRAME_LEN, deadline_s,
+                TEST_WAIT_MS, TEST_WAIT_MS, fake_send, fake_request_version);
+        }
+
+        int Run(const char *version = "")
+        {
+            return fw_upgrade_run(up, path, md5, version);
+        }
+
+        std::string CheckpointPath()
+        {
+            return std::string(path) + FW_CHECKPOINT_SUFFIX;
+        }
+
+        //-1 when there is none
+        long long CheckpointOffset()
+        {
+            fw_checkpoint_t ckpt;
+            FILE *file = fopen(CheckpointPath().c_str(), "rb");
+            size_t got = 0;
+
+            if(NULL == file)
+            {
+                return -1;
+            }
+            got = fread(&ckpt, 1, sizeof(ckpt), file);
+            fclose(file);
+            return (sizeof(ckpt) == got) ? (long long)ckpt.offset : -1;
+        }
+
+        char path[64];
+        char md5[MD5_SIZE];
+};
+
+class FwUpgradeWindowTest : public FwUpgradeTest, public ::testing::WithParamInterface<int>
+{
+    protected:
+        virtual void SetUp()
+        {
+            FwUpgradeTest::SetUp();
+            set_fw_upgrade_window(GetParam());
+        }
+
+        void ExpectFlashed(int rlt)
+        {
+            EXPECT_EQ(0, rlt);
+            EXPECT_EQ(0, board.misplaced);
+            EXPECT_TRUE(board.flash == board.image);
+            EXPECT_EQ(100, fw_upgrade_progress(up));
+            EXPECT_EQ(-1, CheckpointOffset());
+        }
+};
+
+TEST_P(FwUpgradeWindowTest, Clean)
+{
+    ExpectFlashed(Run());
+    EXPECT_EQ(TEST_FRAMES, board.data_frames);
+    EXPECT_EQ(1, board.ready_frames);
+}
+
+//a failed frame is sent again with everything sent after it
+TEST_P(FwUpgradeWindowTest, FailedAck)
+{
+    board.faults[5] = FAULT_FAIL;
+    board.faults[6] = FAULT_FAIL;
+    board.faults[40] = FAULT_FAIL;
+    board.faults[TEST_FRAMES + 2] = FAULT_FAIL;
+    ExpectFlashed(Run());
+    EXPECT_GT(board.data_frames, TEST_FRAMES + 3);
+}
+
+//the board has the frame but the sender never hears of it
+TEST_P(FwUpgradeWindowTest, LostAck)
+{
+    board.faults[3] = FAULT_LOST;
+    board.faults[50] = FAULT_LOST;
+    board.faults[TEST_FRAMES] = FAULT_LOST;
+    ExpectFlashed(Run());
+}
+
+//the ack comes after the frame was sent again
+TEST_P(FwUpgradeWindowTest, LateAck)
+{
+    board.faults[10] = FAULT_LATE;
+    board.faults[60] = FAULT_LATE;
+    ExpectFlashed(Run());
+}
+
+TEST_P(FwUpgradeWindowTest, FailedLostAndLate)
+{
+    board.faults[4] = FAULT_LOST;
+    board.faults[9] = FAULT_FAIL;
+    board.faults[20] = FAULT_LATE;
+    board.faults[21] = FAULT_FAIL;
+    board.faults[70] = FAULT_LOST;
+    ExpectFlashed(Run());
+}
+
+INSTANTIATE_TEST_CASE_P(Window, FwUpgradeWindowTest, ::testing::Values(1, 4));
+
+//a frame lost on the way is only safe one at a time, the board can not tell a gap
+TEST_F(FwUpgradeTest, DroppedFrameWindow1)
+{
+    board.faults[12] = FAULT_DROP;
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(0, board.misplaced);
+    EXPECT_TRUE(board.flash == board.image);
+}
+
+//wider windows can not tell it either, the board writes what follows in its place and refuses the image
+TEST_F(FwUpgradeTest, DroppedFrameFailsEndCheck)
+{
+    set_fw_upgrade_window(4);
+    board.faults[12] = FAULT_DROP;
+    EXPECT_EQ(1, Run());
+    EXPECT_GT(board.misplaced, 0);
+}
+
+//a lost ack with frames outstanding, a board that can not be put back is started over
+TEST_F(FwUpgradeTest, LostAckWithoutResumeStartsOver)
+{
+    set_fw_upgrade_window(4);
+    board.resume = false;
+    board.faults[30] = FAULT_LOST;
+    board.faults[31] = FAULT_LOST;
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(2, board.ready_frames);
+    EXPECT_EQ(0, board.misplaced);
+    EXPECT_TRUE(board.flash == board.image);
+}
+
+//the deadline passes with the acks gone, the checkpoint keeps what was acked
+TEST_F(FwUpgradeTest, DeadlineKeepsCheckpoint)
+{
+    NewUpgrade(1);
+    board.lose_from = 45;
+    EXPECT_EQ(-4, Run());
+    EXPECT_EQ(44 * TEST_FRAME_LEN, CheckpointOffset());
+    EXPECT_EQ(44 * 100 / TEST_FRAMES, fw_upgrade_progress(up));
+}
+
+//the next try resumes where the acks stopped and sends only the rest
+TEST_F(FwUpgradeTest, ResumeFromCheckpoint)
+{
+    NewUpgrade(1);
+    board.lose_from = 45;
+    ASSERT_EQ(-4, Run());
+    ASSERT_EQ(1, board.ready_frames);
+
+    NewUpgrade(60);
+    board.lose_from = 0;
+    board.data_frames = 0;
+    set_fw_upgrade_window(4);
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(44 * TEST_FRAME_LEN, board.resume_offset);
+    EXPECT_EQ(1, board.ready_frames);
+    EXPECT_EQ(TEST_FRAMES - 44, board.data_frames);
+    EXPECT_EQ(0, board.misplaced);
+    EXPECT_TRUE(board.flash == board.image);
+    EXPECT_EQ(-1, CheckpointOffset());
+}
+
+//checkpoints are written every FW_CHECKPOINT_FRAMES acked frames, a crash keeps the last one
+TEST_F(FwUpgradeTest, CheckpointWrittenWhileSending)
+{
+    fw_checkpoint_t ckpt;
+    FILE *file = NULL;
+
+    NewUpgrade(1);
+    board.lose_from = FW_CHECKPOINT_FRAMES + 10;
+    ASSERT_EQ(-4, Run());
+    //what the crash would have left: the last periodic one, not the final save
+    memset(&ckpt, 0, sizeof(ckpt));
+    file = fopen(CheckpointPath().c_str(), "r+b");
+    ASSERT_TRUE(NULL != file);
+    ASSERT_EQ(sizeof(ckpt), fread(&ckpt, 1, sizeof(ckpt), file));
+    EXPECT_EQ((FW_CHECKPOINT_FRAMES + 9) * TEST_FRAME_LEN, (int)ckpt.offset);
+    ckpt.offset = FW_CHECKPOINT_FRAMES * TEST_FRAME_LEN;
+    rewind(file);
+    fwrite(&ckpt, sizeof(ckpt), 1, file);
+    fclose(file);
+
+    NewUpgrade(60);
+    board.lose_from = 0;
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(FW_CHECKPOINT_FRAMES * TEST_FRAME_LEN, board.resume_offset);
+    EXPECT_EQ(0, board.misplaced);
+    EXPECT_TRUE(board.flash == board.image);
+}
+
+//a board without resume gets the ready frame and the whole file
+TEST_F(FwUpgradeTest, ResumeRefusedSendsWholeFile)
+{
+    NewUpgrade(1);
+    board.lose_from = 45;
+    ASSERT_EQ(-4, Run());
+
+    NewUpgrade(60);
+    board.lose_from = 0;
+    board.resume = false;
+    board.data_frames = 0;
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(2, board.ready_frames);
+    EXPECT_EQ(TEST_FRAMES, board.data_frames);
+    EXPECT_TRUE(board.flash == board.image);
+}
+
+//other firmware since the checkpoint, the board does not hold those bytes
+TEST_F(FwUpgradeTest, StaleCheckpointIgnored)
+{
+    NewUpgrade(1);
+    board.lose_from = 45;
+    ASSERT_EQ(-4, Run());
+
+    NewUpgrade(60);
+    board.lose_from = 0;
+    strcpy((char *)board.version, "0.9.0");
+    EXPECT_EQ(0, Run());
+    EXPECT_EQ(-1, board.resume_offset);
+    EXPECT_EQ(2, board.ready_frames);
+    EXPECT_TRUE(board.flash == board.image);
+}
+
+//the end ack of the last try was lost but the board runs the image already
+TEST_F(FwUpgradeTest, AlreadyRunsVersion)
+{
+    EXPECT_EQ(0, Run("1.0.0"));
+    EXPECT_EQ(0, board.ready_frames);
+    EXPECT_EQ(0, board.data_frames);
+}
+
+//a refused image comes back as the board's end ack
+TEST_F(FwUpgradeTest, EndAckRefused)
+{
+    board.image[100] ^= 0xff;
+    EXPECT_EQ(1, Run());
+    EXPECT_EQ(-1, CheckpointOffset());
+}
+
+TEST_F(FwUpgradeTest, NoReadyAck)
+{
+    board.answer_version = false;
+    board.resume = false;
+    NewUpgrade(60);
+    up->send = [](unsigned char *) { return 0; };
+    EXPECT_EQ(-6, Run());
+}